@@ -0,0 +1,330 @@
+#ifdef RR_ALLOC_TRACKER
+
+#include "alloc_tracker.hpp"
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// glibc's allocator, the replacements below count and then forward to it.
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *ptr);
+}
+
+namespace {
+    constexpr size_t SCOPES = static_cast<size_t>(AllocScope::COUNT);
+
+    struct ThreadRecord {
+        std::atomic<int> tid {0};
+        std::atomic<uint64_t> allocations {0};
+        std::atomic<uint64_t> bytes {0};
+        std::array<std::atomic<uint64_t>, SCOPES> scoped {};
+    };
+
+    // fixed storage, the tracker itself must never allocate.
+    std::array<ThreadRecord, AllocTracker::MAX_THREADS> records;
+    std::atomic<size_t> record_ct {0};
+    std::atomic<uint64_t> overflow_allocations {0};
+
+    std::atomic<bool> armed_flag {false};
+    std::atomic<bool> abort_on_violation {false};
+    std::atomic<uint64_t> violation_ct {0};
+    std::atomic<int> violation_scope {0};
+    std::atomic<size_t> violation_bytes {0};
+    std::atomic<int> violation_tid {0};
+
+    thread_local AllocScope current_scope = AllocScope::NONE;
+    thread_local ThreadRecord *current_record = nullptr;
+    thread_local bool claiming = false;
+
+    ThreadRecord *thread_record()
+    {
+        if (current_record != nullptr || claiming) {
+            return current_record;
+        }
+        claiming = true;
+        size_t idx = record_ct.fetch_add(1, std::memory_order_relaxed);
+        if (idx < records.size()) {
+            records[idx].tid.store(static_cast<int>(syscall(SYS_gettid)), std::memory_order_relaxed);
+            current_record = &records[idx];
+        }
+        claiming = false;
+        return current_record;
+    }
+
+    void record(size_t size)
+    {
+        ThreadRecord *r = thread_record();
+        if (r == nullptr) {
+            overflow_allocations.fetch_add(1, std::memory_order_relaxed);
+        }
+        else {
+            r->allocations.fetch_add(1, std::memory_order_relaxed);
+            r->bytes.fetch_add(size, std::memory_order_relaxed);
+            r->scoped[static_cast<size_t>(current_scope)].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        if (current_scope == AllocScope::NONE || !armed_flag.load(std::memory_order_relaxed)) {
+            return;
+        }
+        if (violation_ct.fetch_add(1, std::memory_order_relaxed) == 0) {
+            violation_scope.store(static_cast<int>(current_scope), std::memory_order_relaxed);
+            violation_bytes.store(size, std::memory_order_relaxed);
+            violation_tid.store(r == nullptr ? 0 : r->tid.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        if (abort_on_violation.load(std::memory_order_relaxed)) {
+            std::abort();
+        }
+    }
+
+    const char *scope_name(size_t scope)
+    {
+        switch (static_cast<AllocScope>(scope)) {
+            case AllocScope::ENCODER_CALLBACK:
+                return "encoder";
+            case AllocScope::CONTROL_TICK:
+                return "control";
+            default:
+                return "none";
+        }
+    }
+}
+
+extern "C" {
+void *malloc(size_t size) noexcept
+{
+    record(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) noexcept
+{
+    record(count * size);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) noexcept
+{
+    record(size);
+    return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size) noexcept
+{
+    record(size);
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) noexcept
+{
+    record(size);
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) noexcept
+{
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    record(size);
+    void *p = __libc_memalign(alignment, size);
+    if (p == nullptr) {
+        return ENOMEM;
+    }
+    *ptr = p;
+    return 0;
+}
+
+void free(void *ptr) noexcept
+{
+    __libc_free(ptr);
+}
+}
+
+// operator new would reach malloc anyway, replaced so the count does not depend on how libstdc++ was built.
+void *operator new(size_t size)
+{
+    record(size);
+    void *p = __libc_malloc(size == 0 ? 1 : size);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    record(size);
+    return __libc_malloc(size == 0 ? 1 : size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    __libc_free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    __libc_free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    __libc_free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+    __libc_free(ptr);
+}
+
+AllocScopeGuard::AllocScopeGuard(AllocScope scope) : previous_(current_scope)
+{
+    current_scope = scope;
+}
+
+AllocScopeGuard::~AllocScopeGuard()
+{
+    current_scope = previous_;
+}
+
+void AllocTracker::arm()
+{
+    armed_flag.store(true, std::memory_order_release);
+}
+
+void AllocTracker::disarm()
+{
+    armed_flag.store(false, std::memory_order_release);
+}
+
+bool AllocTracker::armed()
+{
+    return armed_flag.load(std::memory_order_acquire);
+}
+
+void AllocTracker::set_abort_on_violation(bool enable)
+{
+    abort_on_violation.store(enable, std::memory_order_relaxed);
+}
+
+uint64_t AllocTracker::allocations()
+{
+    uint64_t total = overflow_allocations.load(std::memory_order_relaxed);
+    size_t ct = std::min(record_ct.load(std::memory_order_relaxed), records.size());
+    for (size_t i = 0; i < ct; i++) {
+        total += records[i].allocations.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+uint64_t AllocTracker::allocations(AllocScope scope)
+{
+    uint64_t total = 0;
+    size_t ct = std::min(record_ct.load(std::memory_order_relaxed), records.size());
+    for (size_t i = 0; i < ct; i++) {
+        total += records[i].scoped[static_cast<size_t>(scope)].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+uint64_t AllocTracker::violations()
+{
+    return violation_ct.load(std::memory_order_relaxed);
+}
+
+AllocViolation AllocTracker::first_violation()
+{
+    AllocViolation violation;
+    if (violations() > 0) {
+        violation.scope = static_cast<AllocScope>(violation_scope.load(std::memory_order_relaxed));
+        violation.bytes = violation_bytes.load(std::memory_order_relaxed);
+        violation.tid = violation_tid.load(std::memory_order_relaxed);
+    }
+    return violation;
+}
+
+void AllocTracker::reset()
+{
+    size_t ct = std::min(record_ct.load(std::memory_order_relaxed), records.size());
+    for (size_t i = 0; i < ct; i++) {
+        records[i].allocations.store(0, std::memory_order_relaxed);
+        records[i].bytes.store(0, std::memory_order_relaxed);
+        for (auto &scoped : records[i].scoped) {
+            scoped.store(0, std::memory_order_relaxed);
+        }
+    }
+    overflow_allocations.store(0, std::memory_order_relaxed);
+    violation_ct.store(0, std::memory_order_relaxed);
+}
+
+void AllocTracker::report()
+{
+    // snapshot first, printing allocates.
+    size_t ct = std::min(record_ct.load(std::memory_order_relaxed), records.size());
+    struct Row {
+        int tid;
+        uint64_t allocations;
+        uint64_t bytes;
+        std::array<uint64_t, SCOPES> scoped;
+    };
+    std::array<Row, MAX_THREADS> rows {};
+    for (size_t i = 0; i < ct; i++) {
+        rows[i].tid = records[i].tid.load(std::memory_order_relaxed);
+        rows[i].allocations = records[i].allocations.load(std::memory_order_relaxed);
+        rows[i].bytes = records[i].bytes.load(std::memory_order_relaxed);
+        for (size_t s = 0; s < SCOPES; s++) {
+            rows[i].scoped[s] = records[i].scoped[s].load(std::memory_order_relaxed);
+        }
+    }
+
+    std::cout << "Allocations per thread" << (armed() ? " (armed)" : "") << "\n";
+    std::cout << std::setw(8) << "tid" << std::setw(18) << "name" << std::setw(12) << "allocs" << std::setw(14) << "bytes";
+    for (size_t s = 1; s < SCOPES; s++) {
+        std::cout << std::setw(10) << scope_name(s);
+    }
+    std::cout << "\n";
+    for (size_t i = 0; i < ct; i++) {
+        // the thread may have exited, then the name is unknown.
+        std::ifstream comm("/proc/self/task/" + std::to_string(rows[i].tid) + "/comm");
+        std::string name = "-";
+        std::getline(comm, name);
+        std::cout << std::setw(8) << rows[i].tid << std::setw(18) << name << std::setw(12) << rows[i].allocations
+                  << std::setw(14) << rows[i].bytes;
+        for (size_t s = 1; s < SCOPES; s++) {
+            std::cout << std::setw(10) << rows[i].scoped[s];
+        }
+        std::cout << "\n";
+    }
+
+    uint64_t violation_total = violations();
+    if (violation_total > 0) {
+        AllocViolation first = first_violation();
+        std::cout << "ERROR: " << violation_total << " allocations in the hot path, first was " << first.bytes
+                  << " bytes in the " << scope_name(static_cast<size_t>(first.scope)) << " scope on thread "
+                  << first.tid << "\n";
+    }
+}
+
+#endif
@@ -0,0 +1,91 @@
+/**
+ * Debug allocation tracker, proves the encoder callback and control tick do not touch the heap.
+ *
+ * Built with -DALLOC_TRACKER=ON (which defines RR_ALLOC_TRACKER) the malloc family and global operator new are
+ * replaced by counting versions. Every allocation is attributed to the thread that made it, and to the scope that
+ * thread was in:
+ *
+ *   AllocScopeGuard guard(AllocScope::CONTROL_TICK);
+ *
+ * Once armed (MotorExecutor arms on activation, disarms on deactivation) any allocation inside a scope is counted
+ * as a violation and the first one is recorded, optionally aborting so a debugger lands on the offending call.
+ *
+ * Without RR_ALLOC_TRACKER the guard is empty and every call is an inline no-op, so the guards can stay in the
+ * production path.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+enum class AllocScope : uint8_t {
+    NONE = 0,
+    ENCODER_CALLBACK = 1,  // MotorEncoder ISR trampoline
+    CONTROL_TICK = 2,      // MotorExecutor::tick()
+    COUNT = 3,
+};
+
+struct AllocViolation {
+    AllocScope scope = AllocScope::NONE;
+    size_t bytes = 0;
+    int tid = 0;
+};
+
+#ifdef RR_ALLOC_TRACKER
+
+class AllocScopeGuard {
+  public:
+    explicit AllocScopeGuard(AllocScope scope);
+    ~AllocScopeGuard();
+
+  private:
+    AllocScope previous_;
+};
+
+class AllocTracker {
+  public:
+    static constexpr size_t MAX_THREADS = 64;
+
+    // count allocations inside a scope as violations.
+    static void arm();
+    static void disarm();
+    static bool armed();
+
+    // abort() on the first violation, for running under a debugger.
+    static void set_abort_on_violation(bool abort_on_violation);
+
+    static uint64_t allocations();
+    static uint64_t allocations(AllocScope scope);
+    static uint64_t violations();
+    static AllocViolation first_violation();
+
+    // clear every counter, threads keep their records.
+    static void reset();
+
+    // per thread table of allocations, bytes and allocations per scope.
+    static void report();
+};
+
+#else
+
+class AllocScopeGuard {
+  public:
+    explicit AllocScopeGuard(AllocScope) {}
+};
+
+class AllocTracker {
+  public:
+    static void arm() {}
+    static void disarm() {}
+    static bool armed() { return false; }
+    static void set_abort_on_violation(bool) {}
+    static uint64_t allocations() { return 0; }
+    static uint64_t allocations(AllocScope) { return 0; }
+    static uint64_t violations() { return 0; }
+    static AllocViolation first_violation() { return AllocViolation {}; }
+    static void reset() {}
+    static void report() {}
+};
+
+#endif
@@ -0,0 +1,138 @@
+/**
+ * Compile time description of the Pi4B header and of how the robot is wired to it.
+ *
+ * Pins are types, so a wrong pin is a build error rather than a FAILURE from on_configure():
+ *
+ *   using LeftWheel = WheelPins<Pwm<18>, Dir<23>, Enc<9>>;
+ *
+ * - Pwm<N> must be one of the hardware PWM pins (12, 13, 18, 19),
+ * - Dir<N> and Enc<N> must be on the header (0 to 27),
+ * - WheelPins rejects a pin used twice, and pins in the wrong role (Dir<23> where Pwm<> is expected),
+ * - distinct_wheels<A, B>() rejects wheels sharing a pin or a PWM channel. 12 and 18 are both channel 0, and
+ *   wheels on the same channel would be driven by the same duty.
+ *
+ * Each WheelPins precomputes the MotorPinout the drivers work from: the ALT function that routes the pin to its
+ * PWM channel, and the bank and mask used to write the direction pin, so activation and actuation don't have to
+ * work them out from the pin number. make_motor_pinout() is also used for pins only known at run time, which are
+ * still checked by Motor::on_configure().
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <pigpio.h>
+#include <type_traits>
+
+namespace board {
+    // highest GPIO on the Pi4B header.
+    constexpr unsigned MAX_GPIO = 27;
+
+    constexpr int NO_PWM_CHANNEL = -1;
+
+    // PWM channel driving pin, or NO_PWM_CHANNEL if it has no hardware PWM.
+    constexpr int pwm_channel(unsigned pin)
+    {
+        switch (pin) {
+            case 12:
+            case 18:
+                return 0;
+            case 13:
+            case 19:
+                return 1;
+            default:
+                return NO_PWM_CHANNEL;
+        }
+    }
+
+    constexpr bool hardware_pwm_pin(unsigned pin)
+    {
+        return pwm_channel(pin) != NO_PWM_CHANNEL;
+    }
+
+    // pin function that connects the pin to the PWM peripheral, ALT0 on 12 and 13, ALT5 on 18 and 19.
+    constexpr unsigned pwm_mode(unsigned pin)
+    {
+        return pin == 12 || pin == 13 ? PI_ALT0 : PI_ALT5;
+    }
+}
+
+/**
+ * Everything Motor needs to know about its pins, worked out once at configure time (or compile time).
+ */
+struct MotorPinout {
+    unsigned pwm = 0;
+    unsigned dir = 0;
+    unsigned pwm_mode = PI_ALT5;
+    int pwm_channel = board::NO_PWM_CHANNEL;
+    unsigned dir_bank = 0;   // 0 for GPIO 0-31, 1 for 32 and up, selects gpioWrite_Bits_0_31 or _32_53
+    uint32_t dir_mask = 0;   // bit of dir within its bank
+};
+
+constexpr MotorPinout make_motor_pinout(unsigned pwm, unsigned dir)
+{
+    return MotorPinout {pwm, dir, board::pwm_mode(pwm), board::pwm_channel(pwm), dir >> 5, 1u << (dir & 31)};
+}
+
+// role tags, so a pin can only be given where its role is expected.
+struct PwmPinTag {};
+struct DirPinTag {};
+struct EncPinTag {};
+
+template <unsigned N>
+struct Pwm : PwmPinTag {
+    static_assert(N <= board::MAX_GPIO, "PWM pin is not on the Pi4B header");
+    static_assert(board::hardware_pwm_pin(N), "PWM pin must be 12, 13, 18 or 19");
+    static constexpr unsigned pin = N;
+    static constexpr int channel = board::pwm_channel(N);
+};
+
+template <unsigned N>
+struct Dir : DirPinTag {
+    static_assert(N <= board::MAX_GPIO, "direction pin is not on the Pi4B header");
+    static constexpr unsigned pin = N;
+};
+
+template <unsigned N>
+struct Enc : EncPinTag {
+    static_assert(N <= board::MAX_GPIO, "encoder pin is not on the Pi4B header");
+    static constexpr unsigned pin = N;
+};
+
+template <class PwmPin, class DirPin, class EncPin>
+struct WheelPins {
+    static_assert(std::is_base_of<PwmPinTag, PwmPin>::value, "first wheel pin must be Pwm<N>");
+    static_assert(std::is_base_of<DirPinTag, DirPin>::value, "second wheel pin must be Dir<N>");
+    static_assert(std::is_base_of<EncPinTag, EncPin>::value, "third wheel pin must be Enc<N>");
+    static_assert(PwmPin::pin != DirPin::pin && PwmPin::pin != EncPin::pin && DirPin::pin != EncPin::pin,
+        "wheel uses the same pin twice");
+
+    static constexpr unsigned pwm = PwmPin::pin;
+    static constexpr unsigned dir = DirPin::pin;
+    static constexpr unsigned enc = EncPin::pin;
+    static constexpr int channel = PwmPin::channel;
+    static constexpr MotorPinout motor = make_motor_pinout(pwm, dir);
+};
+
+// true if the wheels share no pin and no PWM channel.
+template <class A, class B>
+constexpr bool distinct_wheels()
+{
+    constexpr unsigned a[] = {A::pwm, A::dir, A::enc};
+    constexpr unsigned b[] = {B::pwm, B::dir, B::enc};
+    for (unsigned pa : a) {
+        for (unsigned pb : b) {
+            if (pa == pb) {
+                return false;
+            }
+        }
+    }
+    return A::channel != B::channel;
+}
+
+namespace board {
+    // the robot's wiring, the only place these pins are written down.
+    using LeftWheel = WheelPins<Pwm<18>, Dir<23>, Enc<9>>;
+    using RightWheel = WheelPins<Pwm<19>, Dir<24>, Enc<8>>;
+
+    static_assert(distinct_wheels<LeftWheel, RightWheel>(), "left and right wheels share a pin or PWM channel");
+}
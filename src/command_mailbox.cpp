@@ -0,0 +1,207 @@
+#include "command_mailbox.hpp"
+#include "seqlock.hpp"
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace {
+    size_t segment_size(uint16_t motor_ct)
+    {
+        return sizeof(CommandHeader) + motor_ct * sizeof(CommandSlot);
+    }
+}
+
+uint64_t command_clock_ns()
+{
+    struct timespec ts {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+CommandMailbox::~CommandMailbox()
+{
+    on_deactivate();
+}
+
+CallbackReturn CommandMailbox::on_configure(const std::string &name, uint16_t motor_ct, uint32_t stale_timeout_us)
+{
+    if (name.empty() || name[0] != '/' || motor_ct == 0 || motor_ct > MAX_MOTORS || stale_timeout_us == 0) {
+        std::cout << "ERROR: command mailbox needs a name starting with /, 1 to " << MAX_MOTORS
+                  << " motors and a stale timeout\n";
+        return CallbackReturn::FAILURE;
+    }
+    name_ = name;
+    motor_ct_ = motor_ct;
+    stale_timeout_ns_ = static_cast<uint64_t>(stale_timeout_us) * 1000ULL;
+    return CallbackReturn::SUCCESS;
+}
+
+CallbackReturn CommandMailbox::on_activate()
+{
+    if (base_ != nullptr) {
+        return CallbackReturn::SUCCESS;
+    }
+
+    int fd = shm_open(name_.c_str(), O_CREAT | O_RDWR, 0600);
+    if (fd < 0) {
+        std::cout << "ERROR: unable to create command mailbox " << name_ << "\n";
+        return CallbackReturn::FAILURE;
+    }
+
+    // owner only, a segment left behind by an earlier run keeps the mode it was created with.
+    fchmod(fd, 0600);
+    size_ = segment_size(motor_ct_);
+    if (ftruncate(fd, static_cast<off_t>(size_)) != 0) {
+        std::cout << "ERROR: unable to size command mailbox " << name_ << "\n";
+        close(fd);
+        shm_unlink(name_.c_str());
+        return CallbackReturn::FAILURE;
+    }
+
+    void *base = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        std::cout << "ERROR: unable to map command mailbox " << name_ << "\n";
+        shm_unlink(name_.c_str());
+        return CallbackReturn::FAILURE;
+    }
+    base_ = base;
+    std::memset(base_, 0, size_);
+
+    auto *header = static_cast<CommandHeader *>(base_);
+    header->version = COMMAND_VERSION;
+    header->motor_ct = motor_ct_;
+    header->header_size = sizeof(CommandHeader);
+    header->slot_size = sizeof(CommandSlot);
+    slots_ = reinterpret_cast<CommandSlot *>(static_cast<char *>(base_) + sizeof(CommandHeader));
+
+    for (auto &watch : watch_) {
+        watch = Watch {};
+    }
+
+    // senders treat the segment as valid once they see the magic.
+    header->magic.store(COMMAND_MAGIC, std::memory_order_release);
+    return CallbackReturn::SUCCESS;
+}
+
+CallbackReturn CommandMailbox::on_deactivate()
+{
+    if (base_ == nullptr) {
+        return CallbackReturn::SUCCESS;
+    }
+    static_cast<CommandHeader *>(base_)->magic.store(0, std::memory_order_release);
+    munmap(base_, size_);
+    shm_unlink(name_.c_str());
+    base_ = nullptr;
+    slots_ = nullptr;
+    return CallbackReturn::SUCCESS;
+}
+
+CommandStatus CommandMailbox::poll(uint16_t idx, uint64_t now_ns, MotorCommand &out)
+{
+    if (slots_ == nullptr || idx >= motor_ct_) {
+        return CommandStatus::NONE;
+    }
+    Watch &watch = watch_[idx];
+
+    // cheap check first, the lock sequence only changes when a sender has written. A sender mid write is picked
+    // up on the next cycle rather than waited for.
+    CommandSlot &slot = slots_[idx];
+    uint32_t lock = slot.seq.load(std::memory_order_acquire);
+    MotorCommand command;
+    if ((lock & 1) == 0 && lock != watch.last_lock && seqlock::read(slot.seq, slot.data, command)) {
+        watch.last_lock = lock;
+    } else {
+        command.sequence = watch.last_sequence;
+    }
+
+    if (command.sequence != watch.last_sequence) {
+        watch.last_sequence = command.sequence;
+        watch.last_ns = now_ns;
+        watch.armed = true;
+        out = command;
+        return CommandStatus::NEW;
+    }
+
+    // measured from when the command was seen rather than sent_ns, a slow control cycle must not make a fresh command stale.
+    if (watch.armed && now_ns - watch.last_ns > stale_timeout_ns_) {
+        watch.armed = false;
+        watch.stale_events++;
+        return CommandStatus::STALE;
+    }
+    return CommandStatus::NONE;
+}
+
+CommandSender::~CommandSender()
+{
+    on_deactivate();
+}
+
+CallbackReturn CommandSender::on_activate(const std::string &name)
+{
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+        std::cout << "ERROR: command mailbox " << name << " does not exist\n";
+        return CallbackReturn::FAILURE;
+    }
+
+    struct stat st {};
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(CommandHeader)) {
+        close(fd);
+        std::cout << "ERROR: command mailbox " << name << " is not initialised\n";
+        return CallbackReturn::FAILURE;
+    }
+
+    size_ = static_cast<size_t>(st.st_size);
+    void *base = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        std::cout << "ERROR: unable to map command mailbox " << name << "\n";
+        return CallbackReturn::FAILURE;
+    }
+    base_ = base;
+
+    const auto *header = static_cast<const CommandHeader *>(base_);
+    if (header->magic.load(std::memory_order_acquire) != COMMAND_MAGIC ||
+        header->version != COMMAND_VERSION ||
+        header->header_size != sizeof(CommandHeader) ||
+        header->slot_size != sizeof(CommandSlot) ||
+        segment_size(header->motor_ct) > size_) {
+        std::cout << "ERROR: command mailbox " << name << " has an incompatible layout\n";
+        on_deactivate();
+        return CallbackReturn::FAILURE;
+    }
+
+    motor_ct_ = header->motor_ct;
+    slots_ = reinterpret_cast<CommandSlot *>(static_cast<char *>(base_) + sizeof(CommandHeader));
+    return CallbackReturn::SUCCESS;
+}
+
+CallbackReturn CommandSender::on_deactivate()
+{
+    if (base_ != nullptr) {
+        munmap(base_, size_);
+    }
+    base_ = nullptr;
+    slots_ = nullptr;
+    motor_ct_ = 0;
+    return CallbackReturn::SUCCESS;
+}
+
+bool CommandSender::send(uint16_t idx, DIRECTION direction, int duty, int freq)
+{
+    if (slots_ == nullptr || idx >= motor_ct_) {
+        return false;
+    }
+    CommandSlot &slot = slots_[idx];
+    return seqlock::update_shared(slot.seq, slot.owner, slot.data, [&](MotorCommand &command) {
+        command.sequence++;
+        command.sent_ns = command_clock_ns();
+        command.direction = direction;
+        command.duty = duty;
+        command.freq = freq;
+    });
+}
@@ -0,0 +1,140 @@
+/**
+ * Shared memory setpoint mailbox, lets a planner in another process command the motors without linking the driver.
+ *
+ * One slot per motor holds the latest command, a newer command simply overwrites an older one that has not been
+ * picked up yet (latest value wins). Senders stamp every command with a sequence number and CLOCK_MONOTONIC time,
+ * the control loop polls each slot once per cycle and only acts when the sequence has moved on.
+ *
+ * The control loop also runs the watchdog: if a motor that has been commanded sees no new command for
+ * stale_timeout_us, poll() reports STALE once and the caller is expected to stop the motor. The motor stays under
+ * watchdog control until the next command arrives, so a planner that crashes or hangs cannot leave a wheel spinning.
+ * Planners that hold a constant setpoint must keep re-sending it.
+ *
+ * Segment layout, all blocks 64 byte aligned:
+ *
+ *   CommandHeader       magic, version, sizes and motor count.
+ *   CommandSlot         x motor_ct, seqlocked, see seqlock.hpp.
+ *
+ * The segment is readable and writable by its owner only, senders must run as the same user as the control loop.
+ */
+
+#pragma once
+
+#include "motor.hpp"
+#include "tst_common.hpp"
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#define COMMAND_SHM_NAME "/rr_pi4b_command"
+
+static constexpr uint32_t COMMAND_MAGIC = 0x52524d43; // "RRMC"
+static constexpr uint16_t COMMAND_VERSION = 2;
+
+struct alignas(64) CommandHeader {
+    std::atomic<uint32_t> magic;  // written last, senders must wait for COMMAND_MAGIC
+    uint16_t version;
+    uint16_t motor_ct;
+    uint32_t header_size;         // sizeof(CommandHeader)
+    uint32_t slot_size;           // sizeof(CommandSlot)
+};
+
+struct MotorCommand {
+    uint64_t sequence;      // set by CommandSender, increases with every command to the slot
+    uint64_t sent_ns;       // CLOCK_MONOTONIC when sent
+    int32_t direction;      // DIRECTION
+    int32_t duty;           // %
+    int32_t freq;           // Hz
+};
+
+struct alignas(64) CommandSlot {
+    std::atomic<uint32_t> seq;
+    std::atomic<uint32_t> owner;  // pid of the sender writing the slot, 0 when free, see seqlock::update_shared()
+    MotorCommand data;
+};
+
+enum class CommandStatus : uint8_t {
+    NONE,   // nothing new
+    NEW,    // a new command was copied out
+    STALE,  // watchdog expired, stop the motor
+};
+
+/**
+ * CLOCK_MONOTONIC in ns, the clock used for command timestamps. Shared by every process on the machine.
+ */
+uint64_t command_clock_ns();
+
+/**
+ * Owns the segment, used by the process running the control loop. Single poller.
+ */
+class CommandMailbox {
+  public:
+    static constexpr uint16_t MAX_MOTORS = 32;
+
+    ~CommandMailbox();
+
+    CallbackReturn on_configure(const std::string &name, uint16_t motor_ct, uint32_t stale_timeout_us);
+
+    // create and map the segment, any commands left from a previous run are discarded.
+    CallbackReturn on_activate();
+
+    // unmap and remove the segment.
+    CallbackReturn on_deactivate();
+
+    /**
+     * Check slot idx, call every control cycle with the same now_ns for every motor.
+     * On NEW the command is copied to out. On STALE out is left untouched.
+     */
+    CommandStatus poll(uint16_t idx, uint64_t now_ns, MotorCommand &out);
+
+    // number of times the watchdog has stopped motor idx.
+    uint32_t stale_events(uint16_t idx) const { return idx < motor_ct_ ? watch_[idx].stale_events : 0; }
+
+  private:
+    struct Watch {
+        uint32_t last_lock = 0;      // CommandSlot::seq when last read
+        uint64_t last_sequence = 0;
+        uint64_t last_ns = 0;
+        bool armed = false;  // a command has been seen and the watchdog has not fired yet
+        uint32_t stale_events = 0;
+    };
+
+    std::string name_ {COMMAND_SHM_NAME};
+    uint16_t motor_ct_ = 0;
+    uint64_t stale_timeout_ns_ = 0;
+
+    void *base_ = nullptr;
+    size_t size_ = 0;
+    CommandSlot *slots_ = nullptr;
+
+    // only touched by the polling thread.
+    Watch watch_[MAX_MOTORS] {};
+};
+
+/**
+ * Writes commands into a mailbox created by another process. Several senders may share a slot, the last one wins,
+ * and a sender that dies while writing does not block the others.
+ */
+class CommandSender {
+  public:
+    ~CommandSender();
+
+    // map the segment and check its header.
+    CallbackReturn on_activate(const std::string &name = COMMAND_SHM_NAME);
+
+    CallbackReturn on_deactivate();
+
+    uint16_t motor_ct() const { return motor_ct_; }
+
+    /**
+     * Replace the pending command for motor idx, returns false if idx is out of range or not mapped, or if another
+     * live sender held the slot for longer than a write takes.
+     */
+    bool send(uint16_t idx, DIRECTION direction, int duty, int freq);
+
+  private:
+    void *base_ = nullptr;
+    size_t size_ = 0;
+    uint16_t motor_ct_ = 0;
+    CommandSlot *slots_ = nullptr;
+};
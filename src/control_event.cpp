@@ -0,0 +1,73 @@
+#include "control_event.hpp"
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+ControlEvent::~ControlEvent()
+{
+    on_cleanup();
+}
+
+CallbackReturn ControlEvent::on_configure()
+{
+    if (fd_ >= 0) {
+        return CallbackReturn::SUCCESS;
+    }
+    fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (fd_ < 0) {
+        std::cout << "ERROR: unable to create control eventfd: " << std::strerror(errno) << "\n";
+        return CallbackReturn::FAILURE;
+    }
+    pending_.store(false);
+    writes_.store(0);
+    return CallbackReturn::SUCCESS;
+}
+
+CallbackReturn ControlEvent::on_cleanup()
+{
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+    return CallbackReturn::SUCCESS;
+}
+
+void ControlEvent::notify()
+{
+    if (pending_.exchange(true, std::memory_order_acq_rel)) {
+        return;
+    }
+    uint64_t one = 1;
+    if (write(fd_, &one, sizeof(one)) == static_cast<ssize_t>(sizeof(one))) {
+        writes_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+bool ControlEvent::wait_until(uint64_t deadline_ns)
+{
+    struct timespec now {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t now_ns = static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + static_cast<uint64_t>(now.tv_nsec);
+    uint64_t wait_ns = deadline_ns > now_ns ? deadline_ns - now_ns : 0;
+
+    struct timespec timeout {};
+    timeout.tv_sec = static_cast<time_t>(wait_ns / 1000000000ULL);
+    timeout.tv_nsec = static_cast<long>(wait_ns % 1000000000ULL);
+    struct pollfd pfd {fd_, POLLIN, 0};
+    if (ppoll(&pfd, 1, &timeout, nullptr) <= 0) {
+        return false;
+    }
+
+    uint64_t count = 0;
+    if (read(fd_, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        std::cout << "ERROR: control eventfd: " << std::strerror(errno) << "\n";
+    }
+    // cleared after the read. A notify() in between saw pending_ still set and did not write, so the caller must see
+    // its sample: the acquire half of the exchange keeps the caller's sample loads after it, and synchronises with
+    // that notify()'s exchange, which came after its sample was published. A notify() after this writes again.
+    pending_.exchange(false, std::memory_order_acq_rel);
+    return true;
+}
@@ -0,0 +1,46 @@
+/**
+ * Wakes the control thread when an encoder produces a fresh velocity sample.
+ *
+ * MotorController updates its velocity every PPR_ pulses, but a timer driven executor only reacts on its next
+ * control tick, up to a whole control period later. In event triggered mode (see ControlTrigger) the encoder
+ * callback calls notify() and the executor, blocked in wait_until(), runs the controller straight away.
+ *
+ * An eventfd carries the wakeup. notify() only writes to it when no wakeup is already pending, so several motors
+ * closing a window before the executor runs cost one syscall between them. Nothing is lost by coalescing, the
+ * executor checks every motor's sample count once it wakes.
+ */
+
+#pragma once
+
+#include "tst_common.hpp"
+#include <atomic>
+#include <cstdint>
+
+class ControlEvent {
+  public:
+    ~ControlEvent();
+
+    CallbackReturn on_configure();
+
+    CallbackReturn on_cleanup();
+
+    /**
+     * Wake the waiter, never blocks and never allocates. Safe from encoder callbacks.
+     */
+    void notify();
+
+    /**
+     * Block until notify() or until deadline_ns on CLOCK_MONOTONIC, whichever is first.
+     *
+     * @return true if woken by notify().
+     */
+    bool wait_until(uint64_t deadline_ns);
+
+    // eventfd writes made by notify(), lower than the notify() calls when wakeups were coalesced.
+    uint64_t writes() const { return writes_.load(std::memory_order_relaxed); }
+
+  private:
+    int fd_ = -1;
+    std::atomic<bool> pending_ {false};
+    std::atomic<uint64_t> writes_ {0};
+};
@@ -0,0 +1,208 @@
+#include "deadband.hpp"
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <thread>
+
+namespace {
+    // edges are polled at this interval while a probe holds its duty.
+    constexpr auto POLL = std::chrono::milliseconds(1);
+
+    uint32_t fnv1a(const void *data, size_t len)
+    {
+        const auto *bytes = static_cast<const uint8_t *>(data);
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < len; i++) {
+            hash = (hash ^ bytes[i]) * 16777619u;
+        }
+        return hash;
+    }
+
+    uint64_t realtime_s()
+    {
+        return static_cast<uint64_t>(std::time(nullptr));
+    }
+}
+
+CallbackReturn DeadbandCache::load(const std::string &path)
+{
+    entry_ct_ = 0;
+    std::FILE *f = std::fopen(path.c_str(), "rb");
+    if (f == nullptr) {
+        return CallbackReturn::SUCCESS;
+    }
+
+    DeadbandFileHeader header {};
+    bool ok = std::fread(&header, sizeof(header), 1, f) == 1
+        && header.magic == DEADBAND_MAGIC
+        && header.version == DEADBAND_VERSION
+        && header.entry_size == sizeof(DeadbandEntry)
+        && header.entry_ct <= MAX_ENTRIES
+        && std::fread(entries_.data(), sizeof(DeadbandEntry), header.entry_ct, f) == header.entry_ct
+        && fnv1a(entries_.data(), header.entry_ct * sizeof(DeadbandEntry)) == header.checksum;
+    std::fclose(f);
+    if (!ok) {
+        std::cout << "WARNING: ignoring deadband cache " << path << ", it is corrupt or from another version\n";
+        return CallbackReturn::SUCCESS;
+    }
+    entry_ct_ = header.entry_ct;
+    return CallbackReturn::SUCCESS;
+}
+
+CallbackReturn DeadbandCache::save(const std::string &path) const
+{
+    DeadbandFileHeader header {};
+    header.magic = DEADBAND_MAGIC;
+    header.version = DEADBAND_VERSION;
+    header.entry_ct = static_cast<uint16_t>(entry_ct_);
+    header.entry_size = sizeof(DeadbandEntry);
+    header.checksum = fnv1a(entries_.data(), entry_ct_ * sizeof(DeadbandEntry));
+
+    const std::string tmp = path + ".tmp";
+    std::FILE *f = std::fopen(tmp.c_str(), "wb");
+    if (f == nullptr) {
+        std::cout << "ERROR: unable to write deadband cache " << tmp << "\n";
+        return CallbackReturn::FAILURE;
+    }
+    bool ok = std::fwrite(&header, sizeof(header), 1, f) == 1
+        && std::fwrite(entries_.data(), sizeof(DeadbandEntry), entry_ct_, f) == entry_ct_;
+    ok = std::fclose(f) == 0 && ok;
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::cout << "ERROR: unable to write deadband cache " << path << "\n";
+        std::remove(tmp.c_str());
+        return CallbackReturn::FAILURE;
+    }
+    return CallbackReturn::SUCCESS;
+}
+
+int DeadbandCache::find(unsigned pwm_pin, int freq, uint64_t max_age_s) const
+{
+    const uint64_t now = realtime_s();
+    for (size_t i = 0; i < entry_ct_; i++) {
+        const DeadbandEntry &e = entries_[i];
+        if (e.pwm_pin != pwm_pin || e.freq != static_cast<uint32_t>(freq)) {
+            continue;
+        }
+        if (max_age_s > 0 && (e.found_s > now || now - e.found_s > max_age_s)) {
+            return -1;
+        }
+        return e.duty;
+    }
+    return -1;
+}
+
+bool DeadbandCache::store(unsigned pwm_pin, int freq, int duty, uint32_t search_us)
+{
+    size_t idx = entry_ct_;
+    for (size_t i = 0; i < entry_ct_; i++) {
+        if (entries_[i].pwm_pin == pwm_pin && entries_[i].freq == static_cast<uint32_t>(freq)) {
+            idx = i;
+            break;
+        }
+    }
+    if (idx >= MAX_ENTRIES) {
+        return false;
+    }
+    entries_[idx] = DeadbandEntry {pwm_pin, static_cast<uint32_t>(freq), duty, search_us, realtime_s()};
+    if (idx == entry_ct_) {
+        entry_ct_++;
+    }
+    return true;
+}
+
+CallbackReturn DeadbandSearch::on_configure(const DeadbandConfig &config)
+{
+    if (config.min_duty < 0 || config.max_duty > 100 || config.min_duty >= config.max_duty
+        || config.probe_ms == 0 || config.move_pulses <= 0) {
+        std::cout << "ERROR: deadband search needs 0 <= min_duty < max_duty <= 100 and a probe time\n";
+        return CallbackReturn::FAILURE;
+    }
+    config_ = config;
+    return CallbackReturn::SUCCESS;
+}
+
+DeadbandResult DeadbandSearch::search(MotorController &cntl, int freq) const
+{
+    const auto start = Clock::now();
+    DeadbandResult result;
+    result.freq = freq;
+
+    // nothing is known about the wheel yet, so it must be quiet for a whole settle_ms before the first probe.
+    Clock::time_point last_edge = Clock::now();
+    stop(cntl, freq, last_edge);
+    // lo never turned the wheel, hi is the lowest duty that did, or max_duty until one does.
+    int lo = config_.min_duty - 1;
+    int hi = config_.max_duty;
+    bool moved = false;
+    while (hi - lo > 1) {
+        int mid = lo + (hi - lo) / 2;
+        result.probes++;
+        if (probe(cntl, mid, freq, last_edge)) {
+            hi = mid;
+            moved = true;
+        }
+        else {
+            lo = mid;
+        }
+    }
+    if (!moved) {
+        result.probes++;
+        moved = probe(cntl, hi, freq, last_edge);
+    }
+    result.duty = moved ? hi : -1;
+
+    result.search_us = static_cast<uint32_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count());
+    return result;
+}
+
+DeadbandResult DeadbandSearch::find(MotorController &cntl, int freq, DeadbandCache &cache, uint64_t max_age_s) const
+{
+    int duty = cache.find(static_cast<unsigned>(cntl.pwm_pin()), freq, max_age_s);
+    if (duty >= 0) {
+        DeadbandResult result;
+        result.duty = duty;
+        result.freq = freq;
+        result.cached = true;
+        return result;
+    }
+    DeadbandResult result = search(cntl, freq);
+    if (result.duty >= 0 && !cache.store(static_cast<unsigned>(cntl.pwm_pin()), freq, result.duty, result.search_us)) {
+        std::cout << "WARNING: deadband cache is full, result for pin " << cntl.pwm_pin() << " not kept\n";
+    }
+    return result;
+}
+
+bool DeadbandSearch::probe(MotorController &cntl, int duty, int freq, Clock::time_point &last_edge) const
+{
+    const int start_pulses = cntl.pulses();
+    int pulses = start_pulses;
+    const auto deadline = Clock::now() + std::chrono::milliseconds(config_.probe_ms);
+    cntl.publish(DIRECTION::FORWARD, duty, freq);
+    while (pulses - start_pulses < config_.move_pulses && Clock::now() < deadline) {
+        std::this_thread::sleep_for(POLL);
+        int latest = cntl.pulses();
+        if (latest != pulses) {
+            pulses = latest;
+            last_edge = Clock::now();
+        }
+    }
+    stop(cntl, freq, last_edge);
+    return pulses - start_pulses >= config_.move_pulses;
+}
+
+void DeadbandSearch::stop(MotorController &cntl, int freq, Clock::time_point &last_edge) const
+{
+    cntl.publish(DIRECTION::FORWARD, 0, freq);
+    // a wheel coasting down from a high probe can take a while, but the search must not hang on a noisy encoder.
+    const auto deadline = Clock::now() + 4 * std::chrono::milliseconds(config_.probe_ms);
+    int pulses = cntl.pulses();
+    while (Clock::now() - last_edge < std::chrono::milliseconds(config_.settle_ms) && Clock::now() < deadline) {
+        std::this_thread::sleep_for(POLL);
+        int latest = cntl.pulses();
+        if (latest != pulses) {
+            pulses = latest;
+            last_edge = Clock::now();
+        }
+    }
+}
@@ -0,0 +1,125 @@
+/**
+ * Finds the duty at which a wheel breaks away from standstill, and caches it between runs.
+ *
+ * Below some duty the motor's torque does not overcome static friction and the wheel does not turn. That duty
+ * was hard coded (MIN_DUTY 65), but it moves with battery voltage, wear and PWM frequency. DeadbandSearch
+ * binary searches it with encoder feedback:
+ *
+ * - each probe holds one duty, from standstill, for at most probe_ms and counts encoder edges. move_pulses edges
+ *   means the wheel broke away, the probe ends as soon as they arrive,
+ * - the wheel is then stopped and the next probe waits until no edge has been seen for settle_ms, so every probe
+ *   starts from standstill and measures static rather than rolling friction. A wheel still coasting slowly
+ *   would add edges to the next probe, so settle_ms is most of a probe by default. A probe that saw no edge
+ *   leaves the wheel already settled and costs nothing extra,
+ * - the duty is searched between min_duty and max_duty to 1%, 6 probes by default, well under a second.
+ *
+ * The wheel turns forward briefly during the search, the robot must be free to move a few millimetres.
+ *
+ * DeadbandCache keeps results in a small binary file keyed by PWM pin and frequency, so later starts can skip the
+ * search. File layout, little endian as written by the Pi:
+ *
+ *   DeadbandFileHeader   magic, version, entry count and a checksum of the entries
+ *   DeadbandEntry        x count
+ */
+
+#pragma once
+
+#include "motor_controller.hpp"
+#include "tst_common.hpp"
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+static constexpr uint32_t DEADBAND_MAGIC = 0x52524442; // "RRDB"
+static constexpr uint16_t DEADBAND_VERSION = 1;
+
+struct DeadbandFileHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t entry_ct;
+    uint32_t entry_size;    // sizeof(DeadbandEntry)
+    uint32_t checksum;      // FNV-1a of the entries
+};
+
+struct DeadbandEntry {
+    uint32_t pwm_pin;
+    uint32_t freq;
+    int32_t duty;           // lowest duty % that turned the wheel
+    uint32_t search_us;     // how long the search took
+    uint64_t found_s;       // CLOCK_REALTIME seconds when it was found
+};
+
+struct DeadbandConfig {
+    int min_duty = 30;          // every motor tried so far sat between 50 and 70%
+    int max_duty = 90;
+    uint32_t probe_ms = 50;     // longest a duty is held waiting for the wheel to turn
+    uint32_t settle_ms = 40;    // no edge for this long and the wheel is taken to have stopped
+    int move_pulses = 2;        // edges within a probe that count as breaking away
+};
+
+struct DeadbandResult {
+    int duty = -1;              // -1 when even max_duty did not turn the wheel
+    int freq = 0;
+    int probes = 0;
+    uint32_t search_us = 0;
+    bool cached = false;        // taken from DeadbandCache, no search was run
+};
+
+class DeadbandCache {
+  public:
+    static constexpr size_t MAX_ENTRIES = 32;
+
+    /**
+     * Replace the entries with those in path. A missing file leaves the cache empty and succeeds, a corrupt or
+     * older version file is reported and ignored.
+     */
+    CallbackReturn load(const std::string &path);
+
+    // write every entry to path, through a temporary file so a crash never leaves it half written.
+    CallbackReturn save(const std::string &path) const;
+
+    /**
+     * @param max_age_s entries older than this are ignored, 0 accepts any age.
+     * @return cached duty for pwm_pin at freq, or -1.
+     */
+    int find(unsigned pwm_pin, int freq, uint64_t max_age_s = 0) const;
+
+    // add or replace the entry for pwm_pin at freq, returns false if the cache is full.
+    bool store(unsigned pwm_pin, int freq, int duty, uint32_t search_us);
+
+    void clear() { entry_ct_ = 0; }
+
+    size_t size() const { return entry_ct_; }
+
+  private:
+    std::array<DeadbandEntry, MAX_ENTRIES> entries_ {};
+    size_t entry_ct_ = 0;
+};
+
+class DeadbandSearch {
+  public:
+    CallbackReturn on_configure(const DeadbandConfig &config);
+
+    /**
+     * Search the breakaway duty of an activated controller at freq. The motor is left stopped.
+     */
+    DeadbandResult search(MotorController &cntl, int freq) const;
+
+    /**
+     * Take the duty from cache when it holds one no older than max_age_s, otherwise search and store the result.
+     */
+    DeadbandResult find(MotorController &cntl, int freq, DeadbandCache &cache, uint64_t max_age_s = 0) const;
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    // true if the wheel turned at duty. last_edge is kept up to date with the last edge seen.
+    bool probe(MotorController &cntl, int duty, int freq, Clock::time_point &last_edge) const;
+
+    // stop the wheel and wait until no edge has been seen for settle_ms, bounded by 4 * probe_ms.
+    void stop(MotorController &cntl, int freq, Clock::time_point &last_edge) const;
+
+    DeadbandConfig config_;
+};
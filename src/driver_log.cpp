@@ -0,0 +1,157 @@
+#include "driver_log.hpp"
+
+namespace {
+    // how long the formatting thread sleeps when the queue is empty.
+    constexpr auto IDLE_SLEEP = std::chrono::milliseconds(2);
+
+    const char *error_name(int err)
+    {
+        switch (err) {
+        case PI_BAD_GPIO:
+            return "PI_BAD_GPIO";
+        case PI_BAD_MODE:
+            return "PI_BAD_MODE";
+        case PI_BAD_LEVEL:
+            return "PI_BAD_LEVEL";
+        case PI_NOT_PERMITTED:
+            return "PI_NOT_PERMITTED";
+        case PI_NOT_HPWM_GPIO:
+            return "PI_NOT_HPWM_GPIO";
+        case PI_BAD_HPWM_DUTY:
+            return "PI_BAD_HPWM_DUTY";
+        case PI_BAD_HPWM_FREQ:
+            return "PI_BAD_HPWM_FREQ";
+        case PI_HPWM_ILLEGAL:
+            return "PI_HPWM_ILLEGAL";
+        default:
+            return "unknown error";
+        }
+    }
+}
+
+DriverLog &DriverLog::instance()
+{
+    static DriverLog log;
+    return log;
+}
+
+DriverLog::DriverLog()
+{
+    for (size_t i = 0; i < CAPACITY; i++) {
+        cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+}
+
+DriverLog::~DriverLog()
+{
+    stop();
+}
+
+bool DriverLog::log(LogCode code, unsigned pin, int err, int32_t value)
+{
+    if (pin <= MAX_PIN) {
+        pin_errors_[pin].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    size_t pos = head_.load(std::memory_order_relaxed);
+    for (;;) {
+        Cell &cell = cells_[pos & (CAPACITY - 1)];
+        size_t seq = cell.seq.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+        if (diff == 0) {
+            if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                cell.record = LogRecord {gpioTick(), value, err, static_cast<uint8_t>(pin), code};
+                cell.seq.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0) {
+            // full, the consumer has not freed this cell yet.
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        else {
+            pos = head_.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool DriverLog::pop(LogRecord &record)
+{
+    // single consumer, only the formatting thread (or stop() once it has joined) reads.
+    size_t pos = tail_.load(std::memory_order_relaxed);
+    Cell &cell = cells_[pos & (CAPACITY - 1)];
+    if (cell.seq.load(std::memory_order_acquire) != pos + 1) {
+        return false;
+    }
+    record = cell.record;
+    cell.seq.store(pos + CAPACITY, std::memory_order_release);
+    tail_.store(pos + 1, std::memory_order_relaxed);
+    return true;
+}
+
+void DriverLog::start()
+{
+    if (running_.exchange(true)) {
+        return;
+    }
+    thread_ = std::thread(&DriverLog::run, this);
+}
+
+void DriverLog::stop()
+{
+    if (!running_.exchange(false)) {
+        return;
+    }
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    drain();
+
+    uint32_t dropped = dropped_.load(std::memory_order_relaxed);
+    if (dropped > 0) {
+        std::cout << "WARNING: " << dropped << " log records dropped\n";
+    }
+}
+
+void DriverLog::drain()
+{
+    LogRecord record;
+    while (pop(record)) {
+        format(record);
+    }
+}
+
+void DriverLog::run()
+{
+    while (running_.load(std::memory_order_acquire)) {
+        LogRecord record;
+        if (!pop(record)) {
+            std::this_thread::sleep_for(IDLE_SLEEP);
+            continue;
+        }
+        format(record);
+    }
+}
+
+void DriverLog::format(const LogRecord &record)
+{
+    switch (record.code) {
+    case LogCode::PWM_WRITE_FAILED:
+        std::cout << "ERROR: pin " << +record.pin << " returned " << error_name(record.err)
+                  << " on PWM write (tick " << record.tick << ")\n";
+        break;
+    case LogCode::DIR_WRITE_FAILED:
+        std::cout << "ERROR: pin " << +record.pin << " returned " << error_name(record.err)
+                  << " on direction write (tick " << record.tick << ")\n";
+        break;
+    case LogCode::SET_MODE_FAILED:
+        std::cout << "ERROR: pin " << +record.pin << " returned " << error_name(record.err)
+                  << " on set mode (tick " << record.tick << ")\n";
+        break;
+    case LogCode::EMERGENCY_STOP:
+        std::cout << "ERROR: emergency stop, cause " << record.err << " on pin " << +record.pin << ", PWM off after "
+                  << record.value << "us (tick " << record.tick << ")\n";
+        break;
+    }
+}
@@ -0,0 +1,95 @@
+/**
+ * Asynchronous logger for the motor hot paths.
+ *
+ * Writing to std::cout from set_pwm()/set_direction() meant a wiring fault could stall the control
+ * loop on terminal I/O. Instead hot path code enqueues a compact LogRecord into a bounded lock-free
+ * queue, and a background thread formats and prints it. When the queue is full the record is dropped
+ * and counted, the producer never blocks.
+ *
+ * Errors are also counted per pin, so the error rate of a pin can be read without parsing the log.
+ *
+ * The background thread is started and stopped by GpioRuntime alongside pigpio itself.
+ */
+
+#pragma once
+
+#include "tst_common.hpp"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+enum class LogCode : uint8_t {
+    PWM_WRITE_FAILED = 0,  // gpioHardwarePWM() failed, err is the pigpio error
+    DIR_WRITE_FAILED = 1,  // gpioWrite() on the direction pin failed
+    SET_MODE_FAILED = 2,   // gpioSetMode() failed
+    EMERGENCY_STOP = 3,    // EmergencyStop::trip(), err is the FaultCause, value the fault to PWM off latency in us
+};
+
+struct LogRecord {
+    uint32_t tick;  // gpioTick() when the record was made
+    int32_t value;  // code specific value
+    int32_t err;    // pigpio error code (or code specific value)
+    uint8_t pin;
+    LogCode code;
+};
+
+class DriverLog {
+  public:
+    static constexpr size_t CAPACITY = 1024; // must be a power of 2
+    static constexpr unsigned MAX_PIN = 27;
+
+    static DriverLog &instance();
+
+    // stops the formatting thread, a program returning without GpioRuntime::release() must not exit with it
+    // still joinable.
+    ~DriverLog();
+
+    /**
+     * Enqueue a record, never blocks and never allocates. Safe from any thread including pigpio callbacks.
+     *
+     * @return false if the queue was full and the record was dropped.
+     */
+    bool log(LogCode code, unsigned pin, int err, int32_t value = 0);
+
+    // start the formatting thread, does nothing if already running.
+    void start();
+
+    // print anything still queued, then stop the formatting thread.
+    void stop();
+
+    uint32_t error_count(unsigned pin) const
+    {
+        return pin > MAX_PIN ? 0 : pin_errors_[pin].load(std::memory_order_relaxed);
+    }
+
+    uint32_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+  private:
+    DriverLog();
+    DriverLog(const DriverLog &) = delete;
+    DriverLog &operator=(const DriverLog &) = delete;
+
+    bool pop(LogRecord &record);
+    void drain();
+    void run();
+
+    static void format(const LogRecord &record);
+
+    // bounded MPMC queue (D. Vyukov), each cell carries a sequence number that tells producers and
+    // the consumer whether it is free or filled for the current lap.
+    struct alignas(64) Cell {
+        std::atomic<size_t> seq;
+        LogRecord record;
+    };
+
+    std::array<Cell, CAPACITY> cells_;
+    alignas(64) std::atomic<size_t> head_ {0}; // next cell to write
+    alignas(64) std::atomic<size_t> tail_ {0}; // next cell to read
+
+    std::array<std::atomic<uint32_t>, MAX_PIN + 1> pin_errors_ {};
+    std::atomic<uint32_t> dropped_ {0};
+
+    std::atomic<bool> running_ {false};
+    std::thread thread_;
+};
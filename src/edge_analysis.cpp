@@ -0,0 +1,509 @@
+#include "edge_analysis.hpp"
+#include "encoder.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+namespace {
+    constexpr uint8_t HEALTHY = static_cast<uint8_t>(TickStatus::HEALTHY);
+    constexpr uint8_t TIMEOUT = static_cast<uint8_t>(TickStatus::TIMEOUT);
+    constexpr uint8_t NOISE_REJECTED = static_cast<uint8_t>(TickStatus::NOISE_REJECTED);
+    constexpr uint8_t UNEXPECTED = static_cast<uint8_t>(TickStatus::UNEXPECTED);
+
+    /**
+     * Run fn(worker, begin, end) over [0, n) split evenly across up to threads workers, worker 0 on the caller.
+     */
+    template <typename Fn>
+    void parallel_for(unsigned threads, size_t n, Fn fn)
+    {
+        const size_t workers = std::max<size_t>(1, std::min<size_t>(threads, n));
+        std::vector<std::thread> pool;
+        pool.reserve(workers - 1);
+        for (size_t w = 1; w < workers; w++) {
+            pool.emplace_back(fn, static_cast<unsigned>(w), n * w / workers, n * (w + 1) / workers);
+        }
+        fn(0u, size_t {0}, n / workers);
+        for (std::thread &t : pool) {
+            t.join();
+        }
+    }
+
+    double elapsed_ms(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // digits up to the next non digit, nullptr if there are none or the value does not fit 32 bits.
+    const char *parse_u32(const char *p, const char *end, uint32_t &out)
+    {
+        uint64_t v = 0;
+        const char *start = p;
+        while (p < end && *p >= '0' && *p <= '9' && p - start < 11) {
+            v = v * 10 + static_cast<uint64_t>(*p - '0');
+            p++;
+        }
+        if (p == start || v > UINT32_MAX) {
+            return nullptr;
+        }
+        out = static_cast<uint32_t>(v);
+        return p;
+    }
+
+    /**
+     * Parse GPIO,DELTA_US,TICK_US,STATUS at p, up to but not including the line end.
+     *
+     * @return false if the line is anything else.
+     */
+    bool parse_edge(const char *p, const char *end, EdgeCaptureRecord &out)
+    {
+        uint32_t gpio = 0;
+        uint32_t status = 0;
+        if ((p = parse_u32(p, end, gpio)) == nullptr || p == end || *p++ != ','
+            || (p = parse_u32(p, end, out.delta_us)) == nullptr || p == end || *p++ != ','
+            || (p = parse_u32(p, end, out.tick)) == nullptr || p == end || *p++ != ','
+            || (p = parse_u32(p, end, status)) == nullptr) {
+            return false;
+        }
+        if (p < end && *p == '\r') {
+            p++;
+        }
+        if (p != end || gpio > EdgeAnalyzer::MAX_PIN || status > UNEXPECTED) {
+            return false;
+        }
+        out.gpio = static_cast<uint8_t>(gpio);
+        out.status = static_cast<uint8_t>(status);
+        return true;
+    }
+
+    // the first line starting at or after offset.
+    size_t line_start(const char *data, size_t size, size_t offset)
+    {
+        if (offset == 0) {
+            return 0;
+        }
+        const void *nl = std::memchr(data + offset - 1, '\n', size - offset + 1);
+        return nl == nullptr ? size : static_cast<size_t>(static_cast<const char *>(nl) - data) + 1;
+    }
+
+    struct Worker {
+        std::array<EdgeAnalyzer::Columns, EdgeAnalyzer::MAX_PIN + 1> columns {};
+        uint64_t records = 0;
+        uint64_t skipped = 0;
+
+        void add(const EdgeCaptureRecord &r)
+        {
+            if (r.gpio > EdgeAnalyzer::MAX_PIN || r.status > UNEXPECTED) {
+                skipped++;
+                return;
+            }
+            records++;
+            columns[r.gpio].push(r.tick, r.delta_us, r.status);
+        }
+    };
+
+    // moments, classes and histogram of one worker's share of a pin.
+    struct Partial {
+        std::array<uint64_t, static_cast<size_t>(EdgeClass::COUNT)> classes {};
+        uint64_t n = 0;
+        double mean = 0.0;
+        double m2 = 0.0;
+        uint32_t min = UINT32_MAX;
+        uint32_t max = 0;
+        std::vector<uint64_t> histogram;
+
+        // Chan's parallel update, n_b samples with mean_b and sum of squared deviations m2_b.
+        void merge(uint64_t n_b, double mean_b, double m2_b)
+        {
+            if (n_b == 0) {
+                return;
+            }
+            const double total = static_cast<double>(n + n_b);
+            const double delta = mean_b - mean;
+            mean += delta * static_cast<double>(n_b) / total;
+            m2 += m2_b + delta * delta * static_cast<double>(n) * static_cast<double>(n_b) / total;
+            n += n_b;
+        }
+    };
+
+    /**
+     * Classify edges [begin, end) of a pin, begin to end at most EdgeAnalyzer::BLOCK. Branch free so the loop
+     * vectorizes, every count and sum is exact, a block's sum of squares is under 2^52.
+     */
+    void block_moments(const uint32_t *delta, const uint8_t *status, size_t begin, size_t end, uint32_t min_us,
+        uint32_t max_us, Partial &p)
+    {
+        uint32_t in_range = 0;
+        uint32_t glitch = 0;
+        uint32_t slow = 0;
+        uint32_t timeout = 0;
+        uint32_t noise = 0;
+        uint64_t sum = 0;
+        uint64_t sum_sq = 0;
+        uint32_t lo = UINT32_MAX;
+        uint32_t hi = 0;
+        for (size_t i = begin; i < end; i++) {
+            const uint32_t d = delta[i];
+            const uint32_t healthy = status[i] == HEALTHY;
+            const uint32_t is_glitch = healthy & (d <= min_us);
+            const uint32_t is_slow = healthy & (d >= max_us);
+            const uint32_t ok = healthy & (d > min_us) & (d < max_us);
+            in_range += ok;
+            glitch += is_glitch;
+            slow += is_slow;
+            timeout += status[i] == TIMEOUT;
+            noise += status[i] == NOISE_REJECTED;
+            const uint32_t v = d & (0u - ok);
+            sum += v;
+            sum_sq += static_cast<uint64_t>(v) * v;
+            // d, or UINT32_MAX when not in range, without a select the vectorizer would refuse.
+            lo = std::min(lo, d | (ok - 1u));
+            hi = std::max(hi, v);
+        }
+        p.classes[static_cast<size_t>(EdgeClass::IN_RANGE)] += in_range;
+        p.classes[static_cast<size_t>(EdgeClass::GLITCH)] += glitch;
+        p.classes[static_cast<size_t>(EdgeClass::SLOW)] += slow;
+        p.classes[static_cast<size_t>(EdgeClass::TIMEOUT)] += timeout;
+        p.classes[static_cast<size_t>(EdgeClass::NOISE_REJECTED)] += noise;
+        p.min = std::min(p.min, lo);
+        p.max = std::max(p.max, hi);
+        if (in_range > 0) {
+            const double n_b = in_range;
+            const double mean_b = static_cast<double>(sum) / n_b;
+            const double m2_b = std::max(0.0, static_cast<double>(sum_sq) - static_cast<double>(sum) * mean_b);
+            p.merge(in_range, mean_b, m2_b);
+        }
+    }
+
+    // the same block into the histogram, everything not IN_RANGE lands in bucket 0 which is discarded.
+    void block_histogram(const uint32_t *delta, const uint8_t *status, size_t begin, size_t end, uint32_t min_us,
+        uint32_t max_us, uint64_t *histogram)
+    {
+        for (size_t i = begin; i < end; i++) {
+            const uint32_t d = delta[i];
+            const bool ok = status[i] == HEALTHY && d > min_us && d < max_us;
+            histogram[ok ? d : 0]++;
+        }
+    }
+
+    // nearest rank, 1 based.
+    uint64_t rank(double q, uint64_t n)
+    {
+        return std::max<uint64_t>(1, std::min<uint64_t>(n, static_cast<uint64_t>(std::ceil(q * static_cast<double>(n)))));
+    }
+}
+
+void EdgeAnalyzer::Columns::push(uint32_t t, uint32_t d, uint8_t s)
+{
+    if (s == UNEXPECTED) {
+        unexpected++;
+        return;
+    }
+    tick.push_back(t);
+    delta_us.push_back(d);
+    status.push_back(s);
+}
+
+CallbackReturn EdgeAnalyzer::on_configure(const EdgeAnalysisConfig &config)
+{
+    if (config.ppr < 1 || config.min_delta_us >= config.max_delta_us || config.max_delta_us > MAX_DELTA_LIMIT_US) {
+        std::cout << "ERROR: edge analysis needs ppr of at least 1 and min_delta_us < max_delta_us <= "
+                  << MAX_DELTA_LIMIT_US << "\n";
+        return CallbackReturn::FAILURE;
+    }
+    config_ = config;
+    threads_ = config.threads > 0 ? config.threads : std::max(1u, std::thread::hardware_concurrency());
+    return CallbackReturn::SUCCESS;
+}
+
+CallbackReturn EdgeAnalyzer::analyze(const EdgeCapture &capture, EdgeAnalysis &out)
+{
+    if (capture.format() == CaptureFormat::NONE) {
+        std::cout << "ERROR: no capture is mapped\n";
+        return CallbackReturn::FAILURE;
+    }
+    out = EdgeAnalysis {};
+    out.threads = threads_;
+    for (int gpio = 0; gpio <= MAX_PIN; gpio++) {
+        columns_[gpio] = Columns {};
+        velocity_[gpio].clear();
+        velocity_ticks_[gpio].clear();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    load(capture, out);
+    out.load_ms = elapsed_ms(start);
+
+    start = std::chrono::steady_clock::now();
+    for (int gpio = 0; gpio <= MAX_PIN; gpio++) {
+        if (columns_[gpio].size() == 0 && columns_[gpio].unexpected == 0) {
+            continue;
+        }
+        PinAnalysis pin;
+        analyze_pin(gpio, pin);
+        out.pins.push_back(pin);
+    }
+    out.kernel_ms = elapsed_ms(start);
+    return CallbackReturn::SUCCESS;
+}
+
+void EdgeAnalyzer::load(const EdgeCapture &capture, EdgeAnalysis &out)
+{
+    if (capture.format() == CaptureFormat::BINARY) {
+        load_records(capture, out);
+        return;
+    }
+
+    std::vector<Worker> workers(threads_);
+    // CSV lines vary in length, so each worker parses its share into its own columns and they are joined after.
+    const char *data = capture.data();
+    const size_t size = capture.size();
+    // a line belongs to the worker its first byte falls to.
+    parallel_for(threads_, size, [&](unsigned w, size_t begin, size_t end) {
+        Worker &worker = workers[w];
+        size_t p = line_start(data, size, begin);
+        const size_t last = line_start(data, size, end);
+        while (p < last) {
+            const void *nl = std::memchr(data + p, '\n', size - p);
+            const size_t eol = nl == nullptr ? size : static_cast<size_t>(static_cast<const char *>(nl) - data);
+            EdgeCaptureRecord r {};
+            if (parse_edge(data + p, data + eol, r)) {
+                worker.add(r);
+            }
+            else if (eol > p) {
+                worker.skipped++;
+            }
+            p = eol + 1;
+        }
+    });
+
+    for (const Worker &worker : workers) {
+        out.records += worker.records;
+        out.skipped_lines += worker.skipped;
+    }
+
+    // join each pin's columns in file order, workers hold consecutive parts of the file.
+    parallel_for(threads_, MAX_PIN + 1, [&](unsigned, size_t begin, size_t end) {
+        for (size_t gpio = begin; gpio < end; gpio++) {
+            Columns &joined = columns_[gpio];
+            size_t total = 0;
+            for (const Worker &worker : workers) {
+                total += worker.columns[gpio].size();
+                joined.unexpected += worker.columns[gpio].unexpected;
+            }
+            joined.tick.reserve(total);
+            joined.delta_us.reserve(total);
+            joined.status.reserve(total);
+            for (Worker &worker : workers) {
+                Columns &part = worker.columns[gpio];
+                joined.tick.insert(joined.tick.end(), part.tick.begin(), part.tick.end());
+                joined.delta_us.insert(joined.delta_us.end(), part.delta_us.begin(), part.delta_us.end());
+                joined.status.insert(joined.status.end(), part.status.begin(), part.status.end());
+                part = Columns {};
+            }
+        }
+    });
+}
+
+void EdgeAnalyzer::load_records(const EdgeCapture &capture, EdgeAnalysis &out)
+{
+    // records are a fixed size, so each worker counts its share per pin, then writes it straight to its place in
+    // the joined columns. The second pass splits the records exactly as the first did.
+    const EdgeCaptureRecord *records = capture.records();
+    const size_t n = capture.record_ct();
+    std::vector<std::array<size_t, MAX_PIN + 1>> kept(threads_);
+    std::vector<std::array<uint64_t, MAX_PIN + 1>> unexpected(threads_);
+    std::vector<uint64_t> skipped(threads_);
+    parallel_for(threads_, n, [&](unsigned w, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const EdgeCaptureRecord &r = records[i];
+            if (r.gpio > MAX_PIN || r.status > UNEXPECTED) {
+                skipped[w]++;
+            }
+            else if (r.status == UNEXPECTED) {
+                unexpected[w][r.gpio]++;
+            }
+            else {
+                kept[w][r.gpio]++;
+            }
+        }
+    });
+
+    std::vector<std::array<size_t, MAX_PIN + 1>> offset(threads_);
+    for (int gpio = 0; gpio <= MAX_PIN; gpio++) {
+        size_t total = 0;
+        for (unsigned w = 0; w < threads_; w++) {
+            offset[w][gpio] = total;
+            total += kept[w][gpio];
+            columns_[gpio].unexpected += unexpected[w][gpio];
+        }
+        columns_[gpio].tick.resize(total);
+        columns_[gpio].delta_us.resize(total);
+        columns_[gpio].status.resize(total);
+    }
+    for (unsigned w = 0; w < threads_; w++) {
+        out.skipped_lines += skipped[w];
+    }
+    out.records = n - out.skipped_lines;
+
+    parallel_for(threads_, n, [&](unsigned w, size_t begin, size_t end) {
+        std::array<size_t, MAX_PIN + 1> &at = offset[w];
+        for (size_t i = begin; i < end; i++) {
+            const EdgeCaptureRecord &r = records[i];
+            if (r.gpio > MAX_PIN || r.status >= UNEXPECTED) {
+                continue;
+            }
+            Columns &c = columns_[r.gpio];
+            const size_t k = at[r.gpio]++;
+            c.tick[k] = r.tick;
+            c.delta_us[k] = r.delta_us;
+            c.status[k] = r.status;
+        }
+    });
+}
+
+void EdgeAnalyzer::analyze_pin(int gpio, PinAnalysis &pin)
+{
+    const Columns &c = columns_[gpio];
+    const size_t n = c.size();
+    const uint32_t *delta = c.delta_us.data();
+    const uint8_t *status = c.status.data();
+    const uint32_t min_us = config_.min_delta_us;
+    const uint32_t max_us = config_.max_delta_us;
+
+    pin.gpio = gpio;
+    pin.edges = n + c.unexpected;
+    pin.first_tick = n > 0 ? c.tick.front() : 0;
+    pin.last_tick = n > 0 ? c.tick.back() : 0;
+    pin.classes[static_cast<size_t>(EdgeClass::UNEXPECTED)] = c.unexpected;
+
+    // classes, moments and histogram.
+    std::vector<Partial> partials(threads_);
+    parallel_for(threads_, n, [&](unsigned w, size_t begin, size_t end) {
+        Partial &p = partials[w];
+        p.histogram.assign(max_us, 0);
+        for (size_t b = begin; b < end; b += BLOCK) {
+            const size_t e = std::min(end, b + BLOCK);
+            block_moments(delta, status, b, e, min_us, max_us, p);
+            block_histogram(delta, status, b, e, min_us, max_us, p.histogram.data());
+        }
+    });
+
+    Partial total;
+    total.histogram.assign(max_us, 0);
+    for (Partial &p : partials) {
+        for (size_t i = 0; i < total.classes.size(); i++) {
+            total.classes[i] += p.classes[i];
+        }
+        total.merge(p.n, p.mean, p.m2);
+        total.min = std::min(total.min, p.min);
+        total.max = std::max(total.max, p.max);
+        for (size_t i = 1; i < p.histogram.size(); i++) {
+            total.histogram[i] += p.histogram[i];
+        }
+    }
+    for (size_t i = 0; i < static_cast<size_t>(EdgeClass::UNEXPECTED); i++) {
+        pin.classes[i] = total.classes[i];
+    }
+
+    IntervalStats &interval = pin.interval;
+    interval.count = total.n;
+    if (total.n > 0) {
+        interval.mean_us = total.mean;
+        interval.stddev_us = total.n > 1 ? std::sqrt(total.m2 / static_cast<double>(total.n - 1)) : 0.0;
+        interval.min_us = total.min;
+        interval.max_us = total.max;
+        // percentiles ascend, so one walk of the histogram finds them all.
+        uint64_t seen = 0;
+        size_t q = 0;
+        for (uint32_t us = 1; us < max_us && q < EDGE_PERCENTILES.size(); us++) {
+            seen += total.histogram[us];
+            while (q < EDGE_PERCENTILES.size() && seen >= rank(EDGE_PERCENTILES[q], total.n)) {
+                interval.percentile_us[q++] = us;
+            }
+        }
+    }
+
+    // velocity, one sample per window of ppr edges as MotorController closes them.
+    const size_t ppr = static_cast<size_t>(config_.ppr);
+    const size_t windows = n / ppr;
+    struct VelocityPart {
+        std::vector<float> rps;
+        std::vector<uint32_t> tick;
+        uint64_t empty = 0;
+    };
+    std::vector<VelocityPart> parts(threads_);
+    parallel_for(threads_, windows, [&](unsigned w, size_t begin, size_t end) {
+        VelocityPart &part = parts[w];
+        part.rps.reserve(end - begin);
+        part.tick.reserve(end - begin);
+        for (size_t win = begin; win < end; win++) {
+            const size_t first = win * ppr;
+            uint64_t accum = 0;
+            uint32_t ct = 0;
+            for (size_t i = first; i < first + ppr; i++) {
+                const uint32_t d = delta[i];
+                const uint32_t ok = (status[i] == HEALTHY) & (d > min_us) & (d < max_us);
+                accum += d & (0u - ok);
+                ct += ok;
+            }
+            if (ct == 0) {
+                part.empty++;
+                continue;
+            }
+            // ct of ppr periods took accum us, as VELOCITY_SCALE[ct] / accum.
+            part.rps.push_back(static_cast<float>(ct * 1.0e6 / (static_cast<double>(ppr) * static_cast<double>(accum))));
+            part.tick.push_back(c.tick[first + ppr - 1]);
+        }
+    });
+
+    std::vector<float> &rps = velocity_[gpio];
+    std::vector<uint32_t> &ticks = velocity_ticks_[gpio];
+    VelocityStats &velocity = pin.velocity;
+    for (const VelocityPart &part : parts) {
+        rps.insert(rps.end(), part.rps.begin(), part.rps.end());
+        ticks.insert(ticks.end(), part.tick.begin(), part.tick.end());
+        velocity.empty_windows += part.empty;
+    }
+    velocity.windows = rps.size();
+    if (rps.empty()) {
+        return;
+    }
+
+    double mean = 0.0;
+    double m2 = 0.0;
+    uint64_t ct = 0;
+    for (float v : rps) {
+        ct++;
+        const double delta_v = v - mean;
+        mean += delta_v / static_cast<double>(ct);
+        m2 += delta_v * (v - mean);
+    }
+    velocity.mean_rps = mean;
+    velocity.stddev_rps = ct > 1 ? std::sqrt(m2 / static_cast<double>(ct - 1)) : 0.0;
+
+    // ascending ranks, each nth_element only searches what is left above the last.
+    std::vector<float> sorted(rps);
+    auto from = sorted.begin();
+    for (size_t q = 0; q < EDGE_PERCENTILES.size(); q++) {
+        auto nth = sorted.begin() + static_cast<std::ptrdiff_t>(rank(EDGE_PERCENTILES[q], sorted.size()) - 1);
+        std::nth_element(from, nth, sorted.end());
+        velocity.percentile_rps[q] = *nth;
+        from = nth;
+    }
+    velocity.min_rps = *std::min_element(sorted.begin(), sorted.end());
+    velocity.max_rps = velocity.percentile_rps.back();
+}
+
+const std::vector<float> &EdgeAnalyzer::velocity(int gpio) const
+{
+    static const std::vector<float> none;
+    return gpio >= 0 && gpio <= MAX_PIN ? velocity_[gpio] : none;
+}
+
+const std::vector<uint32_t> &EdgeAnalyzer::velocity_ticks(int gpio) const
+{
+    static const std::vector<uint32_t> none;
+    return gpio >= 0 && gpio <= MAX_PIN ? velocity_ticks_[gpio] : none;
+}
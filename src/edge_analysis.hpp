@@ -0,0 +1,129 @@
+/**
+ * Offline analysis of encoder edge captures, see edge_capture.hpp and edge_analyzer.cpp.
+ *
+ * Per pin it reports what PulseStats does live, but exactly and over the whole capture:
+ *
+ * - every edge classified the way MotorController::encoder_cb_ treats it, healthy intervals inside
+ *   (min_delta_us, max_delta_us) are IN_RANGE, healthy ones at or below it GLITCH and at or above it SLOW,
+ * - mean, standard deviation, min, max and exact percentiles of the IN_RANGE intervals,
+ * - velocity reconstructed as the controller does, one sample per window of ppr edges from the IN_RANGE
+ *   intervals in it, with the same statistics over the samples.
+ *
+ * analyze() runs in two passes over threads workers:
+ *
+ *   load     each worker parses its share of the file into columns per pin, whole lines of a CSV into its own
+ *            columns that are joined in file order after. Binary records are counted per pin and worker first,
+ *            then each worker writes its records straight into its place in the joined columns.
+ *   kernels  each pin's columns are split across the workers. Classification and moments run over blocks of
+ *            BLOCK edges as branch free loops the compiler vectorizes, then the same block goes into a
+ *            histogram of IN_RANGE intervals that gives exact percentiles without sorting. Block moments are
+ *            merged with Chan's update, as PulseStats does per edge with Welford's.
+ *
+ * UNEXPECTED edges are counted but not kept, the controller stops at them and they do not close a window.
+ */
+
+#pragma once
+
+#include "edge_capture.hpp"
+#include <array>
+#include <cstdint>
+#include <vector>
+
+enum class EdgeClass : uint8_t {
+    IN_RANGE = 0,
+    GLITCH = 1,            // healthy, at or below min_delta_us
+    SLOW = 2,              // healthy, at or above max_delta_us, the wheel is stopping or stopped
+    TIMEOUT = 3,
+    NOISE_REJECTED = 4,
+    UNEXPECTED = 5,
+    COUNT = 6,
+};
+
+// reported for intervals and velocity.
+static constexpr std::array<double, 6> EDGE_PERCENTILES {0.5, 0.9, 0.99, 0.999, 0.9999, 1.0};
+
+struct EdgeAnalysisConfig {
+    unsigned threads = 0;         // 0 uses every core
+    int ppr = 8;                  // MotorController::PPR_
+    uint32_t min_delta_us = 300;  // MotorController::MIN_DELTA_US
+    uint32_t max_delta_us = 3000; // MotorController::MAX_DELTA_US
+};
+
+struct IntervalStats {
+    uint64_t count = 0;
+    double mean_us = 0.0;
+    double stddev_us = 0.0;
+    uint32_t min_us = 0;
+    uint32_t max_us = 0;
+    std::array<uint32_t, EDGE_PERCENTILES.size()> percentile_us {};
+};
+
+struct VelocityStats {
+    uint64_t windows = 0;         // with at least one IN_RANGE interval
+    uint64_t empty_windows = 0;   // without, the controller takes no sample
+    double mean_rps = 0.0;
+    double stddev_rps = 0.0;
+    double min_rps = 0.0;
+    double max_rps = 0.0;
+    std::array<double, EDGE_PERCENTILES.size()> percentile_rps {};
+};
+
+struct PinAnalysis {
+    int gpio = -1;
+    uint64_t edges = 0;
+    uint32_t first_tick = 0;
+    uint32_t last_tick = 0;
+    std::array<uint64_t, static_cast<size_t>(EdgeClass::COUNT)> classes {};
+    IntervalStats interval;
+    VelocityStats velocity;
+};
+
+struct EdgeAnalysis {
+    uint64_t records = 0;
+    uint64_t skipped_lines = 0;   // CSV lines that are not edges, binary records with a bad pin or status
+    unsigned threads = 0;
+    double load_ms = 0.0;
+    double kernel_ms = 0.0;
+    std::vector<PinAnalysis> pins;  // in pin order
+};
+
+class EdgeAnalyzer {
+  public:
+    // edges per block, the moments of a block are summed exactly in 64 bits.
+    static constexpr size_t BLOCK = 4096;
+    // the histogram has one counter per microsecond up to max_delta_us, per worker.
+    static constexpr uint32_t MAX_DELTA_LIMIT_US = 1u << 20;
+    static constexpr int MAX_PIN = 63;
+
+    CallbackReturn on_configure(const EdgeAnalysisConfig &config);
+
+    /**
+     * Analyze a mapped capture. Columns and velocity samples are kept until the next call.
+     */
+    CallbackReturn analyze(const EdgeCapture &capture, EdgeAnalysis &out);
+
+    // velocity samples of the last analyze() for gpio, rotations/s, and the tick of the edge closing each window.
+    const std::vector<float> &velocity(int gpio) const;
+    const std::vector<uint32_t> &velocity_ticks(int gpio) const;
+
+    struct Columns {
+        std::vector<uint32_t> tick;
+        std::vector<uint32_t> delta_us;
+        std::vector<uint8_t> status;
+        uint64_t unexpected = 0;
+
+        size_t size() const { return tick.size(); }
+        void push(uint32_t t, uint32_t d, uint8_t s);
+    };
+
+  private:
+    void load(const EdgeCapture &capture, EdgeAnalysis &out);
+    void load_records(const EdgeCapture &capture, EdgeAnalysis &out);
+    void analyze_pin(int gpio, PinAnalysis &pin);
+
+    EdgeAnalysisConfig config_ {};
+    unsigned threads_ = 1;
+    std::array<Columns, MAX_PIN + 1> columns_ {};
+    std::array<std::vector<float>, MAX_PIN + 1> velocity_ {};
+    std::array<std::vector<uint32_t>, MAX_PIN + 1> velocity_ticks_ {};
+};
@@ -0,0 +1,153 @@
+/**
+ * Offline analyzer for encoder edge captures, see edge_analysis.hpp.
+ *
+ * Reads CSV printed by tst_motor_enc, or binary captures written with tst_motor_enc --capture, and prints per
+ * pin how edges were classified, interval and velocity statistics with percentile tables, and how long the load
+ * and the kernels took. Does not touch hardware, and runs on any Linux machine.
+ *
+ * usage: edge_analyzer [--threads N] [--ppr N] [--min-us N] [--max-us N] [--velocity CSV] CAPTURE...
+ *
+ *   --velocity  write the reconstructed velocity of every pin as GPIO,TICK_US,RPS, of the last capture given.
+ */
+
+#include "edge_analysis.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+static const char *CLASS_NAMES[] = {"in range", "glitch", "slow", "timeout", "noise", "unexpected"};
+
+static void usage()
+{
+    std::cout << "usage: edge_analyzer [--threads N] [--ppr N] [--min-us N] [--max-us N] [--velocity CSV] CAPTURE...\n";
+}
+
+static const char *PERCENTILE_NAMES[] = {"p50", "p90", "p99", "p99.9", "p99.99", "max"};
+static_assert(sizeof(PERCENTILE_NAMES) / sizeof(PERCENTILE_NAMES[0]) == EDGE_PERCENTILES.size(), "a name per percentile");
+
+static void print_percentile_header()
+{
+    for (const char *name : PERCENTILE_NAMES) {
+        std::cout << std::setw(10) << name;
+    }
+    std::cout << "\n";
+}
+
+static void print(const std::string &path, const EdgeCapture &capture, const EdgeAnalysis &analysis)
+{
+    const double mb = capture.size() / 1.0e6;
+    const double total_ms = analysis.load_ms + analysis.kernel_ms;
+    std::cout << path << ", " << (capture.format() == CaptureFormat::BINARY ? "binary" : "csv") << ", "
+              << std::fixed << std::setprecision(1) << mb << "MB, " << analysis.records << " edges, "
+              << analysis.skipped_lines << " skipped\n"
+              << "  " << analysis.threads << " threads, load " << analysis.load_ms << "ms, kernels "
+              << analysis.kernel_ms << "ms, " << (total_ms > 0.0 ? mb * 1000.0 / total_ms : 0.0) << "MB/s\n";
+
+    for (const PinAnalysis &pin : analysis.pins) {
+        std::cout << "GPIO " << pin.gpio << ", " << pin.edges << " edges over "
+                  << std::setprecision(3) << (pin.last_tick - pin.first_tick) / 1.0e6 << "s\n  ";
+        for (size_t c = 0; c < pin.classes.size(); c++) {
+            std::cout << CLASS_NAMES[c] << " " << pin.classes[c] << (c + 1 < pin.classes.size() ? ", " : "\n");
+        }
+
+        const IntervalStats &interval = pin.interval;
+        std::cout << std::setprecision(1) << "  interval us  mean " << interval.mean_us << " stddev "
+                  << interval.stddev_us << " min " << interval.min_us << " max " << interval.max_us << "\n"
+                  << "            ";
+        print_percentile_header();
+        std::cout << "            ";
+        for (uint32_t us : interval.percentile_us) {
+            std::cout << std::setw(10) << us;
+        }
+        std::cout << "\n";
+
+        const VelocityStats &velocity = pin.velocity;
+        std::cout << std::setprecision(3) << "  velocity rps  " << velocity.windows << " windows, "
+                  << velocity.empty_windows << " empty, mean " << velocity.mean_rps << " stddev "
+                  << velocity.stddev_rps << " min " << velocity.min_rps << " max " << velocity.max_rps << "\n"
+                  << "            ";
+        print_percentile_header();
+        std::cout << "            ";
+        for (double rps : velocity.percentile_rps) {
+            std::cout << std::setw(10) << rps;
+        }
+        std::cout << "\n";
+    }
+}
+
+static bool write_velocity(const std::string &path, const EdgeAnalyzer &analyzer, const EdgeAnalysis &analysis)
+{
+    std::ofstream out(path);
+    if (!out) {
+        std::cout << "ERROR: unable to create " << path << "\n";
+        return false;
+    }
+    out << "GPIO,TICK_US,RPS\n";
+    for (const PinAnalysis &pin : analysis.pins) {
+        const std::vector<float> &rps = analyzer.velocity(pin.gpio);
+        const std::vector<uint32_t> &ticks = analyzer.velocity_ticks(pin.gpio);
+        for (size_t i = 0; i < rps.size(); i++) {
+            out << pin.gpio << "," << ticks[i] << "," << rps[i] << "\n";
+        }
+    }
+    return static_cast<bool>(out);
+}
+
+int main(int argc, char *argv[])
+{
+    EdgeAnalysisConfig config;
+    std::string velocity_path;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            config.threads = static_cast<unsigned>(std::atoi(argv[++i]));
+        }
+        else if (std::strcmp(argv[i], "--ppr") == 0 && i + 1 < argc) {
+            config.ppr = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--min-us") == 0 && i + 1 < argc) {
+            config.min_delta_us = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (std::strcmp(argv[i], "--max-us") == 0 && i + 1 < argc) {
+            config.max_delta_us = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (std::strcmp(argv[i], "--velocity") == 0 && i + 1 < argc) {
+            velocity_path = argv[++i];
+        }
+        else if (argv[i][0] != '-') {
+            paths.push_back(argv[i]);
+        }
+        else {
+            usage();
+            return 1;
+        }
+    }
+    if (paths.empty()) {
+        usage();
+        return 1;
+    }
+
+    EdgeAnalyzer analyzer;
+    if (analyzer.on_configure(config) == CallbackReturn::FAILURE) {
+        return 1;
+    }
+
+    int rc = 0;
+    EdgeAnalysis analysis;
+    for (const std::string &path : paths) {
+        EdgeCapture capture;
+        if (capture.on_activate(path) == CallbackReturn::FAILURE
+            || analyzer.analyze(capture, analysis) == CallbackReturn::FAILURE) {
+            rc = 1;
+            continue;
+        }
+        print(path, capture, analysis);
+    }
+    if (!velocity_path.empty() && rc == 0 && !write_velocity(velocity_path, analyzer, analysis)) {
+        rc = 1;
+    }
+    return rc;
+}
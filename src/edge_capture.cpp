@@ -0,0 +1,142 @@
+#include "edge_capture.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+EdgeCapture::~EdgeCapture()
+{
+    on_deactivate();
+}
+
+CallbackReturn EdgeCapture::on_activate(const std::string &path)
+{
+    on_deactivate();
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cout << "ERROR: unable to open capture " << path << "\n";
+        return CallbackReturn::FAILURE;
+    }
+
+    struct stat st {};
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        std::cout << "ERROR: capture " << path << " is empty\n";
+        return CallbackReturn::FAILURE;
+    }
+
+    size_ = static_cast<size_t>(st.st_size);
+    void *base = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        std::cout << "ERROR: unable to map capture " << path << "\n";
+        size_ = 0;
+        return CallbackReturn::FAILURE;
+    }
+    base_ = base;
+    // each analyzer thread reads its part of the file front to back once.
+    madvise(base_, size_, MADV_SEQUENTIAL);
+
+    uint32_t magic = 0;
+    if (size_ >= sizeof(magic)) {
+        std::memcpy(&magic, base_, sizeof(magic));
+    }
+    if (magic != EDGE_CAPTURE_MAGIC) {
+        format_ = CaptureFormat::CSV;
+        return CallbackReturn::SUCCESS;
+    }
+
+    EdgeCaptureHeader header {};
+    if (size_ < sizeof(header)) {
+        std::cout << "ERROR: capture " << path << " has a truncated header\n";
+        on_deactivate();
+        return CallbackReturn::FAILURE;
+    }
+    std::memcpy(&header, base_, sizeof(header));
+    if (header.version != EDGE_CAPTURE_VERSION || header.record_size != sizeof(EdgeCaptureRecord)) {
+        std::cout << "ERROR: capture " << path << " has an incompatible layout\n";
+        on_deactivate();
+        return CallbackReturn::FAILURE;
+    }
+
+    // a capture cut short still reads up to its last whole record.
+    const uint64_t whole = (size_ - sizeof(header)) / sizeof(EdgeCaptureRecord);
+    record_ct_ = header.record_ct == 0 ? whole : std::min(header.record_ct, whole);
+    // the mapping is page aligned, and the header a multiple of the record alignment.
+    records_ = reinterpret_cast<const EdgeCaptureRecord *>(static_cast<const char *>(base_) + sizeof(header));
+    format_ = CaptureFormat::BINARY;
+    return CallbackReturn::SUCCESS;
+}
+
+CallbackReturn EdgeCapture::on_deactivate()
+{
+    if (base_ != nullptr) {
+        munmap(base_, size_);
+    }
+    base_ = nullptr;
+    size_ = 0;
+    format_ = CaptureFormat::NONE;
+    records_ = nullptr;
+    record_ct_ = 0;
+    return CallbackReturn::SUCCESS;
+}
+
+EdgeCaptureWriter::~EdgeCaptureWriter()
+{
+    on_deactivate();
+}
+
+CallbackReturn EdgeCaptureWriter::on_activate(const std::string &path)
+{
+    on_deactivate();
+
+    file_ = std::fopen(path.c_str(), "wb");
+    if (file_ == nullptr) {
+        std::cout << "ERROR: unable to create capture " << path << "\n";
+        return CallbackReturn::FAILURE;
+    }
+    record_ct_ = 0;
+
+    // the count stays 0 until on_deactivate(), so a capture that is never closed is read by its size.
+    EdgeCaptureHeader header {EDGE_CAPTURE_MAGIC, EDGE_CAPTURE_VERSION, sizeof(EdgeCaptureRecord), 0};
+    if (std::fwrite(&header, sizeof(header), 1, file_) != 1) {
+        std::cout << "ERROR: unable to write capture " << path << "\n";
+        std::fclose(file_);
+        file_ = nullptr;
+        return CallbackReturn::FAILURE;
+    }
+    return CallbackReturn::SUCCESS;
+}
+
+CallbackReturn EdgeCaptureWriter::write(const EdgeCaptureRecord &record)
+{
+    if (file_ == nullptr || std::fwrite(&record, sizeof(record), 1, file_) != 1) {
+        return CallbackReturn::FAILURE;
+    }
+    record_ct_++;
+    return CallbackReturn::SUCCESS;
+}
+
+CallbackReturn EdgeCaptureWriter::on_deactivate()
+{
+    if (file_ == nullptr) {
+        return CallbackReturn::SUCCESS;
+    }
+
+    CallbackReturn result = CallbackReturn::SUCCESS;
+    if (std::fseek(file_, offsetof(EdgeCaptureHeader, record_ct), SEEK_SET) != 0
+        || std::fwrite(&record_ct_, sizeof(record_ct_), 1, file_) != 1) {
+        std::cout << "ERROR: unable to finish capture header\n";
+        result = CallbackReturn::FAILURE;
+    }
+    if (std::fclose(file_) != 0) {
+        std::cout << "ERROR: unable to close capture\n";
+        result = CallbackReturn::FAILURE;
+    }
+    file_ = nullptr;
+    return result;
+}
@@ -0,0 +1,108 @@
+/**
+ * Encoder edge captures, written by tst_motor_enc and read back for offline analysis, see edge_analysis.hpp.
+ *
+ * Two formats are read, told apart by the first four bytes:
+ *
+ *   CSV     what tst_motor_enc prints, GPIO,DELTA_US,TICK_US,STATUS. Lines that do not parse, the header and
+ *           any messages around the table, are skipped and counted.
+ *   binary  an EdgeCaptureHeader followed by EdgeCaptureRecords, written by EdgeCaptureWriter. About half the
+ *           size of the CSV and nothing to parse, the analyzer reads records straight out of the mapping.
+ *
+ * EdgeCapture maps the whole file read only, so a multi-GB capture costs address space rather than memory and
+ * pages are read in by the kernel as the analyzer's threads reach them.
+ */
+
+#pragma once
+
+#include "tst_common.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+static constexpr uint32_t EDGE_CAPTURE_MAGIC = 0x43455252; // "RREC"
+static constexpr uint16_t EDGE_CAPTURE_VERSION = 1;
+
+struct EdgeCaptureHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;  // sizeof(EdgeCaptureRecord)
+    uint64_t record_ct;    // 0 if the writer did not finish, readers then use the file size
+};
+
+struct EdgeCaptureRecord {
+    uint32_t tick;         // gpioTick() of the edge
+    uint32_t delta_us;     // as passed to the encoder callback
+    uint8_t gpio;
+    uint8_t status;        // TickStatus
+    uint16_t reserved;
+};
+
+static_assert(sizeof(EdgeCaptureHeader) == 16, "capture header layout is part of the file format");
+static_assert(sizeof(EdgeCaptureRecord) == 12, "capture record layout is part of the file format");
+
+enum class CaptureFormat : uint8_t {
+    NONE = 0,
+    CSV = 1,
+    BINARY = 2,
+};
+
+/**
+ * Read only mapping of a capture file.
+ */
+class EdgeCapture {
+  public:
+    EdgeCapture() = default;
+    ~EdgeCapture();
+
+    EdgeCapture(const EdgeCapture &) = delete;
+    EdgeCapture &operator=(const EdgeCapture &) = delete;
+
+    /**
+     * Map path and detect its format. A binary capture must have a compatible header.
+     */
+    CallbackReturn on_activate(const std::string &path);
+
+    CallbackReturn on_deactivate();
+
+    CaptureFormat format() const { return format_; }
+
+    // the whole file, for CSV.
+    const char *data() const { return static_cast<const char *>(base_); }
+    size_t size() const { return size_; }
+
+    // binary only, whole records after the header.
+    const EdgeCaptureRecord *records() const { return records_; }
+    uint64_t record_ct() const { return record_ct_; }
+
+  private:
+    void *base_ = nullptr;
+    size_t size_ = 0;
+    CaptureFormat format_ = CaptureFormat::NONE;
+    const EdgeCaptureRecord *records_ = nullptr;
+    uint64_t record_ct_ = 0;
+};
+
+/**
+ * Writes a binary capture. Buffered, write() must not be called from the encoder callback, collect edges there
+ * and write them once the encoder is deactivated, as tst_motor_enc does.
+ */
+class EdgeCaptureWriter {
+  public:
+    EdgeCaptureWriter() = default;
+    ~EdgeCaptureWriter();
+
+    EdgeCaptureWriter(const EdgeCaptureWriter &) = delete;
+    EdgeCaptureWriter &operator=(const EdgeCaptureWriter &) = delete;
+
+    // create or truncate path.
+    CallbackReturn on_activate(const std::string &path);
+
+    CallbackReturn write(const EdgeCaptureRecord &record);
+
+    // fills in the record count and closes the file.
+    CallbackReturn on_deactivate();
+
+  private:
+    FILE *file_ = nullptr;
+    uint64_t record_ct_ = 0;
+};
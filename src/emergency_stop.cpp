@@ -0,0 +1,125 @@
+#include "emergency_stop.hpp"
+#include "driver_log.hpp"
+#include <time.h>
+
+namespace {
+    uint64_t mono_ns()
+    {
+        struct timespec ts {};
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+    }
+}
+
+EmergencyStop &EmergencyStop::instance()
+{
+    static EmergencyStop stop;
+    return stop;
+}
+
+EmergencyStop::EmergencyStop()
+{
+    for (std::atomic<int> &pin : hardware_pins_) {
+        pin.store(-1, std::memory_order_relaxed);
+    }
+}
+
+bool EmergencyStop::add(unsigned pwm_pin, bool software)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (software) {
+        if (pwm_pin > 31) {
+            std::cout << "ERROR: software PWM pin " << pwm_pin << " is not in bank 0\n";
+            return false;
+        }
+        software_mask_.fetch_or(1u << pwm_pin, std::memory_order_release);
+        return true;
+    }
+    std::atomic<int> *free_slot = nullptr;
+    for (std::atomic<int> &slot : hardware_pins_) {
+        int pin = slot.load(std::memory_order_relaxed);
+        if (pin == static_cast<int>(pwm_pin)) {
+            return true;
+        }
+        if (pin < 0 && free_slot == nullptr) {
+            free_slot = &slot;
+        }
+    }
+    if (free_slot == nullptr) {
+        std::cout << "ERROR: more than " << MAX_MOTORS << " motors on the emergency stop\n";
+        return false;
+    }
+    free_slot->store(static_cast<int>(pwm_pin), std::memory_order_release);
+    return true;
+}
+
+void EmergencyStop::remove(unsigned pwm_pin)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (std::atomic<int> &slot : hardware_pins_) {
+        if (slot.load(std::memory_order_relaxed) == static_cast<int>(pwm_pin)) {
+            slot.store(-1, std::memory_order_release);
+        }
+    }
+    if (pwm_pin <= 31) {
+        software_mask_.fetch_and(~(1u << pwm_pin), std::memory_order_release);
+    }
+}
+
+bool EmergencyStop::trip(FaultCause cause, int pin, uint32_t tick)
+{
+    const uint64_t start = mono_ns();
+    if (tripped_.exchange(true, std::memory_order_acq_rel)) {
+        return false;
+    }
+
+    // PWM off first, everything else waits until the last write has returned.
+    unsigned writes = 0;
+    unsigned errors = 0;
+    for (const std::atomic<int> &slot : hardware_pins_) {
+        int pwm_pin = slot.load(std::memory_order_acquire);
+        if (pwm_pin < 0) {
+            continue;
+        }
+        writes++;
+        // a frequency of 0 switches the channel off.
+        errors += gpioHardwarePWM(static_cast<unsigned>(pwm_pin), 0, 0) != OK ? 1 : 0;
+    }
+    const uint32_t software = software_mask_.load(std::memory_order_acquire);
+    if (software != 0) {
+        // TxStop leaves the pins wherever the waveform was, so they are cleared after it.
+        writes += 2;
+        errors += gpioWaveTxStop() != OK ? 1 : 0;
+        errors += gpioWrite_Bits_0_31_Clear(software) != OK ? 1 : 0;
+    }
+    const uint64_t off_ns = mono_ns();
+    const uint32_t off_tick = gpioTick();
+
+    fault_.cause = cause;
+    fault_.pin = pin;
+    fault_.tick = tick;
+    fault_.writes = writes;
+    fault_.write_errors = errors;
+    fault_.latency_ns = off_ns - start;
+    fault_.fault_to_off_us = off_tick - tick;
+    recorded_.store(true, std::memory_order_release);
+
+    DriverLog::instance().log(LogCode::EMERGENCY_STOP, static_cast<unsigned>(pin), static_cast<int>(cause),
+        static_cast<int32_t>(fault_.fault_to_off_us));
+    return true;
+}
+
+FaultRecord EmergencyStop::fault() const
+{
+    if (!recorded_.load(std::memory_order_acquire)) {
+        return FaultRecord {};
+    }
+    return fault_;
+}
+
+void EmergencyStop::reset()
+{
+    recorded_.store(false, std::memory_order_relaxed);
+    fault_ = FaultRecord {};
+    tripped_.store(false, std::memory_order_release);
+}
@@ -0,0 +1,92 @@
+/**
+ * Process wide hard stop, cuts PWM on every registered motor from whichever thread sees the fault.
+ *
+ * Stopping used to take the main thread calling on_deactivate() on each controller, which stops the encoder
+ * first, logs, and sleeps. A TickStatus::UNEXPECTED edge or a motor whose hardware write failed had nothing to
+ * act on it. EmergencyStop::trip() is meant to be called straight from the encoder callback or control thread:
+ *
+ * - motors register their PWM output when activated, so everything trip() writes is worked out beforehand,
+ * - each hardware PWM channel is switched off with one gpioHardwarePWM() call, and every software PWM channel
+ *   together with one gpioWaveTxStop() and one bank clear, see wave_pwm.hpp. Direction pins are left alone,
+ * - nothing is logged, traced or allocated before the last write. The fault is then handed to DriverLog,
+ * - the first trip latches, later trips return at once. While latched Motor refuses any non zero duty and
+ *   WavePwm stops rebuilding, so nothing restarts a wheel until reset().
+ *
+ * fault() gives the cause, the pin and tick it was seen on, and the latency from trip() and from the fault's
+ * tick to the last PWM write returning.
+ */
+
+#pragma once
+
+#include "tst_common.hpp"
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+enum class FaultCause : uint8_t {
+    NONE = 0,
+    ENCODER_UNEXPECTED = 1, // encoder callback reported TickStatus::UNEXPECTED
+    DRIVE_FAULT = 2,        // Motor::update() entered DriveState::FAULT, a hardware write failed
+    REQUESTED = 3,          // tripped by the application
+};
+
+struct FaultRecord {
+    FaultCause cause = FaultCause::NONE;
+    int pin = -1;                  // pin the fault was seen on
+    uint32_t tick = 0;             // gpioTick() of the fault
+    unsigned writes = 0;           // hardware writes made to stop the motors
+    unsigned write_errors = 0;
+    uint64_t latency_ns = 0;       // trip() entry to the last PWM write returning
+    uint32_t fault_to_off_us = 0;  // tick to the last PWM write returning
+};
+
+class EmergencyStop {
+  public:
+    static constexpr size_t MAX_MOTORS = 16;
+
+    static EmergencyStop &instance();
+
+    /**
+     * Register a PWM output to cut on trip(), registering the same pin again does nothing. Software PWM pins
+     * must be in bank 0, see WavePwm.
+     *
+     * @return false if MAX_MOTORS hardware PWM pins are registered already.
+     */
+    bool add(unsigned pwm_pin, bool software);
+
+    void remove(unsigned pwm_pin);
+
+    /**
+     * Cut PWM on every registered motor and latch the fault. Never blocks on a lock, never allocates, safe from
+     * any thread including encoder callbacks.
+     *
+     * @return true if this call tripped, false if it was latched already.
+     */
+    bool trip(FaultCause cause, int pin, uint32_t tick);
+
+    bool tripped() const { return tripped_.load(std::memory_order_acquire); }
+
+    // the fault that tripped, cause NONE until trip() has finished.
+    FaultRecord fault() const;
+
+    /**
+     * Clear the latch. Deactivate every motor first, they must be activated again before they drive.
+     */
+    void reset();
+
+  private:
+    EmergencyStop();
+    EmergencyStop(const EmergencyStop &) = delete;
+    EmergencyStop &operator=(const EmergencyStop &) = delete;
+
+    // add() and remove() only, trip() reads the slots without it.
+    std::mutex mutex_;
+    std::array<std::atomic<int>, MAX_MOTORS> hardware_pins_; // -1 when free
+    std::atomic<uint32_t> software_mask_ {0};
+
+    std::atomic<bool> tripped_ {false};
+    std::atomic<bool> recorded_ {false}; // fault_ is complete
+    FaultRecord fault_;
+};
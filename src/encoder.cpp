@@ -1,15 +1,26 @@
 #include "encoder.hpp"
+#include "alloc_tracker.hpp"
+#include "fixed_point.hpp"
+#include "gpio_chardev.hpp"
+#include "rt_mode.hpp"
+#include "trace.hpp"
 
 CallbackReturn MotorEncoder::on_configure(uint pin, EncoderTickCallback tick_cb, int timeout, uint32_t min_interval_us) {
-    if (pin > 27) {
+    if (pin > GpioRuntime::MAX_GPIO) {
         // outside of GPIO range.
         return CallbackReturn::FAILURE;
     }
-    pin_ = pin;
     
     if (tick_cb == nullptr) {
         return CallbackReturn::FAILURE;
     }
+
+    // reconfiguring gives up the previous pin first.
+    on_cleanup();
+    if (GpioRuntime::instance().claim_pin(pin, this) != CallbackReturn::SUCCESS) {
+        return CallbackReturn::FAILURE;
+    }
+    pin_ = pin;
     tick_cb_ = tick_cb;
     timeout_ = timeout;
     min_interval_us_ = min_interval_us;
@@ -26,6 +37,17 @@ CallbackReturn MotorEncoder::on_activate() {
         return CallbackReturn::FAILURE;
     }
 
+    if (backend_ == EdgeBackend::CHARDEV) {
+        // the kernel configures the line as a pulled down input when it is requested.
+        stats_.reset();
+        last_tick_ = gpioTick();
+        if (GpioChardev::instance().add_line(pin_, timeout_, &MotorEncoder::gpio_isr_func, this) != CallbackReturn::SUCCESS) {
+            return CallbackReturn::FAILURE;
+        }
+        active_ = true;
+        return CallbackReturn::SUCCESS;
+    }
+
     // For production, this should use a switch which provides feedback.
     if (gpioSetMode(pin_, PI_INPUT) != 0) {
         return CallbackReturn::FAILURE;
@@ -36,6 +58,7 @@ CallbackReturn MotorEncoder::on_activate() {
         return CallbackReturn::FAILURE;
     }
 
+    stats_.reset();
     last_tick_ = gpioTick();
 
     switch (gpioSetISRFuncEx(
@@ -57,18 +80,55 @@ CallbackReturn MotorEncoder::on_activate() {
             return CallbackReturn::FAILURE;
     }
 
-
+    active_ = true;
     return CallbackReturn::SUCCESS;
 }
 
 CallbackReturn  MotorEncoder::on_deactivate() {
-    gpioSetISRFuncEx(pin_, expected_level_, 0, nullptr, nullptr);
+    if (backend_ == EdgeBackend::CHARDEV) {
+        if (active_) {
+            GpioChardev::instance().remove_line(pin_);
+        }
+    }
+    else {
+        gpioSetISRFuncEx(pin_, RISING_EDGE, 0, nullptr, nullptr);
+    }
+    active_ = false;
+    return CallbackReturn::SUCCESS;
+}
+
+CallbackReturn MotorEncoder::set_backend(EdgeBackend backend) {
+    if (active_) {
+        std::cout << "ERROR: encoder backend can only be changed while deactivated\n";
+        return CallbackReturn::FAILURE;
+    }
+    if (backend == EdgeBackend::CHARDEV && !GpioChardev::instance().configured()) {
+        std::cout << "ERROR: GPIO character device backend has no line source\n";
+        return CallbackReturn::FAILURE;
+    }
+    backend_ = backend;
     return CallbackReturn::SUCCESS;
 }
 
 
+CallbackReturn MotorEncoder::on_cleanup() {
+    GpioRuntime::instance().release_pins(this);
+    pin_ = -1;
+    return CallbackReturn::SUCCESS;
+}
+
+MotorEncoder::~MotorEncoder() {
+    GpioRuntime::instance().release_pins(this);
+}
+
+
 // Static wrapper - required for C function pointer compatibility
 void MotorEncoder::gpio_isr_func(int gpio, int level, uint32_t tick, void *userdata) {
+    // pigpio runs each ISR on its own thread, the chardev backend one thread for every pin. Either is pinned and
+    // prioritised the first time through when RtMode is on.
+    RtMode::instance().on_callback_thread();
+    AllocScopeGuard guard(AllocScope::ENCODER_CALLBACK);
+    TraceScope trace(TracePoint::ENCODER_EDGE, gpio, level);
     auto* self = static_cast<MotorEncoder*>(userdata);
     self->handle_interrupt(gpio, level, tick);
 }
@@ -81,13 +141,19 @@ void MotorEncoder::handle_interrupt(int gpio, int level, uint32_t tick) {
     */
 
     TickStatus status = TickStatus::HEALTHY;
-    if (level != expected_level_) {
+    if (level < PI_OFF || level > PI_TIMEOUT) {
+        // no backend reports anything else, the edge source can no longer be trusted.
+        status = TickStatus::UNEXPECTED;
+    }
+    else if (level != expected_level_) {
         status = TickStatus::NOISE_REJECTED;
         if (level == 2) {
             status = TickStatus::TIMEOUT;
         }
     }
-    int32_t delta_us = tick - last_tick_;
+    // unsigned, so an interval spanning the 32 bit tick wrap is still correct.
+    uint32_t delta_us = fixed::tick_elapsed(tick, last_tick_);
     last_tick_ = tick;
+    stats_.record(delta_us, status);
     tick_cb_(gpio, delta_us, tick, status);
 }
\ No newline at end of file
@@ -9,6 +9,9 @@
 #pragma once
 
 #include "tst_common.hpp"
+#include "board.hpp"
+#include "gpio_runtime.hpp"
+#include "pulse_stats.hpp"
 #include <functional>
 #include <cstdint>
 
@@ -22,6 +25,14 @@ enum class TickStatus : uint8_t {
     UNEXPECTED = 3,       // Condition occurred that was unexpected, this should be treated immeidate termination.
 };
 
+/**
+ * Where edges come from, see gpio_chardev.hpp.
+ */
+enum class EdgeBackend : uint8_t {
+    PIGPIO = 0,   // gpioSetISRFuncEx(), one pigpio thread per pin
+    CHARDEV = 1,  // GPIO character device, one epoll thread for every pin, GpioChardev must be configured
+};
+
 
 
 /**
@@ -56,24 +67,51 @@ using EncoderTickCallback = std::function<void(
 class MotorEncoder {
     public:
 
+    ~MotorEncoder();
+
     /**
      * set initial pin and creates the initial tick.
      * 
-     * @param pin, pin that will be used to detect phase.
+     * @param pin, pin that will be used to detect phase, it is claimed from GpioRuntime so
+     *        that a pin already used by another driver fails configuration.
      * @param 
      */
     CallbackReturn on_configure(uint pin, EncoderTickCallback tick_cb, int timeout, uint32_t min_interval_us);
 
+    // pin checked at compile time, see board.hpp.
+    template <unsigned N>
+    CallbackReturn on_configure(Enc<N>, EncoderTickCallback tick_cb, int timeout, uint32_t min_interval_us)
+    {
+        return on_configure(N, tick_cb, timeout, min_interval_us);
+    }
+
     /**
      * Activates callback algorithm. on_activate must check that tick_cb has been defined,
      * before it can be activate, if it has not or pin is not set then it return an error.
      */
     CallbackReturn on_activate();
 
+    /**
+     * select the edge backend, only while deactivated. Callbacks, stall timeouts and stats are the same for both.
+     */
+    CallbackReturn set_backend(EdgeBackend backend);
+
+    EdgeBackend backend() const { return backend_; }
+
     /**
      * resets encoder, so that robot can be cleanly shutdown.
      */
     CallbackReturn on_deactivate();
+
+    /**
+     * gives pin back to the runtime.
+     */
+    CallbackReturn on_cleanup();
+
+    /**
+     * delta_us distribution for this pin, reset on activation. Snapshots may be taken at any time.
+     */
+    const PulseStats &stats() const { return stats_; }
       
 
     private:
@@ -91,5 +129,11 @@ class MotorEncoder {
       EncoderTickCallback tick_cb_{nullptr};
       uint32_t min_interval_us_{0};
 
-      int expected_level_ = RISING_EDGE;
+      // level pigpio reports for a RISING_EDGE, 0 is a falling edge and 2 a timeout.
+      int expected_level_ = PI_ON;
+
+      EdgeBackend backend_ = EdgeBackend::PIGPIO;
+      bool active_ = false;
+
+      PulseStats stats_;
 };
\ No newline at end of file
@@ -0,0 +1,68 @@
+/**
+ * Integer arithmetic for the encoder callback path.
+ *
+ * The pigpio callback thread only ever adds, shifts and does one integer divide per PPR edges. Velocities are
+ * held as Q16.16 rotations/s and converted to double by the reader, see MotorController::velocity().
+ *
+ * - ticks are 32 bit microseconds that wrap every ~71 minutes, tick_elapsed() is correct across the wrap for
+ *   intervals under 2^32us,
+ * - velocity_scale<PPR>() is the reciprocal table that turns an accumulated period into a velocity, indexed by the
+ *   number of healthy periods in the accumulator, so neither the average period nor PPR has to be divided out.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace fixed {
+    using q16_t = int32_t;
+
+    constexpr int Q_BITS = 16;
+    constexpr q16_t Q_ONE = 1 << Q_BITS;
+
+    constexpr uint64_t US_PER_S = 1000000;
+
+    constexpr double to_double(q16_t v)
+    {
+        return static_cast<double>(v) / Q_ONE;
+    }
+
+    // v * 1000 rounded towards 0, for values logged as fixed point integers.
+    constexpr int32_t to_milli(q16_t v)
+    {
+        return static_cast<int32_t>((static_cast<int64_t>(v) * 1000) / Q_ONE);
+    }
+
+    // microseconds from earlier to now, correct across the 32 bit wrap.
+    constexpr uint32_t tick_elapsed(uint32_t now, uint32_t earlier)
+    {
+        return now - earlier;
+    }
+
+    /**
+     * scale[n] = (US_PER_S << Q_BITS) * n / PPR, so that with n healthy periods summing to accum_us
+     *
+     *   velocity (Q16.16 rotations/s) = scale[n] / accum_us
+     *
+     * which is 1e6 / (average period * PPR) without dividing by n or PPR on the callback thread.
+     */
+    template <int PPR>
+    constexpr std::array<uint64_t, PPR + 1> velocity_scale()
+    {
+        static_assert(PPR > 0, "PPR must be positive");
+        std::array<uint64_t, PPR + 1> scale {};
+        for (int n = 0; n <= PPR; n++) {
+            scale[n] = (US_PER_S << Q_BITS) * static_cast<uint64_t>(n) / static_cast<uint64_t>(PPR);
+        }
+        return scale;
+    }
+
+    // exponential moving average with alpha = ALPHA / 256, integer only.
+    template <int ALPHA>
+    constexpr q16_t ema(q16_t current, q16_t sample)
+    {
+        static_assert(ALPHA > 0 && ALPHA <= 256, "alpha is ALPHA / 256");
+        return current + static_cast<q16_t>((static_cast<int64_t>(sample - current) * ALPHA) >> 8);
+    }
+}
@@ -0,0 +1,345 @@
+#include "gpio_chardev.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/gpio.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace {
+    // epoll data for the wake eventfd, lines use their index.
+    constexpr uint32_t WAKE_ID = GpioChardev::MAX_LINES;
+
+    // kernel side queue per line, the default of 16 is a few ms of a fast encoder.
+    constexpr uint32_t KERNEL_EVENT_BUFFER = 256;
+
+    uint64_t mono_ns()
+    {
+        struct timespec ts {};
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+    }
+
+    uint64_t cpu_ns(clockid_t clock)
+    {
+        struct timespec ts {};
+        if (clock_gettime(clock, &ts) != 0) {
+            return 0;
+        }
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+    }
+
+    void close_fd(int &fd)
+    {
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+}
+
+ChipLineSource::~ChipLineSource()
+{
+    close_fd(chip_fd_);
+}
+
+CallbackReturn ChipLineSource::on_configure(const std::string &chip_path)
+{
+    close_fd(chip_fd_);
+    chip_fd_ = open(chip_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (chip_fd_ < 0) {
+        std::cout << "ERROR: unable to open " << chip_path << ": " << std::strerror(errno) << "\n";
+        return CallbackReturn::FAILURE;
+    }
+    return CallbackReturn::SUCCESS;
+}
+
+int ChipLineSource::open_line(unsigned pin)
+{
+    if (chip_fd_ < 0) {
+        return -EBADF;
+    }
+    struct gpio_v2_line_request req {};
+    req.offsets[0] = pin;
+    req.num_lines = 1;
+    // events are timestamped from CLOCK_MONOTONIC unless a clock flag says otherwise.
+    req.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN;
+    req.event_buffer_size = KERNEL_EVENT_BUFFER;
+    std::strncpy(req.consumer, "rr_pi4b_encoder", sizeof(req.consumer) - 1);
+    if (ioctl(chip_fd_, GPIO_V2_GET_LINE_IOCTL, &req) < 0) {
+        return -errno;
+    }
+    return req.fd;
+}
+
+GpioChardev &GpioChardev::instance()
+{
+    static GpioChardev chardev;
+    return chardev;
+}
+
+GpioChardev::~GpioChardev()
+{
+    stop();
+    for (Line &line : lines_) {
+        close_fd(line.fd);
+    }
+}
+
+CallbackReturn GpioChardev::on_configure(EdgeLineSource &source)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (line_ct_ > 0) {
+        std::cout << "ERROR: chardev lines must be removed before the source is changed\n";
+        return CallbackReturn::FAILURE;
+    }
+    source_ = &source;
+    return CallbackReturn::SUCCESS;
+}
+
+CallbackReturn GpioChardev::add_line(unsigned pin, int timeout_ms, gpioISRFuncEx_t f, void *userdata)
+{
+    if (f == nullptr) {
+        return CallbackReturn::FAILURE;
+    }
+    if (!configured()) {
+        std::cout << "ERROR: chardev backend has no line source\n";
+        return CallbackReturn::FAILURE;
+    }
+    if (start() != CallbackReturn::SUCCESS) {
+        return CallbackReturn::FAILURE;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t idx = MAX_LINES;
+    for (size_t i = 0; i < MAX_LINES; i++) {
+        if (lines_[i].active && lines_[i].pin == pin) {
+            std::cout << "ERROR: chardev line " << pin << " is already added\n";
+            return CallbackReturn::FAILURE;
+        }
+        if (!lines_[i].active && idx == MAX_LINES) {
+            idx = i;
+        }
+    }
+    if (idx == MAX_LINES) {
+        std::cout << "ERROR: more than " << MAX_LINES << " chardev lines\n";
+        return CallbackReturn::FAILURE;
+    }
+
+    int fd = source_->open_line(pin);
+    if (fd < 0) {
+        std::cout << "ERROR: unable to request line " << pin << ": " << std::strerror(-fd) << "\n";
+        return CallbackReturn::FAILURE;
+    }
+    // epoll says the line is readable, a short read must never block the other lines.
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    struct epoll_event ev {};
+    ev.events = EPOLLIN;
+    ev.data.u32 = static_cast<uint32_t>(idx);
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        std::cout << "ERROR: unable to watch line " << pin << ": " << std::strerror(errno) << "\n";
+        close(fd);
+        return CallbackReturn::FAILURE;
+    }
+
+    Line &line = lines_[idx];
+    line.active = true;
+    line.fd = fd;
+    line.pin = pin;
+    line.timeout_ms = timeout_ms;
+    line.func = f;
+    line.userdata = userdata;
+    line.line_seqno = 0;
+    line.last_event_ns = mono_ns();
+    line_ct_++;
+
+    // the epoll thread may be sleeping on a previous timeout, wake it so the new one is taken into account.
+    uint64_t one = 1;
+    if (timeout_ms > 0 && write(wake_fd_, &one, sizeof(one)) != sizeof(one)) {
+        std::cout << "ERROR: unable to wake chardev thread\n";
+    }
+    return CallbackReturn::SUCCESS;
+}
+
+void GpioChardev::remove_line(unsigned pin)
+{
+    bool last = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (Line &line : lines_) {
+            if (!line.active || line.pin != pin) {
+                continue;
+            }
+            epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, line.fd, nullptr);
+            close_fd(line.fd);
+            line = Line {};
+            line_ct_--;
+            last = line_ct_ == 0;
+            break;
+        }
+    }
+    if (last) {
+        stop();
+    }
+}
+
+ChardevStats GpioChardev::stats() const
+{
+    ChardevStats s;
+    s.events = events_.load(std::memory_order_relaxed);
+    s.reads = reads_.load(std::memory_order_relaxed);
+    s.max_batch = max_batch_.load(std::memory_order_relaxed);
+    s.seq_gaps = seq_gaps_.load(std::memory_order_relaxed);
+    s.timeouts = timeouts_.load(std::memory_order_relaxed);
+    // read from the thread's CPU clock while it runs, it stores its final figure on exit.
+    s.thread_cpu_ns = running_.load() ? cpu_ns(cpu_clock_) : thread_cpu_ns_.load(std::memory_order_relaxed);
+    return s;
+}
+
+CallbackReturn GpioChardev::start()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_.load()) {
+        return CallbackReturn::SUCCESS;
+    }
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (epoll_fd_ < 0 || wake_fd_ < 0) {
+        std::cout << "ERROR: unable to create chardev epoll: " << std::strerror(errno) << "\n";
+        close_fd(epoll_fd_);
+        close_fd(wake_fd_);
+        return CallbackReturn::FAILURE;
+    }
+    struct epoll_event ev {};
+    ev.events = EPOLLIN;
+    ev.data.u32 = WAKE_ID;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev);
+
+    events_.store(0);
+    reads_.store(0);
+    max_batch_.store(0);
+    seq_gaps_.store(0);
+    timeouts_.store(0);
+    thread_cpu_ns_.store(0);
+
+    running_.store(true);
+    thread_ = std::thread(&GpioChardev::run, this);
+    if (pthread_getcpuclockid(thread_.native_handle(), &cpu_clock_) != 0) {
+        cpu_clock_ = CLOCK_THREAD_CPUTIME_ID;
+    }
+    return CallbackReturn::SUCCESS;
+}
+
+void GpioChardev::stop()
+{
+    if (!thread_.joinable()) {
+        return;
+    }
+    running_.store(false);
+    uint64_t one = 1;
+    if (write(wake_fd_, &one, sizeof(one)) != sizeof(one)) {
+        std::cout << "ERROR: unable to stop chardev thread\n";
+    }
+    thread_.join();
+    close_fd(epoll_fd_);
+    close_fd(wake_fd_);
+}
+
+void GpioChardev::run()
+{
+    pthread_setname_np(pthread_self(), "rr_chardev");
+
+    std::array<struct epoll_event, MAX_LINES + 1> ready {};
+    int wait_ms = -1;
+    while (running_.load(std::memory_order_relaxed)) {
+        int n = epoll_wait(epoll_fd_, ready.data(), static_cast<int>(ready.size()), wait_ms);
+        if (n < 0 && errno != EINTR) {
+            std::cout << "ERROR: chardev epoll_wait: " << std::strerror(errno) << "\n";
+            break;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint64_t now = mono_ns();
+        for (int i = 0; i < n; i++) {
+            uint32_t id = ready[i].data.u32;
+            if (id == WAKE_ID) {
+                uint64_t drained = 0;
+                if (read(wake_fd_, &drained, sizeof(drained)) < 0 && errno != EAGAIN) {
+                    std::cout << "ERROR: chardev wake: " << std::strerror(errno) << "\n";
+                }
+                continue;
+            }
+            drain(id, now);
+        }
+        wait_ms = check_timeouts(now);
+    }
+    thread_cpu_ns_.store(cpu_ns(CLOCK_THREAD_CPUTIME_ID), std::memory_order_relaxed);
+}
+
+void GpioChardev::drain(size_t idx, uint64_t now_ns)
+{
+    Line &line = lines_[idx];
+    // removed after epoll_wait() returned.
+    if (!line.active) {
+        return;
+    }
+
+    std::array<struct gpio_v2_line_event, EVENT_BATCH> batch;
+    ssize_t bytes = read(line.fd, batch.data(), sizeof(batch));
+    if (bytes <= 0) {
+        return;
+    }
+    size_t ct = static_cast<size_t>(bytes) / sizeof(struct gpio_v2_line_event);
+
+    // kernel timestamps are CLOCK_MONOTONIC, callbacks expect the gpioTick() microsecond domain.
+    uint32_t offset_us = gpioTick() - static_cast<uint32_t>(now_ns / 1000);
+    for (size_t i = 0; i < ct; i++) {
+        const struct gpio_v2_line_event &ev = batch[i];
+        uint32_t expected = line.line_seqno + 1;
+        if (ev.line_seqno != expected) {
+            seq_gaps_.fetch_add(ev.line_seqno - expected, std::memory_order_relaxed);
+        }
+        line.line_seqno = ev.line_seqno;
+        int level = ev.id == GPIO_V2_LINE_EVENT_RISING_EDGE ? PI_ON : PI_OFF;
+        uint32_t tick = static_cast<uint32_t>(ev.timestamp_ns / 1000) + offset_us;
+        line.func(static_cast<int>(line.pin), level, tick, line.userdata);
+    }
+    line.last_event_ns = now_ns;
+
+    events_.fetch_add(ct, std::memory_order_relaxed);
+    reads_.fetch_add(1, std::memory_order_relaxed);
+    uint32_t batch_ct = static_cast<uint32_t>(ct);
+    if (batch_ct > max_batch_.load(std::memory_order_relaxed)) {
+        max_batch_.store(batch_ct, std::memory_order_relaxed);
+    }
+}
+
+int GpioChardev::check_timeouts(uint64_t now_ns)
+{
+    int64_t next_ms = -1;
+    for (Line &line : lines_) {
+        if (!line.active || line.timeout_ms <= 0) {
+            continue;
+        }
+        uint64_t timeout_ns = static_cast<uint64_t>(line.timeout_ms) * 1000000ULL;
+        uint64_t due = line.last_event_ns + timeout_ns;
+        if (now_ns >= due) {
+            // as pigpio, the timeout repeats every timeout_ms until an edge arrives.
+            line.func(static_cast<int>(line.pin), PI_TIMEOUT, gpioTick(), line.userdata);
+            timeouts_.fetch_add(1, std::memory_order_relaxed);
+            line.last_event_ns = now_ns;
+            due = now_ns + timeout_ns;
+        }
+        // rounded up, so the wait does not return just before the timeout is due.
+        int64_t wait = static_cast<int64_t>((due - now_ns + 999999) / 1000000);
+        if (next_ms < 0 || wait < next_ms) {
+            next_ms = wait;
+        }
+    }
+    return static_cast<int>(next_ms);
+}
@@ -0,0 +1,147 @@
+/**
+ * Encoder edges from the Linux GPIO v2 character device, an alternative to pigpio's gpioSetISRFuncEx().
+ *
+ * pigpio needs root, samples every GPIO by DMA and runs one callback thread per pin. GpioChardev instead requests
+ * each encoder line from the kernel as a rising edge input, and a single epoll thread waits on every line:
+ *
+ * - each read() returns up to EVENT_BATCH gpio_v2_line_event records, so a burst of edges costs one syscall,
+ * - edges carry the kernel's CLOCK_MONOTONIC timestamp taken in the interrupt handler, converted to the
+ *   gpioTick() domain so intervals and stall detection are unchanged,
+ * - gaps in line_seqno (the kernel's per line event buffer overflowed) are counted rather than silently lost.
+ *
+ * Callbacks have pigpio's gpioISRFuncEx_t signature, so MotorEncoder passes the same trampoline to either backend,
+ * see EdgeBackend. Edges are delivered as level PI_ON, timeouts as PI_TIMEOUT.
+ *
+ * Lines come from an EdgeLineSource. ChipLineSource opens /dev/gpiochipN, ScriptedLineSource (scripted_lines.hpp)
+ * feeds scripted events through pipes so the backend can be exercised on any Linux machine.
+ */
+
+#pragma once
+
+#include "tst_common.hpp"
+#include <pigpio.h>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <time.h>
+
+/**
+ * Provides a file descriptor per encoder line, that reads gpio_v2_line_event records.
+ */
+class EdgeLineSource {
+  public:
+    virtual ~EdgeLineSource() = default;
+
+    /**
+     * Open pin as a rising edge input.
+     *
+     * @return a readable fd owned by the caller, or a negative errno.
+     */
+    virtual int open_line(unsigned pin) = 0;
+};
+
+/**
+ * Lines requested from a GPIO chip, on the Pi4B /dev/gpiochip0 offsets are the BCM GPIO numbers.
+ */
+class ChipLineSource : public EdgeLineSource {
+  public:
+    ~ChipLineSource() override;
+
+    CallbackReturn on_configure(const std::string &chip_path);
+
+    int open_line(unsigned pin) override;
+
+  private:
+    int chip_fd_ = -1;
+};
+
+struct ChardevStats {
+    uint64_t events = 0;      // edges delivered
+    uint64_t reads = 0;       // read() calls that returned events
+    uint32_t max_batch = 0;   // most events returned by one read()
+    uint64_t seq_gaps = 0;    // edges the kernel dropped, from line_seqno
+    uint64_t timeouts = 0;
+    uint64_t thread_cpu_ns = 0; // CPU used by the epoll thread
+};
+
+class GpioChardev {
+  public:
+    static constexpr size_t MAX_LINES = 16;
+    static constexpr size_t EVENT_BATCH = 64;
+
+    static GpioChardev &instance();
+
+    /**
+     * Select where lines come from, only while no line is added. source must outlive the lines.
+     */
+    CallbackReturn on_configure(EdgeLineSource &source);
+
+    bool configured() const { return source_ != nullptr; }
+
+    /**
+     * Open pin and deliver its edges to f, starting the epoll thread with the first line.
+     *
+     * @param timeout_ms if > 0, f is called with PI_TIMEOUT when no edge arrives for this long, as pigpio does.
+     */
+    CallbackReturn add_line(unsigned pin, int timeout_ms, gpioISRFuncEx_t f, void *userdata);
+
+    /**
+     * Close pin, once this returns f is not running and will not be called again for it. The epoll thread
+     * stops with the last line.
+     */
+    void remove_line(unsigned pin);
+
+    // counters since the epoll thread last started.
+    ChardevStats stats() const;
+
+    ~GpioChardev();
+
+  private:
+    GpioChardev() = default;
+    GpioChardev(const GpioChardev &) = delete;
+    GpioChardev &operator=(const GpioChardev &) = delete;
+
+    struct Line {
+        bool active = false;
+        int fd = -1;
+        unsigned pin = 0;
+        int timeout_ms = 0;
+        gpioISRFuncEx_t func = nullptr;
+        void *userdata = nullptr;
+        uint32_t line_seqno = 0;  // last seen, 0 before the first event
+        uint64_t last_event_ns = 0;
+    };
+
+    CallbackReturn start();
+    void stop();
+    void run();
+
+    // read one batch from line idx and dispatch it, mutex_ held.
+    void drain(size_t idx, uint64_t now_ns);
+
+    // fire timeouts due at now_ns and return ms until the next one, -1 if none, mutex_ held.
+    int check_timeouts(uint64_t now_ns);
+
+    EdgeLineSource *source_ = nullptr;
+
+    // held while lines change and while a batch is dispatched, uncontended unless a line is being removed.
+    mutable std::mutex mutex_;
+    std::array<Line, MAX_LINES> lines_ {};
+    size_t line_ct_ = 0;
+
+    int epoll_fd_ = -1;
+    int wake_fd_ = -1;  // eventfd that wakes the epoll thread to stop or to re-arm timeouts
+    std::thread thread_;
+    clockid_t cpu_clock_ = CLOCK_THREAD_CPUTIME_ID;
+    std::atomic<bool> running_ {false};
+
+    std::atomic<uint64_t> events_ {0};
+    std::atomic<uint64_t> reads_ {0};
+    std::atomic<uint32_t> max_batch_ {0};
+    std::atomic<uint64_t> seq_gaps_ {0};
+    std::atomic<uint64_t> timeouts_ {0};
+    std::atomic<uint64_t> thread_cpu_ns_ {0};
+};
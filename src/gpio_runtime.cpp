@@ -0,0 +1,122 @@
+#include "gpio_runtime.hpp"
+#include "driver_log.hpp"
+
+GpioRuntime &GpioRuntime::instance()
+{
+    static GpioRuntime runtime;
+    return runtime;
+}
+
+int GpioRuntime::acquire()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (ref_ct_ > 0) {
+        ref_ct_++;
+        return handle_;
+    }
+
+    if (revision_ == 0) {
+        revision_ = gpioHardwareRevision();
+        if (revision_ == 0) {
+            std::cout << "pigpiod has an unknown revision\n";
+            return PI_INIT_FAILED;
+        }
+        // This will be printed to the log, but we may want a way of detecting the hardware.
+        std::cout << "Hardware revision: 0x" << std::hex << revision_ << std::dec << std::endl;
+        std::cout << "Model number: " << ((revision_ >> 4) & 0xFF) << std::endl;
+        std::cout << "Expected model for Pi4B: 17" << std::endl;
+    }
+
+    int pi = gpioInitialise();
+    if (pi < 0) {
+        std::cout << "Failed to connect to pigpiod\n";
+        return pi;
+    }
+    handle_ = pi;
+    ref_ct_ = 1;
+    DriverLog::instance().start();
+    return handle_;
+}
+
+void GpioRuntime::release(int pi)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (ref_ct_ == 0 || pi != handle_) {
+        return;
+    }
+    if (--ref_ct_ == 0) {
+        // flush outstanding errors before the library goes away.
+        DriverLog::instance().stop();
+        gpioTerminate();
+        handle_ = -1;
+    }
+}
+
+bool GpioRuntime::valid_handle(int pi) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return ref_ct_ > 0 && pi >= 0 && pi == handle_;
+}
+
+unsigned GpioRuntime::hardware_revision() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return revision_;
+}
+
+unsigned GpioRuntime::model() const
+{
+    return (hardware_revision() >> 4) & 0xFF;
+}
+
+bool GpioRuntime::hardware_pwm_pin(unsigned pin)
+{
+    return board::hardware_pwm_pin(pin);
+}
+
+CallbackReturn GpioRuntime::claim_pin(unsigned pin, const void *owner)
+{
+    if (pin > MAX_GPIO || owner == nullptr) {
+        std::cout << "ERROR: pin " << pin << " is outside of GPIO range\n";
+        return CallbackReturn::FAILURE;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (owners_[pin] != nullptr && owners_[pin] != owner) {
+        std::cout << "ERROR: pin " << pin << " is already claimed by another driver\n";
+        return CallbackReturn::FAILURE;
+    }
+    owners_[pin] = owner;
+    return CallbackReturn::SUCCESS;
+}
+
+void GpioRuntime::release_pin(unsigned pin, const void *owner)
+{
+    if (pin > MAX_GPIO) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (owners_[pin] == owner) {
+        owners_[pin] = nullptr;
+    }
+}
+
+void GpioRuntime::release_pins(const void *owner)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto &o : owners_) {
+        if (o == owner) {
+            o = nullptr;
+        }
+    }
+}
+
+const void *GpioRuntime::pin_owner(unsigned pin) const
+{
+    if (pin > MAX_GPIO) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    return owners_[pin];
+}
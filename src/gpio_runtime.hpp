@@ -0,0 +1,75 @@
+/**
+ * Process wide owner of the pigpio library.
+ *
+ * pigpio must only be initialised once per process, but every executable (and every MotorController
+ * within it) was calling gpioHardwareRevision() and gpioInitialise() itself. GpioRuntime reference counts
+ * the library so that bringing up N controllers costs a single initialisation, and gpioTerminate() is only
+ * called when the last user releases it.
+ *
+ * It also keeps track of which object owns each GPIO, so that two drivers that are configured with the
+ * same pin are rejected at configure time rather than fighting over the pin once activated.
+ */
+
+#pragma once
+
+#include "board.hpp"
+#include "tst_common.hpp"
+#include <array>
+#include <mutex>
+
+class GpioRuntime {
+  public:
+    // Highest GPIO available on the Pi4B header, the simulated backend has the same, see src/pigpio_sim.hpp.
+    static constexpr unsigned MAX_GPIO = board::MAX_GPIO;
+
+    // True if pin can be driven by gpioHardwarePWM().
+    static bool hardware_pwm_pin(unsigned pin);
+
+    static GpioRuntime &instance();
+
+    /**
+     * Initialise pigpio on first use, and hand out the handle that drivers should be configured with.
+     *
+     * @return handle (>= 0) on success, negative pigpio error code otherwise.
+     */
+    int acquire();
+
+    /**
+     * Release a handle returned by acquire(), the library is terminated when the last handle is released.
+     */
+    void release(int pi);
+
+    /**
+     * True if pi was handed out by acquire() and the library has not since been terminated.
+     */
+    bool valid_handle(int pi) const;
+
+    // cached on first acquire(), 0 until then.
+    unsigned hardware_revision() const;
+
+    unsigned model() const;
+
+    /**
+     * Record that owner is using pin. Claiming a pin that the same owner already holds succeeds,
+     * claiming a pin held by somebody else fails.
+     */
+    CallbackReturn claim_pin(unsigned pin, const void *owner);
+
+    void release_pin(unsigned pin, const void *owner);
+
+    // release every pin held by owner, used by on_cleanup() and destructors.
+    void release_pins(const void *owner);
+
+    const void *pin_owner(unsigned pin) const;
+
+  private:
+    GpioRuntime() = default;
+    GpioRuntime(const GpioRuntime &) = delete;
+    GpioRuntime &operator=(const GpioRuntime &) = delete;
+
+    mutable std::mutex mutex_;
+    int handle_ = -1;
+    int ref_ct_ = 0;
+    unsigned revision_ = 0;
+    std::array<const void *, MAX_GPIO + 1> owners_ {};
+};
@@ -0,0 +1,105 @@
+#include "kalman.hpp"
+#include <algorithm>
+
+namespace {
+    // variance of a value rounded to a whole tick or pulse.
+    constexpr double QUANTIZATION_VAR = 1.0 / 12.0;
+}
+
+CallbackReturn VelocityKalman::on_configure(double jerk_density, double period_sigma_us,
+    double duty_gain, double duty_deadband, double duty_sigma)
+{
+    if (jerk_density <= 0.0 || period_sigma_us < 0.0 || duty_gain < 0.0 || duty_sigma < 0.0) {
+        return CallbackReturn::FAILURE;
+    }
+    jerk_density_ = jerk_density;
+    period_var_us_ = period_sigma_us * period_sigma_us + QUANTIZATION_VAR;
+    duty_gain_ = duty_gain;
+    duty_deadband_ = duty_deadband;
+    duty_var_ = duty_sigma * duty_sigma;
+    return on_activate();
+}
+
+CallbackReturn VelocityKalman::on_activate()
+{
+    x_ = Matrix<N, 1> {};
+    p_ = Matrix<N, N> {};
+    p_(0, 0) = INITIAL_VAR_POS;
+    p_(1, 1) = INITIAL_VAR_VEL;
+    p_(2, 2) = INITIAL_VAR_ACC;
+    return CallbackReturn::SUCCESS;
+}
+
+void VelocityKalman::predict(double dt)
+{
+    if (dt <= 0.0) {
+        return;
+    }
+    const double dt2 = dt * dt;
+    const double dt3 = dt2 * dt;
+
+    Matrix<N, N> f = Matrix<N, N>::identity();
+    f(0, 1) = dt;
+    f(0, 2) = 0.5 * dt2;
+    f(1, 2) = dt;
+
+    // discrete white noise jerk model
+    Matrix<N, N> q;
+    q(0, 0) = dt3 * dt2 / 20.0;
+    q(0, 1) = q(1, 0) = dt2 * dt2 / 8.0;
+    q(0, 2) = q(2, 0) = dt3 / 6.0;
+    q(1, 1) = dt3 / 3.0;
+    q(1, 2) = q(2, 1) = dt2 / 2.0;
+    q(2, 2) = dt;
+    q *= jerk_density_;
+
+    x_ = f * x_;
+    p_ = f * p_ * f.transpose() + q;
+}
+
+void VelocityKalman::update_period(uint32_t period_us)
+{
+    if (period_us == 0) {
+        return;
+    }
+    // v = 1e6 / T, so dv/dT = -1e6 / T^2 and var(v) = (1e6 / T^2)^2 * var(T)
+    const double t = static_cast<double>(period_us);
+    const double dv_dt = 1.0e6 / (t * t);
+    update<1>(1.0e6 / t, dv_dt * dv_dt * period_var_us_);
+}
+
+void VelocityKalman::update_counts(int64_t counts)
+{
+    update<0>(static_cast<double>(counts), QUANTIZATION_VAR);
+}
+
+void VelocityKalman::update_duty(double duty)
+{
+    if (duty_gain_ <= 0.0) {
+        return;
+    }
+    update<1>(duty_gain_ * std::max(0.0, duty - duty_deadband_), duty_var_);
+}
+
+template <size_t IDX>
+void VelocityKalman::update(double z, double r)
+{
+    // H selects a single state, so S = P(idx, idx) + R and K = P(:, idx) / S.
+    const double s = p_(IDX, IDX) + r;
+    if (s <= 0.0) {
+        return;
+    }
+    const double innovation = z - x_(IDX, 0);
+
+    Matrix<N, 1> k;
+    static_for<N>([&](auto i) { k(i, 0) = p_(i, IDX) / s; });
+
+    // P = (I - K H) P, computed from the row being observed so it can be done in place.
+    Matrix<1, N> row;
+    static_for<N>([&](auto j) { row(0, j) = p_(IDX, j); });
+
+    static_for<N>([&](auto i) {
+        x_(i, 0) += k(i, 0) * innovation;
+        static_for<N>([&](auto j) { p_(i, j) -= k(i, 0) * row(0, j); });
+    });
+}
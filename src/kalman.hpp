@@ -0,0 +1,76 @@
+/**
+ * Constant acceleration Kalman filter for wheel position, velocity and acceleration.
+ *
+ * Replaces reading the EMA in MotorController::encoder_cb_ directly, the EMA does not know about edge
+ * quantization and gives no measure of how much the estimate can be trusted.
+ *
+ * State is [position (pulses), velocity (pulses/s), acceleration (pulses/s^2)], driven by white jerk
+ * noise. Measurements are fused as scalar updates, so no matrix inversion is required:
+ *
+ * - update_period(): the interval between two healthy edges, converted to velocity. Its variance is
+ *   derived from the timing uncertainty (jitter plus the 1µs tick quantization) so short periods,
+ *   which are the most sensitive to a single µs of error, are trusted less.
+ * - update_counts(): the pulse count, with the 1/12 pulse^2 variance of a quantized count.
+ * - update_duty(): the velocity the commanded duty would give at steady state. It carries a large
+ *   variance, so it mostly matters when edges are sparse (starting, stopping, stalls).
+ *
+ * Everything is fixed size, nothing is allocated, see matrix.hpp.
+ */
+
+#pragma once
+
+#include "matrix.hpp"
+#include "tst_common.hpp"
+#include <cstdint>
+
+class VelocityKalman {
+  public:
+    static constexpr size_t N = 3;
+
+    /**
+     * @param jerk_density spectral density of the jerk process noise ((pulses/s^3)^2 / Hz).
+     * @param period_sigma_us standard deviation of edge timing jitter in µs.
+     * @param duty_gain steady state pulses/s per % duty above duty_deadband, 0 disables update_duty().
+     * @param duty_deadband duty % below which the motor does not turn.
+     * @param duty_sigma standard deviation (pulses/s) of the duty derived velocity.
+     */
+    CallbackReturn on_configure(double jerk_density, double period_sigma_us,
+        double duty_gain, double duty_deadband, double duty_sigma);
+
+    // reset to rest, with a wide initial covariance.
+    CallbackReturn on_activate();
+
+    // propagate the state forward by dt seconds.
+    void predict(double dt);
+
+    void update_period(uint32_t period_us);
+
+    void update_counts(int64_t counts);
+
+    void update_duty(double duty);
+
+    double position() const { return x_(0, 0); }
+    double velocity() const { return x_(1, 0); }
+    double acceleration() const { return x_(2, 0); }
+
+    const Matrix<N, N> &covariance() const { return p_; }
+
+  private:
+    // fuse a measurement z of state element idx with variance r.
+    template <size_t IDX>
+    void update(double z, double r);
+
+    Matrix<N, 1> x_;
+    Matrix<N, N> p_;
+
+    double jerk_density_ = 1.0e6;
+    double period_var_us_ = 1.0;
+    double duty_gain_ = 0.0;
+    double duty_deadband_ = 0.0;
+    double duty_var_ = 0.0;
+
+    // initial variances used by on_activate()
+    const double INITIAL_VAR_POS {1.0};
+    const double INITIAL_VAR_VEL {1.0e6};
+    const double INITIAL_VAR_ACC {1.0e8};
+};
@@ -0,0 +1,104 @@
+/**
+ * Small fixed size matrices for estimators that run every control tick.
+ *
+ * Dimensions are template parameters, storage is a std::array so nothing touches the heap, and every
+ * loop is expanded at compile time by static_for so the compiler sees straight line code.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <utility>
+
+namespace detail {
+    template <typename F, size_t... I>
+    constexpr void static_for_impl(F &&f, std::index_sequence<I...>)
+    {
+        (f(std::integral_constant<size_t, I> {}), ...);
+    }
+}
+
+/**
+ * Calls f(0) ... f(N - 1), expanded at compile time.
+ */
+template <size_t N, typename F>
+constexpr void static_for(F &&f)
+{
+    detail::static_for_impl(std::forward<F>(f), std::make_index_sequence<N> {});
+}
+
+template <size_t R, size_t C>
+struct Matrix {
+    std::array<double, R * C> m {};
+
+    constexpr double &operator()(size_t r, size_t c) { return m[r * C + c]; }
+    constexpr double operator()(size_t r, size_t c) const { return m[r * C + c]; }
+
+    static constexpr Matrix identity()
+    {
+        static_assert(R == C, "identity requires a square matrix");
+        Matrix out;
+        static_for<R>([&](auto i) { out(i, i) = 1.0; });
+        return out;
+    }
+
+    constexpr Matrix<C, R> transpose() const
+    {
+        Matrix<C, R> out;
+        static_for<R>([&](auto r) {
+            static_for<C>([&](auto c) { out(c, r) = (*this)(r, c); });
+        });
+        return out;
+    }
+
+    constexpr Matrix &operator+=(const Matrix &rhs)
+    {
+        static_for<R * C>([&](auto i) { m[i] += rhs.m[i]; });
+        return *this;
+    }
+
+    constexpr Matrix &operator-=(const Matrix &rhs)
+    {
+        static_for<R * C>([&](auto i) { m[i] -= rhs.m[i]; });
+        return *this;
+    }
+
+    constexpr Matrix &operator*=(double s)
+    {
+        static_for<R * C>([&](auto i) { m[i] *= s; });
+        return *this;
+    }
+};
+
+template <size_t R, size_t C>
+constexpr Matrix<R, C> operator+(Matrix<R, C> lhs, const Matrix<R, C> &rhs)
+{
+    return lhs += rhs;
+}
+
+template <size_t R, size_t C>
+constexpr Matrix<R, C> operator-(Matrix<R, C> lhs, const Matrix<R, C> &rhs)
+{
+    return lhs -= rhs;
+}
+
+template <size_t R, size_t C>
+constexpr Matrix<R, C> operator*(Matrix<R, C> lhs, double s)
+{
+    return lhs *= s;
+}
+
+template <size_t R, size_t K, size_t C>
+constexpr Matrix<R, C> operator*(const Matrix<R, K> &lhs, const Matrix<K, C> &rhs)
+{
+    Matrix<R, C> out;
+    static_for<R>([&](auto r) {
+        static_for<C>([&](auto c) {
+            double sum = 0.0;
+            static_for<K>([&](auto k) { sum += lhs(r, k) * rhs(k, c); });
+            out(r, c) = sum;
+        });
+    });
+    return out;
+}
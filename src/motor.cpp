@@ -1,4 +1,23 @@
 #include "motor.hpp"
+#include "emergency_stop.hpp"
+#include "trace.hpp"
+
+namespace {
+    using BankWrite = int (*)(uint32_t);
+
+    // indexed by MotorPinout::dir_bank then level, so writing the direction pin does not branch. The bank writes
+    // return 0 for any mask, a bad direction pin can not be reported by them, claim() checks it instead.
+    constexpr BankWrite DIR_WRITE[2][2] = {
+        {gpioWrite_Bits_0_31_Clear, gpioWrite_Bits_0_31_Set},
+        {gpioWrite_Bits_32_53_Clear, gpioWrite_Bits_32_53_Set},
+    };
+
+    // a duty write_pwm() refused while EmergencyStop is latched, the wheel is already stopped, nothing failed.
+    bool refused_by_stop(int r)
+    {
+        return r == PI_NOT_PERMITTED && EmergencyStop::instance().tripped();
+    }
+}
 
 /**
  * In final versions this should be done as an interface that can be used by concrete classes (may be plugins).
@@ -20,71 +39,117 @@
 *
 */
 CallbackReturn Motor::on_configure(uint pwm_pin, uint dir_pin, int pi) {
+    return on_configure(make_motor_pinout(pwm_pin, dir_pin), pi);
+}
 
-    if (pi < 0) {
-        std::cout << "ERROR: pi daemon is not correct\n";
+CallbackReturn Motor::on_configure(const MotorPinout &pins, int pi) {
+
+    // a WheelPins pinout has been checked already, pins given at run time have not.
+    if (!GpioRuntime::hardware_pwm_pin(pins.pwm)) {
+        std::cout << "ERROR: non PWM pin\n";
         return CallbackReturn::FAILURE;
     }
-    pi_ = pi;
+    return claim(pins, pi);
+}
 
-    switch(pwm_pin) {
-        case 12:
-            break;
-        case 13:
-            break;
-        case 18:
-            break;
-        case 19:
-            break;
-        default:
-            std::cout << "ERROR: non PWM pin\n";
-            return CallbackReturn::FAILURE;
+CallbackReturn Motor::on_configure(const MotorPinout &pins, int pi, WavePwm &wave) {
+    MotorPinout soft = pins;
+    // driven as a plain output by the waveform, not routed to a PWM channel.
+    soft.pwm_mode = PI_OUTPUT;
+    soft.pwm_channel = board::NO_PWM_CHANNEL;
+    if (claim(soft, pi) != CallbackReturn::SUCCESS) {
+        return CallbackReturn::FAILURE;
+    }
+    int channel = wave.add_channel(pins.pwm);
+    if (channel < 0) {
+        on_cleanup();
+        return CallbackReturn::FAILURE;
     }
+    wave_ = &wave;
+    wave_channel_ = static_cast<size_t>(channel);
+    return CallbackReturn::SUCCESS;
+}
 
-    pwm_pin_ = pwm_pin; 
+CallbackReturn Motor::claim(const MotorPinout &pins, int pi) {
 
-    if (dir_pin == pwm_pin_) {
+    if (!GpioRuntime::instance().valid_handle(pi)) {
+        std::cout << "ERROR: pi daemon is not correct\n";
+        return CallbackReturn::FAILURE;
+    }
+
+    if (pins.dir == pins.pwm) {
         std::cout << "ERROR: pin assigned previously\n";
         return CallbackReturn::FAILURE;           
     }
-    dir_pin_ = dir_pin;
+
+    // the only chance to see PI_BAD_GPIO for the direction pin, write_dir() can not fail once configured.
+    if (gpioGetMode(pins.dir) < 0) {
+        std::cout << "ERROR: direction pin " << pins.dir << " is not a usable GPIO\n";
+        return CallbackReturn::FAILURE;
+    }
+
+    // reconfiguring gives up the previous pins first.
+    on_cleanup();
+
+    GpioRuntime &runtime = GpioRuntime::instance();
+    if (runtime.claim_pin(pins.pwm, this) != CallbackReturn::SUCCESS ||
+        runtime.claim_pin(pins.dir, this) != CallbackReturn::SUCCESS) {
+        runtime.release_pins(this);
+        return CallbackReturn::FAILURE;
+    }
+
+    pi_ = pi;
+    pins_ = pins;
+    return CallbackReturn::SUCCESS;
+}
+
+CallbackReturn Motor::on_cleanup() {
+    if (pi_ >= 0) {
+        EmergencyStop::instance().remove(pins_.pwm);
+    }
+    GpioRuntime::instance().release_pins(this);
+    if (wave_ != nullptr) {
+        wave_->remove_channel(pins_.pwm);
+        wave_ = nullptr;
+    }
+    pi_ = -1;
     return CallbackReturn::SUCCESS;
 }
 
+Motor::~Motor() {
+    // a software PWM channel left behind would keep driving the pin after the motor is gone.
+    on_cleanup();
+}
+
 // create links with hardware. Perform error checking, and fail if something goes wrong.
 CallbackReturn Motor::on_activate() {
 
-    if (set_mode_internal(dir_pin_, PI_OUTPUT) != OK) {
-        std::cout << "ERROR: pin " << dir_pin_ << "had errors\n";
+    if (set_mode_internal(pins_.dir, PI_OUTPUT) != OK) {
+        std::cout << "ERROR: pin " << pins_.dir << "had errors\n";
         return CallbackReturn::FAILURE;
     }
     
 
-    // set to ALT5 for PWM hardware output.
-    // could add support for soft PWM, but not in this test
-    if (set_mode_internal(pwm_pin_, PI_ALT5) != OK) {
-        std::cout << "ERROR: pin " << pwm_pin_ << "had errors\n";
+    // route the pin to its PWM channel, ALT0 or ALT5 depending on the pin, see board.hpp. A software PWM pin
+    // is a plain output driven by its WavePwm.
+    if (set_mode_internal(pins_.pwm, pins_.pwm_mode) != OK) {
+        std::cout << "ERROR: pin " << pins_.pwm << "had errors\n";
         return CallbackReturn::FAILURE;
     }
 
-    {
-        int r = OK;
-        if ((r = gpioWrite(dir_pin_, LOW)) != OK) {
-            switch(r) {
-                case PI_BAD_GPIO:
-                    std::cout << "ERROR: pin " << dir_pin_ << " returned PI_BAD_GPIO\n";
-                    break;
-                case PI_BAD_LEVEL:
-                    std::cout << "ERROR: pin " << dir_pin_ << " returned PI_BAD_LEVEL\n";
-                    break;
-                case PI_NOT_PERMITTED:
-                    std::cout << "ERROR: pin " << dir_pin_ << " returned PI_NOT_PERMITTED\n"; 
-            }
-            std::cout << "ERROR: pin " << dir_pin_ << "had errors!!!\n";
-            return CallbackReturn::FAILURE;
-        }
+    if (write_dir(BACKWARD) != OK) {
+        return CallbackReturn::FAILURE;
     }
+    dir_ = BACKWARD;
     if (set_pwm(0, 0) != OK) return CallbackReturn::FAILURE;
+
+    // a fault on any thread must be able to cut this motor once it can drive.
+    if (!EmergencyStop::instance().add(pins_.pwm, software_pwm())) {
+        return CallbackReturn::FAILURE;
+    }
+    target_dir_ = dir_;
+    target_duty_ = 0;
+    state_ = DriveState::IDLE;
     return CallbackReturn::SUCCESS;
 }
 
@@ -97,22 +162,13 @@ CallbackReturn Motor::on_deactivate() {
         exit_res = CallbackReturn::FAILURE;
     }
 
-    {
-        int r = OK;
-        if ((r = gpioWrite(dir_pin_, LOW)) != OK) {
-            // note fallthrough is delibrate here
-            switch(r) {
-                case PI_BAD_GPIO:
-                    std::cout << "ERROR: pin " << dir_pin_ << "returned PI_BAD_GPIO\n";
-                    [[fallthrough]];
-                case PI_BAD_LEVEL:
-                    std::cout << "ERROR: pin " << dir_pin_ << "returned PI_BAD_LEVEL\n";
-                        [[fallthrough]];
-                default:
-                    return CallbackReturn::FAILURE; 
-            }
-        }
+    if (write_dir(BACKWARD) != OK) {
+        return CallbackReturn::FAILURE; 
     }
+    dir_ = BACKWARD;
+    target_dir_ = dir_;
+    target_duty_ = 0;
+    state_ = DriveState::IDLE;
     
     return exit_res;
 }
@@ -124,66 +180,149 @@ int Motor::set_pwm(int duty) {
 
     
 CallbackReturn Motor::set_direction(DIRECTION dir) {
-    int r = OK;
-    if ((r = gpioWrite(dir_pin_, dir)) != OK) {
-        switch(r) {
-            case PI_BAD_GPIO:
-                std::cout << "ERROR: pin " << dir_pin_ << "returned PI_BAD_GPIO\n";
-                [[fallthrough]];
-            case PI_BAD_LEVEL:
-                std::cout << "ERROR: pin " << dir_pin_ << "returned PI_BAD_LEVEL\n";
-                [[fallthrough]];
-            default:
-                return CallbackReturn::FAILURE; 
-        }
+    if (write_dir(dir) != OK) {
+        return CallbackReturn::FAILURE; 
     }
+    dir_ = dir;
     return CallbackReturn::SUCCESS; 
 }
 
+CallbackReturn Motor::configure_sequencer(int ramp_step, uint32_t coast_us) {
+    if (ramp_step <= 0 || ramp_step > 100) {
+        std::cout << "ERROR: ramp step must be between 1 and 100\n";
+        return CallbackReturn::FAILURE;
+    }
+    ramp_step_ = ramp_step;
+    coast_us_ = coast_us;
+    return CallbackReturn::SUCCESS;
+}
+
+void Motor::drive(DIRECTION dir, int duty) {
+    target_dir_ = dir;
+    target_duty_ = std::clamp(duty, 0, 100);
+}
+
+bool Motor::ramp_towards(int target) {
+    int next = (duty_ < target) ? std::min(duty_ + ramp_step_, target) : std::max(duty_ - ramp_step_, target);
+    int r = set_pwm(active_freq_ > 0 ? active_freq_ : freq_, next);
+    return r == OK || refused_by_stop(r);
+}
+
+DriveState Motor::update(uint32_t tick) {
+    switch (state_) {
+        case DriveState::IDLE:
+            if (target_dir_ != dir_) {
+                state_ = DriveState::RAMP_DOWN;
+            }
+            else if (target_duty_ != duty_) {
+                state_ = DriveState::RAMP_UP;
+            }
+            else {
+                break;
+            }
+            return update(tick);
+        case DriveState::RAMP_DOWN:
+            // request may have been reverted part way through.
+            if (target_dir_ == dir_) {
+                state_ = DriveState::RAMP_UP;
+                return update(tick);
+            }
+            if (duty_ > 0) {
+                if (!ramp_towards(0)) {
+                    fault(tick);
+                }
+                break;
+            }
+            coast_start_ = tick;
+            state_ = DriveState::COAST;
+            break;
+        case DriveState::COAST:
+            // unsigned subtraction is safe across tick wrap.
+            if (tick - coast_start_ >= coast_us_) {
+                state_ = DriveState::FLIP;
+            }
+            break;
+        case DriveState::FLIP:
+            if (target_dir_ != dir_ && set_direction(target_dir_) != CallbackReturn::SUCCESS) {
+                fault(tick);
+                break;
+            }
+            state_ = DriveState::RAMP_UP;
+            break;
+        case DriveState::RAMP_UP:
+            if (target_dir_ != dir_) {
+                state_ = DriveState::RAMP_DOWN;
+                return update(tick);
+            }
+            if (duty_ != target_duty_ && !ramp_towards(target_duty_)) {
+                fault(tick);
+                break;
+            }
+            if (duty_ == target_duty_) {
+                state_ = DriveState::IDLE;
+            }
+            break;
+        case DriveState::FAULT:
+            break;
+    }
+    return state_;
+}
+
 
 
+void Motor::fault(uint32_t tick) {
+    state_ = DriveState::FAULT;
+    EmergencyStop::instance().trip(FaultCause::DRIVE_FAULT, static_cast<int>(pins_.pwm), tick);
+}
+
+int Motor::write_pwm(int freq, int duty) {
+    const EmergencyStop &stop = EmergencyStop::instance();
+    // latched by EmergencyStop, the motor may only be stopped.
+    if (duty > 0 && stop.tripped()) {
+        return PI_NOT_PERMITTED;
+    }
+    // a latched WavePwm does not send the duty, and it is cleared when the waveform is deactivated.
+    if (wave_ != nullptr) {
+        return wave_->set_duty(wave_channel_, duty*DUTY_OFFSET);
+    }
+    int r = gpioHardwarePWM(pins_.pwm, freq, duty*DUTY_OFFSET);
+    // trip() may have cut the pin between the check above and the write, which restarted it.
+    if (r == OK && duty > 0 && stop.tripped()) {
+        gpioHardwarePWM(pins_.pwm, 0, 0);
+        return PI_NOT_PERMITTED;
+    }
+    return r;
+}
+
 int Motor::set_pwm(int freq, int duty) {
-    int r =  gpioHardwarePWM (pwm_pin_, freq, duty*DUTY_OFFSET);
-    switch(r) {
-        // note fallthrough is delibrate here
-        case OK:
-            return r;
-        case PI_BAD_GPIO:
-            std::cout << "ERROR: pin " << pwm_pin_ << "returned PI_BAD_GPIO\n";
-            [[fallthrough]];
-        case PI_NOT_HPWM_GPIO:
-            std::cout << "ERROR: pin " << pwm_pin_ << "returned PI_NOT_HPWM_GPIO\n";
-            [[fallthrough]];
-        case PI_BAD_HPWM_DUTY:
-            std::cout << "ERROR: pin " << pwm_pin_ << "returned PI_BAD_HPWM_DUTY\n";
-            [[fallthrough]];
-        case PI_BAD_HPWM_FREQ:
-            std::cout << "ERROR: pin " << pwm_pin_ << "returned PI_BAD_HPWM_FREQ\n";
-            [[fallthrough]];
-        case PI_HPWM_ILLEGAL:
-            std::cout << "ERROR: pin " << pwm_pin_ << "returned PI_HPWM_ILLEGAL\n";
-            [[fallthrough]];
-        default:
-            std::cout << "ERROR: pin " << pwm_pin_ << "errors where found on pin!!!\n";
+    TraceScope trace(TracePoint::PWM_WRITE, pins_.pwm, duty);
+    int r = write_pwm(freq, duty);
+    if (r != OK) {
+        // formatted off the control thread, see DriverLog. A refused duty is expected while latched.
+        if (!refused_by_stop(r)) {
+            DriverLog::instance().log(LogCode::PWM_WRITE_FAILED, pins_.pwm, r);
+        }
+        return r;
     }
+    duty_ = duty;
+    active_freq_ = freq;
     return r;    
 }
 
 int Motor::set_mode_internal(uint pin, uint mode) {
-    switch (int r = gpioSetMode(pin, mode)) {
-        case OK:
-            return r;
-        case PI_BAD_GPIO:
-            std::cout << "ERROR: pin " << pin << "returned PI_BAD_GPIO\n";
-            [[fallthrough]];
-        case PI_BAD_MODE:
-            std::cout << "ERROR: pin " << pin << "returned PI_BAD_MODE\n";
-            [[fallthrough]];
-        case PI_NOT_PERMITTED:
-            std::cout << "ERROR: pin " << pin << "returned PI_NOT_PERMITTED\n";
-            [[fallthrough]];
-        default:
-            std::cout << "ERROR: pin " << pin << "had errors!!!\n";
-            return r;
+    int r = gpioSetMode(pin, mode);
+    if (r != OK) {
+        DriverLog::instance().log(LogCode::SET_MODE_FAILED, pin, r);
+    }
+    return r;
+}
+
+int Motor::write_dir(DIRECTION dir) {
+    TraceScope trace(TracePoint::DIR_WRITE, pins_.dir, dir);
+    int r = DIR_WRITE[pins_.dir_bank][dir](pins_.dir_mask);
+    if (r != OK) {
+        // formatted off the control thread, see DriverLog.
+        DriverLog::instance().log(LogCode::DIR_WRITE_FAILED, pins_.dir, r);
     }
+    return r;
 }
@@ -1,11 +1,16 @@
 #pragma once
 
+#include <algorithm>
 #include <cstddef>
 #include <iostream>
 #include <pigpio.h> 
 #include <thread>
 #include <atomic>
 #include "tst_common.hpp"
+#include "board.hpp"
+#include "driver_log.hpp"
+#include "gpio_runtime.hpp"
+#include "wave_pwm.hpp"
 
 
 enum DIRECTION {
@@ -13,6 +18,21 @@ enum DIRECTION {
     FORWARD = 1,
 };
 
+/**
+ * States of the direction sequencer, see Motor::drive() and Motor::update().
+ *
+ * Flipping dir_pin_ under full duty stresses the H-bridge, so a reversal is sequenced over several
+ * control ticks: RAMP_DOWN -> COAST -> FLIP -> RAMP_UP -> IDLE.
+ */
+enum class DriveState : uint8_t {
+    IDLE = 0,      // duty and direction match the last drive() request.
+    RAMP_DOWN = 1, // stepping duty towards 0 before a direction change.
+    COAST = 2,     // PWM is off, waiting coast_us for the motor to wind down.
+    FLIP = 3,      // direction pin is written on the next update().
+    RAMP_UP = 4,   // stepping duty towards the requested duty.
+    FAULT = 5,     // a hardware write failed, trips EmergencyStop, cleared by on_deactivate().
+};
+
 /**
  * In final versions this should be done as an interface that can be used by concrete classes (may be plugins).
  *
@@ -28,18 +48,39 @@ enum DIRECTION {
 class Motor {
     public:
 
+    ~Motor();
+
     /**
     * Performs configuration, this does not engage the hardware, just sets variables that will
     * be used at later stages.
     *
+    * pi must be a handle returned by GpioRuntime::acquire(), and both pins are claimed from the
+    * runtime so that a pin shared with another Motor or MotorEncoder fails here.
     */
     CallbackReturn on_configure(uint pwm_pin, uint dir_pin, int pi);
 
+    /**
+    * Configure from a pinout checked at compile time, see board.hpp:
+    *
+    *   motor.on_configure(board::LeftWheel::motor, pi);
+    */
+    CallbackReturn on_configure(const MotorPinout &pins, int pi);
+
+    /**
+    * Drive the PWM pin from a channel of wave, any bank 0 GPIO may be used, see wave_pwm.hpp.
+    * The frequency is the wave's, frequencies given to set_pwm() are ignored. wave must outlive the motor,
+    * and is activated by its owner once every motor on it is configured.
+    */
+    CallbackReturn on_configure(const MotorPinout &pins, int pi, WavePwm &wave);
+
     // create links with hardware. Perform error checking, and fail if something goes wrong.
     CallbackReturn on_activate();
 
     CallbackReturn on_deactivate();
 
+    // give pins back to the runtime, motor must be configured again before it can be activated.
+    CallbackReturn on_cleanup();
+
     // set the duty cycle to something that will work for testing.
     int set_pwm(int duty);
 
@@ -48,14 +89,62 @@ class Motor {
     
     CallbackReturn set_direction(DIRECTION dir);
 
+    /**
+     * Set the step size (duty % per update) and coast time used by the sequencer.
+     */
+    CallbackReturn configure_sequencer(int ramp_step, uint32_t coast_us);
+
+    /**
+     * Request a direction and duty, this does not touch hardware. The change is carried out over
+     * subsequent calls to update(), so the control thread never has to sleep between steps.
+     * A new request may be made at any time, including part way through a reversal.
+     *
+     * Calling set_pwm() or set_direction() directly bypasses the sequencer, the next update()
+     * will move the motor back towards the last drive() request.
+     */
+    void drive(DIRECTION dir, int duty);
+
+    /**
+     * Advance the sequencer by one control tick, performing at most one hardware write.
+     *
+     * @param tick current gpioTick(), used to time the coast period.
+     * @return the state after this tick, callers can update other motors while this is not IDLE.
+     */
+    DriveState update(uint32_t tick);
+
+    DriveState state() const { return state_; }
+
+    int duty() const { return duty_; }
+
+    DIRECTION direction() const { return dir_; }
+
+    // frequency of the last PWM write, or the default before the first.
+    int frequency() const { return active_freq_ > 0 ? active_freq_ : freq_; }
+
+    const MotorPinout &pins() const { return pins_; }
+
+    bool software_pwm() const { return wave_ != nullptr; }
+
     // This is not correct, but gives an idea of a method that interacts with
     // the hardware, this will be performed mostly likely through a ROS2 action.
 
  private:
-    uint pwm_pin_ = 0; // set speed of the pin
-    uint dir_pin_ = 0; // set direction.
+    // commits staged values to several motors at once, see motor_group.hpp.
+    friend class MotorGroup;
+
+    MotorPinout pins_; // pwm sets speed, dir sets direction.
     int pi_ = -1;
 
+    // set when the PWM pin is a software PWM channel rather than a hardware PWM pin.
+    WavePwm *wave_ = nullptr;
+    size_t wave_channel_ = 0;
+
+    // claim pins from the runtime once they have been checked.
+    CallbackReturn claim(const MotorPinout &pins, int pi);
+
+    // duty is 0 to 100, written to the hardware PWM channel or the wave channel.
+    int write_pwm(int freq, int duty);
+
     // TC78H660FTG have an adjustable OSCM which means that the frequency can be anything, and since 
     // 
     // The TC78H660FTG brushed DC motor driver accepts input PWM frequencies from DC up to 400 kHz max. For optimal 
@@ -68,6 +157,29 @@ class Motor {
     // be scaled down to give more range, say 0-1000 etc.
     const int DUTY_OFFSET = 10000;
 
+    // last values successfully written to hardware.
+    int duty_ = 0;
+    int active_freq_ = 0;
+    DIRECTION dir_ = BACKWARD;
+
+    // sequencer
+    DriveState state_ = DriveState::IDLE;
+    DIRECTION target_dir_ = BACKWARD;
+    int target_duty_ = 0;
+    int ramp_step_ = 10;
+    uint32_t coast_us_ = 20000;
+    uint32_t coast_start_ = 0;
+
+    // one step of duty towards target, returns false if hardware write failed. A step refused while
+    // EmergencyStop is latched is not a failure, the sequencer keeps waiting for on_deactivate().
+    bool ramp_towards(int target);
+
+    // enter DriveState::FAULT and stop every motor, see emergency_stop.hpp.
+    void fault(uint32_t tick);
+
 
     int set_mode_internal(uint pin, uint mode);
+
+    // write the direction pin through its bank mask. The pin was checked by claim(), so this only returns OK.
+    int write_dir(DIRECTION dir);
 };
\ No newline at end of file
@@ -0,0 +1,364 @@
+#include "motor_controller.hpp"
+#include "emergency_stop.hpp"
+#include "trace.hpp"
+#include <cmath>
+
+namespace {
+    // increment for a counter with a single writer, a plain load and store rather than a locked read-modify-write.
+    template <class T>
+    void bump(std::atomic<T> &counter, T n = 1, std::memory_order order = std::memory_order_relaxed)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + n, order);
+    }
+}
+
+CallbackReturn MotorController::on_configure(
+    const int pi,
+    const int pwm_pin,
+    const int dir_pin,
+    const int en_pin,
+    int timeout,
+    uint32_t min_interval_us,
+    uint32_t pid_frequency_rate,
+    double kp,
+    double ki,
+    double kd,
+    double p_min,
+    double p_max)
+{
+    (void)pid_frequency_rate;
+    (void)kp;
+    (void)ki;
+    (void)kd;
+    (void)p_min;
+    (void)p_max;
+
+    return configure(pi, pwm_pin, dir_pin, en_pin, timeout, min_interval_us, nullptr);
+}
+
+CallbackReturn MotorController::on_configure(
+    const int pi,
+    const int pwm_pin,
+    const int dir_pin,
+    const int en_pin,
+    int timeout,
+    uint32_t min_interval_us,
+    WavePwm &wave)
+{
+    return configure(pi, pwm_pin, dir_pin, en_pin, timeout, min_interval_us, &wave);
+}
+
+CallbackReturn MotorController::configure(int pi, int pwm_pin, int dir_pin, int en_pin, int timeout,
+    uint32_t min_interval_us, WavePwm *wave)
+{
+    callback_ = [this](int gpio_pin, uint32_t delta_us, uint32_t tick, TickStatus tick_status) {
+        this->encoder_cb_(gpio_pin, delta_us, tick, tick_status);
+    };
+
+    // configure motor, pid and encoder.
+    CallbackReturn motor_result = wave == nullptr
+        ? motor_.on_configure(pwm_pin, dir_pin, pi)
+        : motor_.on_configure(make_motor_pinout(pwm_pin, dir_pin), pi, *wave);
+    if (motor_result == CallbackReturn::FAILURE ||
+        encoder_.on_configure(en_pin, callback_, timeout, min_interval_us) == CallbackReturn::FAILURE) {
+        callback_ = nullptr;
+        return CallbackReturn::FAILURE;
+    }
+    pwm_pin_ = pwm_pin;
+    en_pin_ = en_pin;
+    return CallbackReturn::SUCCESS;
+}
+
+CallbackReturn MotorController::on_activate()
+{
+    if (motor_.on_activate() != CallbackReturn::SUCCESS) {
+        return CallbackReturn::FAILURE;
+    }
+
+    // dont rollback, this will call two deactivates for motor,
+    // which may not be what is needed.
+    if (encoder_.on_activate() != CallbackReturn::SUCCESS) {
+        return CallbackReturn::FAILURE;
+    }
+    estimator_.on_activate();
+    estimated_pulses_ = edge_.healthy_pulses.load(std::memory_order_acquire);
+    counted_edges_ = edge_.edges.load(std::memory_order_relaxed);
+    activated_edges_ = counted_edges_;
+    estimated_edges_ = counted_edges_;
+    running_.store(true, std::memory_order_release);
+
+    return CallbackReturn::SUCCESS;
+}
+
+CallbackReturn MotorController::on_deactivate()
+{
+    running_.store(false, std::memory_order_release);
+    auto enc_result = encoder_.on_deactivate(); // stop interrupts first
+    auto motor_result = motor_.on_deactivate(); // then stop PWM
+    callback_ = nullptr;
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+
+    // the callback has stopped, this thread is now velocity's only writer.
+    sample_.velocity.store(0, std::memory_order_release);
+
+    window_.reset();
+    publish(DIRECTION::FORWARD, 0, 0);
+
+    return (enc_result == CallbackReturn::SUCCESS && motor_result == CallbackReturn::SUCCESS)
+        ? CallbackReturn::SUCCESS
+        : CallbackReturn::FAILURE;
+}
+
+CallbackReturn MotorController::attach_stall_detector(TimerWheel &wheel, uint32_t timeout_us)
+{
+    if (en_pin_ < 0) {
+        std::cout << "ERROR: stall detector attached before configuration\n";
+        return CallbackReturn::FAILURE;
+    }
+    if (stall_wheel_ != nullptr) {
+        stall_wheel_->remove(stall_id_);
+    }
+
+    int id = wheel.add(en_pin_, timeout_us,
+        [this](int gpio_pin, uint32_t delta_us, uint32_t tick, TickStatus tick_status) {
+            this->stall_cb_(gpio_pin, delta_us, tick, tick_status);
+        });
+    if (id < 0) {
+        std::cout << "ERROR: stall detector is full\n";
+        stall_wheel_ = nullptr;
+        return CallbackReturn::FAILURE;
+    }
+    stall_wheel_ = &wheel;
+    stall_id_ = id;
+    return CallbackReturn::SUCCESS;
+}
+
+bool MotorController::is_stalled() const
+{
+    return stall_wheel_ != nullptr && stall_wheel_->is_stalled(stall_id_);
+}
+
+uint32_t MotorController::time_since_last_pulse() const
+{
+    return stall_wheel_ == nullptr ? 0 : stall_wheel_->time_since_last_edge(stall_id_);
+}
+
+CallbackReturn MotorController::configure_estimator(double jerk_density, double period_sigma_us,
+    double duty_gain, double duty_deadband, double duty_sigma)
+{
+    return estimator_.on_configure(jerk_density, period_sigma_us, duty_gain, duty_deadband, duty_sigma);
+}
+
+void MotorController::estimate(double dt)
+{
+    TraceScope trace(TracePoint::ESTIMATE, en_pin_);
+    estimator_.predict(dt);
+
+    int healthy = edge_.healthy_pulses.load(std::memory_order_acquire);
+    if (healthy != estimated_pulses_) {
+        // the edge that brought the count to healthy is the one this estimate consumes.
+        Tracer::flow_end(trace_flow_id(en_pin_, static_cast<uint32_t>(healthy)));
+        estimated_pulses_ = healthy;
+        estimator_.update_period(edge_.last_period_us.load(std::memory_order_relaxed));
+    }
+
+    // the position is every edge since on_activate() reset the estimator, glitches and slow edges still move the
+    // wheel, only their period is not trusted.
+    int edges = edge_.edges.load(std::memory_order_relaxed);
+    if (edges != estimated_edges_) {
+        estimated_edges_ = edges;
+        estimator_.update_counts(edges - activated_edges_);
+    }
+    estimator_.update_duty(motor_.duty());
+}
+
+void MotorController::publish(DIRECTION direction, double duty_cycle, int freq)
+{
+    motor_.set_direction(direction);
+    motor_.set_pwm(freq, duty_cycle);
+}
+
+void MotorController::subscribe(TelemetryPublisher &telemetry, uint16_t idx) const
+{
+    MotorTelemetry snapshot {};
+    fill_telemetry(snapshot);
+    telemetry.publish(idx, snapshot);
+}
+
+int MotorController::get_counts_reset()
+{
+    int edges = edge_.edges.load(std::memory_order_relaxed);
+    int counts = edges - counted_edges_;
+    counted_edges_ = edges;
+    return motor_.direction() == DIRECTION::FORWARD ? counts : -counts;
+}
+
+double MotorController::velocity() const
+{
+    // a stall the last sample has not seen means the wheel stopped after it. stalls_seen is stored after velocity,
+    // so the velocity read here is at least as new as the stalls it was computed after.
+    int stalls = counters_[CONTROL_COUNTERS].stall_events.load(std::memory_order_acquire);
+    if (sample_.stalls_seen.load(std::memory_order_acquire) != stalls) {
+        return 0.0;
+    }
+    return fixed::to_double(sample_.velocity.load(std::memory_order_relaxed));
+}
+
+ControllerCounters MotorController::counters() const
+{
+    ControllerCounters c;
+    for (const CounterBlock &block : counters_) {
+        c.total_pulses += block.total_pulses.load(std::memory_order_relaxed);
+        c.boundary_triggers += block.boundary_triggers.load(std::memory_order_relaxed);
+        c.stall_events += block.stall_events.load(std::memory_order_relaxed);
+    }
+    c.healthy_pulses = edge_.healthy_pulses.load(std::memory_order_relaxed);
+    return c;
+}
+
+void MotorController::print_diagnostics()
+{
+    ControllerCounters c = counters();
+    int total = c.total_pulses;
+    int healthy = c.healthy_pulses;
+    int triggers = c.boundary_triggers;
+
+    std::cout << "Total pulses: " << total << "\n";
+    std::cout << "Healthy pulses: " << healthy << " ("
+              << (100.0 * healthy / total) << "%)\n";
+    std::cout << "Rejected pulses: " << (total - healthy) << " ("
+              << (100.0 * (total - healthy) / total) << "%)\n";
+    std::cout << "Boundary triggers: " << triggers << "\n";
+    std::cout << "Stall events: " << c.stall_events << "\n";
+    std::cout << "PWM pin errors: " << DriverLog::instance().error_count(pwm_pin_) << "\n";
+    std::cout << "Expected rotations: " << (total / PPR_) << "\n";
+    std::cout << "Estimated velocity: " << estimator_.velocity() << " +/- "
+              << std::sqrt(estimator_.covariance()(1, 1)) << " pps\n";
+
+    PulseStatsSnapshot stats = interval_stats();
+    std::cout << "Interval mean: " << stats.mean_us << "us stddev: " << stats.stddev() << "us"
+              << " min: " << stats.min_us << "us max: " << stats.max_us << "us\n";
+    std::cout << "Interval p50: " << stats.percentile(0.5) << "us p90: " << stats.percentile(0.9)
+              << "us p99: " << stats.percentile(0.99) << "us\n";
+    std::cout << "Noise rejected: " << stats.rejected_count(TickStatus::NOISE_REJECTED)
+              << " timeouts: " << stats.rejected_count(TickStatus::TIMEOUT)
+              << " unexpected: " << stats.rejected_count(TickStatus::UNEXPECTED) << "\n";
+}
+
+void MotorController::fill_telemetry(MotorTelemetry &telemetry) const
+{
+    telemetry.tick = gpioTick();
+    telemetry.pwm_pin = pwm_pin_;
+    telemetry.duty = motor_.duty();
+    telemetry.direction = motor_.direction();
+    telemetry.drive_state = static_cast<int32_t>(motor_.state());
+    telemetry.stalled = is_stalled() ? 1 : 0;
+
+    telemetry.velocity = velocity();
+    telemetry.est_position = estimator_.position();
+    telemetry.est_velocity = estimator_.velocity();
+    telemetry.est_acceleration = estimator_.acceleration();
+    telemetry.est_velocity_var = estimator_.covariance()(1, 1);
+
+    ControllerCounters c = counters();
+    telemetry.total_pulses = c.total_pulses;
+    telemetry.healthy_pulses = c.healthy_pulses;
+    telemetry.boundary_triggers = c.boundary_triggers;
+    telemetry.stall_events = c.stall_events;
+
+    PulseStatsSnapshot stats = interval_stats();
+    telemetry.interval_mean_us = stats.mean_us;
+    telemetry.interval_stddev_us = stats.stddev();
+    telemetry.interval_p50_us = stats.percentile(0.5);
+    telemetry.interval_p99_us = stats.percentile(0.99);
+    telemetry.noise_rejected = static_cast<uint32_t>(stats.rejected_count(TickStatus::NOISE_REJECTED));
+    telemetry.timeouts = static_cast<uint32_t>(stats.rejected_count(TickStatus::TIMEOUT));
+}
+
+void MotorController::encoder_cb_(
+    const int gpio_pin,
+    const uint32_t delta_us,
+    const uint32_t tick,
+    const TickStatus tick_status)
+{
+    if (tick_status == TickStatus::UNEXPECTED) {
+        // straight from this thread, waiting for the control thread would leave the wheels driven meanwhile.
+        EmergencyStop::instance().trip(FaultCause::ENCODER_UNEXPECTED, gpio_pin, tick);
+        return;
+    }
+    if (!running_.load(std::memory_order_acquire)) {
+        return;
+    }
+
+    EdgeState &edge = edge_;
+    CounterBlock &counters = counters_[CALLBACK_COUNTERS];
+    bump(counters.total_pulses);
+    if (tick_status == TickStatus::HEALTHY) {
+        bump(edge.edges);
+    }
+
+    // Accumulate timing (ONCE!)
+    bool healthy_delta = tick_status == TickStatus::HEALTHY && delta_us > MIN_DELTA_US && delta_us < MAX_DELTA_US;
+    if (healthy_delta) {
+        if (stall_wheel_ != nullptr) {
+            stall_wheel_->touch(stall_id_, tick);
+        }
+        edge.last_period_us.store(delta_us, std::memory_order_relaxed);
+        // released after last_period_us, estimate() reads the period that goes with the count.
+        int healthy = edge.healthy_pulses.load(std::memory_order_relaxed) + 1;
+        edge.healthy_pulses.store(healthy, std::memory_order_release);
+        Tracer::flow_begin(trace_flow_id(gpio_pin, static_cast<uint32_t>(healthy)));
+    }
+
+    // Check if THIS interrupt brought us to exactly PPR
+    if (!window_.add(healthy_delta, delta_us, tick)) {
+        return;
+    }
+    bump(counters.boundary_triggers);
+
+    // the window just retired, written by this thread so the copy always succeeds.
+    PulseWindow window;
+    window_.retired(window);
+    uint32_t accum = window.accum_us;
+    int ct = window.healthy;
+
+    // ct healthy periods in a window of PPR_ pulses, ct can not exceed PPR_.
+    if (accum > 0 && ct > 0 && ct <= PPR_) {
+        auto new_vel = static_cast<fixed::q16_t>(VELOCITY_SCALE[ct] / accum);
+        // the average restarts from 0 after a stall, the wheel stopped since the last window.
+        int stalls = counters_[CONTROL_COUNTERS].stall_events.load(std::memory_order_acquire);
+        fixed::q16_t current_vel = 0;
+        if (sample_.stalls_seen.load(std::memory_order_relaxed) == stalls) {
+            current_vel = sample_.velocity.load(std::memory_order_relaxed);
+        }
+        fixed::q16_t smoothed_vel = fixed::ema<VELOCITY_ALPHA>(current_vel, new_vel);
+        sample_.velocity.store(smoothed_vel, std::memory_order_relaxed);
+        sample_.stalls_seen.store(stalls, std::memory_order_release);
+        Tracer::instant(TracePoint::VELOCITY, gpio_pin, fixed::to_milli(smoothed_vel));
+
+        sample_.sample_tick.store(tick, std::memory_order_relaxed);
+        bump(sample_.samples, 1u, std::memory_order_release);
+        if (sample_event_ != nullptr) {
+            sample_event_->notify();
+        }
+    }
+}
+
+void MotorController::stall_cb_(
+    const int gpio_pin,
+    const uint32_t delta_us,
+    const uint32_t tick,
+    const TickStatus tick_status)
+{
+    (void)gpio_pin;
+    (void)delta_us;
+    (void)tick;
+
+    if (tick_status != TickStatus::TIMEOUT || !running_.load(std::memory_order_acquire)) {
+        return;
+    }
+
+    // no pulses within the timeout, the wheel is not turning so the last velocity no longer applies. Only counted
+    // here, velocity() and the next window see the new count, sample_ stays the callback's alone.
+    bump(counters_[CONTROL_COUNTERS].stall_events, 1, std::memory_order_release);
+}
@@ -1,33 +1,119 @@
 #pragma once
 
+#include "control_event.hpp"
+#include "encoder.hpp"
+#include "fixed_point.hpp"
+#include "kalman.hpp"
+#include "motor.hpp"
+#include "telemetry.hpp"
+#include "timer_wheel.hpp"
+#include "tst_common.hpp"
+#include "window_accumulator.hpp"
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Pulse counters, summed from the blocks each thread writes, see MotorController::counters().
+ */
+struct ControllerCounters {
+    int total_pulses = 0;
+    int healthy_pulses = 0;
+    int boundary_triggers = 0;
+    int stall_events = 0;
+};
 
 /**
  * Keeps record of velocity of motors.
- * When activated will begin record keeping, reporting pulses, and time duration in ms. 
+ * When activated will begin record keeping, reporting pulses, and time duration in ms.
+ *
+ * Owns the Motor and MotorEncoder for a single wheel, velocity is derived from the encoder
+ * callback every PPR_ pulses.
+ *
+ * The state shared with the encoder callback is split into cache line aligned blocks by the thread that writes
+ * it, so the control thread reading velocity() is not invalidated by every edge, and the callback's counters
+ * are not bounced by readers:
+ *
+ *   EdgeState     the healthy period and the counts estimate() and get_counts_reset() read, written on every
+ *                 edge
+ *   window_       the PPR_ window, double buffered so it can be read whole off the callback thread, see
+ *                 window_accumulator.hpp
+ *   SampleState   velocity and sample count, written once per PPR_ window
+ *   counters_     diagnostics, one CounterBlock per thread that counts
+ *
+ * Every edge backend calls one pin's callback from a single thread, and the stall detector runs on the control
+ * thread, so each block has one writer and is updated with a relaxed load and store instead of locked
+ * read-modify-writes. counters() sums the blocks on read. A stall does not touch SampleState, velocity() reads
+ * 0 until the callback closes a window after it, and that window's average restarts from 0.
  */
-class MotorEncoder {
-    public:
+class MotorController
+{
+  public:
+    // TODO: Ignore PID variables kp, ki, kd, p_min, and p_max for now these will be re-introduced.
+    CallbackReturn on_configure(
+        const int pi,
+        const int pwm_pin,
+        const int dir_pin,
+        const int en_pin,
+        int timeout,
+        uint32_t min_interval_us,
+        uint32_t pid_frequency_rate,
+        double kp,
+        double ki,
+        double kd,
+        double p_min,
+        double p_max);
 
     /**
-     * Get encoder counts since last call and reset counter
-     * Useful for position tracking
+     * Configure from a wheel checked at compile time, see board.hpp:
+     *
+     *   cntl.on_configure(pi, board::LeftWheel {}, TIMEOUT, ...);
      */
-    int get_counts_reset();
+    template <class PwmPin, class DirPin, class EncPin>
+    CallbackReturn on_configure(
+        const int pi,
+        WheelPins<PwmPin, DirPin, EncPin> pins,
+        int timeout,
+        uint32_t min_interval_us,
+        uint32_t pid_frequency_rate,
+        double kp,
+        double ki,
+        double kd,
+        double p_min,
+        double p_max)
+    {
+        return on_configure(pi, pins.pwm, pins.dir, pins.enc, timeout, min_interval_us, pid_frequency_rate,
+            kp, ki, kd, p_min, p_max);
+    }
 
     /**
-     * Get current velocity in pulses per second 
-     * Updated on every encoder edge for responsiveness
-     *
-     * signed for direction.
+     * Configure with the PWM pin driven by a channel of wave instead of hardware PWM, any header pin can then be
+     * used, see Motor::on_configure(). wave must outlive the controller.
      */
-    double velocity_pps() const;
+    CallbackReturn on_configure(
+        const int pi,
+        const int pwm_pin,
+        const int dir_pin,
+        const int en_pin,
+        int timeout,
+        uint32_t min_interval_us,
+        WavePwm &wave);
+
+    CallbackReturn on_activate();
 
+    CallbackReturn on_deactivate();
 
     /**
-     * Get current angular velocity in rad/s (signed for direction)
-     * Calculated as: (velocity_pps / ppr) * 2π
+     * Register the encoder with a shared stall detector. The wheel is driven by the control thread,
+     * and reports a timeout when no healthy pulse has been seen for timeout_us.
      */
-    double angular_velocity() const;
+    CallbackReturn attach_stall_detector(TimerWheel &wheel, uint32_t timeout_us);
+
+    /**
+     * Check if encoder appears to be stalled
+     * Returns true if no pulses detected within the timeout given to attach_stall_detector()
+     */
+    bool is_stalled() const;
 
     /**
     * Get time since last encoder pulse in microseconds
@@ -36,35 +122,161 @@ class MotorEncoder {
     uint32_t time_since_last_pulse() const;
 
     /**
-     * Check if encoder appears to be stalled
-     * Returns true if no pulses detected for timeout_ms
+     * Configure the Kalman filter run by estimate(), see VelocityKalman::on_configure().
      */
-    bool is_stalled(uint32_t timeout_ms = 100) const;
-    
+    CallbackReturn configure_estimator(double jerk_density, double period_sigma_us,
+        double duty_gain, double duty_deadband, double duty_sigma);
+
     /**
-     * Reset all counters and state
+     * Run the estimator for one control tick of dt seconds, fusing any healthy encoder period that
+     * arrived since the last call and the currently commanded duty. Call from the control thread.
      */
-    void reset();
-
-    private:
-
-    int ppr_ = 0;     // pulses per revolution
-    int pin_a_ = 0;   // first pin hit if spinning clockwise
-    int pin_b_ = 0;   // second pin hit if spinning counter-clockwise
-
-    std::atomic<int> total_counts_{0};     // Cumulative count (signed)
-    std::atomic<double> velocity_pps_{0.0}; // Current velocity (pulses/sec)
-    std::atomic<uint32_t> last_tick_{0};    // Last pulse timestamp
-    std::atomic<uint8_t> last_state_{0};    // Previous AB state
-    
-    // Quadrature decoding lookup table
-    static const int8_t quadrature_table_[16];
-    
-    // Static callback for pigpio
-    static void encoder_callback_a(int gpio, int level, uint32_t tick);
-    static void encoder_callback_b(int gpio, int level, uint32_t tick);
-    
-    // Instance callback
-    void processEncoder(uint32_t tick);
-};
+    void estimate(double dt);
+
+    const VelocityKalman &estimator() const { return estimator_; }
 
+    // rotations/s from the encoder callback, smoothed over PPR_ pulses, 0 after a stall. Kept in fixed point,
+    // converted here.
+    double velocity() const;
+
+    /**
+     * Notify event every time the encoder callback closes a PPR_ window, see ControlTrigger::EVENT. Set before
+     * on_activate(), nullptr stops notifying.
+     */
+    void set_sample_event(ControlEvent *event) { sample_event_ = event; }
+
+    // PPR_ windows closed since configuration, a change means velocity() holds a new sample.
+    uint32_t samples() const { return sample_.samples.load(std::memory_order_acquire); }
+
+    // gpioTick() of the edge that closed the last window.
+    uint32_t sample_tick() const { return sample_.sample_tick.load(std::memory_order_relaxed); }
+
+    // every encoder edge seen while active, healthy or not.
+    int pulses() const { return counters().total_pulses; }
+
+    /**
+     * Encoder edges since the last call, signed by the direction the motor is driven in, for position tracking.
+     * Unlike healthy pulses, edges outside the delta limits still count, a slow wheel still moves. The encoder is
+     * single channel, so an edge from a wheel still coasting after the direction pin flipped is counted the new
+     * way, the sequencer's coast keeps those few. Call from the control thread.
+     */
+    int get_counts_reset();
+
+    ControllerCounters counters() const;
+
+    /**
+     * The last closed PPR_ window, safe from any thread, see WindowAccumulator.
+     *
+     * @return false if no window has closed since activation.
+     */
+    bool last_window(PulseWindow &window) const { return window_.retired(window); }
+
+    int pwm_pin() const { return pwm_pin_; }
+
+    void publish(DIRECTION direction, double duty_cycle, int freq);
+
+    /**
+     * Request a direction and duty through the motor's sequencer, applied by update_drive(), see Motor::drive().
+     */
+    void drive(DIRECTION direction, int duty) { motor_.drive(direction, duty); }
+
+    DriveState update_drive(uint32_t tick) { return motor_.update(tick); }
+
+    /**
+     * Publish velocity, duty, direction and the rest of fill_telemetry() as motor idx of telemetry, read it
+     * with TelemetryReader (tst_telemetry). Call from the control thread.
+     */
+    void subscribe(TelemetryPublisher &telemetry, uint16_t idx) const;
+
+    void print_diagnostics();
+
+    /**
+     * Snapshot of the controller for TelemetryPublisher, call from the control thread.
+     */
+    void fill_telemetry(MotorTelemetry &telemetry) const;
+
+    // delta_us distribution seen by the encoder, see PulseStats.
+    PulseStatsSnapshot interval_stats() const { return encoder_.stats().snapshot(); }
+
+  protected:
+    void encoder_cb_(
+        const int gpio_pin,
+        const uint32_t delta_us,
+        const uint32_t tick,
+        const TickStatus tick_status);
+
+    // called by the stall detector from the control thread.
+    void stall_cb_(
+        const int gpio_pin,
+        const uint32_t delta_us,
+        const uint32_t tick,
+        const TickStatus tick_status);
+
+  private:
+    // wave is nullptr for hardware PWM.
+    CallbackReturn configure(int pi, int pwm_pin, int dir_pin, int en_pin, int timeout, uint32_t min_interval_us,
+        WavePwm *wave);
+
+    // limit variables
+    static constexpr uint32_t MIN_DELTA_US = 300;
+    static constexpr uint32_t MAX_DELTA_US = 3000;
+    static constexpr int PPR_ = 8;
+
+    // written by the encoder callback on every edge.
+    struct alignas(64) EdgeState {
+        std::atomic<uint32_t> last_period_us {0}; // most recent healthy delta
+        std::atomic<int> edges {0};               // edges of the expected level, see get_counts_reset()
+        std::atomic<int> healthy_pulses {0};      // released after last_period_us, see estimate()
+    };
+
+    // written by the encoder callback once per PPR_ window.
+    struct alignas(64) SampleState {
+        std::atomic<fixed::q16_t> velocity {0}; // rotations/s, Q16.16
+        std::atomic<uint32_t> samples {0};       // windows closed, see samples()
+        std::atomic<uint32_t> sample_tick {0};
+        std::atomic<int> stalls_seen {0};        // stall_events of the control block when velocity was stored
+    };
+
+    // diagnoses variables, each thread only writes its own block.
+    enum CounterThread { CALLBACK_COUNTERS, CONTROL_COUNTERS, COUNTER_THREADS };
+    struct alignas(64) CounterBlock {
+        std::atomic<int> total_pulses {0};
+        std::atomic<int> boundary_triggers {0};
+        std::atomic<int> stall_events {0};
+    };
+
+    EdgeState edge_;
+    WindowAccumulator<PPR_> window_; // healthy deltas, at most PPR_ * MAX_DELTA_US per window
+    SampleState sample_;
+    std::array<CounterBlock, COUNTER_THREADS> counters_;
+
+    // read by the encoder callback on every edge, only written while the encoder is not running.
+    alignas(64) std::atomic<bool> running_ {false};
+    ControlEvent *sample_event_ = nullptr; // see set_sample_event()
+
+    // stall detection, shared between controllers.
+    TimerWheel *stall_wheel_ = nullptr;
+    int stall_id_ = -1;
+
+    // estimator, only touched by the control thread. Aligned so its writes do not share running_'s line.
+    alignas(64) VelocityKalman estimator_;
+    int estimated_pulses_ = 0; // edge_.healthy_pulses at the last estimate()
+    int estimated_edges_ = 0;  // edge_.edges at the last estimate()
+    int activated_edges_ = 0;  // edge_.edges at on_activate(), position 0 of the estimator
+    int counted_edges_ = 0;    // edge_.edges at the last get_counts_reset()
+    int pwm_pin_ = -1;
+    int en_pin_ = -1;
+
+    // Drivers
+    MotorEncoder encoder_;
+    Motor motor_;
+
+    // callbacks
+    EncoderTickCallback callback_ {nullptr};
+
+    // see fixed::velocity_scale(), indexed by the healthy periods in a window.
+    static constexpr std::array<uint64_t, PPR_ + 1> VELOCITY_SCALE = fixed::velocity_scale<PPR_>();
+
+    // weight of a new PPR_ window in sample_.velocity, 77 / 256 ~ 0.3.
+    static constexpr int VELOCITY_ALPHA = 77;
+};
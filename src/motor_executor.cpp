@@ -0,0 +1,572 @@
+#include "motor_executor.hpp"
+#include "alloc_tracker.hpp"
+#include "gpio_runtime.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+static_assert(TELEMETRY_STAGES == static_cast<size_t>(ExecutorStage::COUNT), "LoopTelemetry needs every stage");
+
+namespace {
+    uint64_t now_ns()
+    {
+        struct timespec ts {};
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+    }
+
+    void add_ns(struct timespec &ts, uint64_t ns)
+    {
+        ts.tv_nsec += static_cast<long>(ns);
+        while (ts.tv_nsec >= 1000000000L) {
+            ts.tv_nsec -= 1000000000L;
+            ts.tv_sec++;
+        }
+    }
+
+    uint64_t to_ns(const struct timespec &ts)
+    {
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+    }
+}
+
+void MotorExecutor::StageTiming::record(uint64_t ns)
+{
+    samples.store(samples.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    total_ns.store(total_ns.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+    last_ns.store(ns, std::memory_order_relaxed);
+    if (ns > max_ns.load(std::memory_order_relaxed)) {
+        max_ns.store(ns, std::memory_order_relaxed);
+    }
+    auto &counter = histogram[StageTimingSnapshot::bucket(ns)];
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+int StageTimingSnapshot::bucket(uint64_t ns)
+{
+    if (ns < SUB) {
+        return static_cast<int>(ns);
+    }
+    int m = 63 - __builtin_clzll(ns);
+    int idx = (m - SUB_BITS + 1) * static_cast<int>(SUB) + static_cast<int>((ns >> (m - SUB_BITS)) & (SUB - 1));
+    return std::min(idx, BUCKETS - 1);
+}
+
+uint64_t StageTimingSnapshot::bucket_upper(int idx)
+{
+    if (idx < static_cast<int>(SUB)) {
+        return static_cast<uint64_t>(idx);
+    }
+    int m = idx / static_cast<int>(SUB) + SUB_BITS - 1;
+    return ((SUB + idx % SUB + 1) << (m - SUB_BITS)) - 1;
+}
+
+uint64_t StageTimingSnapshot::percentile(double q) const
+{
+    if (samples == 0) {
+        return 0;
+    }
+    uint64_t total = 0;
+    for (uint32_t c : histogram) {
+        total += c;
+    }
+    uint64_t target = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * static_cast<double>(total))));
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += histogram[i];
+        if (seen >= target) {
+            return std::min(bucket_upper(i), max_ns);
+        }
+    }
+    return max_ns;
+}
+
+MotorExecutor::~MotorExecutor()
+{
+    on_deactivate();
+}
+
+CallbackReturn MotorExecutor::on_configure(uint32_t period_us, uint32_t control_divider, uint32_t stall_timeout_us)
+{
+    if (running_.load() || period_us == 0 || control_divider == 0) {
+        std::cout << "ERROR: executor needs a period and control divider, and must not be running\n";
+        return CallbackReturn::FAILURE;
+    }
+    if (stall_timeout_us > 0 && stall_wheel_.on_configure(period_us) == CallbackReturn::FAILURE) {
+        return CallbackReturn::FAILURE;
+    }
+    period_us_ = period_us;
+    control_divider_ = control_divider;
+    stall_timeout_us_ = stall_timeout_us;
+    control_dt_ = static_cast<double>(period_us) * control_divider / 1.0e6;
+    return CallbackReturn::SUCCESS;
+}
+
+CallbackReturn MotorExecutor::configure_position(size_t idx, double kp, double ki, double kd, double max_pps,
+    uint32_t position_divider, uint32_t tolerance)
+{
+    if (running_.load() || idx >= motor_ct_ || position_divider == 0 || max_pps <= 0.0) {
+        std::cout << "ERROR: position loop needs an added motor, a divider and a speed limit, and must not be running\n";
+        return CallbackReturn::FAILURE;
+    }
+    ControlSlot &slot = slots_[idx];
+    if (slot.position_pid.on_configure(kp, ki, kd, -max_pps, max_pps) == CallbackReturn::FAILURE) {
+        return CallbackReturn::FAILURE;
+    }
+    slot.position_period_ns = static_cast<uint64_t>(period_us_) * control_divider_ * position_divider * 1000ULL;
+    slot.position_tolerance = tolerance;
+    return CallbackReturn::SUCCESS;
+}
+
+CallbackReturn MotorExecutor::set_trigger(ControlTrigger trigger, uint32_t min_interval_us)
+{
+    if (running_.load()) {
+        std::cout << "ERROR: executor trigger can only be changed while deactivated\n";
+        return CallbackReturn::FAILURE;
+    }
+    trigger_ = trigger;
+    min_interval_ns_ = static_cast<uint64_t>(min_interval_us) * 1000ULL;
+    return CallbackReturn::SUCCESS;
+}
+
+int MotorExecutor::add_motor(int pi, int pwm_pin, int dir_pin, int en_pin, int timeout, uint32_t min_interval_us,
+    double kp, double ki, double kd, double p_min, double p_max, int phase)
+{
+    if (period_us_ == 0 || running_.load()) {
+        std::cout << "ERROR: motors must be added after on_configure and before on_activate\n";
+        return -1;
+    }
+    if (motor_ct_ >= MAX_MOTORS) {
+        std::cout << "ERROR: executor is limited to " << MAX_MOTORS << " motors\n";
+        return -1;
+    }
+
+    size_t idx = motor_ct_;
+    MotorController &cntl = controllers_[idx];
+    ControlSlot &slot = slots_[idx];
+    const bool software_pwm = wave_ != nullptr && pwm_pin >= 0 && !GpioRuntime::hardware_pwm_pin(pwm_pin);
+    CallbackReturn cntl_result = software_pwm
+        ? cntl.on_configure(pi, pwm_pin, dir_pin, en_pin, timeout, min_interval_us, *wave_)
+        : cntl.on_configure(pi, pwm_pin, dir_pin, en_pin, timeout, min_interval_us,
+              period_us_ * control_divider_ / 1000, kp, ki, kd, p_min, p_max);
+    if (cntl_result == CallbackReturn::FAILURE ||
+        slot.pid.on_configure(kp, ki, kd, p_min, p_max) == CallbackReturn::FAILURE) {
+        return -1;
+    }
+    if (stall_timeout_us_ > 0 && cntl.attach_stall_detector(stall_wheel_, stall_timeout_us_) == CallbackReturn::FAILURE) {
+        return -1;
+    }
+
+    slot.phase = static_cast<uint32_t>(phase < 0 ? idx : static_cast<size_t>(phase)) % control_divider_;
+    motor_ct_++;
+    return static_cast<int>(idx);
+}
+
+CallbackReturn MotorExecutor::on_activate()
+{
+    if (running_.load()) {
+        return CallbackReturn::SUCCESS;
+    }
+    if (motor_ct_ == 0) {
+        std::cout << "ERROR: executor has no motors\n";
+        return CallbackReturn::FAILURE;
+    }
+    if (trigger_ == ControlTrigger::EVENT && event_.on_configure() == CallbackReturn::FAILURE) {
+        return CallbackReturn::FAILURE;
+    }
+
+    const uint64_t activated_ns = now_ns();
+    for (size_t i = 0; i < motor_ct_; i++) {
+        controllers_[i].set_sample_event(trigger_ == ControlTrigger::EVENT ? &event_ : nullptr);
+        if (controllers_[i].on_activate() == CallbackReturn::FAILURE) {
+            std::cout << "ERROR: motor " << i << " failed to activate\n";
+            for (size_t j = 0; j <= i; j++) {
+                controllers_[j].on_deactivate();
+            }
+            return CallbackReturn::FAILURE;
+        }
+        ControlSlot &slot = slots_[i];
+        slot.pid.on_activate();
+        slot.setpoint.store(0.0, std::memory_order_relaxed);
+        slot.velocity = 0.0;
+        slot.duty = 0;
+        slot.direction = DIRECTION::FORWARD;
+        slot.samples = controllers_[i].samples();
+        slot.last_run_ns = activated_ns;
+        slot.position_pid.on_activate();
+        slot.position.store(0, std::memory_order_relaxed);
+        slot.position_target.store(0, std::memory_order_relaxed);
+        slot.position_mode.store(false, std::memory_order_relaxed);
+        slot.positioning = false;
+        slot.position_pps = 0.0;
+        slot.last_position_ns = activated_ns;
+    }
+    if (stall_timeout_us_ > 0) {
+        stall_wheel_.on_activate();
+    }
+
+    cycle_ = 0;
+    reset_timing();
+    event_wakeups_.store(0, std::memory_order_relaxed);
+    active_ = true;
+    running_.store(true, std::memory_order_release);
+    thread_ = std::thread(&MotorExecutor::run, this);
+
+    // with RtMode on the thread sets its own priority and affinity.
+    if (!RtMode::instance().enabled()) {
+        sched_param param {};
+        param.sched_priority = RT_PRIORITY;
+        if (pthread_setschedparam(thread_.native_handle(), SCHED_FIFO, &param) != 0) {
+            std::cout << "WARNING: executor is not running SCHED_FIFO, run as root for real time scheduling\n";
+        }
+    }
+    // everything the hot path needs is allocated by now, from here the tick and the encoder callbacks must not.
+    AllocTracker::arm();
+    return CallbackReturn::SUCCESS;
+}
+
+CallbackReturn MotorExecutor::on_deactivate()
+{
+    if (running_.exchange(false, std::memory_order_acq_rel) && thread_.joinable()) {
+        thread_.join();
+    }
+    AllocTracker::disarm();
+    if (!active_) {
+        return CallbackReturn::SUCCESS;
+    }
+    active_ = false;
+    if (stall_timeout_us_ > 0) {
+        stall_wheel_.on_deactivate();
+    }
+    for (size_t i = 0; i < motor_ct_; i++) {
+        controllers_[i].on_deactivate();
+        controllers_[i].set_sample_event(nullptr);
+        slots_[i].pid.on_deactivate();
+        slots_[i].position_pid.on_deactivate();
+    }
+    event_.on_cleanup();
+    return CallbackReturn::SUCCESS;
+}
+
+void MotorExecutor::set_setpoint(size_t idx, double pps)
+{
+    if (idx < motor_ct_) {
+        slots_[idx].setpoint.store(pps, std::memory_order_relaxed);
+        slots_[idx].position_mode.store(false, std::memory_order_release);
+    }
+}
+
+void MotorExecutor::set_position_target(size_t idx, int64_t counts)
+{
+    if (idx < motor_ct_ && slots_[idx].position_period_ns > 0) {
+        slots_[idx].position_target.store(counts, std::memory_order_relaxed);
+        slots_[idx].position_mode.store(true, std::memory_order_release);
+    }
+}
+
+void MotorExecutor::tick(uint32_t gpio_tick)
+{
+    for (size_t i = 0; i < motor_ct_; i++) {
+        ControlSlot &slot = slots_[i];
+        slot.due = cycle_ % control_divider_ == slot.phase;
+        slot.dt = control_dt_;
+    }
+    run_stages(gpio_tick, true);
+}
+
+bool MotorExecutor::select_events(uint64_t now, bool periodic, uint64_t &retry_ns)
+{
+    const uint64_t period_ns = static_cast<uint64_t>(period_us_) * 1000ULL;
+    const uint64_t fallback_ns = period_ns * control_divider_;
+    bool any = false;
+    for (size_t i = 0; i < motor_ct_; i++) {
+        ControlSlot &slot = slots_[i];
+        const uint64_t since = now - slot.last_run_ns;
+        const bool fresh = controllers_[i].samples() != slot.samples;
+        // half a period of slack, so the fallback is not pushed a whole period out by wakeup jitter.
+        slot.due = periodic && since + period_ns / 2 >= fallback_ns;
+        if (!slot.due && fresh) {
+            slot.due = since >= min_interval_ns_;
+            if (!slot.due) {
+                retry_ns = std::min(retry_ns, slot.last_run_ns + min_interval_ns_);
+            }
+        }
+        if (slot.due) {
+            slot.dt = static_cast<double>(since) / 1.0e9;
+            any = true;
+        }
+    }
+    return any;
+}
+
+void MotorExecutor::run_stages(uint32_t gpio_tick, bool periodic)
+{
+    AllocScopeGuard guard(AllocScope::CONTROL_TICK);
+    TraceScope trace(TracePoint::CONTROL_TICK, TRACE_NO_PIN, static_cast<int32_t>(cycle_));
+    const uint64_t start = now_ns();
+
+    if (periodic && stall_timeout_us_ > 0) {
+        stall_wheel_.advance(gpio_tick);
+    }
+    const uint64_t stall_done = now_ns();
+
+    for (size_t i = 0; i < motor_ct_; i++) {
+        ControlSlot &slot = slots_[i];
+        if (slot.due) {
+            uint32_t samples = controllers_[i].samples();
+            slot.fresh = samples != slot.samples;
+            slot.samples = samples;
+            slot.last_run_ns = start;
+            controllers_[i].estimate(slot.dt);
+            slot.velocity = controllers_[i].estimator().velocity();
+            slot.position.store(slot.position.load(std::memory_order_relaxed) + controllers_[i].get_counts_reset(),
+                std::memory_order_relaxed);
+        }
+    }
+    const uint64_t estimate_done = now_ns();
+
+    // outer loop, its output stands in for the setpoint of the velocity loop until it next runs.
+    const uint64_t slack_ns = static_cast<uint64_t>(period_us_) * control_divider_ * 500ULL;
+    bool positioned = false;
+    for (size_t i = 0; i < motor_ct_; i++) {
+        ControlSlot &slot = slots_[i];
+        if (!slot.due) {
+            continue;
+        }
+        const bool mode = slot.position_mode.load(std::memory_order_acquire);
+        if (mode != slot.positioning) {
+            // entering position control runs the outer loop now, as if a whole position period had passed.
+            slot.positioning = mode;
+            slot.position_pid.reset();
+            slot.last_position_ns = start - slot.position_period_ns;
+        }
+        if (!slot.positioning || start - slot.last_position_ns + slack_ns < slot.position_period_ns) {
+            continue;
+        }
+        const double dt = static_cast<double>(start - slot.last_position_ns) / 1.0e9;
+        slot.last_position_ns = start;
+        positioned = true;
+
+        const int64_t target = slot.position_target.load(std::memory_order_relaxed);
+        const int64_t position = slot.position.load(std::memory_order_relaxed);
+        if (std::llabs(target - position) <= slot.position_tolerance) {
+            // a single channel encoder can not tell which way a wheel hunting around the target moves, so it is
+            // stopped instead.
+            slot.position_pid.reset();
+            slot.position_pps = 0.0;
+            continue;
+        }
+        // PID::compute() takes error as measurement - setpoint, so target - position is passed that way round.
+        slot.position_pps = slot.position_pid.compute(static_cast<double>(position), static_cast<double>(target), dt);
+    }
+    const uint64_t position_done = now_ns();
+
+    // PID works on speed, direction comes from the sign of the setpoint. The encoder is single channel so the
+    // estimate is a magnitude.
+    for (size_t i = 0; i < motor_ct_; i++) {
+        ControlSlot &slot = slots_[i];
+        if (!slot.due) {
+            continue;
+        }
+        double setpoint = slot.positioning ? slot.position_pps : slot.setpoint.load(std::memory_order_relaxed);
+        if (setpoint == 0.0) {
+            slot.pid.reset();
+            slot.duty = 0;
+            continue;
+        }
+        slot.direction = setpoint > 0.0 ? DIRECTION::FORWARD : DIRECTION::BACKWARD;
+        // PID::compute() takes error as measurement - setpoint, so the arguments are swapped for velocity.
+        double duty = slot.pid.compute(std::abs(slot.velocity), std::abs(setpoint), slot.dt);
+        slot.duty = static_cast<int>(std::lround(duty));
+    }
+    const uint64_t pid_done = now_ns();
+
+    for (size_t i = 0; i < motor_ct_; i++) {
+        ControlSlot &slot = slots_[i];
+        if (slot.due) {
+            controllers_[i].drive(slot.direction, slot.duty);
+        }
+        // the sequencer runs every period so ramps and coasting keep their timing between control ticks.
+        if (slot.due || periodic) {
+            controllers_[i].update_drive(gpio_tick);
+        }
+    }
+    const uint64_t actuate_done = now_ns();
+
+    const uint32_t applied = gpioTick();
+    for (size_t i = 0; i < motor_ct_; i++) {
+        if (slots_[i].due && slots_[i].fresh) {
+            uint32_t reaction_us = applied - controllers_[i].sample_tick();
+            timing_[static_cast<size_t>(ExecutorStage::REACTION)].record(static_cast<uint64_t>(reaction_us) * 1000ULL);
+        }
+    }
+
+    timing_[static_cast<size_t>(ExecutorStage::STALL)].record(stall_done - start);
+    timing_[static_cast<size_t>(ExecutorStage::ESTIMATE)].record(estimate_done - stall_done);
+    if (positioned) {
+        timing_[static_cast<size_t>(ExecutorStage::POSITION)].record(position_done - estimate_done);
+    }
+    timing_[static_cast<size_t>(ExecutorStage::PID)].record(pid_done - position_done);
+    timing_[static_cast<size_t>(ExecutorStage::ACTUATE)].record(actuate_done - pid_done);
+    timing_[static_cast<size_t>(ExecutorStage::CYCLE)].record(actuate_done - start);
+    if (periodic) {
+        cycle_++;
+        if (actuate_done - start > static_cast<uint64_t>(period_us_) * 1000ULL) {
+            overruns_.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (telemetry_ != nullptr) {
+            telemetry_->publish_cycle(gpio_tick, static_cast<uint32_t>((actuate_done - start) / 1000ULL));
+            if (cycle_ % TELEMETRY_SAMPLE_TICKS == 0) {
+                publish_telemetry();
+            }
+        }
+    }
+}
+
+void MotorExecutor::publish_telemetry()
+{
+    StageTelemetry stages[TELEMETRY_STAGES] {};
+    for (size_t s = 0; s < TELEMETRY_STAGES; s++) {
+        const StageTimingSnapshot t = timing(static_cast<ExecutorStage>(s));
+        stages[s].samples = t.samples;
+        stages[s].p50_ns = t.percentile(0.5);
+        stages[s].p99_ns = t.percentile(0.99);
+        stages[s].p999_ns = t.percentile(0.999);
+        stages[s].max_ns = t.max_ns;
+        stages[s].mean_ns = t.mean_ns;
+    }
+    telemetry_->publish_stages(stages, overruns_.load(std::memory_order_relaxed));
+    for (size_t i = 0; i < motor_ct_; i++) {
+        controllers_[i].subscribe(*telemetry_, static_cast<uint16_t>(i));
+    }
+}
+
+void MotorExecutor::run()
+{
+    RtMode::instance().harden_current_thread(RtThreadRole::CONTROL);
+    const ThreadFaultStats baseline = thread_fault_stats();
+    if (trigger_ == ControlTrigger::EVENT) {
+        run_event(baseline);
+        sample_faults(baseline);
+        return;
+    }
+    uint32_t fault_sample = 0;
+
+    const uint64_t period_ns = static_cast<uint64_t>(period_us_) * 1000ULL;
+    struct timespec next {};
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while (running_.load(std::memory_order_acquire)) {
+        if (++fault_sample >= FAULT_SAMPLE_TICKS) {
+            fault_sample = 0;
+            sample_faults(baseline);
+        }
+
+        add_ns(next, period_ns);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr);
+
+        uint64_t woke = now_ns();
+        uint64_t due = to_ns(next);
+        timing_[static_cast<size_t>(ExecutorStage::WAKEUP)].record(woke > due ? woke - due : 0);
+
+        tick(gpioTick());
+
+        // after an overrun start again from now rather than firing the missed ticks back to back.
+        if (now_ns() > due + period_ns) {
+            clock_gettime(CLOCK_MONOTONIC, &next);
+        }
+    }
+    sample_faults(baseline);
+}
+
+void MotorExecutor::run_event(const ThreadFaultStats &baseline)
+{
+    uint32_t fault_sample = 0;
+    const uint64_t period_ns = static_cast<uint64_t>(period_us_) * 1000ULL;
+    uint64_t next = now_ns() + period_ns;
+    uint64_t retry = std::numeric_limits<uint64_t>::max();
+
+    while (running_.load(std::memory_order_acquire)) {
+        bool notified = event_.wait_until(std::min(next, retry));
+
+        uint64_t woke = now_ns();
+        bool periodic = woke >= next;
+        if (periodic) {
+            timing_[static_cast<size_t>(ExecutorStage::WAKEUP)].record(woke - next);
+            if (++fault_sample >= FAULT_SAMPLE_TICKS) {
+                fault_sample = 0;
+                sample_faults(baseline);
+            }
+        }
+        else if (notified) {
+            event_wakeups_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        retry = std::numeric_limits<uint64_t>::max();
+        if (select_events(woke, periodic, retry) || periodic) {
+            run_stages(gpioTick(), periodic);
+        }
+
+        if (periodic) {
+            // after an overrun start again from now rather than firing the missed periods back to back.
+            uint64_t due = next;
+            next += period_ns;
+            uint64_t now = now_ns();
+            if (now > due + period_ns) {
+                next = now + period_ns;
+            }
+        }
+    }
+}
+
+void MotorExecutor::sample_faults(const ThreadFaultStats &baseline)
+{
+    ThreadFaultStats faults = thread_fault_stats() - baseline;
+    minor_faults_.store(faults.minor_faults, std::memory_order_relaxed);
+    major_faults_.store(faults.major_faults, std::memory_order_relaxed);
+    voluntary_switches_.store(faults.voluntary_switches, std::memory_order_relaxed);
+    involuntary_switches_.store(faults.involuntary_switches, std::memory_order_relaxed);
+}
+
+ThreadFaultStats MotorExecutor::control_faults() const
+{
+    ThreadFaultStats faults;
+    faults.minor_faults = minor_faults_.load(std::memory_order_relaxed);
+    faults.major_faults = major_faults_.load(std::memory_order_relaxed);
+    faults.voluntary_switches = voluntary_switches_.load(std::memory_order_relaxed);
+    faults.involuntary_switches = involuntary_switches_.load(std::memory_order_relaxed);
+    return faults;
+}
+
+StageTimingSnapshot MotorExecutor::timing(ExecutorStage stage) const
+{
+    const StageTiming &t = timing_[static_cast<size_t>(stage)];
+    StageTimingSnapshot snapshot;
+    snapshot.samples = t.samples.load(std::memory_order_relaxed);
+    snapshot.last_ns = t.last_ns.load(std::memory_order_relaxed);
+    snapshot.max_ns = t.max_ns.load(std::memory_order_relaxed);
+    snapshot.mean_ns = snapshot.samples == 0 ? 0.0 : static_cast<double>(t.total_ns.load(std::memory_order_relaxed)) / snapshot.samples;
+    for (int i = 0; i < StageTimingSnapshot::BUCKETS; i++) {
+        snapshot.histogram[i] = t.histogram[i].load(std::memory_order_relaxed);
+    }
+    return snapshot;
+}
+
+void MotorExecutor::reset_timing()
+{
+    for (auto &t : timing_) {
+        t.samples.store(0, std::memory_order_relaxed);
+        t.last_ns.store(0, std::memory_order_relaxed);
+        t.max_ns.store(0, std::memory_order_relaxed);
+        t.total_ns.store(0, std::memory_order_relaxed);
+        for (auto &c : t.histogram) {
+            c.store(0, std::memory_order_relaxed);
+        }
+    }
+    overruns_.store(0, std::memory_order_relaxed);
+}
@@ -0,0 +1,300 @@
+/**
+ * Runs the control loop for several MotorControllers from a single real time thread.
+ *
+ * Previously every executable drove its controllers by hand and nothing coordinated them. The executor owns up to
+ * MAX_MOTORS controllers in one contiguous array, and once per period runs each stage for every due motor before
+ * moving to the next stage:
+ *
+ *   STALL     advance the shared stall detector
+ *   ESTIMATE  MotorController::estimate(), the Kalman filter, and the position count
+ *   POSITION  velocity setpoint from the position target, for motors under position control
+ *   PID       duty from the setpoint and estimated velocity
+ *   ACTUATE   MotorController::update_drive(), through the direction sequencer
+ *
+ * The per tick control state (setpoint, PID, last output) is kept apart from the controllers in a packed array,
+ * one cache line per motor, so the PID stage walks sequential memory instead of touching each controller's
+ * encoder statistics and atomics, which the encoder ISR thread is writing to.
+ *
+ * Each motor runs every control_divider periods, offset by its phase, so with a 1ms period and a divider of 10
+ * sixteen motors are spread over ten ticks rather than all landing on the same one.
+ *
+ * That is ControlTrigger::TIMER, where a velocity sample waits up to control_divider periods for its motor's
+ * tick. With ControlTrigger::EVENT the encoder callback wakes the executor through a ControlEvent as soon as a
+ * PPR_ window closes, and the motor runs its stages straight away:
+ *
+ * - a motor runs at most once per min_interval_us, a sample arriving sooner is held until the interval is up,
+ * - a motor that has not run for control_divider periods runs on the next period anyway, so a stopped or stalled
+ *   wheel, which produces no samples, still gets its setpoint applied,
+ * - the stall detector and the direction sequencers still advance every period,
+ * - each motor's estimator and PID are given the time since it last ran as dt.
+ *
+ * In both modes REACTION times each new sample from the edge that closed its window to the drive being updated.
+ *
+ * A motor given a position target runs a cascade, see configure_position(). The outer position PID runs every
+ * position_divider runs of the motor's velocity loop, 100Hz over a 1kHz velocity loop with a divider of 10, and
+ * its output in pulses/s is the velocity loop's setpoint until the next outer run. The decimation is by time
+ * rather than by counting runs, with half a velocity period of slack, so it holds under either trigger. Position
+ * is the sum of MotorController::get_counts_reset(), counted every run whatever the mode.
+ *
+ * Given a TelemetryPublisher, see set_telemetry(), the executor thread publishes every cycle's duration, and every
+ * TELEMETRY_SAMPLE_TICKS the percentiles of each stage and a snapshot of every motor.
+ *
+ * When RtMode is active the executor thread hardens itself on start, see rt_mode.hpp. Its page faults and context
+ * switches are sampled every FAULT_SAMPLE_TICKS and can be read with control_faults().
+ *
+ * The executor is large (MAX_MOTORS controllers with their encoder histograms), allocate it statically or on the heap.
+ */
+
+#pragma once
+
+#include "control_event.hpp"
+#include "motor_controller.hpp"
+#include "pid.hpp"
+#include "rt_mode.hpp"
+#include "timer_wheel.hpp"
+#include "tst_common.hpp"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+enum class ExecutorStage : uint8_t {
+    STALL = 0,
+    ESTIMATE = 1,
+    PID = 2,
+    ACTUATE = 3,
+    CYCLE = 4,    // the whole tick
+    WAKEUP = 5,   // how late the thread woke up
+    REACTION = 6, // from the edge closing a velocity window to the drive update using it
+    POSITION = 7, // outer position loop, only timed on ticks where some motor ran it
+    COUNT = 8,
+};
+
+enum class ControlTrigger : uint8_t {
+    TIMER = 0,  // motors run every control_divider periods
+    EVENT = 1,  // motors run when their encoder has a new velocity sample
+};
+
+struct StageTimingSnapshot {
+    // below SUB ns a bucket each, above that each power of 2 is split into SUB buckets, up to ~18 minutes.
+    static constexpr int SUB_BITS = 2;
+    static constexpr uint64_t SUB = 1u << SUB_BITS;
+    static constexpr int BUCKETS = 160;
+
+    uint64_t samples = 0;
+    uint64_t last_ns = 0;
+    uint64_t max_ns = 0;
+    double mean_ns = 0.0;
+    std::array<uint32_t, BUCKETS> histogram {};
+
+    /**
+     * Approximate percentile from the histogram, the upper bound of the bucket containing q, at most max_ns.
+     *
+     * @param q between 0.0 and 1.0
+     */
+    uint64_t percentile(double q) const;
+
+    static int bucket(uint64_t ns);
+    static uint64_t bucket_upper(int idx);
+};
+
+class MotorExecutor {
+  public:
+    static constexpr size_t MAX_MOTORS = 16;
+
+    ~MotorExecutor();
+
+    /**
+     * @param period_us executor tick.
+     * @param control_divider motors run every control_divider ticks.
+     * @param stall_timeout_us no healthy pulse for this long is reported as a stall, 0 disables stall detection.
+     */
+    CallbackReturn on_configure(uint32_t period_us, uint32_t control_divider, uint32_t stall_timeout_us);
+
+    /**
+     * Configure the next controller, see MotorController::on_configure(). kp, ki, kd, p_min and p_max configure the
+     * velocity PID, whose output is duty %.
+     *
+     * @param phase tick within control_divider the motor runs on, -1 spreads motors in the order they are added.
+     * @return index of the motor, or -1 on failure.
+     */
+    int add_motor(int pi, int pwm_pin, int dir_pin, int en_pin, int timeout, uint32_t min_interval_us,
+        double kp, double ki, double kd, double p_min, double p_max, int phase = -1);
+
+    /**
+     * Drive motors added from now on whose PWM pin has no hardware PWM channel from a channel of wave. The caller
+     * activates wave once the motors are added, and deactivates it after the executor. wave must outlive it.
+     */
+    void set_software_pwm(WavePwm &wave) { wave_ = &wave; }
+
+    /**
+     * Publish the loop statistics and every motor, as its index, to telemetry from the executor thread. Call before
+     * on_activate(), the caller activates telemetry for at least motor_ct() motors and it must outlive the executor.
+     */
+    void set_telemetry(TelemetryPublisher &telemetry) { telemetry_ = &telemetry; }
+
+    /**
+     * Configure the position loop of motor idx, before on_activate(). The position PID's output is the velocity
+     * loop's setpoint in pulses/s, clamped to +-max_pps.
+     *
+     * @param position_divider the position loop runs once every position_divider runs of the velocity loop.
+     * @param tolerance within this many counts of the target the velocity setpoint is 0 and the wheel is held.
+     */
+    CallbackReturn configure_position(size_t idx, double kp, double ki, double kd, double max_pps,
+        uint32_t position_divider, uint32_t tolerance);
+
+    /**
+     * Choose what runs a motor's stages, before on_activate().
+     *
+     * @param min_interval_us for ControlTrigger::EVENT, the shortest time between two runs of the same motor.
+     */
+    CallbackReturn set_trigger(ControlTrigger trigger, uint32_t min_interval_us);
+
+    ControlTrigger trigger() const { return trigger_; }
+
+    // activate every controller and start the executor thread.
+    CallbackReturn on_activate();
+
+    // stop the thread, then every motor.
+    CallbackReturn on_deactivate();
+
+    /**
+     * Target velocity for motor idx in pulses/s, negative runs BACKWARD. Safe to call from any thread, ends
+     * position control.
+     */
+    void set_setpoint(size_t idx, double pps);
+
+    /**
+     * Move motor idx to counts and hold it there, see position(). Safe to call from any thread, ignored unless
+     * configure_position() was called for the motor.
+     */
+    void set_position_target(size_t idx, int64_t counts);
+
+    // encoder counts of motor idx since activation, FORWARD is positive.
+    int64_t position(size_t idx) const { return slots_[idx].position.load(std::memory_order_relaxed); }
+
+    MotorController &controller(size_t idx) { return controllers_[idx]; }
+
+    size_t motor_ct() const { return motor_ct_; }
+
+    /**
+     * Run one period. Called by the executor thread, public so the loop can be driven by hand when not activated.
+     */
+    void tick(uint32_t gpio_tick);
+
+    // wakeups of the executor thread by a new sample rather than its period.
+    uint64_t event_wakeups() const { return event_wakeups_.load(std::memory_order_relaxed); }
+
+    /**
+     * Mean, max and a histogram of each stage. WAKEUP is the lateness of each wakeup against its deadline, its
+     * percentiles are the scheduling jitter the control loop sees.
+     */
+    StageTimingSnapshot timing(ExecutorStage stage) const;
+
+    // ticks where the cycle took longer than the period.
+    uint64_t overruns() const { return overruns_.load(std::memory_order_relaxed); }
+
+    /**
+     * Page faults and context switches of the executor thread since it started, updated every FAULT_SAMPLE_TICKS.
+     */
+    ThreadFaultStats control_faults() const;
+
+    // clear the stage timings, best called while the executor is not running.
+    void reset_timing();
+
+  private:
+    struct alignas(64) ControlSlot {
+        std::atomic<double> setpoint {0.0};
+        PID pid;
+        double velocity = 0.0;      // estimate used by the last PID stage, pulses/s
+        int duty = 0;
+        DIRECTION direction = DIRECTION::FORWARD;
+        uint32_t phase = 0;
+        bool due = false;
+        bool fresh = false;          // due with a sample the last run did not see
+        uint32_t samples = 0;        // MotorController::samples() at the last run
+        uint64_t last_run_ns = 0;
+        double dt = 0.0;             // seconds since the last run
+
+        // position loop, see configure_position().
+        PID position_pid;
+        std::atomic<int64_t> position {0};        // written by the executor thread
+        std::atomic<int64_t> position_target {0};
+        std::atomic<bool> position_mode {false};  // set by set_position_target(), cleared by set_setpoint()
+        bool positioning = false;                 // position_mode as last seen by the executor
+        double position_pps = 0.0;                // velocity setpoint from the last position run
+        uint64_t position_period_ns = 0;          // 0 until configure_position()
+        uint64_t last_position_ns = 0;
+        int64_t position_tolerance = 0;
+    };
+
+    struct StageTiming {
+        std::atomic<uint64_t> samples {0};
+        std::atomic<uint64_t> last_ns {0};
+        std::atomic<uint64_t> max_ns {0};
+        std::atomic<uint64_t> total_ns {0};
+        std::array<std::atomic<uint32_t>, StageTimingSnapshot::BUCKETS> histogram {};
+
+        // single writer, the executor thread.
+        void record(uint64_t ns);
+    };
+
+    void run();
+
+    void run_event(const ThreadFaultStats &baseline);
+
+    // stages for the motors marked due, periodic also advances the stall detector and every sequencer.
+    void run_stages(uint32_t gpio_tick, bool periodic);
+
+    /**
+     * Mark motors due for an event driven run at now_ns, returns true if any are. retry_ns is lowered to when a
+     * motor held back by min_interval_us can run.
+     */
+    bool select_events(uint64_t now_ns, bool periodic, uint64_t &retry_ns);
+
+    // publish the executor thread's counters since baseline, called from the executor thread.
+    void sample_faults(const ThreadFaultStats &baseline);
+
+    // stage percentiles and every motor to telemetry_, called from the executor thread.
+    void publish_telemetry();
+
+    std::array<MotorController, MAX_MOTORS> controllers_;
+    std::array<ControlSlot, MAX_MOTORS> slots_;
+    size_t motor_ct_ = 0;
+
+    uint32_t period_us_ = 0;
+    uint32_t control_divider_ = 1;
+    uint32_t stall_timeout_us_ = 0;
+    double control_dt_ = 0.0;
+    WavePwm *wave_ = nullptr;  // see set_software_pwm()
+    TelemetryPublisher *telemetry_ = nullptr;  // see set_telemetry()
+    uint64_t cycle_ = 0;
+    TimerWheel stall_wheel_;
+
+    ControlTrigger trigger_ = ControlTrigger::TIMER;
+    uint64_t min_interval_ns_ = 0;
+    ControlEvent event_;
+    std::atomic<uint64_t> event_wakeups_ {0};
+
+    std::array<StageTiming, static_cast<size_t>(ExecutorStage::COUNT)> timing_;
+    std::atomic<uint64_t> overruns_ {0};
+
+    // written by the executor thread, see control_faults().
+    std::atomic<uint64_t> minor_faults_ {0};
+    std::atomic<uint64_t> major_faults_ {0};
+    std::atomic<uint64_t> voluntary_switches_ {0};
+    std::atomic<uint64_t> involuntary_switches_ {0};
+
+    std::thread thread_;
+    std::atomic<bool> running_ {false};
+    bool active_ = false;  // controllers activated, only touched by the owning thread
+
+    // SCHED_FIFO priority requested for the executor thread when RtMode is off.
+    const int RT_PRIORITY {80};
+
+    // getrusage() is a syscall, so faults are sampled once a second at a 1ms period.
+    const uint32_t FAULT_SAMPLE_TICKS {1000};
+
+    // percentiles walk every stage's histogram, so they are published at 10Hz at a 1ms period.
+    const uint32_t TELEMETRY_SAMPLE_TICKS {100};
+};
@@ -0,0 +1,182 @@
+#include "motor_group.hpp"
+#include "driver_log.hpp"
+#include "emergency_stop.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <time.h>
+
+namespace {
+    uint64_t mono_ns()
+    {
+        struct timespec ts {};
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+    }
+
+    int write_bank(unsigned bank, bool set, uint32_t mask)
+    {
+        if (bank == 0) {
+            return set ? gpioWrite_Bits_0_31_Set(mask) : gpioWrite_Bits_0_31_Clear(mask);
+        }
+        return set ? gpioWrite_Bits_32_53_Set(mask) : gpioWrite_Bits_32_53_Clear(mask);
+    }
+}
+
+int MotorGroup::add(Motor &motor)
+{
+    if (motor_ct_ >= MAX_MOTORS) {
+        std::cout << "ERROR: more than " << MAX_MOTORS << " motors in a group\n";
+        return -1;
+    }
+    for (size_t i = 0; i < motor_ct_; i++) {
+        const Motor *other = staged_[i].motor;
+        if (other == &motor) {
+            std::cout << "ERROR: motor is already in the group\n";
+            return -1;
+        }
+        // two motors on one channel would both be driven by whichever duty was written last.
+        if (motor.pins_.pwm_channel != board::NO_PWM_CHANNEL && other->pins_.pwm_channel == motor.pins_.pwm_channel) {
+            std::cout << "ERROR: PWM channel " << motor.pins_.pwm_channel << " is already in the group\n";
+            return -1;
+        }
+    }
+    staged_[motor_ct_] = Staged {&motor, motor.direction(), motor.duty(), motor.frequency()};
+    return static_cast<int>(motor_ct_++);
+}
+
+void MotorGroup::stage_direction(size_t idx, DIRECTION dir)
+{
+    if (idx < motor_ct_) {
+        staged_[idx].dir = dir;
+    }
+}
+
+void MotorGroup::stage_duty(size_t idx, int duty)
+{
+    if (idx < motor_ct_) {
+        staged_[idx].duty = std::clamp(duty, 0, 100);
+    }
+}
+
+void MotorGroup::stage_frequency(size_t idx, int freq)
+{
+    if (idx < motor_ct_) {
+        staged_[idx].freq = freq;
+    }
+}
+
+void MotorGroup::stage(size_t idx, DIRECTION dir, int duty)
+{
+    stage_direction(idx, dir);
+    stage_duty(idx, duty);
+}
+
+int MotorGroup::commit()
+{
+    const EmergencyStop &stop = EmergencyStop::instance();
+    // latched by EmergencyStop, the motors may only be stopped, see Motor::write_pwm().
+    const bool latched = stop.tripped();
+    bool refused = false;
+
+    // worked out up front, so the writes below are issued with nothing in between.
+    std::array<std::array<uint32_t, 2>, 2> dir_masks {};  // [bank][level]
+    std::array<size_t, MAX_MOTORS> pwm_idx {};
+    std::array<unsigned, MAX_MOTORS> pwm_reg {};
+    size_t pwm_ct = 0;
+    for (size_t i = 0; i < motor_ct_; i++) {
+        const Staged &s = staged_[i];
+        const Motor &m = *s.motor;
+        if (s.dir != m.dir_) {
+            dir_masks[m.pins_.dir_bank][s.dir] |= m.pins_.dir_mask;
+        }
+        if (s.duty != m.duty_ || s.freq != m.active_freq_) {
+            if (latched && s.duty > 0) {
+                refused = true;
+                continue;
+            }
+            pwm_idx[pwm_ct] = i;
+            pwm_reg[pwm_ct] = static_cast<unsigned>(s.duty * m.DUTY_OFFSET);
+            pwm_ct++;
+        }
+    }
+
+    std::array<std::array<int, 2>, 2> dir_result {};
+    for (unsigned bank = 0; bank < 2; bank++) {
+        for (unsigned level = 0; level < 2; level++) {
+            if (dir_masks[bank][level] != 0) {
+                dir_result[bank][level] = write_bank(bank, level == FORWARD, dir_masks[bank][level]);
+            }
+        }
+    }
+
+    std::array<int, MAX_MOTORS> pwm_result {};
+    std::array<uint64_t, MAX_MOTORS> pwm_done_ns {};
+    for (size_t w = 0; w < pwm_ct; w++) {
+        const Staged &s = staged_[pwm_idx[w]];
+        const Motor &m = *s.motor;
+        if (m.wave_ != nullptr) {
+            pwm_result[w] = m.wave_->set_duty(m.wave_channel_, pwm_reg[w]);
+        }
+        else {
+            pwm_result[w] = gpioHardwarePWM(m.pins_.pwm, static_cast<unsigned>(s.freq), pwm_reg[w]);
+        }
+        pwm_done_ns[w] = mono_ns();
+    }
+
+    // trip() may have cut a hardware channel between the check above and its write, which restarted it. A latched
+    // WavePwm does not send, see Motor::write_pwm().
+    if (stop.tripped()) {
+        for (size_t w = 0; w < pwm_ct; w++) {
+            const Staged &s = staged_[pwm_idx[w]];
+            const Motor &m = *s.motor;
+            if (pwm_result[w] == OK && s.duty > 0 && m.wave_ == nullptr) {
+                gpioHardwarePWM(m.pins_.pwm, 0, 0);
+                pwm_result[w] = PI_NOT_PERMITTED;
+                refused = true;
+            }
+        }
+    }
+
+    // everything below is bookkeeping, the hardware has been written.
+    if (pwm_ct >= 2) {
+        uint64_t skew = pwm_done_ns[pwm_ct - 1] - pwm_done_ns[0];
+        skew_.commits++;
+        skew_.last_ns = skew;
+        skew_.max_ns = std::max(skew_.max_ns, skew);
+        skew_.total_ns += skew;
+    }
+
+    int first_error = refused ? PI_NOT_PERMITTED : OK;
+    for (size_t i = 0; i < motor_ct_; i++) {
+        const Staged &s = staged_[i];
+        Motor &m = *s.motor;
+        if (s.dir == m.dir_) {
+            continue;
+        }
+        int r = dir_result[m.pins_.dir_bank][s.dir];
+        if (r != OK) {
+            DriverLog::instance().log(LogCode::DIR_WRITE_FAILED, m.pins_.dir, r);
+            first_error = first_error == OK ? r : first_error;
+            continue;
+        }
+        Tracer::instant(TracePoint::DIR_WRITE, m.pins_.dir, s.dir);
+        m.dir_ = s.dir;
+    }
+    for (size_t w = 0; w < pwm_ct; w++) {
+        const Staged &s = staged_[pwm_idx[w]];
+        Motor &m = *s.motor;
+        if (pwm_result[w] == PI_NOT_PERMITTED && stop.tripped()) {
+            // cut by the check above, the wheel is stopped, nothing failed.
+            continue;
+        }
+        if (pwm_result[w] != OK) {
+            DriverLog::instance().log(LogCode::PWM_WRITE_FAILED, m.pins_.pwm, pwm_result[w]);
+            first_error = first_error == OK ? pwm_result[w] : first_error;
+            continue;
+        }
+        Tracer::instant(TracePoint::PWM_WRITE, m.pins_.pwm, s.duty);
+        m.duty_ = s.duty;
+        m.active_freq_ = s.freq;
+    }
+    return first_error;
+}
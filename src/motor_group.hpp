@@ -0,0 +1,83 @@
+/**
+ * Commits direction, duty and frequency to several motors together.
+ *
+ * motor_a.set_pwm(85) followed by motor_b.set_pwm(85) leaves one wheel running at the new duty while the other
+ * call logs, traces and returns, and on a differential drive that gap turns into heading drift. MotorGroup stages
+ * the new values for every motor and commit() then writes them back to back:
+ *
+ * - every register value is worked out before the first write, nothing is logged or traced between writes,
+ * - direction pins are written as one gpioWrite_Bits set and one clear per bank, so wheels turning the same
+ *   way change direction in the same register write however many there are,
+ * - PWM writes are issued back to back in the order the motors were added. pigpio exposes no call that updates
+ *   both hardware PWM channels at once, so this is as close as its API allows. Software PWM motors on the same
+ *   WavePwm change together on its next waveform, see wave_pwm.hpp.
+ *
+ * While EmergencyStop is latched a staged non zero duty is refused and not written, stops
+ * and direction changes are still committed. A channel whose write raced a trip() is cut again after the writes.
+ *
+ * Only values that differ from what the motor last wrote are committed. Each commit measures the skew, the time
+ * from the first PWM write returning to the last, see skew().
+ *
+ * Like set_pwm() and set_direction() a commit bypasses each motor's sequencer, use drive()/update() for
+ * reversals under load.
+ */
+
+#pragma once
+
+#include "motor.hpp"
+#include "tst_common.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+struct GroupSkew {
+    uint64_t commits = 0;   // commits that wrote at least two PWM channels
+    uint64_t last_ns = 0;
+    uint64_t max_ns = 0;
+    uint64_t total_ns = 0;  // for the mean
+};
+
+class MotorGroup {
+  public:
+    static constexpr size_t MAX_MOTORS = 16;
+
+    /**
+     * Add a configured motor to the group, the motor must outlive the group. Staged values start from what the
+     * motor last wrote. A motor already in the group, or on a PWM channel already in the group, is rejected.
+     *
+     * @return index used to stage values for the motor, or -1.
+     */
+    int add(Motor &motor);
+
+    size_t size() const { return motor_ct_; }
+
+    // stage values for motor idx, nothing is written until commit().
+    void stage_direction(size_t idx, DIRECTION dir);
+    void stage_duty(size_t idx, int duty);
+    void stage_frequency(size_t idx, int freq);
+    void stage(size_t idx, DIRECTION dir, int duty);
+
+    /**
+     * Write every staged change.
+     *
+     * @return OK, PI_NOT_PERMITTED if EmergencyStop refused a duty, or the first pigpio error. Motors whose writes
+     * succeeded are updated regardless.
+     */
+    int commit();
+
+    const GroupSkew &skew() const { return skew_; }
+
+    void reset_skew() { skew_ = GroupSkew {}; }
+
+  private:
+    struct Staged {
+        Motor *motor = nullptr;
+        DIRECTION dir = BACKWARD;
+        int duty = 0;
+        int freq = 0;
+    };
+
+    std::array<Staged, MAX_MOTORS> staged_ {};
+    size_t motor_ct_ = 0;
+    GroupSkew skew_;
+};
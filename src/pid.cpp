@@ -1,4 +1,5 @@
 #include "pid.hpp"
+#include "trace.hpp"
 
 // 2600µs per pulse corresponds to 3 m/s. This should the max speed. We want around half of that for turning.
 
@@ -67,6 +68,7 @@ double PID::compute(double setpoint, double measurement, double dt)
      * - If measurement > setpoint: pulses are too slow (motor too slow) → positive error → increase output
      * - If measurement < setpoint: pulses are too fast (motor too fast) → negative error → decrease output
      */
+    TraceScope trace(TracePoint::PID, TRACE_NO_PIN);
     double error = measurement - setpoint;
 
     // Proportional
@@ -88,6 +90,7 @@ double PID::compute(double setpoint, double measurement, double dt)
     prev_error_ = error;
 
     // Sum and clamp output
-    double output = p_term + i_term + d_term;
-    return std::clamp(output, output_min_, output_max_);
+    double output = std::clamp(p_term + i_term + d_term, output_min_, output_max_);
+    trace.set_value(static_cast<int32_t>(output * 1000.0));
+    return output;
 }
\ No newline at end of file
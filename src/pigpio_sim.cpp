@@ -0,0 +1,575 @@
+#include "pigpio_sim.hpp"
+#include "board.hpp"
+#include <pigpio.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+    // the Pi4B header, the same limits the drivers are built with.
+    constexpr unsigned SIM_GPIO = board::MAX_GPIO + 1;
+    static_assert(SIM_GPIO <= 32, "simulated pins must all be in bank 0");
+    constexpr int SIM_VERSION = 79;
+    constexpr unsigned SIM_REVISION = 0xc03114; // Pi4B 8GB
+    constexpr unsigned MAX_HPWM_DUTY = 1000000;
+    constexpr unsigned MAX_HPWM_FREQ = 187500000;
+    constexpr unsigned MAX_WAVES = 250;
+    constexpr int MAX_WAVE_CBS = 25016;
+
+    struct Isr {
+        gpioISRFuncEx_t func = nullptr;
+        void *userdata = nullptr;
+        unsigned edge = RISING_EDGE;
+        int timeout_ms = 0;
+        uint32_t last_tick = 0;
+    };
+
+    struct Wheel {
+        bool attached = false;
+        unsigned pwm_pin = 0;
+        unsigned dir_pin = 0;
+        SimMotorModel model;
+        double velocity = 0.0;  // pulses/s, signed
+        double phase = 0.0;     // fraction of a pulse travelled
+        std::atomic<double> reported_velocity {0.0};
+        std::atomic<uint64_t> pulses {0};
+    };
+
+    // a jumper from a PWM pin, see pigpio_sim_loopback().
+    struct Loopback {
+        bool wired = false;
+        unsigned out_pin = 0;
+        double phase = 0.0;     // fraction of a PWM period travelled
+        std::atomic<uint64_t> pulses {0};
+    };
+
+    struct Sim {
+        std::array<std::atomic<unsigned>, SIM_GPIO> level {};
+        std::array<std::atomic<unsigned>, SIM_GPIO> mode {};
+        std::array<std::atomic<unsigned>, SIM_GPIO> pwm_duty {};
+        std::array<std::atomic<unsigned>, SIM_GPIO> pwm_freq {};
+
+        // ISRs and wheels are only changed under the mutex, and the plant thread holds it while stepping,
+        // so a callback cannot run once gpioSetISRFuncEx() has removed it.
+        std::mutex mutex;
+        std::array<Isr, SIM_GPIO> isr {};
+        std::array<Wheel, SIM_GPIO> wheels {};
+        std::array<Loopback, SIM_GPIO> loopbacks {};
+
+        // waveforms, a transmitted waveform is applied as the average duty of each of its pins.
+        std::mutex wave_mutex;
+        std::vector<gpioPulse_t> building;
+        std::array<std::vector<gpioPulse_t>, MAX_WAVES> waves {};
+        std::array<bool, MAX_WAVES> wave_used {};
+        int tx_wave = -1;
+        uint32_t tx_mask = 0;
+
+        std::atomic<bool> running {false};
+        std::thread plant;
+        std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    };
+
+    Sim &sim()
+    {
+        static Sim instance;
+        return instance;
+    }
+
+    void step(Sim &s, double dt, uint32_t tick, std::mt19937 &rng)
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        for (unsigned pin = 0; pin < SIM_GPIO; pin++) {
+            Wheel &w = s.wheels[pin];
+            if (!w.attached) {
+                continue;
+            }
+            double duty = s.pwm_duty[w.pwm_pin].load(std::memory_order_relaxed) * 100.0 / MAX_HPWM_DUTY;
+            double target = 0.0;
+            if (duty > w.model.deadband && w.model.deadband < 100.0) {
+                target = w.model.max_pps * (duty - w.model.deadband) / (100.0 - w.model.deadband);
+            }
+            if (s.level[w.dir_pin].load(std::memory_order_relaxed) == 0) {
+                target = -target;
+            }
+            w.velocity += (target - w.velocity) * std::min(1.0, dt / w.model.tau_s);
+            w.reported_velocity.store(w.velocity, std::memory_order_relaxed);
+
+            // single channel encoder, edges are counted whichever way the wheel turns.
+            w.phase += std::abs(w.velocity) * dt;
+            Isr &isr = s.isr[pin];
+            while (w.phase >= 1.0) {
+                w.phase -= 1.0;
+                w.pulses.fetch_add(1, std::memory_order_relaxed);
+                // back date the edge to where the pulse was crossed within the step.
+                uint32_t edge_tick = tick - static_cast<uint32_t>(w.phase / std::abs(w.velocity) * 1.0e6);
+                if (w.model.jitter_us > 0.0) {
+                    std::normal_distribution<double> jitter(0.0, w.model.jitter_us);
+                    edge_tick += static_cast<int32_t>(jitter(rng));
+                }
+                if (isr.func != nullptr && isr.edge != FALLING_EDGE) {
+                    isr.func(static_cast<int>(pin), 1, edge_tick, isr.userdata);
+                    isr.last_tick = tick;
+                }
+            }
+        }
+
+        for (unsigned pin = 0; pin < SIM_GPIO; pin++) {
+            Loopback &l = s.loopbacks[pin];
+            if (!l.wired) {
+                continue;
+            }
+            const unsigned duty = s.pwm_duty[l.out_pin].load(std::memory_order_relaxed);
+            const double freq = s.pwm_freq[l.out_pin].load(std::memory_order_relaxed);
+            if (duty == 0 || duty >= MAX_HPWM_DUTY || freq == 0.0) {
+                continue;
+            }
+            l.phase += freq * dt;
+            Isr &isr = s.isr[pin];
+            while (l.phase >= 1.0) {
+                l.phase -= 1.0;
+                l.pulses.fetch_add(1, std::memory_order_relaxed);
+                uint32_t edge_tick = tick - static_cast<uint32_t>(l.phase / freq * 1.0e6);
+                if (isr.func != nullptr && isr.edge != FALLING_EDGE) {
+                    isr.func(static_cast<int>(pin), 1, edge_tick, isr.userdata);
+                    isr.last_tick = tick;
+                }
+            }
+        }
+
+        // pigpio reports PI_TIMEOUT when an ISR sees no edge for timeout_ms.
+        for (unsigned pin = 0; pin < SIM_GPIO; pin++) {
+            Isr &isr = s.isr[pin];
+            if (isr.func != nullptr && isr.timeout_ms > 0 &&
+                tick - isr.last_tick >= static_cast<uint32_t>(isr.timeout_ms) * 1000) {
+                isr.func(static_cast<int>(pin), PI_TIMEOUT, tick, isr.userdata);
+                isr.last_tick = tick;
+            }
+        }
+    }
+
+    void plant(Sim &s)
+    {
+        std::mt19937 rng(1);
+        auto next = std::chrono::steady_clock::now();
+        auto last = next;
+        while (s.running.load(std::memory_order_acquire)) {
+            next += std::chrono::microseconds(SIM_STEP_US);
+            std::this_thread::sleep_until(next);
+            auto now = std::chrono::steady_clock::now();
+            double dt = std::chrono::duration<double>(now - last).count();
+            last = now;
+            step(s, dt, gpioTick(), rng);
+        }
+    }
+}
+
+int pigpio_sim_attach(unsigned pwm_pin, unsigned dir_pin, unsigned enc_pin, const SimMotorModel &model)
+{
+    if (pwm_pin >= SIM_GPIO || dir_pin >= SIM_GPIO || enc_pin >= SIM_GPIO) {
+        return PI_BAD_GPIO;
+    }
+    Sim &s = sim();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    Wheel &w = s.wheels[enc_pin];
+    w.attached = true;
+    w.pwm_pin = pwm_pin;
+    w.dir_pin = dir_pin;
+    w.model = model;
+    w.velocity = 0.0;
+    w.phase = 0.0;
+    w.reported_velocity.store(0.0);
+    w.pulses.store(0);
+    return 0;
+}
+
+double pigpio_sim_velocity(unsigned enc_pin)
+{
+    return enc_pin < SIM_GPIO ? sim().wheels[enc_pin].reported_velocity.load(std::memory_order_relaxed) : 0.0;
+}
+
+uint64_t pigpio_sim_pulses(unsigned enc_pin)
+{
+    if (enc_pin >= SIM_GPIO) {
+        return 0;
+    }
+    Sim &s = sim();
+    return s.wheels[enc_pin].pulses.load(std::memory_order_relaxed)
+        + s.loopbacks[enc_pin].pulses.load(std::memory_order_relaxed);
+}
+
+int pigpio_sim_loopback(unsigned out_pin, unsigned in_pin)
+{
+    if (out_pin >= SIM_GPIO || in_pin >= SIM_GPIO) {
+        return PI_BAD_GPIO;
+    }
+    Sim &s = sim();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    Loopback &l = s.loopbacks[in_pin];
+    l.wired = true;
+    l.out_pin = out_pin;
+    l.phase = 0.0;
+    l.pulses.store(0);
+    return 0;
+}
+
+int gpioInitialise(void)
+{
+    Sim &s = sim();
+    if (s.running.exchange(true)) {
+        return PI_INIT_FAILED;
+    }
+    s.plant = std::thread(plant, std::ref(s));
+    return SIM_VERSION;
+}
+
+void gpioTerminate(void)
+{
+    Sim &s = sim();
+    if (!s.running.exchange(false)) {
+        return;
+    }
+    s.plant.join();
+    gpioWaveClear();
+
+    std::lock_guard<std::mutex> lock(s.mutex);
+    for (unsigned pin = 0; pin < SIM_GPIO; pin++) {
+        s.isr[pin] = Isr {};
+        s.wheels[pin].attached = false;
+        s.loopbacks[pin].wired = false;
+        s.level[pin].store(0);
+        s.mode[pin].store(PI_INPUT);
+        s.pwm_duty[pin].store(0);
+        s.pwm_freq[pin].store(0);
+    }
+}
+
+unsigned gpioHardwareRevision(void)
+{
+    return SIM_REVISION;
+}
+
+int gpioSetMode(unsigned gpio, unsigned mode)
+{
+    if (gpio >= SIM_GPIO) {
+        return PI_BAD_GPIO;
+    }
+    if (mode > 7) {
+        return PI_BAD_MODE;
+    }
+    sim().mode[gpio].store(mode, std::memory_order_relaxed);
+    return 0;
+}
+
+int gpioGetMode(unsigned gpio)
+{
+    return gpio < SIM_GPIO ? static_cast<int>(sim().mode[gpio].load(std::memory_order_relaxed)) : PI_BAD_GPIO;
+}
+
+int gpioSetPullUpDown(unsigned gpio, unsigned pud)
+{
+    (void)pud;
+    return gpio < SIM_GPIO ? 0 : PI_BAD_GPIO;
+}
+
+int gpioWrite(unsigned gpio, unsigned level)
+{
+    if (gpio >= SIM_GPIO) {
+        return PI_BAD_GPIO;
+    }
+    if (level > 1) {
+        return PI_BAD_LEVEL;
+    }
+    sim().level[gpio].store(level, std::memory_order_relaxed);
+    return 0;
+}
+
+// bits above the header are accepted and ignored, as on a Pi where nothing is wired to them.
+static int write_bank(unsigned base, uint32_t bits, unsigned level)
+{
+    for (unsigned bit = 0; bit < 32 && base + bit < SIM_GPIO; bit++) {
+        if (bits & (1u << bit)) {
+            sim().level[base + bit].store(level, std::memory_order_relaxed);
+        }
+    }
+    return 0;
+}
+
+int gpioWrite_Bits_0_31_Clear(uint32_t bits)
+{
+    return write_bank(0, bits, 0);
+}
+
+int gpioWrite_Bits_0_31_Set(uint32_t bits)
+{
+    return write_bank(0, bits, 1);
+}
+
+int gpioWrite_Bits_32_53_Clear(uint32_t bits)
+{
+    return write_bank(32, bits, 0);
+}
+
+int gpioWrite_Bits_32_53_Set(uint32_t bits)
+{
+    return write_bank(32, bits, 1);
+}
+
+int gpioRead(unsigned gpio)
+{
+    return gpio < SIM_GPIO ? static_cast<int>(sim().level[gpio].load(std::memory_order_relaxed)) : PI_BAD_GPIO;
+}
+
+int gpioHardwarePWM(unsigned gpio, unsigned PWMfreq, unsigned PWMduty)
+{
+    if (gpio >= SIM_GPIO || !board::hardware_pwm_pin(gpio)) {
+        return PI_NOT_HPWM_GPIO;
+    }
+    if (PWMfreq > MAX_HPWM_FREQ) {
+        return PI_BAD_HPWM_FREQ;
+    }
+    if (PWMduty > MAX_HPWM_DUTY) {
+        return PI_BAD_HPWM_DUTY;
+    }
+    // a frequency of 0 switches PWM off.
+    sim().pwm_duty[gpio].store(PWMfreq == 0 ? 0 : PWMduty, std::memory_order_relaxed);
+    sim().pwm_freq[gpio].store(PWMfreq, std::memory_order_relaxed);
+    return 0;
+}
+
+int gpioGetPWMdutycycle(unsigned user_gpio)
+{
+    if (user_gpio >= SIM_GPIO) {
+        return PI_BAD_USER_GPIO;
+    }
+    return static_cast<int>(sim().pwm_duty[user_gpio].load(std::memory_order_relaxed));
+}
+
+int gpioSetISRFuncEx(unsigned gpio, unsigned edge, int timeout, gpioISRFuncEx_t f, void *userdata)
+{
+    if (gpio >= SIM_GPIO) {
+        return PI_BAD_GPIO;
+    }
+    if (edge > EITHER_EDGE) {
+        return PI_BAD_EDGE;
+    }
+    Sim &s = sim();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.isr[gpio] = Isr {f, userdata, edge, std::max(0, timeout), gpioTick()};
+    return 0;
+}
+
+uint32_t gpioTick(void)
+{
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - sim().epoch);
+    return static_cast<uint32_t>(us.count());
+}
+
+namespace {
+    struct WaveEdge {
+        uint64_t at_us;
+        uint32_t on;
+        uint32_t off;
+    };
+
+    void append_edges(const std::vector<gpioPulse_t> &pulses, std::vector<WaveEdge> &edges)
+    {
+        uint64_t at = 0;
+        for (const gpioPulse_t &p : pulses) {
+            edges.push_back(WaveEdge {at, p.gpioOn, p.gpioOff});
+            at += p.usDelay;
+        }
+        // the end of the waveform, so its length survives the merge.
+        edges.push_back(WaveEdge {at, 0, 0});
+    }
+}
+
+int gpioWaveClear(void)
+{
+    Sim &s = sim();
+    std::lock_guard<std::mutex> lock(s.wave_mutex);
+    s.building.clear();
+    for (unsigned id = 0; id < MAX_WAVES; id++) {
+        s.waves[id].clear();
+        s.wave_used[id] = false;
+    }
+    for (unsigned pin = 0; pin < SIM_GPIO; pin++) {
+        if (s.tx_mask & (1u << pin)) {
+            s.pwm_duty[pin].store(0, std::memory_order_relaxed);
+        }
+    }
+    s.tx_wave = -1;
+    s.tx_mask = 0;
+    return 0;
+}
+
+int gpioWaveAddNew(void)
+{
+    Sim &s = sim();
+    std::lock_guard<std::mutex> lock(s.wave_mutex);
+    s.building.clear();
+    return 0;
+}
+
+// as pigpio, pulses are merged with those already added by time rather than appended.
+int gpioWaveAddGeneric(unsigned numPulses, gpioPulse_t *pulses)
+{
+    Sim &s = sim();
+    std::lock_guard<std::mutex> lock(s.wave_mutex);
+    std::vector<WaveEdge> edges;
+    append_edges(s.building, edges);
+    append_edges(std::vector<gpioPulse_t>(pulses, pulses + numPulses), edges);
+    std::stable_sort(edges.begin(), edges.end(), [](const WaveEdge &a, const WaveEdge &b) {
+        return a.at_us < b.at_us;
+    });
+
+    std::vector<gpioPulse_t> merged;
+    uint64_t last_at = 0;
+    for (const WaveEdge &e : edges) {
+        if (!merged.empty() && e.at_us == last_at) {
+            merged.back().gpioOn |= e.on;
+            merged.back().gpioOff |= e.off;
+            continue;
+        }
+        if (!merged.empty()) {
+            merged.back().usDelay = static_cast<uint32_t>(e.at_us - last_at);
+        }
+        merged.push_back(gpioPulse_t {e.on, e.off, 0});
+        last_at = e.at_us;
+    }
+    // the final edge only marks the end of the waveform.
+    if (!merged.empty() && merged.back().gpioOn == 0 && merged.back().gpioOff == 0) {
+        merged.pop_back();
+    }
+    if (merged.size() > PI_WAVE_MAX_PULSES) {
+        return PI_TOO_MANY_PULSES;
+    }
+    s.building = std::move(merged);
+    return static_cast<int>(s.building.size());
+}
+
+int gpioWaveCreate(void)
+{
+    Sim &s = sim();
+    std::lock_guard<std::mutex> lock(s.wave_mutex);
+    if (s.building.empty()) {
+        return PI_EMPTY_WAVEFORM;
+    }
+    size_t total = s.building.size();
+    int free_id = -1;
+    for (unsigned id = 0; id < MAX_WAVES; id++) {
+        total += s.waves[id].size();
+        if (!s.wave_used[id] && free_id < 0) {
+            free_id = static_cast<int>(id);
+        }
+    }
+    if (free_id < 0) {
+        return PI_NO_WAVEFORM_ID;
+    }
+    if (total > PI_WAVE_MAX_PULSES) {
+        return PI_TOO_MANY_PULSES;
+    }
+    s.waves[free_id] = std::move(s.building);
+    s.wave_used[free_id] = true;
+    s.building.clear();
+    return free_id;
+}
+
+int gpioWaveDelete(unsigned wave_id)
+{
+    Sim &s = sim();
+    std::lock_guard<std::mutex> lock(s.wave_mutex);
+    if (wave_id >= MAX_WAVES || !s.wave_used[wave_id]) {
+        return PI_BAD_WAVE_ID;
+    }
+    s.waves[wave_id].clear();
+    s.wave_used[wave_id] = false;
+    return 0;
+}
+
+// the switch is immediate rather than at the end of the current cycle, the plant only sees average duty.
+int gpioWaveTxSend(unsigned wave_id, unsigned wave_mode)
+{
+    Sim &s = sim();
+    std::lock_guard<std::mutex> lock(s.wave_mutex);
+    if (wave_id >= MAX_WAVES || !s.wave_used[wave_id]) {
+        return PI_BAD_WAVE_ID;
+    }
+    if (wave_mode > PI_WAVE_MODE_REPEAT_SYNC) {
+        return PI_BAD_WAVE_MODE;
+    }
+    const std::vector<gpioPulse_t> &wave = s.waves[wave_id];
+
+    // levels at the start of a repeat are those left by the end of the previous cycle, so run it twice.
+    std::array<uint64_t, 32> high_us {};
+    uint32_t levels = 0;
+    uint32_t mask = 0;
+    uint64_t total_us = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        for (const gpioPulse_t &p : wave) {
+            levels = (levels | p.gpioOn) & ~p.gpioOff;
+            mask |= p.gpioOn | p.gpioOff;
+            if (pass == 1) {
+                for (unsigned pin = 0; pin < SIM_GPIO; pin++) {
+                    high_us[pin] += (levels & (1u << pin)) ? p.usDelay : 0;
+                }
+                total_us += p.usDelay;
+            }
+        }
+    }
+    for (unsigned pin = 0; pin < SIM_GPIO; pin++) {
+        if (mask & (1u << pin)) {
+            unsigned duty = total_us > 0 ? static_cast<unsigned>(high_us[pin] * MAX_HPWM_DUTY / total_us) : 0;
+            s.pwm_duty[pin].store(duty, std::memory_order_relaxed);
+        }
+        else if (s.tx_mask & (1u << pin)) {
+            s.pwm_duty[pin].store(0, std::memory_order_relaxed);
+        }
+    }
+    s.tx_wave = static_cast<int>(wave_id);
+    s.tx_mask = mask;
+    return static_cast<int>(wave.size()) * 2;
+}
+
+int gpioWaveTxStop(void)
+{
+    Sim &s = sim();
+    std::lock_guard<std::mutex> lock(s.wave_mutex);
+    for (unsigned pin = 0; pin < SIM_GPIO; pin++) {
+        if (s.tx_mask & (1u << pin)) {
+            s.pwm_duty[pin].store(0, std::memory_order_relaxed);
+        }
+    }
+    s.tx_wave = -1;
+    s.tx_mask = 0;
+    return 0;
+}
+
+int gpioWaveTxBusy(void)
+{
+    Sim &s = sim();
+    std::lock_guard<std::mutex> lock(s.wave_mutex);
+    return s.tx_wave >= 0 ? 1 : 0;
+}
+
+int gpioWaveTxAt(void)
+{
+    Sim &s = sim();
+    std::lock_guard<std::mutex> lock(s.wave_mutex);
+    return s.tx_wave >= 0 ? s.tx_wave : PI_NO_TX_WAVE;
+}
+
+int gpioWaveGetMaxPulses(void)
+{
+    return PI_WAVE_MAX_PULSES;
+}
+
+int gpioWaveGetMaxCbs(void)
+{
+    return MAX_WAVE_CBS;
+}
@@ -0,0 +1,54 @@
+/**
+ * Simulated pigpio backend, linked in place of libpigpio when the build is configured with -DPIGPIO_SIM=ON.
+ *
+ * Implements the subset of the pigpio C API used by the drivers against an in process model, so controllers
+ * can be exercised and benchmarked on a development machine, or with more motors than the robot has wired.
+ * The board's limits hold as on a Pi: GPIO 0 to board::MAX_GPIO, hardware PWM on 12, 13, 18 and 19 only, so
+ * further wheels are driven from software PWM, see wave_pwm.hpp.
+ *
+ * A motor is simulated by linking its PWM, direction and encoder pins with pigpio_sim_attach(). A plant thread
+ * steps every SIM_STEP_US, moving each wheel towards the velocity given by its duty with a first order lag,
+ * and calls the ISR registered on the encoder pin once per pulse, from its own thread as pigpio does.
+ *
+ * Waveforms are held and validated as pigpio would, but the plant only sees the average duty a transmitted
+ * waveform gives each of its pins, so a wheel can be driven from software PWM, see wave_pwm.hpp.
+ *
+ * pigpio_sim_loopback() stands in for a jumper from a hardware PWM pin to an encoder pin, an edge source of known
+ * rate for stress testing the encoder path.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+struct SimMotorModel {
+    double max_pps = 3000.0;   // encoder pulses/s at 100% duty
+    double deadband = 60.0;    // duty % below which the wheel does not turn
+    double tau_s = 0.05;       // time constant of the wheel
+    double jitter_us = 0.0;    // gaussian jitter added to each edge tick
+};
+
+static constexpr uint32_t SIM_STEP_US = 50;
+
+/**
+ * Drive the wheel on enc_pin from pwm_pin and dir_pin, replacing any wheel already on enc_pin.
+ * May be called before or after gpioInitialise(), links are cleared by gpioTerminate().
+ *
+ * @return 0 on success, PI_BAD_GPIO if a pin is out of range.
+ */
+int pigpio_sim_attach(unsigned pwm_pin, unsigned dir_pin, unsigned enc_pin, const SimMotorModel &model);
+
+// current simulated velocity of the wheel on enc_pin in pulses/s, signed by direction.
+double pigpio_sim_velocity(unsigned enc_pin);
+
+// pulses generated on enc_pin since it was attached or looped back.
+uint64_t pigpio_sim_pulses(unsigned enc_pin);
+
+/**
+ * Wire out_pin to in_pin. While out_pin runs hardware PWM at a duty strictly between 0 and 100%, the ISR on in_pin
+ * sees one rising edge per PWM period. Edges are generated by the plant thread, so they arrive in bursts of
+ * SIM_STEP_US, each timestamped when it would have occurred. Links are cleared by gpioTerminate().
+ *
+ * @return 0 on success, PI_BAD_GPIO if a pin is out of range.
+ */
+int pigpio_sim_loopback(unsigned out_pin, unsigned in_pin);
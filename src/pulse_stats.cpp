@@ -0,0 +1,171 @@
+#include "pulse_stats.hpp"
+#include "encoder.hpp"
+#include <cmath>
+
+namespace {
+    // each power of 2 is split into 2^SUB_BITS buckets.
+    constexpr int SUB_BITS = 3;
+    constexpr uint32_t SUB = 1u << SUB_BITS;
+    static_assert((32 - SUB_BITS + 1) * SUB <= PulseStatsSnapshot::BUCKETS, "histogram too small");
+
+    // index of the highest set bit, v must be non zero.
+    inline int msb(uint32_t v)
+    {
+        return 31 - __builtin_clz(v);
+    }
+}
+
+int PulseStats::bucket(uint32_t delta_us)
+{
+    // values below SUB get a bucket each, above that each power of 2 is split into SUB buckets.
+    if (delta_us < SUB) {
+        return static_cast<int>(delta_us);
+    }
+    int m = msb(delta_us);
+    return (m - SUB_BITS + 1) * SUB + static_cast<int>((delta_us >> (m - SUB_BITS)) & (SUB - 1));
+}
+
+void PulseStats::record(uint32_t delta_us, TickStatus status)
+{
+    if (status != TickStatus::HEALTHY) {
+        int idx = delta_us == 0 ? 0 : msb(delta_us);
+        auto &counter = rejected_[static_cast<int>(status) & (PulseStatsSnapshot::STATUSES - 1)][idx];
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return;
+    }
+
+    // single writer, so a plain load/store is enough and avoids a locked read-modify-write.
+    auto &counter = histogram_[bucket(delta_us)];
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+    // Welford update under a seqlock, readers retry while seq_ is odd or has moved.
+    uint32_t seq = seq_.load(std::memory_order_relaxed);
+    seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    uint64_t n = count_.load(std::memory_order_relaxed) + 1;
+    double mean = mean_.load(std::memory_order_relaxed);
+    double delta = static_cast<double>(delta_us) - mean;
+    mean += delta / static_cast<double>(n);
+    double m2 = m2_.load(std::memory_order_relaxed) + delta * (static_cast<double>(delta_us) - mean);
+
+    count_.store(n, std::memory_order_relaxed);
+    mean_.store(mean, std::memory_order_relaxed);
+    m2_.store(m2, std::memory_order_relaxed);
+    if (delta_us < min_.load(std::memory_order_relaxed)) {
+        min_.store(delta_us, std::memory_order_relaxed);
+    }
+    if (delta_us > max_.load(std::memory_order_relaxed)) {
+        max_.store(delta_us, std::memory_order_relaxed);
+    }
+
+    seq_.store(seq + 2, std::memory_order_release);
+}
+
+PulseStatsSnapshot PulseStats::snapshot() const
+{
+    PulseStatsSnapshot snap;
+
+    uint32_t begin = 0;
+    uint32_t end = 0;
+    double m2 = 0.0;
+    do {
+        begin = seq_.load(std::memory_order_acquire);
+        snap.count = count_.load(std::memory_order_relaxed);
+        snap.mean_us = mean_.load(std::memory_order_relaxed);
+        m2 = m2_.load(std::memory_order_relaxed);
+        snap.min_us = min_.load(std::memory_order_relaxed);
+        snap.max_us = max_.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        end = seq_.load(std::memory_order_relaxed);
+    } while ((begin & 1) != 0 || begin != end);
+
+    snap.variance = snap.count > 1 ? m2 / static_cast<double>(snap.count - 1) : 0.0;
+    if (snap.count == 0) {
+        snap.min_us = 0;
+    }
+
+    for (int i = 0; i < PulseStatsSnapshot::BUCKETS; i++) {
+        snap.histogram[i] = histogram_[i].load(std::memory_order_relaxed);
+    }
+    for (int s = 0; s < PulseStatsSnapshot::STATUSES; s++) {
+        for (int i = 0; i < PulseStatsSnapshot::REJECT_BUCKETS; i++) {
+            snap.rejected[s][i] = rejected_[s][i].load(std::memory_order_relaxed);
+        }
+    }
+    return snap;
+}
+
+void PulseStats::reset()
+{
+    seq_.store(0, std::memory_order_relaxed);
+    count_.store(0, std::memory_order_relaxed);
+    mean_.store(0.0, std::memory_order_relaxed);
+    m2_.store(0.0, std::memory_order_relaxed);
+    min_.store(UINT32_MAX, std::memory_order_relaxed);
+    max_.store(0, std::memory_order_relaxed);
+    for (auto &c : histogram_) {
+        c.store(0, std::memory_order_relaxed);
+    }
+    for (auto &status : rejected_) {
+        for (auto &c : status) {
+            c.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+double PulseStatsSnapshot::stddev() const
+{
+    return std::sqrt(variance);
+}
+
+uint64_t PulseStatsSnapshot::rejected_count(TickStatus status) const
+{
+    uint64_t total = 0;
+    for (uint32_t c : rejected[static_cast<int>(status) & (STATUSES - 1)]) {
+        total += c;
+    }
+    return total;
+}
+
+uint32_t PulseStatsSnapshot::percentile(double q) const
+{
+    uint64_t total = 0;
+    for (uint32_t c : histogram) {
+        total += c;
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    uint64_t target = static_cast<uint64_t>(std::ceil(q * static_cast<double>(total)));
+    if (target == 0) {
+        target = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += histogram[i];
+        if (seen >= target) {
+            return bucket_upper(i);
+        }
+    }
+    return max_us;
+}
+
+uint32_t PulseStatsSnapshot::bucket_lower(int idx)
+{
+    if (idx < static_cast<int>(SUB)) {
+        return static_cast<uint32_t>(idx);
+    }
+    int m = idx / SUB + SUB_BITS - 1;
+    return (SUB + idx % SUB) << (m - SUB_BITS);
+}
+
+uint32_t PulseStatsSnapshot::bucket_upper(int idx)
+{
+    if (idx < static_cast<int>(SUB)) {
+        return static_cast<uint32_t>(idx);
+    }
+    int m = idx / SUB + SUB_BITS - 1;
+    return bucket_lower(idx) + ((1u << (m - SUB_BITS)) - 1);
+}
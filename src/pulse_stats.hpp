@@ -0,0 +1,82 @@
+/**
+ * Streaming statistics over the delta_us reported by a MotorEncoder.
+ *
+ * Kept per pin so that encoder degradation or noise coupling can be spotted while the robot is
+ * running, rather than by dumping tst_motor_enc CSV and working it out by hand.
+ *
+ * - HEALTHY intervals go into a log bucketed histogram (8 buckets per power of 2), and a Welford
+ *   running mean/variance.
+ * - rejected intervals (TIMEOUT, NOISE_REJECTED, UNEXPECTED) go into a coarser histogram per status,
+ *   one bucket per power of 2.
+ *
+ * record() has a single writer, the pigpio callback thread for the pin, and costs O(1) with no locks.
+ * snapshot() may be called from any thread at any time, the Welford state is read under a seqlock
+ * and each histogram counter is read atomically.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// defined in encoder.hpp, which includes this file.
+enum class TickStatus : uint8_t;
+
+struct PulseStatsSnapshot {
+    static constexpr int BUCKETS = 240;
+    static constexpr int REJECT_BUCKETS = 32;
+    static constexpr int STATUSES = 4;
+
+    uint64_t count = 0;   // healthy intervals
+    double mean_us = 0.0;
+    double variance = 0.0;
+    uint32_t min_us = 0;
+    uint32_t max_us = 0;
+
+    std::array<uint32_t, BUCKETS> histogram {};
+    // indexed by TickStatus, HEALTHY is always empty.
+    std::array<std::array<uint32_t, REJECT_BUCKETS>, STATUSES> rejected {};
+
+    double stddev() const;
+
+    uint64_t rejected_count(TickStatus status) const;
+
+    /**
+     * Approximate percentile from the histogram, returns the upper bound of the bucket containing q.
+     *
+     * @param q between 0.0 and 1.0
+     */
+    uint32_t percentile(double q) const;
+
+    // range of values held in histogram bucket idx.
+    static uint32_t bucket_lower(int idx);
+    static uint32_t bucket_upper(int idx);
+};
+
+class PulseStats {
+  public:
+    /**
+     * Add an interval, called from the encoder callback thread only.
+     */
+    void record(uint32_t delta_us, TickStatus status);
+
+    // Readable from any thread.
+    PulseStatsSnapshot snapshot() const;
+
+    // Only safe while no edges are being recorded (e.g. before activation).
+    void reset();
+
+    static int bucket(uint32_t delta_us);
+
+  private:
+    std::atomic<uint32_t> seq_ {0};
+    std::atomic<uint64_t> count_ {0};
+    std::atomic<double> mean_ {0.0};
+    std::atomic<double> m2_ {0.0};
+    std::atomic<uint32_t> min_ {UINT32_MAX};
+    std::atomic<uint32_t> max_ {0};
+
+    std::array<std::atomic<uint32_t>, PulseStatsSnapshot::BUCKETS> histogram_ {};
+    std::array<std::array<std::atomic<uint32_t>, PulseStatsSnapshot::REJECT_BUCKETS>, PulseStatsSnapshot::STATUSES> rejected_ {};
+};
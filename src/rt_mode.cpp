@@ -0,0 +1,288 @@
+#include "rt_mode.hpp"
+#include <algorithm>
+#include <alloca.h>
+#include <cstring>
+#include <fstream>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace {
+    constexpr size_t PAGE_BYTES = 4096;
+
+    // left below the prefaulted region for the frames the thread pushes after prefault_stack() returns.
+    constexpr size_t STACK_HEADROOM_BYTES = 16 * 1024;
+
+    const char *thread_name(RtThreadRole role)
+    {
+        return role == RtThreadRole::CONTROL ? "rr_control" : "rr_gpio_cb";
+    }
+
+    // bytes of the calling thread's stack between its lowest address and the caller's frame, 0 if unknown.
+    __attribute__((noinline)) size_t stack_below_caller()
+    {
+        pthread_attr_t attr;
+        if (pthread_getattr_np(pthread_self(), &attr) != 0) {
+            return 0;
+        }
+        void *lowest = nullptr;
+        size_t size = 0;
+        int r = pthread_attr_getstack(&attr, &lowest, &size);
+        pthread_attr_destroy(&attr);
+        if (r != 0) {
+            return 0;
+        }
+        auto low = reinterpret_cast<uintptr_t>(lowest);
+        auto depth = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+        return depth > low ? depth - low : 0;
+    }
+
+    /**
+     * Touch up to bytes of stack just below the caller, clamped to what is left of the thread's stack. pigpio's
+     * callback thread has a much smaller stack than the main thread.
+     *
+     * noinline so the alloca is a frame of its own, and freed when it returns.
+     *
+     * @return bytes prefaulted.
+     */
+    __attribute__((noinline)) size_t prefault_stack(size_t bytes)
+    {
+        size_t below = stack_below_caller();
+        bytes = std::min(bytes, below > STACK_HEADROOM_BYTES ? below - STACK_HEADROOM_BYTES : 0);
+        if (bytes == 0) {
+            return 0;
+        }
+        auto *buffer = static_cast<volatile char *>(alloca(bytes));
+        // from the top down, the way the stack grows, starting next to the pages already in use.
+        for (size_t touched = 0; touched < bytes; touched += PAGE_BYTES) {
+            buffer[bytes - 1 - touched] = 0;
+        }
+        return bytes;
+    }
+
+    std::string read_line(const char *path)
+    {
+        std::ifstream in(path);
+        std::string line;
+        std::getline(in, line);
+        return line;
+    }
+
+    // VmLck from /proc/self/status, in kB.
+    std::string locked_kb()
+    {
+        std::ifstream in("/proc/self/status");
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.rfind("VmLck:", 0) == 0) {
+                return line.substr(6);
+            }
+        }
+        return " unknown";
+    }
+}
+
+ThreadFaultStats thread_fault_stats()
+{
+    ThreadFaultStats stats;
+    struct rusage usage {};
+    if (getrusage(RUSAGE_THREAD, &usage) == 0) {
+        stats.minor_faults = static_cast<uint64_t>(usage.ru_minflt);
+        stats.major_faults = static_cast<uint64_t>(usage.ru_majflt);
+        stats.voluntary_switches = static_cast<uint64_t>(usage.ru_nvcsw);
+        stats.involuntary_switches = static_cast<uint64_t>(usage.ru_nivcsw);
+    }
+    return stats;
+}
+
+ThreadFaultStats operator-(const ThreadFaultStats &a, const ThreadFaultStats &b)
+{
+    return ThreadFaultStats {
+        a.minor_faults - b.minor_faults,
+        a.major_faults - b.major_faults,
+        a.voluntary_switches - b.voluntary_switches,
+        a.involuntary_switches - b.involuntary_switches,
+    };
+}
+
+RtMode &RtMode::instance()
+{
+    static RtMode mode;
+    return mode;
+}
+
+CallbackReturn RtMode::on_configure(const RtConfig &config)
+{
+    if (enabled()) {
+        std::cout << "ERROR: real time mode is already active\n";
+        return CallbackReturn::FAILURE;
+    }
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (config.control_cpu >= cpus || config.callback_cpu >= cpus) {
+        std::cout << "ERROR: real time CPU out of range, " << cpus << " CPUs online\n";
+        return CallbackReturn::FAILURE;
+    }
+    int min_priority = sched_get_priority_min(SCHED_FIFO);
+    int max_priority = sched_get_priority_max(SCHED_FIFO);
+    if (config.control_priority < min_priority || config.control_priority > max_priority ||
+        config.callback_priority < min_priority || config.callback_priority > max_priority) {
+        std::cout << "ERROR: SCHED_FIFO priority must be between " << min_priority << " and " << max_priority << "\n";
+        return CallbackReturn::FAILURE;
+    }
+    config_ = config;
+    return CallbackReturn::SUCCESS;
+}
+
+CallbackReturn RtMode::on_activate()
+{
+    if (enabled()) {
+        return CallbackReturn::SUCCESS;
+    }
+
+    if (config_.lock_memory) {
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+            std::cout << "ERROR: mlockall failed (" << std::strerror(errno) << "), run as root or grant CAP_IPC_LOCK\n";
+            return CallbackReturn::FAILURE;
+        }
+        // keep freed memory in the locked heap rather than handing it back, and never mmap allocations.
+        mallopt(M_TRIM_THRESHOLD, -1);
+        mallopt(M_MMAP_MAX, 0);
+    }
+    prefault_heap();
+
+    isolated_ = isolated_cpus();
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    control_cpu_ = config_.control_cpu;
+    if (control_cpu_ < 0) {
+        control_cpu_ = isolated_.empty() ? static_cast<int>(cpus - 1) : isolated_[0];
+    }
+    callback_cpu_ = config_.callback_cpu;
+    if (callback_cpu_ < 0) {
+        callback_cpu_ = isolated_.size() > 1 ? isolated_[1] : control_cpu_;
+    }
+
+    activate_faults_ = thread_fault_stats();
+    enabled_.store(true, std::memory_order_release);
+    return CallbackReturn::SUCCESS;
+}
+
+void RtMode::prefault_heap() const
+{
+    if (config_.prefault_heap_bytes == 0) {
+        return;
+    }
+    // touching every page grows the heap to this size, and with trimming disabled it stays that size.
+    char *heap = static_cast<char *>(malloc(config_.prefault_heap_bytes));
+    if (heap == nullptr) {
+        return;
+    }
+    for (size_t i = 0; i < config_.prefault_heap_bytes; i += PAGE_BYTES) {
+        heap[i] = 0;
+    }
+    free(heap);
+}
+
+bool RtMode::harden_current_thread(RtThreadRole role)
+{
+    if (!enabled()) {
+        return true;
+    }
+    // nothing is printed from the callback thread, its state is kept for report() instead.
+    const bool quiet = role == RtThreadRole::CALLBACK;
+    pthread_t self = pthread_self();
+    pthread_setname_np(self, thread_name(role));
+
+    int cpu = role == RtThreadRole::CONTROL ? control_cpu_ : callback_cpu_;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    bool pinned = pthread_setaffinity_np(self, sizeof(set), &set) == 0;
+    if (!pinned && !quiet) {
+        std::cout << "WARNING: unable to pin " << thread_name(role) << " to CPU " << cpu << "\n";
+    }
+
+    sched_param param {};
+    param.sched_priority = role == RtThreadRole::CONTROL ? config_.control_priority : config_.callback_priority;
+    bool fifo = pthread_setschedparam(self, SCHED_FIFO, &param) == 0;
+    if (!fifo && !quiet) {
+        std::cout << "WARNING: unable to run " << thread_name(role) << " SCHED_FIFO\n";
+    }
+
+    size_t stack = prefault_stack(config_.prefault_stack_bytes);
+    if (stack < config_.prefault_stack_bytes && !quiet) {
+        std::cout << "WARNING: only " << stack << " of " << config_.prefault_stack_bytes << " stack bytes prefaulted on "
+                  << thread_name(role) << "\n";
+    }
+
+    RtThreadState &state = threads_[static_cast<size_t>(role)];
+    state.stack_bytes.store(stack, std::memory_order_relaxed);
+    state.pinned.store(pinned, std::memory_order_relaxed);
+    state.fifo.store(fifo, std::memory_order_relaxed);
+    state.hardened.store(true, std::memory_order_release);
+    return pinned && fifo;
+}
+
+void RtMode::on_callback_thread()
+{
+    thread_local bool hardened = false;
+    if (hardened || !enabled()) {
+        return;
+    }
+    hardened = true;
+    harden_current_thread(RtThreadRole::CALLBACK);
+}
+
+void RtMode::report() const
+{
+    std::cout << "Real time mode: " << (enabled() ? "on" : "off") << "\n";
+    if (!enabled()) {
+        return;
+    }
+    std::cout << "  memory locked:" << locked_kb() << "\n";
+    std::cout << "  isolated CPUs: " << (isolated_.empty() ? std::string("none") : read_line("/sys/devices/system/cpu/isolated")) << "\n";
+    std::cout << "  control CPU: " << control_cpu_ << " priority " << config_.control_priority
+              << ", callback CPU: " << callback_cpu_ << " priority " << config_.callback_priority << "\n";
+
+    for (RtThreadRole role : {RtThreadRole::CONTROL, RtThreadRole::CALLBACK}) {
+        const RtThreadState &state = threads_[static_cast<size_t>(role)];
+        std::cout << "  " << thread_name(role) << ": ";
+        if (!state.hardened.load(std::memory_order_acquire)) {
+            std::cout << "not started\n";
+            continue;
+        }
+        std::cout << (state.pinned.load(std::memory_order_relaxed) ? "pinned" : "NOT pinned") << ", "
+                  << (state.fifo.load(std::memory_order_relaxed) ? "SCHED_FIFO" : "NOT SCHED_FIFO") << ", stack "
+                  << state.stack_bytes.load(std::memory_order_relaxed) << " of " << config_.prefault_stack_bytes
+                  << " bytes prefaulted\n";
+    }
+
+    ThreadFaultStats since = thread_fault_stats() - activate_faults_;
+    std::cout << "  this thread since activation, minor faults: " << since.minor_faults
+              << " major faults: " << since.major_faults
+              << " voluntary switches: " << since.voluntary_switches
+              << " involuntary switches: " << since.involuntary_switches << "\n";
+}
+
+std::vector<int> RtMode::isolated_cpus()
+{
+    // a list such as "2-3,5", empty when nothing is isolated.
+    std::vector<int> cpus;
+    std::stringstream list(read_line("/sys/devices/system/cpu/isolated"));
+    std::string range;
+    while (std::getline(list, range, ',')) {
+        if (range.empty()) {
+            continue;
+        }
+        size_t dash = range.find('-');
+        int first = std::stoi(range.substr(0, dash));
+        int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
@@ -0,0 +1,111 @@
+/**
+ * Opt in real time hardening for the control and pigpio callback threads.
+ *
+ * By default nothing stops the kernel from paging out the control loop's memory, or from running the control
+ * thread on the same core as everything else. When enabled, RtMode:
+ *
+ * - locks current and future memory with mlockall(), and stops glibc from trimming or mmapping the heap so memory
+ *   freed after startup stays resident,
+ * - prefaults prefault_heap_bytes of heap and, per hardened thread, prefault_stack_bytes of stack,
+ * - names the control and callback threads, pins them to a CPU, and runs them SCHED_FIFO. CPUs listed in
+ *   /sys/devices/system/cpu/isolated (isolcpus=) are preferred when no CPU is given.
+ *
+ * Page faults and context switches are counted per thread with getrusage(RUSAGE_THREAD), see ThreadFaultStats.
+ *
+ * Everything here is a no-op until on_activate() succeeds, so executables only pay for it when asked to.
+ */
+
+#pragma once
+
+#include "tst_common.hpp"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum class RtThreadRole : uint8_t {
+    CONTROL = 0,   // control loop, MotorExecutor
+    CALLBACK = 1,  // pigpio ISR callback thread
+};
+
+struct RtConfig {
+    bool lock_memory = true;
+    size_t prefault_heap_bytes = 8 * 1024 * 1024;
+    size_t prefault_stack_bytes = 256 * 1024;  // clamped to what is left of each thread's stack
+    int control_cpu = -1;                      // -1 picks the first isolated CPU, or the last CPU
+    int callback_cpu = -1;                     // -1 picks the second isolated CPU, or the control CPU
+    int control_priority = 80;                 // SCHED_FIFO
+    int callback_priority = 70;
+};
+
+struct ThreadFaultStats {
+    uint64_t minor_faults = 0;
+    uint64_t major_faults = 0;
+    uint64_t voluntary_switches = 0;
+    uint64_t involuntary_switches = 0;
+};
+
+/**
+ * Counters for the calling thread since it started.
+ */
+ThreadFaultStats thread_fault_stats();
+
+ThreadFaultStats operator-(const ThreadFaultStats &a, const ThreadFaultStats &b);
+
+class RtMode {
+  public:
+    static RtMode &instance();
+
+    CallbackReturn on_configure(const RtConfig &config);
+
+    /**
+     * Lock and prefault memory and resolve CPUs. Call from main before any control or callback thread starts,
+     * fails if memory cannot be locked (needs root or CAP_IPC_LOCK).
+     */
+    CallbackReturn on_activate();
+
+    bool enabled() const { return enabled_.load(std::memory_order_acquire); }
+
+    /**
+     * Name, pin, prioritise and prefault the stack of the calling thread. Returns false if any step failed,
+     * the thread keeps running either way. Failures are printed for the control thread, and kept for report()
+     * for the callback thread.
+     */
+    bool harden_current_thread(RtThreadRole role);
+
+    /**
+     * Harden the pigpio callback thread the first time it is seen, called from the ISR trampoline.
+     * A thread local check once enabled, nothing otherwise.
+     */
+    void on_callback_thread();
+
+    // print memory, CPU and hardening state, and page faults for the calling thread.
+    void report() const;
+
+    // CPUs from /sys/devices/system/cpu/isolated, empty when isolcpus= is not set.
+    static std::vector<int> isolated_cpus();
+
+  private:
+    RtMode() = default;
+    RtMode(const RtMode &) = delete;
+    RtMode &operator=(const RtMode &) = delete;
+
+    void prefault_heap() const;
+
+    // outcome of harden_current_thread() per RtThreadRole, written by that thread.
+    struct RtThreadState {
+        std::atomic<bool> hardened {false};
+        std::atomic<bool> pinned {false};
+        std::atomic<bool> fifo {false};
+        std::atomic<size_t> stack_bytes {0};
+    };
+
+    RtConfig config_;
+    std::array<RtThreadState, 2> threads_;
+    std::atomic<bool> enabled_ {false};
+    std::vector<int> isolated_;
+    int control_cpu_ = -1;
+    int callback_cpu_ = -1;
+    ThreadFaultStats activate_faults_;
+};
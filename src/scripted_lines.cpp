@@ -0,0 +1,127 @@
+#include "scripted_lines.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/gpio.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace {
+    // the playback thread also wakes this often to pick up rate changes.
+    constexpr uint64_t IDLE_NS = 10000000ULL;
+
+    uint64_t mono_ns()
+    {
+        struct timespec ts {};
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+    }
+}
+
+ScriptedLineSource::~ScriptedLineSource()
+{
+    on_deactivate();
+    for (Script &script : scripts_) {
+        if (script.write_fd >= 0) {
+            close(script.write_fd);
+        }
+    }
+}
+
+int ScriptedLineSource::open_line(unsigned pin)
+{
+    if (pin >= MAX_PINS) {
+        return -EINVAL;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    Script &script = scripts_[pin];
+    if (script.write_fd >= 0) {
+        close(script.write_fd);
+    }
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        return -errno;
+    }
+    // a reader that falls behind loses events rather than stalling the script, as the kernel buffer would.
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+    script.write_fd = fds[1];
+    script.line_seqno = 0;
+    script.next_ns = 0;
+    return fds[0];
+}
+
+void ScriptedLineSource::set_rate(unsigned pin, uint32_t hz)
+{
+    if (pin < MAX_PINS) {
+        scripts_[pin].hz.store(hz, std::memory_order_relaxed);
+    }
+}
+
+uint64_t ScriptedLineSource::sent(unsigned pin) const
+{
+    return pin < MAX_PINS ? scripts_[pin].sent.load(std::memory_order_relaxed) : 0;
+}
+
+CallbackReturn ScriptedLineSource::on_activate()
+{
+    if (running_.exchange(true)) {
+        return CallbackReturn::SUCCESS;
+    }
+    thread_ = std::thread(&ScriptedLineSource::run, this);
+    return CallbackReturn::SUCCESS;
+}
+
+CallbackReturn ScriptedLineSource::on_deactivate()
+{
+    running_.store(false);
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    return CallbackReturn::SUCCESS;
+}
+
+void ScriptedLineSource::run()
+{
+    pthread_setname_np(pthread_self(), "rr_script");
+    while (running_.load(std::memory_order_relaxed)) {
+        uint64_t now = mono_ns();
+        uint64_t wake = now + IDLE_NS;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (size_t pin = 0; pin < MAX_PINS; pin++) {
+                Script &script = scripts_[pin];
+                uint32_t hz = script.hz.load(std::memory_order_relaxed);
+                if (script.write_fd < 0 || hz == 0) {
+                    script.next_ns = 0;
+                    continue;
+                }
+                uint64_t period_ns = 1000000000ULL / hz;
+                if (script.next_ns == 0) {
+                    script.next_ns = now + period_ns;
+                }
+                while (script.next_ns <= now) {
+                    struct gpio_v2_line_event ev {};
+                    // stamped when the edge was due, as the kernel stamps it in the interrupt handler.
+                    ev.timestamp_ns = script.next_ns;
+                    ev.id = GPIO_V2_LINE_EVENT_RISING_EDGE;
+                    ev.offset = static_cast<uint32_t>(pin);
+                    ev.seqno = ++script.line_seqno;
+                    ev.line_seqno = script.line_seqno;
+                    // a full pipe drops the event, which the reader sees as a line_seqno gap.
+                    if (write(script.write_fd, &ev, sizeof(ev)) == static_cast<ssize_t>(sizeof(ev))) {
+                        script.sent.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    script.next_ns += period_ns;
+                }
+                if (script.next_ns < wake) {
+                    wake = script.next_ns;
+                }
+            }
+        }
+        struct timespec ts {};
+        ts.tv_sec = static_cast<time_t>(wake / 1000000000ULL);
+        ts.tv_nsec = static_cast<long>(wake % 1000000000ULL);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr);
+    }
+}
@@ -0,0 +1,54 @@
+/**
+ * Stand in for /dev/gpiochipN, so GpioChardev can be exercised without a Pi.
+ *
+ * Every line opened is a pipe, and a playback thread writes whole gpio_v2_line_event records into it at the rate
+ * set for the pin, timestamped from CLOCK_MONOTONIC with an incrementing line_seqno exactly as the kernel would.
+ * Records are smaller than PIPE_BUF so each write is atomic and a reader always sees whole events.
+ *
+ * Rates may be changed at any time from the test thread, a rate of 0 stops the pin. sent() is the number of
+ * events written for a pin, for checking that none were lost.
+ */
+
+#pragma once
+
+#include "gpio_chardev.hpp"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+class ScriptedLineSource : public EdgeLineSource {
+  public:
+    ~ScriptedLineSource() override;
+
+    int open_line(unsigned pin) override;
+
+    // edges per second on pin, 0 to pause it.
+    void set_rate(unsigned pin, uint32_t hz);
+
+    uint64_t sent(unsigned pin) const;
+
+    // start writing events to the opened lines.
+    CallbackReturn on_activate();
+
+    CallbackReturn on_deactivate();
+
+  private:
+    static constexpr size_t MAX_PINS = 64;
+
+    struct Script {
+        int write_fd = -1;
+        std::atomic<uint32_t> hz {0};
+        std::atomic<uint64_t> sent {0};
+        uint64_t next_ns = 0;
+        uint32_t line_seqno = 0;
+    };
+
+    void run();
+
+    std::array<Script, MAX_PINS> scripts_ {};
+    std::mutex mutex_;
+    std::thread thread_;
+    std::atomic<bool> running_ {false};
+};
@@ -0,0 +1,104 @@
+/**
+ * Seqlock helpers shared by the shared memory segments (telemetry.hpp, command_mailbox.hpp).
+ *
+ * The sequence is odd while a write is in progress. Readers copy the payload and retry if the sequence was odd
+ * or changed during the copy. Payloads must be trivially copyable, they live in memory mapped by other processes.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <unistd.h>
+
+namespace seqlock {
+    // bounded so a writer that died mid update cannot hang a reader.
+    constexpr int MAX_READ_ATTEMPTS = 1000;
+
+    /**
+     * Write when there is only ever one writer for seq.
+     */
+    template <typename T>
+    void write(std::atomic<uint32_t> &seq, T &dst, const T &src)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "seqlock payload must be trivially copyable");
+        uint32_t s = seq.load(std::memory_order_relaxed);
+        seq.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(&dst, &src, sizeof(T));
+        seq.store(s + 2, std::memory_order_release);
+    }
+
+    // spins on a slot owned by a live writer before giving up, each one is a load or a failed CAS.
+    constexpr int MAX_WRITE_ATTEMPTS = 100000;
+
+    /**
+     * Modify dst in place when several writers, possibly in different processes, may race.
+     *
+     * A writer first claims owner by a CAS from 0 to its pid, then writes as the single writer of seq, so fn sees the
+     * payload left by the previous writer. seq is only ever changed by the owner, readers are unaffected by the
+     * ownership word.
+     *
+     * The claim is bounded: after MAX_WRITE_ATTEMPTS the owner's pid is checked, and a writer that died holding the
+     * slot, possibly mid update with seq left odd, is taken over. fn then rewrites the whole payload and seq is made
+     * even again. A slot held by a live process for that long is reported busy.
+     *
+     * @return false if the slot stayed busy, dst is unchanged.
+     */
+    template <typename T, typename Fn>
+    bool update_shared(std::atomic<uint32_t> &seq, std::atomic<uint32_t> &owner, T &dst, Fn &&fn)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "seqlock payload must be trivially copyable");
+        const auto self = static_cast<uint32_t>(getpid());
+        uint32_t held = 0;
+        int attempts = 0;
+        while (!owner.compare_exchange_weak(held, self, std::memory_order_acquire, std::memory_order_relaxed)) {
+            if (held == 0) {
+                continue;
+            }
+            if (++attempts < MAX_WRITE_ATTEMPTS) {
+                held = 0;
+                continue;
+            }
+            // a pid that no longer exists cannot release the slot.
+            if (held == self || kill(static_cast<pid_t>(held), 0) == 0 || errno != ESRCH) {
+                return false;
+            }
+            if (owner.compare_exchange_strong(held, self, std::memory_order_acquire, std::memory_order_relaxed)) {
+                break;
+            }
+            attempts = 0;
+            held = 0;
+        }
+
+        // even unless the previous owner died mid update, either way the next odd value marks this write.
+        uint32_t s = seq.load(std::memory_order_relaxed) & ~1u;
+        seq.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        fn(dst);
+        seq.store(s + 2, std::memory_order_release);
+        owner.store(0, std::memory_order_release);
+        return true;
+    }
+
+    template <typename T>
+    bool read(const std::atomic<uint32_t> &seq, const T &src, T &out)
+    {
+        for (int i = 0; i < MAX_READ_ATTEMPTS; i++) {
+            uint32_t begin = seq.load(std::memory_order_acquire);
+            if (begin & 1) {
+                continue;
+            }
+            std::memcpy(&out, &src, sizeof(T));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq.load(std::memory_order_relaxed) == begin) {
+                return true;
+            }
+        }
+        return false;
+    }
+}
@@ -0,0 +1,198 @@
+#include "telemetry.hpp"
+#include "seqlock.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <iterator>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    size_t segment_size(uint16_t motor_ct)
+    {
+        return sizeof(TelemetryHeader) + sizeof(LoopTelemetrySlot) + motor_ct * sizeof(MotorTelemetrySlot);
+    }
+}
+
+TelemetryPublisher::~TelemetryPublisher()
+{
+    on_deactivate();
+}
+
+CallbackReturn TelemetryPublisher::on_configure(const std::string &name, uint16_t motor_ct)
+{
+    if (name.empty() || name[0] != '/' || motor_ct == 0) {
+        std::cout << "ERROR: telemetry needs a name starting with / and at least one motor\n";
+        return CallbackReturn::FAILURE;
+    }
+    name_ = name;
+    motor_ct_ = motor_ct;
+    return CallbackReturn::SUCCESS;
+}
+
+CallbackReturn TelemetryPublisher::on_activate()
+{
+    if (base_ != nullptr) {
+        return CallbackReturn::SUCCESS;
+    }
+
+    int fd = shm_open(name_.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        std::cout << "ERROR: unable to create telemetry segment " << name_ << "\n";
+        return CallbackReturn::FAILURE;
+    }
+
+    size_ = segment_size(motor_ct_);
+    if (ftruncate(fd, static_cast<off_t>(size_)) != 0) {
+        std::cout << "ERROR: unable to size telemetry segment " << name_ << "\n";
+        close(fd);
+        shm_unlink(name_.c_str());
+        return CallbackReturn::FAILURE;
+    }
+
+    void *base = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        std::cout << "ERROR: unable to map telemetry segment " << name_ << "\n";
+        shm_unlink(name_.c_str());
+        return CallbackReturn::FAILURE;
+    }
+    base_ = base;
+    std::memset(base_, 0, size_);
+
+    auto *header = static_cast<TelemetryHeader *>(base_);
+    header->version = TELEMETRY_VERSION;
+    header->motor_ct = motor_ct_;
+    header->header_size = sizeof(TelemetryHeader);
+    header->loop_size = sizeof(LoopTelemetrySlot);
+    header->motor_size = sizeof(MotorTelemetrySlot);
+
+    loop_ = reinterpret_cast<LoopTelemetrySlot *>(static_cast<char *>(base_) + sizeof(TelemetryHeader));
+    motors_ = reinterpret_cast<MotorTelemetrySlot *>(reinterpret_cast<char *>(loop_) + sizeof(LoopTelemetrySlot));
+    loop_stats_ = LoopTelemetry {};
+
+    // readers treat the segment as valid once they see the magic.
+    header->magic.store(TELEMETRY_MAGIC, std::memory_order_release);
+    return CallbackReturn::SUCCESS;
+}
+
+CallbackReturn TelemetryPublisher::on_deactivate()
+{
+    if (base_ == nullptr) {
+        return CallbackReturn::SUCCESS;
+    }
+    static_cast<TelemetryHeader *>(base_)->magic.store(0, std::memory_order_release);
+    munmap(base_, size_);
+    shm_unlink(name_.c_str());
+    base_ = nullptr;
+    loop_ = nullptr;
+    motors_ = nullptr;
+    return CallbackReturn::SUCCESS;
+}
+
+void TelemetryPublisher::publish(uint16_t idx, const MotorTelemetry &telemetry)
+{
+    if (motors_ == nullptr || idx >= motor_ct_) {
+        return;
+    }
+    seqlock::write(motors_[idx].seq, motors_[idx].data, telemetry);
+}
+
+void TelemetryPublisher::publish_cycle(uint32_t tick, uint32_t cycle_us)
+{
+    if (loop_ == nullptr) {
+        return;
+    }
+    loop_stats_.cycles++;
+    loop_stats_.tick = tick;
+    loop_stats_.cycle_us = cycle_us;
+    loop_stats_.cycle_max_us = std::max(loop_stats_.cycle_max_us, cycle_us);
+    loop_stats_.cycle_mean_us += (cycle_us - loop_stats_.cycle_mean_us) / static_cast<double>(loop_stats_.cycles);
+    seqlock::write(loop_->seq, loop_->data, loop_stats_);
+}
+
+void TelemetryPublisher::publish_stages(const StageTelemetry (&stages)[TELEMETRY_STAGES], uint64_t overruns)
+{
+    if (loop_ == nullptr) {
+        return;
+    }
+    std::copy(std::begin(stages), std::end(stages), std::begin(loop_stats_.stages));
+    loop_stats_.overruns = overruns;
+    seqlock::write(loop_->seq, loop_->data, loop_stats_);
+}
+
+TelemetryReader::~TelemetryReader()
+{
+    on_deactivate();
+}
+
+CallbackReturn TelemetryReader::on_activate(const std::string &name)
+{
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        std::cout << "ERROR: telemetry segment " << name << " does not exist\n";
+        return CallbackReturn::FAILURE;
+    }
+
+    struct stat st {};
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(TelemetryHeader)) {
+        close(fd);
+        std::cout << "ERROR: telemetry segment " << name << " is not initialised\n";
+        return CallbackReturn::FAILURE;
+    }
+
+    size_ = static_cast<size_t>(st.st_size);
+    void *base = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        std::cout << "ERROR: unable to map telemetry segment " << name << "\n";
+        return CallbackReturn::FAILURE;
+    }
+    base_ = base;
+
+    const auto *header = static_cast<const TelemetryHeader *>(base_);
+    if (header->magic.load(std::memory_order_acquire) != TELEMETRY_MAGIC ||
+        header->version != TELEMETRY_VERSION ||
+        header->header_size != sizeof(TelemetryHeader) ||
+        header->loop_size != sizeof(LoopTelemetrySlot) ||
+        header->motor_size != sizeof(MotorTelemetrySlot) ||
+        segment_size(header->motor_ct) > size_) {
+        std::cout << "ERROR: telemetry segment " << name << " has an incompatible layout\n";
+        on_deactivate();
+        return CallbackReturn::FAILURE;
+    }
+
+    motor_ct_ = header->motor_ct;
+    loop_ = reinterpret_cast<const LoopTelemetrySlot *>(static_cast<const char *>(base_) + sizeof(TelemetryHeader));
+    motors_ = reinterpret_cast<const MotorTelemetrySlot *>(reinterpret_cast<const char *>(loop_) + sizeof(LoopTelemetrySlot));
+    return CallbackReturn::SUCCESS;
+}
+
+CallbackReturn TelemetryReader::on_deactivate()
+{
+    if (base_ != nullptr) {
+        munmap(base_, size_);
+    }
+    base_ = nullptr;
+    loop_ = nullptr;
+    motors_ = nullptr;
+    motor_ct_ = 0;
+    return CallbackReturn::SUCCESS;
+}
+
+bool TelemetryReader::read(uint16_t idx, MotorTelemetry &out) const
+{
+    if (motors_ == nullptr || idx >= motor_ct_) {
+        return false;
+    }
+    return seqlock::read(motors_[idx].seq, motors_[idx].data, out);
+}
+
+bool TelemetryReader::read_loop(LoopTelemetry &out) const
+{
+    if (loop_ == nullptr) {
+        return false;
+    }
+    return seqlock::read(loop_->seq, loop_->data, out);
+}
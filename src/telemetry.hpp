@@ -0,0 +1,176 @@
+/**
+ * Exports controller state through POSIX shared memory.
+ *
+ * Previously the only way to see velocity or duty was the CSV printed by subscribe(). The control loop
+ * now writes a snapshot per motor into a shared memory segment (MotorController::subscribe()), and any
+ * number of external readers (plotters, loggers, a ROS2 bridge) can map it read only and sample at their
+ * own rate. Publishing is a handful of stores, no syscalls and no locks, so readers cannot slow the
+ * control loop down.
+ *
+ * MotorExecutor publishes from its own thread once set_telemetry() is called, including the percentiles
+ * of each of its stages.
+ *
+ * Segment layout, all blocks 64 byte aligned:
+ *
+ *   TelemetryHeader     magic, version, sizes and motor count. Readers must check version.
+ *   LoopTelemetrySlot   control loop cycle and executor stage statistics
+ *   MotorTelemetrySlot  x motor_ct
+ *
+ * Each slot is a seqlock: the writer makes seq odd, writes the payload, then makes seq even. Readers
+ * copy the payload and retry if seq was odd or changed while they were copying.
+ */
+
+#pragma once
+
+#include "tst_common.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#define TELEMETRY_SHM_NAME "/rr_pi4b_telemetry"
+
+static constexpr uint32_t TELEMETRY_MAGIC = 0x52524d54; // "RRMT"
+static constexpr uint16_t TELEMETRY_VERSION = 2;
+
+// ExecutorStage::COUNT, kept here so readers do not need the executor.
+static constexpr size_t TELEMETRY_STAGES = 8;
+
+struct alignas(64) TelemetryHeader {
+    std::atomic<uint32_t> magic;  // written last, readers must wait for TELEMETRY_MAGIC
+    uint16_t version;
+    uint16_t motor_ct;
+    uint32_t header_size;         // sizeof(TelemetryHeader)
+    uint32_t loop_size;           // sizeof(LoopTelemetrySlot)
+    uint32_t motor_size;          // sizeof(MotorTelemetrySlot)
+};
+
+// one stage of MotorExecutor::timing(), indexed by ExecutorStage.
+struct StageTelemetry {
+    uint64_t samples;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+    uint64_t p999_ns;
+    uint64_t max_ns;
+    double mean_ns;
+};
+
+struct LoopTelemetry {
+    uint64_t cycles;
+    uint32_t tick;          // gpioTick() at the last cycle
+    uint32_t cycle_us;      // duration of the last cycle
+    uint32_t cycle_max_us;
+    double cycle_mean_us;
+
+    // all 0 unless published by a MotorExecutor, see publish_stages().
+    uint64_t overruns;
+    StageTelemetry stages[TELEMETRY_STAGES];
+};
+
+struct MotorTelemetry {
+    uint32_t tick;          // gpioTick() when published
+    int32_t pwm_pin;
+    int32_t duty;           // commanded duty %
+    int32_t direction;      // DIRECTION
+    int32_t drive_state;    // DriveState
+    int32_t stalled;
+
+    double velocity;        // EMA velocity (rotations/s)
+    double est_position;    // Kalman estimate (pulses)
+    double est_velocity;    // Kalman estimate (pulses/s)
+    double est_acceleration;
+    double est_velocity_var;
+
+    int64_t total_pulses;
+    int64_t healthy_pulses;
+    int64_t boundary_triggers;
+    int64_t stall_events;
+
+    // delta_us distribution, see PulseStats
+    double interval_mean_us;
+    double interval_stddev_us;
+    uint32_t interval_p50_us;
+    uint32_t interval_p99_us;
+    uint32_t noise_rejected;
+    uint32_t timeouts;
+};
+
+struct alignas(64) LoopTelemetrySlot {
+    std::atomic<uint32_t> seq;
+    LoopTelemetry data;
+};
+
+struct alignas(64) MotorTelemetrySlot {
+    std::atomic<uint32_t> seq;
+    MotorTelemetry data;
+};
+
+/**
+ * Owns the segment, used by the process running the control loop.
+ */
+class TelemetryPublisher {
+  public:
+    ~TelemetryPublisher();
+
+    CallbackReturn on_configure(const std::string &name, uint16_t motor_ct);
+
+    // create and map the segment.
+    CallbackReturn on_activate();
+
+    // unmap and remove the segment.
+    CallbackReturn on_deactivate();
+
+    /**
+     * Publish the state of motor idx. Single writer per motor, call from the control thread.
+     */
+    void publish(uint16_t idx, const MotorTelemetry &telemetry);
+
+    /**
+     * Record a control loop cycle that took cycle_us.
+     */
+    void publish_cycle(uint32_t tick, uint32_t cycle_us);
+
+    /**
+     * Replace the stage statistics of the loop slot, call from the same thread as publish_cycle().
+     */
+    void publish_stages(const StageTelemetry (&stages)[TELEMETRY_STAGES], uint64_t overruns);
+
+  private:
+    std::string name_ {TELEMETRY_SHM_NAME};
+    uint16_t motor_ct_ = 0;
+
+    void *base_ = nullptr;
+    size_t size_ = 0;
+    LoopTelemetrySlot *loop_ = nullptr;
+    MotorTelemetrySlot *motors_ = nullptr;
+
+    // running loop statistics, only touched by the control thread.
+    LoopTelemetry loop_stats_ {};
+};
+
+/**
+ * Read only view of the segment, for tools outside the control process.
+ */
+class TelemetryReader {
+  public:
+    ~TelemetryReader();
+
+    // map the segment and check its header.
+    CallbackReturn on_activate(const std::string &name = TELEMETRY_SHM_NAME);
+
+    CallbackReturn on_deactivate();
+
+    uint16_t motor_ct() const { return motor_ct_; }
+
+    // copy a consistent snapshot, retrying while the writer is mid update.
+    bool read(uint16_t idx, MotorTelemetry &out) const;
+
+    bool read_loop(LoopTelemetry &out) const;
+
+  private:
+    void *base_ = nullptr;
+    size_t size_ = 0;
+    uint16_t motor_ct_ = 0;
+    const LoopTelemetrySlot *loop_ = nullptr;
+    const MotorTelemetrySlot *motors_ = nullptr;
+};
@@ -0,0 +1,209 @@
+#include "timer_wheel.hpp"
+
+namespace {
+    constexpr uint32_t L0_BITS = 8; // log2(TimerWheel::L0_SLOTS)
+    static_assert((1u << L0_BITS) == TimerWheel::L0_SLOTS, "L0_BITS must match L0_SLOTS");
+
+    // longest delay that can be held without aliasing onto the level 1 slot currently being cascaded.
+    constexpr uint32_t MAX_STEPS = TimerWheel::L0_SLOTS * (TimerWheel::L1_SLOTS - 1);
+}
+
+CallbackReturn TimerWheel::on_configure(uint32_t resolution_us)
+{
+    if (resolution_us == 0) {
+        return CallbackReturn::FAILURE;
+    }
+    resolution_us_ = resolution_us;
+    slots_.fill(-1);
+    return CallbackReturn::SUCCESS;
+}
+
+CallbackReturn TimerWheel::on_activate()
+{
+    slots_.fill(-1);
+    now_ = 0;
+    now_us_ = gpioTick();
+
+    for (int id = 0; id < MAX_TIMERS; id++) {
+        Timer &t = timers_[id];
+        t.slot = -1;
+        if (!t.used) {
+            continue;
+        }
+        t.edge.store(now_us_, std::memory_order_relaxed);
+        t.armed_edge = now_us_;
+        arm(id, t.timeout_us);
+    }
+    active_ = true;
+    return CallbackReturn::SUCCESS;
+}
+
+CallbackReturn TimerWheel::on_deactivate()
+{
+    active_ = false;
+    for (int id = 0; id < MAX_TIMERS; id++) {
+        unlink(id);
+    }
+    return CallbackReturn::SUCCESS;
+}
+
+int TimerWheel::add(int pin, uint32_t timeout_us, EncoderTickCallback timeout_cb)
+{
+    if (timeout_cb == nullptr || timeout_us == 0) {
+        return -1;
+    }
+
+    for (int id = 0; id < MAX_TIMERS; id++) {
+        Timer &t = timers_[id];
+        if (t.used) {
+            continue;
+        }
+        t.used = true;
+        t.pin = pin;
+        t.timeout_us = timeout_us;
+        t.timeout_cb = timeout_cb;
+        t.slot = -1;
+        t.edge.store(active_ ? now_us_ : 0, std::memory_order_relaxed);
+
+        if (active_) {
+            t.armed_edge = now_us_;
+            arm(id, timeout_us);
+        }
+        return id;
+    }
+    return -1;
+}
+
+void TimerWheel::remove(int id)
+{
+    if (id < 0 || id >= MAX_TIMERS) {
+        return;
+    }
+    unlink(id);
+    timers_[id].used = false;
+    timers_[id].timeout_cb = nullptr;
+}
+
+void TimerWheel::advance(uint32_t tick)
+{
+    if (!active_) {
+        return;
+    }
+
+    // unsigned subtraction keeps this correct when the 32 bit tick wraps (~72 minutes).
+    uint32_t elapsed = tick - now_us_;
+    while (elapsed >= resolution_us_) {
+        step();
+        elapsed -= resolution_us_;
+    }
+}
+
+void TimerWheel::arm(int id, uint32_t delay_us)
+{
+    uint32_t steps = (delay_us + resolution_us_ - 1) / resolution_us_;
+    if (steps == 0) {
+        steps = 1;
+    }
+    timers_[id].expires = now_ + steps;
+    link(id);
+}
+
+void TimerWheel::link(int id)
+{
+    Timer &t = timers_[id];
+    uint32_t diff = t.expires - now_;
+    if (diff >= MAX_STEPS) {
+        t.expires = now_ + MAX_STEPS - 1;
+        diff = MAX_STEPS - 1;
+    }
+
+    int slot = (diff < L0_SLOTS)
+        ? static_cast<int>(t.expires & (L0_SLOTS - 1))
+        : static_cast<int>(L0_SLOTS + ((t.expires >> L0_BITS) & (L1_SLOTS - 1)));
+
+    t.slot = static_cast<int16_t>(slot);
+    t.prev = -1;
+    t.next = slots_[slot];
+    if (t.next >= 0) {
+        timers_[t.next].prev = id;
+    }
+    slots_[slot] = id;
+}
+
+void TimerWheel::unlink(int id)
+{
+    Timer &t = timers_[id];
+    if (t.slot < 0) {
+        return;
+    }
+    if (t.prev >= 0) {
+        timers_[t.prev].next = t.next;
+    }
+    else {
+        slots_[t.slot] = t.next;
+    }
+    if (t.next >= 0) {
+        timers_[t.next].prev = t.prev;
+    }
+    t.slot = -1;
+    t.next = -1;
+    t.prev = -1;
+}
+
+void TimerWheel::step()
+{
+    now_++;
+    now_us_ += resolution_us_;
+
+    // level 0 has wrapped, move the next level 1 slot down.
+    if ((now_ & (L0_SLOTS - 1)) == 0) {
+        int slot = L0_SLOTS + ((now_ >> L0_BITS) & (L1_SLOTS - 1));
+        int id = slots_[slot];
+        slots_[slot] = -1;
+        while (id >= 0) {
+            int next = timers_[id].next;
+            timers_[id].slot = -1;
+            link(id);
+            id = next;
+        }
+    }
+
+    int slot = now_ & (L0_SLOTS - 1);
+    int id = slots_[slot];
+    slots_[slot] = -1;
+    while (id >= 0) {
+        int next = timers_[id].next;
+        timers_[id].slot = -1;
+        expire(id);
+        id = next;
+    }
+}
+
+void TimerWheel::expire(int id)
+{
+    Timer &t = timers_[id];
+    uint64_t edge = t.edge.load(std::memory_order_acquire);
+    uint32_t last = edge_tick(edge);
+    uint32_t since_edge = edge_age(now_us_, last);
+
+    // edges arrived since the timer was armed, push the deadline out rather than firing.
+    if (last != t.armed_edge && since_edge < t.timeout_us) {
+        t.armed_edge = last;
+        arm(id, t.timeout_us - since_edge);
+        return;
+    }
+
+    // only stalled if no edge was touched since the load above, otherwise that edge would read as a stall until
+    // the next timeout. The new edge is picked up when the timer expires again.
+    if (!t.edge.compare_exchange_strong(edge, edge | STALLED, std::memory_order_acq_rel, std::memory_order_acquire)) {
+        arm(id, t.timeout_us);
+        return;
+    }
+    t.armed_edge = last;
+    t.timeout_cb(t.pin, since_edge, now_us_, TickStatus::TIMEOUT);
+
+    // callback may have removed the timer.
+    if (t.used) {
+        arm(id, t.timeout_us);
+    }
+}
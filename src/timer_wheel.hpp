@@ -0,0 +1,127 @@
+/**
+ * Hierarchical timer wheel used to detect stalled encoders from the control thread.
+ *
+ * pigpio can report a timeout per pin through gpioSetISRFuncEx(), but every pin then costs a timer
+ * thread inside pigpio. Instead each encoder registers a deadline here, and the control thread calls
+ * advance() once per cycle. When no edge has been seen for timeout_us the registered callback is
+ * invoked with TickStatus::TIMEOUT, the same as pigpio would have done, and is repeated every
+ * timeout_us until the next edge.
+ *
+ * Edges only record their tick (touch()), timers are re-scheduled lazily when their slot expires, this
+ * keeps the cost O(1) per edge and per wheel step regardless of the number of encoders.
+ *
+ * Level 0 has L0_SLOTS slots of resolution_us each, level 1 has L1_SLOTS slots each spanning the whole of
+ * level 0. With the default 1ms resolution timeouts up to ~16 seconds can be tracked.
+ */
+
+#pragma once
+
+#include "encoder.hpp"
+#include "tst_common.hpp"
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// touch() runs on the encoder callback thread, the edge word must not take a lock.
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "TimerWheel needs lock free 64 bit atomics");
+
+class TimerWheel {
+  public:
+    static constexpr int MAX_TIMERS = 64;
+    static constexpr uint32_t L0_SLOTS = 256;
+    static constexpr uint32_t L1_SLOTS = 64;
+
+    /**
+     * @param resolution_us granularity of the wheel, deadlines are rounded up to this.
+     */
+    CallbackReturn on_configure(uint32_t resolution_us);
+
+    /**
+     * starts the wheel at the current tick, and arms all registered timers from that tick.
+     */
+    CallbackReturn on_activate();
+
+    CallbackReturn on_deactivate();
+
+    /**
+     * Register an encoder. Must be called from the control thread.
+     *
+     * @param pin pin reported back through timeout_cb.
+     * @param timeout_us time without edges before timeout_cb is called.
+     * @param timeout_cb invoked from advance() with TickStatus::TIMEOUT.
+     * @return timer id (>= 0), or -1 if the wheel is full or arguments are invalid.
+     */
+    int add(int pin, uint32_t timeout_us, EncoderTickCallback timeout_cb);
+
+    void remove(int id);
+
+    /**
+     * Record an edge, safe to call from the pigpio callback thread.
+     */
+    void touch(int id, uint32_t tick)
+    {
+        // one store records the edge and clears the stall, see expire().
+        timers_[id].edge.store(tick, std::memory_order_release);
+    }
+
+    /**
+     * Move the wheel forward to tick, firing any expired timers. Must be called from the control thread.
+     */
+    void advance(uint32_t tick);
+
+    // true from the first timeout until the next edge.
+    bool is_stalled(int id) const
+    {
+        return (timers_[id].edge.load(std::memory_order_relaxed) & STALLED) != 0;
+    }
+
+    // µs since the last recorded edge, relative to the last advance().
+    uint32_t time_since_last_edge(int id) const
+    {
+        return edge_age(now_us_, edge_tick(timers_[id].edge.load(std::memory_order_acquire)));
+    }
+
+    /**
+     * now - edge, 0 when the edge is newer than now. The wheel only moves in whole resolution_us steps, so
+     * now_us_ lags gpioTick() by up to one step and touch() can record a later tick than it.
+     */
+    static uint32_t edge_age(uint32_t now, uint32_t edge)
+    {
+        const auto age = static_cast<int32_t>(now - edge);
+        return age < 0 ? 0 : static_cast<uint32_t>(age);
+    }
+
+  private:
+    // set in Timer::edge above the tick, from a timeout until the next touch().
+    static constexpr uint64_t STALLED = 1ULL << 32;
+
+    static uint32_t edge_tick(uint64_t edge) { return static_cast<uint32_t>(edge); }
+
+    struct Timer {
+        std::atomic<uint64_t> edge {0};      // tick of the last edge and STALLED, written by touch() and expire()
+        uint32_t armed_edge = 0;             // edge tick when the timer was scheduled
+        uint32_t timeout_us = 0;
+        uint32_t expires = 0;                // in wheel steps
+        int pin = -1;
+        int next = -1;
+        int prev = -1;
+        int16_t slot = -1;                   // index into slots_, -1 when unlinked
+        bool used = false;
+        EncoderTickCallback timeout_cb {nullptr};
+    };
+
+    void arm(int id, uint32_t delay_us);
+    void link(int id);
+    void unlink(int id);
+    void step();
+    void expire(int id);
+
+    std::array<Timer, MAX_TIMERS> timers_;
+    // level 0 slots followed by level 1 slots, each holds the head of an intrusive list.
+    std::array<int, L0_SLOTS + L1_SLOTS> slots_;
+
+    uint32_t resolution_us_ = 1000;
+    uint32_t now_ = 0;    // wheel steps since activation
+    uint32_t now_us_ = 0; // tick at now_
+    bool active_ = false;
+};
@@ -0,0 +1,248 @@
+#ifdef RR_TRACE
+
+#include "trace.hpp"
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <iomanip>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+std::atomic<bool> Tracer::enabled_ {false};
+
+namespace {
+    enum class Phase : uint8_t {
+        COMPLETE = 0,
+        INSTANT = 1,
+        FLOW_BEGIN = 2,
+        FLOW_END = 3,
+    };
+
+    struct TraceEvent {
+        uint64_t ts_ns;
+        uint64_t arg;  // duration for COMPLETE, flow id for FLOW_*
+        int32_t value;
+        uint16_t pin;
+        TracePoint point;
+        Phase phase;
+    };
+
+    struct alignas(64) ThreadRing {
+        std::atomic<uint64_t> head {0}; // events ever written, single writer
+        int tid = 0;
+        char name[16] {};
+    };
+
+    struct PointInfo {
+        const char *name;
+        const char *category;
+    };
+
+    constexpr std::array<PointInfo, static_cast<size_t>(TracePoint::COUNT)> POINTS {{
+        {"encoder_edge", "isr"},
+        {"velocity", "isr"},
+        {"estimate", "control"},
+        {"pid", "control"},
+        {"pwm_write", "actuate"},
+        {"dir_write", "actuate"},
+        {"control_tick", "control"},
+    }};
+
+    std::array<ThreadRing, Tracer::MAX_THREADS> rings;
+    std::atomic<size_t> ring_ct {0};
+    std::atomic<uint64_t> lost {0};
+
+    // one block of capacity events per ring, only resized while nothing records.
+    std::vector<TraceEvent> storage;
+    size_t capacity = Tracer::DEFAULT_EVENTS;
+    uint64_t epoch_ns = 0;
+
+    thread_local ThreadRing *thread_ring = nullptr;
+    thread_local bool no_ring = false;
+
+    ThreadRing *claim_ring()
+    {
+        if (thread_ring != nullptr || no_ring) {
+            return thread_ring;
+        }
+        size_t idx = ring_ct.fetch_add(1, std::memory_order_relaxed);
+        if (idx >= rings.size()) {
+            no_ring = true;
+            return nullptr;
+        }
+        ThreadRing &ring = rings[idx];
+        ring.tid = static_cast<int>(syscall(SYS_gettid));
+        pthread_getname_np(pthread_self(), ring.name, sizeof(ring.name));
+        thread_ring = &ring;
+        return thread_ring;
+    }
+
+    void record(const TraceEvent &event)
+    {
+        ThreadRing *ring = claim_ring();
+        if (ring == nullptr) {
+            lost.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        uint64_t head = ring->head.load(std::memory_order_relaxed);
+        size_t idx = static_cast<size_t>(ring - rings.data());
+        storage[idx * capacity + (head & (capacity - 1))] = event;
+        ring->head.store(head + 1, std::memory_order_release);
+    }
+
+    // microseconds with ns precision, without going through floating point.
+    void write_us(std::ostream &out, uint64_t ns)
+    {
+        out << ns / 1000 << '.' << std::setw(3) << std::setfill('0') << ns % 1000 << std::setfill(' ');
+    }
+}
+
+CallbackReturn Tracer::on_configure(size_t events_per_thread)
+{
+    if (enabled()) {
+        std::cout << "ERROR: tracer must be deactivated before it is configured\n";
+        return CallbackReturn::FAILURE;
+    }
+    if (events_per_thread == 0) {
+        std::cout << "ERROR: trace ring must hold at least one event\n";
+        return CallbackReturn::FAILURE;
+    }
+    size_t rounded = 1;
+    while (rounded < events_per_thread) {
+        rounded <<= 1;
+    }
+    capacity = rounded;
+    storage.clear();
+    return CallbackReturn::SUCCESS;
+}
+
+CallbackReturn Tracer::on_activate()
+{
+    if (enabled()) {
+        return CallbackReturn::SUCCESS;
+    }
+    // allocated here so recording never does, and zeroed so every page is resident before the hot path runs.
+    storage.assign(MAX_THREADS * capacity, TraceEvent {});
+    for (ThreadRing &ring : rings) {
+        ring.head.store(0, std::memory_order_relaxed);
+    }
+    lost.store(0, std::memory_order_relaxed);
+    epoch_ns = now_ns();
+    enabled_.store(true, std::memory_order_release);
+    return CallbackReturn::SUCCESS;
+}
+
+CallbackReturn Tracer::on_deactivate()
+{
+    enabled_.store(false, std::memory_order_release);
+    return CallbackReturn::SUCCESS;
+}
+
+uint64_t Tracer::now_ns()
+{
+    struct timespec ts {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+void Tracer::complete(TracePoint point, uint64_t start_ns, uint64_t dur_ns, unsigned pin, int32_t value)
+{
+    if (!enabled()) {
+        return;
+    }
+    record(TraceEvent {start_ns, dur_ns, value, static_cast<uint16_t>(pin), point, Phase::COMPLETE});
+}
+
+void Tracer::instant(TracePoint point, unsigned pin, int32_t value)
+{
+    if (!enabled()) {
+        return;
+    }
+    record(TraceEvent {now_ns(), 0, value, static_cast<uint16_t>(pin), point, Phase::INSTANT});
+}
+
+void Tracer::flow_begin(uint64_t id)
+{
+    if (!enabled()) {
+        return;
+    }
+    record(TraceEvent {now_ns(), id, 0, TRACE_NO_PIN, TracePoint::ENCODER_EDGE, Phase::FLOW_BEGIN});
+}
+
+void Tracer::flow_end(uint64_t id)
+{
+    if (!enabled()) {
+        return;
+    }
+    record(TraceEvent {now_ns(), id, 0, TRACE_NO_PIN, TracePoint::ESTIMATE, Phase::FLOW_END});
+}
+
+uint64_t Tracer::overwritten()
+{
+    uint64_t total = lost.load(std::memory_order_relaxed);
+    size_t ct = std::min(ring_ct.load(std::memory_order_relaxed), rings.size());
+    for (size_t i = 0; i < ct; i++) {
+        uint64_t head = rings[i].head.load(std::memory_order_relaxed);
+        total += head > capacity ? head - capacity : 0;
+    }
+    return total;
+}
+
+bool Tracer::write_json(const std::string &path)
+{
+    std::ofstream out(path);
+    if (!out) {
+        std::cout << "ERROR: unable to open " << path << " for the trace\n";
+        return false;
+    }
+    const int pid = static_cast<int>(getpid());
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"args\":{\"name\":\"rr_pi4b_driver\"}}";
+
+    size_t ct = std::min(ring_ct.load(std::memory_order_relaxed), rings.size());
+    for (size_t r = 0; r < ct; r++) {
+        const ThreadRing &ring = rings[r];
+        out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << ring.tid
+            << ",\"args\":{\"name\":\"" << ring.name << "\"}}";
+
+        uint64_t head = ring.head.load(std::memory_order_acquire);
+        uint64_t first = head > capacity ? head - capacity : 0;
+        for (uint64_t i = first; i < head; i++) {
+            const TraceEvent &e = storage[r * capacity + (i & (capacity - 1))];
+            const PointInfo &info = POINTS[static_cast<size_t>(e.point)];
+            // events from a previous activation are dropped rather than given a negative time.
+            if (e.ts_ns < epoch_ns) {
+                continue;
+            }
+            out << ",\n{\"pid\":" << pid << ",\"tid\":" << ring.tid << ",\"ts\":";
+            write_us(out, e.ts_ns - epoch_ns);
+            switch (e.phase) {
+                case Phase::COMPLETE:
+                    out << ",\"ph\":\"X\",\"dur\":";
+                    write_us(out, e.arg);
+                    break;
+                case Phase::INSTANT:
+                    out << ",\"ph\":\"i\",\"s\":\"t\"";
+                    break;
+                case Phase::FLOW_BEGIN:
+                    out << ",\"ph\":\"s\",\"id\":" << e.arg << ",\"name\":\"edge\",\"cat\":\"flow\"}";
+                    continue;
+                case Phase::FLOW_END:
+                    out << ",\"ph\":\"f\",\"bp\":\"e\",\"id\":" << e.arg << ",\"name\":\"edge\",\"cat\":\"flow\"}";
+                    continue;
+            }
+            out << ",\"name\":\"" << info.name << "\",\"cat\":\"" << info.category << "\",\"args\":{";
+            if (e.pin != TRACE_NO_PIN) {
+                out << "\"pin\":" << e.pin << ",";
+            }
+            out << "\"value\":" << e.value << "}}";
+        }
+    }
+    out << "\n]}\n";
+    return static_cast<bool>(out);
+}
+
+#endif
@@ -0,0 +1,149 @@
+/**
+ * Optional trace points exported as Chrome trace / Perfetto JSON.
+ *
+ * perf shows where time goes inside a thread, but not how an encoder edge on the pigpio callback thread leads to a
+ * velocity update, an estimate on the control thread and then a gpioHardwarePWM() write. Built with -DTRACE=ON
+ * (which defines RR_TRACE) the drivers record:
+ *
+ *   encoder_edge    MotorEncoder ISR trampoline, the whole callback including the controller's velocity update
+ *   velocity        MotorController, a PPR_ window closed and the velocity changed, value is rotations/s * 1000
+ *   estimate        MotorController::estimate()
+ *   pid             PID::compute(), value is the output * 1000
+ *   pwm_write       Motor::set_pwm(), value is the duty
+ *   dir_write       Motor direction write, value is the direction
+ *   control_tick    MotorExecutor::tick()
+ *
+ * Each healthy edge starts a flow that the estimate consuming it finishes, so the timeline draws an arrow from
+ * the edge to the control tick that used it.
+ *
+ * Every thread records into its own ring buffer (single writer, no locks, no allocation), the oldest events are
+ * overwritten so the buffers hold the most recent history. Nothing is recorded until on_activate(), and
+ * write_json() should be called once the recording threads have stopped.
+ *
+ * Without RR_TRACE the scope is empty and every call is an inline no-op.
+ */
+
+#pragma once
+
+#include "tst_common.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+enum class TracePoint : uint8_t {
+    ENCODER_EDGE = 0,
+    VELOCITY = 1,
+    ESTIMATE = 2,
+    PID = 3,
+    PWM_WRITE = 4,
+    DIR_WRITE = 5,
+    CONTROL_TICK = 6,
+    COUNT = 7,
+};
+
+// for trace points that are not tied to a pin, e.g. PID.
+constexpr unsigned TRACE_NO_PIN = 0xFFFF;
+
+// flow linking the healthy edge number count on pin to the estimate that consumes it.
+constexpr uint64_t trace_flow_id(unsigned pin, uint32_t count)
+{
+    return (static_cast<uint64_t>(pin) << 32) | count;
+}
+
+#ifdef RR_TRACE
+
+#include <atomic>
+
+class Tracer {
+  public:
+    static constexpr size_t MAX_THREADS = 16;
+    static constexpr size_t DEFAULT_EVENTS = 65536;
+
+    /**
+     * @param events_per_thread ring size for each thread, rounded up to a power of 2.
+     */
+    static CallbackReturn on_configure(size_t events_per_thread = DEFAULT_EVENTS);
+
+    // allocate the rings and start recording.
+    static CallbackReturn on_activate();
+
+    // stop recording, the rings are kept for write_json().
+    static CallbackReturn on_deactivate();
+
+    static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+    static uint64_t now_ns();
+
+    // a slice of dur_ns starting at start_ns, see TraceScope.
+    static void complete(TracePoint point, uint64_t start_ns, uint64_t dur_ns, unsigned pin, int32_t value);
+
+    static void instant(TracePoint point, unsigned pin, int32_t value);
+
+    // bound to the slice enclosing the calling thread's current time.
+    static void flow_begin(uint64_t id);
+    static void flow_end(uint64_t id);
+
+    // events lost because a thread's ring wrapped, or because more than MAX_THREADS threads recorded.
+    static uint64_t overwritten();
+
+    /**
+     * Write every ring to path in the Chrome trace event format, open with ui.perfetto.dev or chrome://tracing.
+     */
+    static bool write_json(const std::string &path);
+
+  private:
+    static std::atomic<bool> enabled_;
+};
+
+/**
+ * Records a slice from construction to destruction, the value may be filled in before it ends.
+ */
+class TraceScope {
+  public:
+    TraceScope(TracePoint point, unsigned pin, int32_t value = 0)
+        : point_(point), pin_(pin), value_(value), start_ns_(Tracer::enabled() ? Tracer::now_ns() : 0)
+    {
+    }
+
+    ~TraceScope()
+    {
+        if (start_ns_ != 0) {
+            Tracer::complete(point_, start_ns_, Tracer::now_ns() - start_ns_, pin_, value_);
+        }
+    }
+
+    void set_value(int32_t value) { value_ = value; }
+
+  private:
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+    TracePoint point_;
+    unsigned pin_;
+    int32_t value_;
+    uint64_t start_ns_;
+};
+
+#else
+
+class Tracer {
+  public:
+    static CallbackReturn on_configure(size_t = 0) { return CallbackReturn::SUCCESS; }
+    static CallbackReturn on_activate() { return CallbackReturn::SUCCESS; }
+    static CallbackReturn on_deactivate() { return CallbackReturn::SUCCESS; }
+    static bool enabled() { return false; }
+    static void complete(TracePoint, uint64_t, uint64_t, unsigned, int32_t) {}
+    static void instant(TracePoint, unsigned, int32_t) {}
+    static void flow_begin(uint64_t) {}
+    static void flow_end(uint64_t) {}
+    static uint64_t overwritten() { return 0; }
+    static bool write_json(const std::string &) { return false; }
+};
+
+class TraceScope {
+  public:
+    TraceScope(TracePoint, unsigned, int32_t = 0) {}
+    void set_value(int32_t) {}
+};
+
+#endif
@@ -0,0 +1,126 @@
+/**
+ * Proves the hot path is allocation free, build with -DALLOC_TRACKER=ON (and -DPIGPIO_SIM=ON without hardware).
+ *
+ * First checks the tracker itself catches an allocation made inside a scope, then runs the executor with both
+ * motors through a few setpoint changes, including reversing, with the tracker armed. Any allocation made in the
+ * encoder callback or the control tick fails the test, and the per thread table is printed either way.
+ */
+
+#include "alloc_tracker.hpp"
+#include "board.hpp"
+#include "gpio_runtime.hpp"
+#include "motor_executor.hpp"
+#include "tst_common.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+
+#ifdef PIGPIO_SIM
+#include "pigpio_sim.hpp"
+#endif
+
+#define PERIOD_US 1000
+#define CONTROL_DIVIDER 10
+#define STALL_TIMEOUT_US 250000
+#define TIMEOUT 0
+#define MIN_INTERVAL 150
+#define STEP_MS 700
+
+#define KP 0.01
+#define KI 0.2
+#define KD 0
+#define PID_MIN 0
+#define PID_MAX 100
+
+static constexpr int PWM[] = {board::LeftWheel::pwm, board::RightWheel::pwm};
+static constexpr int DIR[] = {board::LeftWheel::dir, board::RightWheel::dir};
+static constexpr int EN[] = {board::LeftWheel::enc, board::RightWheel::enc};
+static constexpr double SETPOINTS[] = {1500.0, 800.0, -1200.0, 0.0};
+
+/**
+ * An allocation in a scope while armed must be counted, otherwise a pass below means nothing.
+ */
+static bool tracker_detects()
+{
+    AllocTracker::reset();
+    AllocTracker::arm();
+    {
+        AllocScopeGuard guard(AllocScope::CONTROL_TICK);
+        // volatile so the compiler cannot elide the pair.
+        void *volatile block = std::malloc(16);
+        std::free(block);
+    }
+    AllocTracker::disarm();
+    bool detected = AllocTracker::violations() == 1 && AllocTracker::first_violation().scope == AllocScope::CONTROL_TICK;
+    AllocTracker::reset();
+    return detected;
+}
+
+int main()
+{
+#ifndef RR_ALLOC_TRACKER
+    std::cout << "ERROR: built without the allocation tracker, configure with -DALLOC_TRACKER=ON\n";
+    return 1;
+#endif
+    if (!tracker_detects()) {
+        std::cout << "ERROR: tracker did not detect a deliberate allocation\n";
+        return 1;
+    }
+
+    GpioRuntime &gpio = GpioRuntime::instance();
+    int pi = gpio.acquire();
+    if (pi < 0) {
+        std::cout << "ERROR: Failed to initialize hardware\n";
+        return 1;
+    }
+
+    auto executor = std::make_unique<MotorExecutor>();
+    if (executor->on_configure(PERIOD_US, CONTROL_DIVIDER, STALL_TIMEOUT_US) == CallbackReturn::FAILURE) {
+        gpio.release(pi);
+        return 1;
+    }
+    for (size_t i = 0; i < 2; i++) {
+#ifdef PIGPIO_SIM
+        pigpio_sim_attach(PWM[i], DIR[i], EN[i], SimMotorModel {});
+#endif
+        if (executor->add_motor(pi, PWM[i], DIR[i], EN[i], TIMEOUT, MIN_INTERVAL, KP, KI, KD, PID_MIN, PID_MAX) < 0) {
+            gpio.release(pi);
+            return 1;
+        }
+    }
+
+    // configuration may allocate, only what happens after activation counts.
+    AllocTracker::reset();
+    if (executor->on_activate() == CallbackReturn::FAILURE) {
+        gpio.release(pi);
+        return 1;
+    }
+    for (double setpoint : SETPOINTS) {
+        executor->set_setpoint(0, setpoint);
+        executor->set_setpoint(1, setpoint);
+        std::this_thread::sleep_for(std::chrono::milliseconds(STEP_MS));
+    }
+    uint64_t cycles = executor->timing(ExecutorStage::CYCLE).samples;
+    executor->on_deactivate();
+    gpio.release(pi);
+
+    AllocTracker::report();
+
+    uint64_t pulses = 0;
+    for (size_t i = 0; i < 2; i++) {
+        pulses += executor->controller(i).interval_stats().count;
+    }
+    std::cout << cycles << " control cycles, " << pulses << " encoder pulses\n";
+
+    if (cycles == 0 || pulses == 0) {
+        std::cout << "ERROR: hot path did not run, nothing was proven\n";
+        return 1;
+    }
+    if (AllocTracker::violations() > 0) {
+        return 1;
+    }
+    std::cout << "PASS: no allocations in the encoder callback or control tick\n";
+    return 0;
+}
@@ -0,0 +1,270 @@
+/**
+ * Exercises the GPIO character device edge backend, see gpio_chardev.hpp.
+ *
+ * By default both encoders are fed from ScriptedLineSource, which writes kernel formatted edge events through
+ * pipes, so this runs on any Linux machine. The script steps the edge rate and the test checks that every
+ * scripted edge reached the encoder callback, that no line_seqno gap was seen and that the stall timeout fires
+ * once the edges stop. It prints the edge to callback latency, how many events each read() returned and the
+ * epoll thread's CPU per edge.
+ *
+ * usage: tst_chardev [--compare CHIP]
+ *
+ * --compare drives the left wheel at COMPARE_DUTY on a Pi, and runs its encoder for RUN_MS from pigpio's ISR and
+ * then from CHIP (e.g. /dev/gpiochip0). pigpio keeps sampling for the PWM in both runs, so the difference in
+ * process CPU is the cost of delivering the edges.
+ */
+
+#include "board.hpp"
+#include "encoder.hpp"
+#include "gpio_chardev.hpp"
+#include "gpio_runtime.hpp"
+#include "motor.hpp"
+#include "scripted_lines.hpp"
+#include "tst_common.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <iomanip>
+#include <string>
+#include <sys/resource.h>
+#include <thread>
+#include <vector>
+
+#define STEP_MS 1000
+#define RUN_MS 3000
+#define DRAIN_MS 50
+#define TIMEOUT_MS 100
+#define MIN_INTERVAL 150
+#define COMPARE_DUTY 85
+
+// edges per second on the left wheel for each step, the right wheel runs at RIGHT_RATE_PCT of it.
+static constexpr std::array<uint32_t, 3> RATES_HZ {500, 2000, 3300};
+#define RIGHT_RATE_PCT 90
+
+// enough for every edge of the scripted run, edges past this are counted but not kept.
+#define MAX_SAMPLES 32768
+
+struct EdgeCounts {
+    std::atomic<uint64_t> healthy {0};
+    std::atomic<uint64_t> timeouts {0};
+};
+
+// preallocated, the callback runs on the backend's thread and must not allocate or block.
+static std::array<uint32_t, MAX_SAMPLES> latency_us;
+static std::atomic<size_t> sample_ct {0};
+static std::array<EdgeCounts, 2> counts;
+
+static size_t wheel_index(int gpio_pin)
+{
+    return gpio_pin == static_cast<int>(board::LeftWheel::enc) ? 0 : 1;
+}
+
+static void cb(int gpio_pin, uint32_t, uint32_t tick, TickStatus tick_status)
+{
+    EdgeCounts &c = counts[wheel_index(gpio_pin)];
+    if (tick_status == TickStatus::TIMEOUT) {
+        c.timeouts.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    c.healthy.fetch_add(1, std::memory_order_relaxed);
+    size_t idx = sample_ct.fetch_add(1, std::memory_order_relaxed);
+    if (idx < latency_us.size()) {
+        latency_us[idx] = gpioTick() - tick;
+    }
+}
+
+static void reset_samples()
+{
+    sample_ct.store(0);
+    for (EdgeCounts &c : counts) {
+        c.healthy.store(0);
+        c.timeouts.store(0);
+    }
+}
+
+static void print_latency()
+{
+    size_t s = std::min(sample_ct.load(), latency_us.size());
+    if (s == 0) {
+        std::cout << "  latency: no edges\n";
+        return;
+    }
+    std::vector<uint32_t> sorted(latency_us.begin(), latency_us.begin() + s);
+    std::sort(sorted.begin(), sorted.end());
+    std::cout << "  latency us p50: " << sorted[s / 2]
+              << " p99: " << sorted[static_cast<size_t>(0.99 * (s - 1))]
+              << " max: " << sorted.back() << "\n";
+}
+
+static void print_chardev_stats()
+{
+    ChardevStats s = GpioChardev::instance().stats();
+    std::cout << "  events: " << s.events << " reads: " << s.reads << std::fixed << std::setprecision(2)
+              << " events/read: " << (s.reads > 0 ? static_cast<double>(s.events) / s.reads : 0.0)
+              << " max batch: " << s.max_batch << "\n"
+              << "  epoll thread cpu: " << s.thread_cpu_ns / 1000 << "us"
+              << " per edge: " << (s.events > 0 ? static_cast<double>(s.thread_cpu_ns) / s.events : 0.0) << "ns"
+              << " seq gaps: " << s.seq_gaps << " timeouts: " << s.timeouts << "\n";
+}
+
+static uint64_t process_cpu_us()
+{
+    struct rusage usage {};
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<uint64_t>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000ULL
+        + static_cast<uint64_t>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+
+/**
+ * Both encoders from the scripted stand in, returns false if an edge was lost.
+ */
+static bool run_scripted()
+{
+    ScriptedLineSource script;
+    GpioChardev &chardev = GpioChardev::instance();
+    if (chardev.on_configure(script) == CallbackReturn::FAILURE) {
+        return false;
+    }
+
+    MotorEncoder left;
+    MotorEncoder right;
+    if (left.on_configure(Enc<board::LeftWheel::enc> {}, &cb, TIMEOUT_MS, MIN_INTERVAL) == CallbackReturn::FAILURE
+        || right.on_configure(Enc<board::RightWheel::enc> {}, &cb, TIMEOUT_MS, MIN_INTERVAL) == CallbackReturn::FAILURE
+        || left.set_backend(EdgeBackend::CHARDEV) == CallbackReturn::FAILURE
+        || right.set_backend(EdgeBackend::CHARDEV) == CallbackReturn::FAILURE) {
+        std::cout << "ERROR: unable to configure encoders\n";
+        return false;
+    }
+
+    reset_samples();
+    if (left.on_activate() == CallbackReturn::FAILURE || right.on_activate() == CallbackReturn::FAILURE) {
+        std::cout << "ERROR: unable to activate encoders\n";
+        left.on_deactivate();
+        return false;
+    }
+    script.on_activate();
+
+    std::cout << "scripted lines, " << RATES_HZ.size() << " steps of " << STEP_MS << "ms\n";
+    for (uint32_t hz : RATES_HZ) {
+        script.set_rate(board::LeftWheel::enc, hz);
+        script.set_rate(board::RightWheel::enc, hz * RIGHT_RATE_PCT / 100);
+        std::this_thread::sleep_for(std::chrono::milliseconds(STEP_MS));
+        std::cout << "  " << hz << "Hz, events so far: " << chardev.stats().events << "\n";
+    }
+    script.set_rate(board::LeftWheel::enc, 0);
+    script.set_rate(board::RightWheel::enc, 0);
+    // long enough for the stall timeout to fire at least once on both wheels.
+    std::this_thread::sleep_for(std::chrono::milliseconds(DRAIN_MS + 2 * TIMEOUT_MS));
+
+    left.on_deactivate();
+    right.on_deactivate();
+    script.on_deactivate();
+
+    bool ok = true;
+    const std::array<unsigned, 2> pins {board::LeftWheel::enc, board::RightWheel::enc};
+    for (size_t i = 0; i < pins.size(); i++) {
+        uint64_t sent = script.sent(pins[i]);
+        uint64_t received = counts[i].healthy.load();
+        uint64_t timeouts = counts[i].timeouts.load();
+        std::cout << "  GPIO " << pins[i] << " sent: " << sent << " received: " << received
+                  << " timeouts: " << timeouts << "\n";
+        if (sent != received) {
+            std::cout << "FAIL: " << sent - received << " edges lost on GPIO " << pins[i] << "\n";
+            ok = false;
+        }
+        if (timeouts == 0) {
+            std::cout << "FAIL: no stall timeout on GPIO " << pins[i] << "\n";
+            ok = false;
+        }
+    }
+    print_latency();
+    print_chardev_stats();
+    if (chardev.stats().seq_gaps != 0) {
+        std::cout << "FAIL: line_seqno gaps\n";
+        ok = false;
+    }
+    return ok;
+}
+
+/**
+ * Left wheel encoder from pigpio and then from chip, with the motor driven by pigpio in both runs.
+ */
+static bool run_compare(int pi, const std::string &chip)
+{
+    ChipLineSource source;
+    if (source.on_configure(chip) == CallbackReturn::FAILURE
+        || GpioChardev::instance().on_configure(source) == CallbackReturn::FAILURE) {
+        return false;
+    }
+
+    Motor motor;
+    if (motor.on_configure(board::LeftWheel::motor, pi) == CallbackReturn::FAILURE
+        || motor.on_activate() == CallbackReturn::FAILURE) {
+        std::cout << "ERROR: unable to bring up the left motor\n";
+        return false;
+    }
+    motor.set_pwm(COMPARE_DUTY);
+    // let the wheel reach speed before either run starts.
+    std::this_thread::sleep_for(std::chrono::milliseconds(STEP_MS));
+
+    bool ok = true;
+    for (EdgeBackend backend : {EdgeBackend::PIGPIO, EdgeBackend::CHARDEV}) {
+        MotorEncoder encoder;
+        if (encoder.on_configure(Enc<board::LeftWheel::enc> {}, &cb, TIMEOUT_MS, MIN_INTERVAL) == CallbackReturn::FAILURE
+            || encoder.set_backend(backend) == CallbackReturn::FAILURE) {
+            ok = false;
+            break;
+        }
+        reset_samples();
+        uint64_t cpu_start = process_cpu_us();
+        if (encoder.on_activate() == CallbackReturn::FAILURE) {
+            std::cout << "ERROR: unable to activate encoder\n";
+            ok = false;
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(RUN_MS));
+        encoder.on_deactivate();
+        uint64_t cpu_us = process_cpu_us() - cpu_start;
+
+        uint64_t edges = counts[0].healthy.load();
+        std::cout << (backend == EdgeBackend::PIGPIO ? "pigpio ISR" : "chardev") << ", " << RUN_MS << "ms at "
+                  << COMPARE_DUTY << "% duty\n"
+                  << "  edges: " << edges << " process cpu: " << cpu_us << "us per edge: "
+                  << (edges > 0 ? cpu_us * 1000 / edges : 0) << "ns\n";
+        print_latency();
+        if (backend == EdgeBackend::CHARDEV) {
+            print_chardev_stats();
+        }
+    }
+
+    motor.set_pwm(0);
+    motor.on_deactivate();
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string chip;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--compare") == 0 && i + 1 < argc) {
+            chip = argv[++i];
+        }
+        else {
+            std::cout << "usage: tst_chardev [--compare CHIP]\n";
+            return 1;
+        }
+    }
+
+    GpioRuntime &gpio = GpioRuntime::instance();
+    int pi = gpio.acquire();
+    if (pi < 0) {
+        std::cout << "ERROR: Failed to initialize hardware\n";
+        return 1;
+    }
+    bool ok = chip.empty() ? run_scripted() : run_compare(pi, chip);
+    gpio.release(pi);
+
+    std::cout << (ok ? "PASS\n" : "FAIL\n");
+    return ok ? 0 : 1;
+}
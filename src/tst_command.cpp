@@ -0,0 +1,180 @@
+/**
+ * Benchmarks command to PWM latency through the shared memory mailbox, and checks the stale command watchdog.
+ *
+ * A sender thread maps the mailbox the same way an external planner would, and sends commands at random
+ * intervals. The control loop polls the mailbox every CONTROL_PERIOD_US and applies new commands with
+ * MotorController::publish(), latency is measured from CommandSender::send() until the PWM write returns.
+ * When the sender stops the watchdog must stop the motor within STALE_TIMEOUT_US.
+ *
+ * Before that a child process claims the slot and exits mid write, as a planner killed inside send() would, and
+ * the next send() must take the slot over rather than wait for it.
+ */
+
+#include "board.hpp"
+#include "command_mailbox.hpp"
+#include "gpio_runtime.hpp"
+#include "motor_controller.hpp"
+#include "tst_common.hpp"
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <random>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#define TIMEOUT 0
+#define MIN_INTERVAL 150
+
+#define CONTROL_PERIOD_US 1000
+#define STALE_TIMEOUT_US 100000
+#define BENCH_COMMANDS 2000
+#define PWM_FREQUENCY 2000
+
+static uint64_t percentile(const std::vector<uint64_t> &sorted, double q)
+{
+    return sorted[static_cast<size_t>(q * (sorted.size() - 1))];
+}
+
+/**
+ * Leave slot 0 owned by a process that no longer exists, with its sequence odd, then send through it.
+ */
+static bool dead_sender_takes_over(CommandMailbox &mailbox)
+{
+    pid_t child = fork();
+    if (child == 0) {
+        int fd = shm_open(COMMAND_SHM_NAME, O_RDWR, 0);
+        size_t size = sizeof(CommandHeader) + sizeof(CommandSlot);
+        void *base = fd < 0 ? MAP_FAILED : mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED) {
+            _exit(1);
+        }
+        auto *slot = reinterpret_cast<CommandSlot *>(static_cast<char *>(base) + sizeof(CommandHeader));
+        slot->owner.store(static_cast<uint32_t>(getpid()));
+        slot->seq.fetch_add(1);
+        _exit(0);
+    }
+    int status = 0;
+    if (child < 0 || waitpid(child, &status, 0) != child || WEXITSTATUS(status) != 0) {
+        std::cout << "ERROR: unable to run the dead sender\n";
+        return false;
+    }
+
+    CommandSender sender;
+    if (sender.on_activate(COMMAND_SHM_NAME) == CallbackReturn::FAILURE) {
+        return false;
+    }
+    auto start = std::chrono::steady_clock::now();
+    bool sent = sender.send(0, DIRECTION::FORWARD, 0, PWM_FREQUENCY);
+    auto took = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+    MotorCommand command;
+    bool received = mailbox.poll(0, command_clock_ns(), command) == CommandStatus::NEW;
+    std::cout << "Send after a sender died mid write: " << (sent && received ? "taken over" : "FAILED") << " in "
+              << took.count() << "us\n";
+    return sent && received;
+}
+
+int main()
+{
+    GpioRuntime &gpio = GpioRuntime::instance();
+    int pi = gpio.acquire();
+    if (pi < 0) {
+        std::cout << "ERROR: Failed to initialize hardware\n";
+        return 1;
+    }
+
+    MotorController cntl;
+    CommandMailbox mailbox;
+    if (cntl.on_configure(pi, board::LeftWheel {}, TIMEOUT, MIN_INTERVAL, CONTROL_PERIOD_US / 1000, 0, 0, 0, 0, 0) == CallbackReturn::FAILURE ||
+        mailbox.on_configure(COMMAND_SHM_NAME, 1, STALE_TIMEOUT_US) == CallbackReturn::FAILURE) {
+        std::cout << "failed on configuration\n";
+        gpio.release(pi);
+        return 1;
+    }
+    if (cntl.on_activate() == CallbackReturn::FAILURE || mailbox.on_activate() == CallbackReturn::FAILURE) {
+        std::cout << "failed on activation\n";
+        cntl.on_deactivate();
+        gpio.release(pi);
+        return 1;
+    }
+
+    if (!dead_sender_takes_over(mailbox)) {
+        mailbox.on_deactivate();
+        cntl.on_deactivate();
+        gpio.release(pi);
+        return 1;
+    }
+
+    std::atomic<bool> sending {true};
+    std::thread sender_thread([&sending]() {
+        CommandSender sender;
+        if (sender.on_activate(COMMAND_SHM_NAME) == CallbackReturn::FAILURE) {
+            sending.store(false);
+            return;
+        }
+        std::mt19937 rng(11);
+        std::uniform_int_distribution<int> gap_us(2000, 7000);
+        for (auto i = 0; i < BENCH_COMMANDS; i++) {
+            sender.send(0, DIRECTION::FORWARD, (i & 1) ? 75 : 65, PWM_FREQUENCY);
+            std::this_thread::sleep_for(std::chrono::microseconds(gap_us(rng)));
+        }
+        sending.store(false);
+    });
+
+    std::vector<uint64_t> latency_ns;
+    latency_ns.reserve(BENCH_COMMANDS);
+    uint64_t last_command_ns = 0;
+    uint64_t stopped_after_ns = 0;
+
+    std::cout << "benchmarking " << BENCH_COMMANDS << " commands, control period " << CONTROL_PERIOD_US << "us\n";
+    auto next = std::chrono::steady_clock::now();
+    for (;;) {
+        next += std::chrono::microseconds(CONTROL_PERIOD_US);
+        std::this_thread::sleep_until(next);
+
+        MotorCommand command;
+        CommandStatus status = mailbox.poll(0, command_clock_ns(), command);
+        if (status == CommandStatus::NEW) {
+            cntl.publish(static_cast<DIRECTION>(command.direction), command.duty, command.freq);
+            uint64_t applied_ns = command_clock_ns();
+            latency_ns.push_back(applied_ns - command.sent_ns);
+            last_command_ns = applied_ns;
+        } else if (status == CommandStatus::STALE) {
+            cntl.publish(DIRECTION::FORWARD, 0, 0);
+            stopped_after_ns = command_clock_ns() - last_command_ns;
+            break;
+        }
+        if (!sending.load() && last_command_ns == 0) {
+            break;
+        }
+    }
+    sender_thread.join();
+
+    cntl.publish(DIRECTION::FORWARD, 0, 0);
+    mailbox.on_deactivate();
+    cntl.on_deactivate();
+    gpio.release(pi);
+
+    if (latency_ns.empty()) {
+        std::cout << "ERROR: no commands received\n";
+        return 1;
+    }
+
+    std::sort(latency_ns.begin(), latency_ns.end());
+    double mean = 0.0;
+    for (auto ns : latency_ns) {
+        mean += static_cast<double>(ns) / latency_ns.size();
+    }
+    std::cout << "Commands applied: " << latency_ns.size() << " of " << BENCH_COMMANDS
+              << " (newer commands overwrite ones not yet polled)\n";
+    std::cout << "Command to PWM latency us, mean: " << mean / 1000.0
+              << " p50: " << percentile(latency_ns, 0.5) / 1000.0
+              << " p99: " << percentile(latency_ns, 0.99) / 1000.0
+              << " max: " << latency_ns.back() / 1000.0 << "\n";
+    std::cout << "Watchdog stopped motor " << stopped_after_ns / 1000 << "us after the last command (timeout "
+              << STALE_TIMEOUT_US << "us), stale events: " << mailbox.stale_events(0) << "\n";
+    return stopped_after_ns > 0 ? 0 : 1;
+}
@@ -0,0 +1,366 @@
+/**
+ * Cost of the encoder callback's shared state with readers on other cores, before and after MotorController
+ * split it into cache line aligned blocks by writer, see motor_controller.hpp.
+ *
+ * Both layouts run the same callback, the one MotorController had before the split: count the edge, accumulate
+ * healthy periods, and every PPR edges close the window into a smoothed velocity. "packed" keeps the previous
+ * layout, every atomic next to each other and updated with fetch_add and compare_exchange. "blocked" keeps the
+ * current one, a block per writer updated with a plain load and store, and velocity read against the stall
+ * count. "controller" drives a real MotorController's encoder callback, which adds the double buffered window,
+ * for reference.
+ *
+ * One writer thread plays the encoder callback for EDGES edges while 0 to MAX_READERS threads read velocity and
+ * the pulse counters as fast as they can, each thread pinned to its own core. Printed per reader count and
+ * layout: the writer's CPU time per edge, so readers sharing its core do not count, and reads per second per
+ * reader. Each figure is the median of RUNS runs. Build with optimisation, the CMake target sets -O2.
+ *
+ * The controller is activated but its wheel is not driven, runs on the robot or with -DPIGPIO_SIM=ON.
+ *
+ * usage: tst_counters
+ */
+
+#include "board.hpp"
+#include "fixed_point.hpp"
+#include "gpio_runtime.hpp"
+#include "motor_controller.hpp"
+#include "tst_common.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <pthread.h>
+#include <sched.h>
+#include <thread>
+#include <time.h>
+#include <vector>
+
+#define EDGES 2000000
+#define RUNS 5
+#define MAX_READERS 3
+#define DELTA_US 1000
+#define TIMEOUT 0
+#define MIN_INTERVAL 150
+#define MIN_DELTA_US 300
+#define MAX_DELTA_US 3000
+
+// unused by MotorController, see its on_configure().
+#define PID_FREQUENCY 10
+#define KP 0
+#define KI 0
+#define KD 0
+#define PID_MIN 0
+#define PID_MAX 100
+
+static constexpr int PPR = 8;
+static constexpr std::array<uint64_t, PPR + 1> VELOCITY_SCALE = fixed::velocity_scale<PPR>();
+static constexpr int VELOCITY_ALPHA = 77;
+
+/**
+ * The state and callback MotorController had before, without the stall wheel and trace points, which neither
+ * layout uses here.
+ */
+struct PackedController {
+    std::atomic<fixed::q16_t> velocity {0};
+    std::atomic<int> total_pulses {0};
+    std::atomic<int> healthy_pulses {0};
+    std::atomic<int> boundary_triggers {0};
+    std::atomic<int> stall_events {0};
+    std::atomic<int> delta_ct {0};
+    std::atomic<int> delta_us_ct {0};
+    std::atomic<uint32_t> delta_us_accum {0};
+    std::atomic<uint32_t> last_period_us {0};
+    std::atomic<uint32_t> samples {0};
+    std::atomic<uint32_t> sample_tick {0};
+    std::atomic<bool> running {true};
+
+    void edge(uint32_t delta_us, uint32_t tick)
+    {
+        if (!running.load(std::memory_order_acquire)) {
+            return;
+        }
+        total_pulses.fetch_add(1, std::memory_order_relaxed);
+        if (delta_us > MIN_DELTA_US && delta_us < MAX_DELTA_US) {
+            last_period_us.store(delta_us, std::memory_order_relaxed);
+            healthy_pulses.fetch_add(1, std::memory_order_release);
+            delta_us_ct.fetch_add(1, std::memory_order_acq_rel);
+            delta_us_accum.fetch_add(delta_us, std::memory_order_acq_rel);
+        }
+
+        int old_count = delta_ct.fetch_add(1, std::memory_order_acq_rel);
+        if (old_count == PPR - 1) {
+            boundary_triggers.fetch_add(1, std::memory_order_relaxed);
+            int expected = PPR;
+            if (delta_ct.compare_exchange_strong(expected, 0, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                uint32_t accum = delta_us_accum.load(std::memory_order_acquire);
+                int ct = delta_us_ct.load(std::memory_order_acquire);
+                delta_us_ct.store(0, std::memory_order_release);
+                delta_us_accum.store(0, std::memory_order_release);
+                if (accum > 0 && ct > 0 && ct <= PPR) {
+                    auto new_vel = static_cast<fixed::q16_t>(VELOCITY_SCALE[ct] / accum);
+                    fixed::q16_t current = velocity.load(std::memory_order_acquire);
+                    velocity.store(fixed::ema<VELOCITY_ALPHA>(current, new_vel), std::memory_order_release);
+                    sample_tick.store(tick, std::memory_order_relaxed);
+                    samples.fetch_add(1, std::memory_order_release);
+                }
+            }
+        }
+    }
+
+    int read() const
+    {
+        return velocity.load(std::memory_order_acquire) + total_pulses.load(std::memory_order_relaxed)
+            + healthy_pulses.load(std::memory_order_relaxed) + boundary_triggers.load(std::memory_order_relaxed)
+            + stall_events.load(std::memory_order_relaxed);
+    }
+};
+
+/**
+ * The same callback on MotorController's layout, blocks by writer and single writer increments.
+ */
+struct BlockedController {
+    template <class T>
+    static void bump(std::atomic<T> &counter, T n = 1, std::memory_order order = std::memory_order_relaxed)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + n, order);
+    }
+
+    struct alignas(64) EdgeState {
+        std::atomic<uint32_t> last_period_us {0};
+        std::atomic<int> healthy_pulses {0};
+        int window_ct = 0;
+        int window_healthy = 0;
+        uint32_t window_accum = 0;
+    };
+
+    struct alignas(64) SampleState {
+        std::atomic<fixed::q16_t> velocity {0};
+        std::atomic<uint32_t> samples {0};
+        std::atomic<uint32_t> sample_tick {0};
+        std::atomic<int> stalls_seen {0};
+    };
+
+    struct alignas(64) CounterBlock {
+        std::atomic<int> total_pulses {0};
+        std::atomic<int> boundary_triggers {0};
+        std::atomic<int> stall_events {0};
+    };
+
+    EdgeState edge_state;
+    SampleState sample;
+    std::array<CounterBlock, 2> counters; // callback, control
+    alignas(64) std::atomic<bool> running {true};
+
+    void edge(uint32_t delta_us, uint32_t tick)
+    {
+        if (!running.load(std::memory_order_acquire)) {
+            return;
+        }
+        EdgeState &e = edge_state;
+        bump(counters[0].total_pulses);
+        if (delta_us > MIN_DELTA_US && delta_us < MAX_DELTA_US) {
+            e.last_period_us.store(delta_us, std::memory_order_relaxed);
+            bump(e.healthy_pulses, 1, std::memory_order_release);
+            e.window_healthy++;
+            e.window_accum += delta_us;
+        }
+        if (++e.window_ct < PPR) {
+            return;
+        }
+        bump(counters[0].boundary_triggers);
+        uint32_t accum = e.window_accum;
+        int ct = e.window_healthy;
+        e.window_ct = 0;
+        e.window_healthy = 0;
+        e.window_accum = 0;
+        if (accum > 0 && ct > 0 && ct <= PPR) {
+            auto new_vel = static_cast<fixed::q16_t>(VELOCITY_SCALE[ct] / accum);
+            int stalls = counters[1].stall_events.load(std::memory_order_acquire);
+            fixed::q16_t current = 0;
+            if (sample.stalls_seen.load(std::memory_order_relaxed) == stalls) {
+                current = sample.velocity.load(std::memory_order_relaxed);
+            }
+            sample.velocity.store(fixed::ema<VELOCITY_ALPHA>(current, new_vel), std::memory_order_relaxed);
+            sample.stalls_seen.store(stalls, std::memory_order_release);
+            sample.sample_tick.store(tick, std::memory_order_relaxed);
+            bump(sample.samples, 1u, std::memory_order_release);
+        }
+    }
+
+    int read() const
+    {
+        int stalls = counters[1].stall_events.load(std::memory_order_acquire);
+        int velocity = sample.stalls_seen.load(std::memory_order_acquire) == stalls
+            ? sample.velocity.load(std::memory_order_relaxed)
+            : 0;
+        int sum = velocity + edge_state.healthy_pulses.load(std::memory_order_relaxed);
+        for (const CounterBlock &block : counters) {
+            sum += block.total_pulses.load(std::memory_order_relaxed)
+                + block.boundary_triggers.load(std::memory_order_relaxed)
+                + block.stall_events.load(std::memory_order_relaxed);
+        }
+        return sum;
+    }
+};
+
+/**
+ * Exposes the encoder callback so the benchmark can drive it without edges.
+ */
+class RealController : public MotorController {
+  public:
+    void edge(uint32_t delta_us, uint32_t tick)
+    {
+        encoder_cb_(board::LeftWheel::enc, delta_us, tick, TickStatus::HEALTHY);
+    }
+
+    int read() const
+    {
+        ControllerCounters c = counters();
+        return static_cast<int>(velocity() * 1000.0) + c.total_pulses + c.healthy_pulses + c.boundary_triggers
+            + c.stall_events;
+    }
+};
+
+struct RunResult {
+    double writer_ns_per_edge = 0.0;
+    double reads_per_s = 0.0;  // per reader
+};
+
+static void pin_to_cpu(unsigned cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % std::thread::hardware_concurrency(), &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static double thread_cpu_ns()
+{
+    struct timespec ts {};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<double>(ts.tv_sec) * 1.0e9 + static_cast<double>(ts.tv_nsec);
+}
+
+template <class Controller>
+static RunResult run_once(Controller &cntl, size_t readers)
+{
+    std::atomic<bool> done {false};
+    std::atomic<size_t> ready {0};
+    std::vector<uint64_t> reads(readers, 0);
+    std::vector<std::thread> threads;
+    for (size_t r = 0; r < readers; r++) {
+        threads.emplace_back([&, r]() {
+            pin_to_cpu(static_cast<unsigned>(r + 1));
+            ready.fetch_add(1);
+            uint64_t n = 0;
+            volatile int sink = 0;
+            while (!done.load(std::memory_order_relaxed)) {
+                sink = sink + cntl.read();
+                n++;
+            }
+            reads[r] = n;
+        });
+    }
+
+    double cpu_ns = 0.0;
+    double elapsed_ns = 0.0;
+    std::thread writer([&]() {
+        pin_to_cpu(0);
+        while (ready.load() < readers) {
+            std::this_thread::yield();
+        }
+        uint32_t tick = 0;
+        auto start = std::chrono::steady_clock::now();
+        double cpu_start = thread_cpu_ns();
+        for (int i = 0; i < EDGES; i++) {
+            tick += DELTA_US;
+            cntl.edge(DELTA_US, tick);
+        }
+        cpu_ns = thread_cpu_ns() - cpu_start;
+        elapsed_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        done.store(true);
+    });
+    writer.join();
+    uint64_t total_reads = 0;
+    for (size_t r = 0; r < readers; r++) {
+        threads[r].join();
+        total_reads += reads[r];
+    }
+
+    RunResult result;
+    result.writer_ns_per_edge = cpu_ns / EDGES;
+    if (readers > 0) {
+        result.reads_per_s = static_cast<double>(total_reads) / readers * 1.0e9 / elapsed_ns;
+    }
+    return result;
+}
+
+/**
+ * Median of RUNS runs, each figure taken separately.
+ */
+template <class Controller>
+static RunResult run(Controller &cntl, size_t readers)
+{
+    std::array<double, RUNS> ns {};
+    std::array<double, RUNS> reads {};
+    for (size_t i = 0; i < RUNS; i++) {
+        RunResult r = run_once(cntl, readers);
+        ns[i] = r.writer_ns_per_edge;
+        reads[i] = r.reads_per_s;
+    }
+    std::nth_element(ns.begin(), ns.begin() + RUNS / 2, ns.end());
+    std::nth_element(reads.begin(), reads.begin() + RUNS / 2, reads.end());
+    RunResult result;
+    result.writer_ns_per_edge = ns[RUNS / 2];
+    result.reads_per_s = reads[RUNS / 2];
+    return result;
+}
+
+int main()
+{
+    GpioRuntime &gpio = GpioRuntime::instance();
+    int pi = gpio.acquire();
+    if (pi < 0) {
+        std::cout << "ERROR: Failed to initialize hardware\n";
+        return 1;
+    }
+    RealController real;
+    if (real.on_configure(pi, board::LeftWheel {}, TIMEOUT, MIN_INTERVAL, PID_FREQUENCY, KP, KI, KD, PID_MIN, PID_MAX) == CallbackReturn::FAILURE
+        || real.on_activate() == CallbackReturn::FAILURE) {
+        std::cout << "ERROR: unable to bring up the controller\n";
+        gpio.release(pi);
+        return 1;
+    }
+    PackedController packed;
+    BlockedController blocked;
+
+    std::cout << EDGES << " edges, median of " << RUNS << " runs, " << std::thread::hardware_concurrency() << " cpus\n"
+              << "                writer cpu ns/edge                 reads/s per reader\n"
+              << "readers   packed  blocked  controller     packed    blocked  controller\n"
+              << std::fixed;
+    for (size_t readers = 0; readers <= MAX_READERS; readers++) {
+        RunResult p = run(packed, readers);
+        RunResult b = run(blocked, readers);
+        RunResult c = run(real, readers);
+        std::cout << std::setw(7) << readers << std::setprecision(2) << std::setw(9) << p.writer_ns_per_edge
+                  << std::setw(9) << b.writer_ns_per_edge << std::setw(12) << c.writer_ns_per_edge
+                  << std::setprecision(0) << std::setw(11) << p.reads_per_s << std::setw(11) << b.reads_per_s
+                  << std::setw(12) << c.reads_per_s << "\n";
+    }
+
+    // every layout counts every edge it was given.
+    const int expected = (MAX_READERS + 1) * RUNS * EDGES;
+    ControllerCounters c = real.counters();
+    if (c.total_pulses != expected || packed.total_pulses.load() != expected
+        || blocked.counters[0].total_pulses.load() != expected) {
+        std::cout << "FAIL: " << packed.total_pulses.load() << " packed, " << blocked.counters[0].total_pulses.load()
+                  << " blocked, " << c.total_pulses << " controller pulses counted of " << expected << "\n";
+        real.on_deactivate();
+        gpio.release(pi);
+        return 1;
+    }
+    real.on_deactivate();
+    gpio.release(pi);
+    std::cout << "PASS\n";
+    return 0;
+}
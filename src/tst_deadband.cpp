@@ -0,0 +1,130 @@
+/**
+ * Searches the breakaway duty of both wheels at two PWM frequencies, see deadband.hpp.
+ *
+ * Each search must finish within SEARCH_BUDGET_MS. The results are saved to CACHE_PATH, loaded into a fresh
+ * cache and looked up again, which must then skip the search. With -DPIGPIO_SIM=ON the wheels are given known
+ * deadbands and each result must land within SIM_TOLERANCE of them, see pigpio_sim.hpp.
+ *
+ * The wheels turn forward briefly, the robot must be free to move. Simulated wheels coast down without friction,
+ * so each search takes longer there than on the robot.
+ *
+ * usage: tst_deadband
+ */
+
+#include "board.hpp"
+#include "deadband.hpp"
+#include "gpio_runtime.hpp"
+#include "motor_controller.hpp"
+#include "tst_common.hpp"
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+
+#ifdef PIGPIO_SIM
+#include "pigpio_sim.hpp"
+#endif
+
+#define TIMEOUT 0
+#define MIN_INTERVAL 150
+#define SEARCH_BUDGET_MS 1000
+#define CACHE_PATH "tst_deadband.bin"
+
+// unused by MotorController, see its on_configure().
+#define PID_FREQUENCY 10
+#define KP 0
+#define KI 0
+#define KD 0
+#define PID_MIN 0
+#define PID_MAX 100
+
+#ifdef PIGPIO_SIM
+#define SIM_TOLERANCE 3
+static constexpr std::array<double, 2> SIM_DEADBAND {60.0, 52.0};
+#endif
+
+static constexpr std::array<int, 2> FREQS {500, 2000};
+
+int main()
+{
+    GpioRuntime &gpio = GpioRuntime::instance();
+#ifdef PIGPIO_SIM
+    SimMotorModel left_model;
+    SimMotorModel right_model;
+    left_model.deadband = SIM_DEADBAND[0];
+    right_model.deadband = SIM_DEADBAND[1];
+    pigpio_sim_attach(board::LeftWheel::pwm, board::LeftWheel::dir, board::LeftWheel::enc, left_model);
+    pigpio_sim_attach(board::RightWheel::pwm, board::RightWheel::dir, board::RightWheel::enc, right_model);
+#endif
+    int pi = gpio.acquire();
+    if (pi < 0) {
+        std::cout << "ERROR: Failed to initialize hardware\n";
+        return 1;
+    }
+
+    std::array<MotorController, 2> cntl;
+    if (cntl[0].on_configure(pi, board::LeftWheel {}, TIMEOUT, MIN_INTERVAL, PID_FREQUENCY, KP, KI, KD, PID_MIN, PID_MAX) == CallbackReturn::FAILURE
+        || cntl[1].on_configure(pi, board::RightWheel {}, TIMEOUT, MIN_INTERVAL, PID_FREQUENCY, KP, KI, KD, PID_MIN, PID_MAX) == CallbackReturn::FAILURE
+        || cntl[0].on_activate() == CallbackReturn::FAILURE
+        || cntl[1].on_activate() == CallbackReturn::FAILURE) {
+        std::cout << "ERROR: unable to bring up the wheels\n";
+        cntl[0].on_deactivate();
+        cntl[1].on_deactivate();
+        gpio.release(pi);
+        return 1;
+    }
+
+    DeadbandSearch search;
+    search.on_configure(DeadbandConfig {});
+    DeadbandCache cache;
+    std::remove(CACHE_PATH);
+
+    bool ok = true;
+    for (size_t w = 0; w < cntl.size(); w++) {
+        for (int freq : FREQS) {
+            DeadbandResult r = search.find(cntl[w], freq, cache);
+            std::cout << "pin " << cntl[w].pwm_pin() << " at " << freq << "Hz: deadband " << r.duty << "% in "
+                      << r.search_us / 1000 << "ms, " << r.probes << " probes\n";
+            if (r.duty < 0 || r.cached) {
+                std::cout << "FAIL: no search result\n";
+                ok = false;
+            }
+            if (r.search_us > SEARCH_BUDGET_MS * 1000) {
+                std::cout << "FAIL: search took longer than " << SEARCH_BUDGET_MS << "ms\n";
+                ok = false;
+            }
+#ifdef PIGPIO_SIM
+            if (std::abs(r.duty - static_cast<int>(SIM_DEADBAND[w])) > SIM_TOLERANCE) {
+                std::cout << "FAIL: simulated deadband is " << SIM_DEADBAND[w] << "%\n";
+                ok = false;
+            }
+#endif
+        }
+    }
+
+    // a later start, the cache read back from disk must answer without touching the wheels.
+    if (cache.save(CACHE_PATH) == CallbackReturn::FAILURE) {
+        ok = false;
+    }
+    DeadbandCache reloaded;
+    reloaded.load(CACHE_PATH);
+    std::cout << "cache holds " << reloaded.size() << " entries\n";
+    for (size_t w = 0; w < cntl.size(); w++) {
+        for (int freq : FREQS) {
+            int pulses = cntl[w].pulses();
+            DeadbandResult r = search.find(cntl[w], freq, reloaded);
+            if (!r.cached || r.duty != cache.find(static_cast<unsigned>(cntl[w].pwm_pin()), freq)
+                || cntl[w].pulses() != pulses) {
+                std::cout << "FAIL: pin " << cntl[w].pwm_pin() << " at " << freq << "Hz was not taken from the cache\n";
+                ok = false;
+            }
+        }
+    }
+    std::remove(CACHE_PATH);
+
+    cntl[0].on_deactivate();
+    cntl[1].on_deactivate();
+    gpio.release(pi);
+
+    std::cout << (ok ? "PASS\n" : "FAIL\n");
+    return ok ? 0 : 1;
+}
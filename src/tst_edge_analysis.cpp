@@ -0,0 +1,343 @@
+/**
+ * Checks EdgeAnalyzer against a naive reference and measures its throughput, see edge_analysis.hpp.
+ *
+ * RECORDS synthetic edges over two pins are written as both a CSV, laid out as tst_motor_enc prints it with
+ * messages around the table, and a binary capture. The intervals are jittered around DELTA_US with a share of
+ * glitches, slow intervals, timeouts, noise and unexpected edges. Each capture is analyzed with 1 thread and
+ * with THREADS, and every result must match the reference, which sorts for percentiles and walks each pin's
+ * edges one at a time: counts and percentiles exactly, moments to within TOLERANCE. A binary capture that was
+ * never closed, record count 0 in its header, must read the same. Printed per run: load and kernel time and MB/s.
+ *
+ * Does not touch hardware.
+ *
+ * usage: tst_edge_analysis [RECORDS]
+ */
+
+#include "edge_analysis.hpp"
+#include "encoder.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+#define DEFAULT_RECORDS 4000000
+#define MIN_RECORDS 1000
+#define THREADS 4
+#define DELTA_US 1000
+#define JITTER_US 200
+#define TOLERANCE 1e-9
+
+// per million edges
+#define GLITCH_PPM 10000
+#define SLOW_PPM 5000
+#define TIMEOUT_PPM 5000
+#define NOISE_PPM 5000
+#define UNEXPECTED_PPM 100
+
+#define CSV_PATH "/tmp/tst_edge_analysis.csv"
+#define BINARY_PATH "/tmp/tst_edge_analysis.bin"
+#define UNCLOSED_PATH "/tmp/tst_edge_analysis_unclosed.bin"
+
+static constexpr std::array<uint8_t, 2> PINS {9, 25};
+
+// lines of the CSV that are not edges, as tst_motor_enc prints them.
+#define CSV_LEADING "Testing motor A\nGPIO,DELTA_US,TICK_US,STATUS\n"
+#define CSV_TRAILING "WARNING: 3 edges were not recorded\n"
+#define CSV_SKIPPED 3
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+static uint32_t next_random()
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return static_cast<uint32_t>(rng_state >> 32);
+}
+
+static std::vector<EdgeCaptureRecord> generate(size_t records)
+{
+    std::vector<EdgeCaptureRecord> edges(records);
+    std::array<uint32_t, 2> tick {0, 0};
+    for (EdgeCaptureRecord &e : edges) {
+        const size_t p = next_random() % PINS.size();
+        const uint32_t draw = next_random() % 1000000;
+        uint32_t delta = DELTA_US - JITTER_US + next_random() % (2 * JITTER_US + 1);
+        uint8_t status = static_cast<uint8_t>(TickStatus::HEALTHY);
+        if (draw < GLITCH_PPM) {
+            delta = 1 + next_random() % 300;
+        }
+        else if (draw < GLITCH_PPM + SLOW_PPM) {
+            delta = 3000 + next_random() % 100000;
+        }
+        else if (draw < GLITCH_PPM + SLOW_PPM + TIMEOUT_PPM) {
+            status = static_cast<uint8_t>(TickStatus::TIMEOUT);
+        }
+        else if (draw < GLITCH_PPM + SLOW_PPM + TIMEOUT_PPM + NOISE_PPM) {
+            status = static_cast<uint8_t>(TickStatus::NOISE_REJECTED);
+        }
+        else if (draw < GLITCH_PPM + SLOW_PPM + TIMEOUT_PPM + NOISE_PPM + UNEXPECTED_PPM) {
+            status = static_cast<uint8_t>(TickStatus::UNEXPECTED);
+        }
+        tick[p] += delta;
+        e = EdgeCaptureRecord {tick[p], delta, PINS[p], status, 0};
+    }
+    return edges;
+}
+
+static bool write_csv(const std::vector<EdgeCaptureRecord> &edges)
+{
+    std::ofstream out(CSV_PATH);
+    out << CSV_LEADING;
+    for (const EdgeCaptureRecord &e : edges) {
+        out << static_cast<int>(e.gpio) << "," << e.delta_us << "," << e.tick << "," << static_cast<int>(e.status)
+            << "\n";
+    }
+    out << CSV_TRAILING;
+    return static_cast<bool>(out);
+}
+
+static bool write_binary(const std::vector<EdgeCaptureRecord> &edges)
+{
+    EdgeCaptureWriter writer;
+    if (writer.on_activate(BINARY_PATH) == CallbackReturn::FAILURE) {
+        return false;
+    }
+    for (const EdgeCaptureRecord &e : edges) {
+        if (writer.write(e) == CallbackReturn::FAILURE) {
+            return false;
+        }
+    }
+    if (writer.on_deactivate() == CallbackReturn::FAILURE) {
+        return false;
+    }
+
+    // as left by a writer that never reached on_deactivate().
+    FILE *in = std::fopen(BINARY_PATH, "rb");
+    FILE *out = std::fopen(UNCLOSED_PATH, "wb");
+    bool ok = in != nullptr && out != nullptr;
+    EdgeCaptureHeader header {};
+    if (ok && std::fread(&header, sizeof(header), 1, in) == 1) {
+        header.record_ct = 0;
+        ok = std::fwrite(&header, sizeof(header), 1, out) == 1;
+        std::vector<char> buf(1 << 20);
+        size_t n = 0;
+        while (ok && (n = std::fread(buf.data(), 1, buf.size(), in)) > 0) {
+            ok = std::fwrite(buf.data(), 1, n, out) == n;
+        }
+    }
+    if (in != nullptr) {
+        std::fclose(in);
+    }
+    if (out != nullptr) {
+        ok = std::fclose(out) == 0 && ok;
+    }
+    return ok;
+}
+
+/**
+ * The analysis of one pin, an edge at a time.
+ */
+static PinAnalysis reference(const std::vector<EdgeCaptureRecord> &edges, uint8_t gpio, const EdgeAnalysisConfig &config)
+{
+    PinAnalysis pin;
+    pin.gpio = gpio;
+    std::vector<uint32_t> in_range;
+    std::vector<bool> ok_window;
+    std::vector<uint32_t> deltas;
+    bool first = true;
+    for (const EdgeCaptureRecord &e : edges) {
+        if (e.gpio != gpio) {
+            continue;
+        }
+        pin.edges++;
+        EdgeClass c = EdgeClass::IN_RANGE;
+        switch (static_cast<TickStatus>(e.status)) {
+            case TickStatus::HEALTHY:
+                c = e.delta_us <= config.min_delta_us ? EdgeClass::GLITCH
+                    : e.delta_us >= config.max_delta_us ? EdgeClass::SLOW
+                    : EdgeClass::IN_RANGE;
+                break;
+            case TickStatus::TIMEOUT:
+                c = EdgeClass::TIMEOUT;
+                break;
+            case TickStatus::NOISE_REJECTED:
+                c = EdgeClass::NOISE_REJECTED;
+                break;
+            case TickStatus::UNEXPECTED:
+                c = EdgeClass::UNEXPECTED;
+                break;
+        }
+        pin.classes[static_cast<size_t>(c)]++;
+        if (c == EdgeClass::UNEXPECTED) {
+            continue;
+        }
+        if (first) {
+            pin.first_tick = e.tick;
+            first = false;
+        }
+        pin.last_tick = e.tick;
+        deltas.push_back(e.delta_us);
+        ok_window.push_back(c == EdgeClass::IN_RANGE);
+        if (c == EdgeClass::IN_RANGE) {
+            in_range.push_back(e.delta_us);
+        }
+    }
+
+    IntervalStats &interval = pin.interval;
+    interval.count = in_range.size();
+    double sum = 0.0;
+    for (uint32_t d : in_range) {
+        sum += d;
+    }
+    interval.mean_us = sum / in_range.size();
+    double ss = 0.0;
+    for (uint32_t d : in_range) {
+        ss += (d - interval.mean_us) * (d - interval.mean_us);
+    }
+    interval.stddev_us = std::sqrt(ss / (in_range.size() - 1));
+    std::sort(in_range.begin(), in_range.end());
+    interval.min_us = in_range.front();
+    interval.max_us = in_range.back();
+    for (size_t q = 0; q < EDGE_PERCENTILES.size(); q++) {
+        size_t r = static_cast<size_t>(std::ceil(EDGE_PERCENTILES[q] * in_range.size()));
+        interval.percentile_us[q] = in_range[std::max<size_t>(r, 1) - 1];
+    }
+
+    std::vector<double> rps;
+    const size_t ppr = static_cast<size_t>(config.ppr);
+    for (size_t w = 0; w + ppr <= deltas.size(); w += ppr) {
+        uint64_t accum = 0;
+        int ct = 0;
+        for (size_t i = w; i < w + ppr; i++) {
+            if (ok_window[i]) {
+                accum += deltas[i];
+                ct++;
+            }
+        }
+        if (ct == 0) {
+            pin.velocity.empty_windows++;
+            continue;
+        }
+        rps.push_back(static_cast<float>(ct * 1.0e6 / (ppr * static_cast<double>(accum))));
+    }
+    VelocityStats &velocity = pin.velocity;
+    velocity.windows = rps.size();
+    sum = 0.0;
+    for (double v : rps) {
+        sum += v;
+    }
+    velocity.mean_rps = sum / rps.size();
+    ss = 0.0;
+    for (double v : rps) {
+        ss += (v - velocity.mean_rps) * (v - velocity.mean_rps);
+    }
+    velocity.stddev_rps = std::sqrt(ss / (rps.size() - 1));
+    std::sort(rps.begin(), rps.end());
+    velocity.min_rps = rps.front();
+    velocity.max_rps = rps.back();
+    for (size_t q = 0; q < EDGE_PERCENTILES.size(); q++) {
+        size_t r = static_cast<size_t>(std::ceil(EDGE_PERCENTILES[q] * rps.size()));
+        velocity.percentile_rps[q] = rps[std::max<size_t>(r, 1) - 1];
+    }
+    return pin;
+}
+
+static bool close_to(double a, double b)
+{
+    return std::fabs(a - b) <= TOLERANCE * std::max(1.0, std::fabs(b));
+}
+
+static bool matches(const PinAnalysis &got, const PinAnalysis &want)
+{
+    bool ok = got.gpio == want.gpio && got.edges == want.edges && got.classes == want.classes
+        && got.first_tick == want.first_tick && got.last_tick == want.last_tick;
+    const IntervalStats &gi = got.interval;
+    const IntervalStats &wi = want.interval;
+    ok = ok && gi.count == wi.count && gi.min_us == wi.min_us && gi.max_us == wi.max_us
+        && gi.percentile_us == wi.percentile_us && close_to(gi.mean_us, wi.mean_us)
+        && close_to(gi.stddev_us, wi.stddev_us);
+    const VelocityStats &gv = got.velocity;
+    const VelocityStats &wv = want.velocity;
+    ok = ok && gv.windows == wv.windows && gv.empty_windows == wv.empty_windows && gv.min_rps == wv.min_rps
+        && gv.max_rps == wv.max_rps && gv.percentile_rps == wv.percentile_rps && close_to(gv.mean_rps, wv.mean_rps)
+        && close_to(gv.stddev_rps, wv.stddev_rps);
+    return ok;
+}
+
+static bool run(const char *path, unsigned threads, uint64_t skipped, const std::vector<PinAnalysis> &want)
+{
+    EdgeAnalysisConfig config;
+    config.threads = threads;
+    EdgeAnalyzer analyzer;
+    EdgeCapture capture;
+    EdgeAnalysis analysis;
+    if (analyzer.on_configure(config) == CallbackReturn::FAILURE || capture.on_activate(path) == CallbackReturn::FAILURE
+        || analyzer.analyze(capture, analysis) == CallbackReturn::FAILURE) {
+        std::cout << "FAIL: unable to analyze " << path << "\n";
+        return false;
+    }
+
+    const double mb = capture.size() / 1.0e6;
+    std::cout << std::setw(40) << path << std::setw(4) << threads << std::fixed << std::setprecision(1)
+              << std::setw(10) << analysis.load_ms << std::setw(12) << analysis.kernel_ms << std::setw(9)
+              << mb * 1000.0 / (analysis.load_ms + analysis.kernel_ms) << "\n";
+
+    bool ok = analysis.skipped_lines == skipped && analysis.pins.size() == want.size();
+    for (size_t i = 0; ok && i < want.size(); i++) {
+        ok = matches(analysis.pins[i], want[i]);
+        if (!ok) {
+            const PinAnalysis &p = analysis.pins[i];
+            std::cout << "  GPIO " << p.gpio << " got mean " << p.interval.mean_us << " p99 "
+                      << p.interval.percentile_us[2] << " windows " << p.velocity.windows << ", want mean "
+                      << want[i].interval.mean_us << " p99 " << want[i].interval.percentile_us[2] << " windows "
+                      << want[i].velocity.windows << "\n";
+        }
+    }
+    if (!ok) {
+        std::cout << "FAIL: " << path << " with " << threads << " threads does not match the reference\n";
+    }
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    const size_t records = argc > 1 ? static_cast<size_t>(std::atoll(argv[1])) : DEFAULT_RECORDS;
+    if (records < MIN_RECORDS) {
+        std::cout << "usage: tst_edge_analysis [RECORDS], at least " << MIN_RECORDS << "\n";
+        return 1;
+    }
+    std::vector<EdgeCaptureRecord> edges = generate(records);
+    if (!write_csv(edges) || !write_binary(edges)) {
+        std::cout << "ERROR: unable to write the captures to /tmp\n";
+        return 1;
+    }
+
+    EdgeAnalysisConfig config;
+    std::vector<PinAnalysis> want;
+    std::vector<uint8_t> pins(PINS.begin(), PINS.end());
+    std::sort(pins.begin(), pins.end());
+    for (uint8_t gpio : pins) {
+        want.push_back(reference(edges, gpio, config));
+    }
+
+    std::cout << records << " edges over " << PINS.size() << " pins\n"
+              << std::setw(40) << "capture" << std::setw(4) << "thr" << std::setw(10) << "load ms" << std::setw(12)
+              << "kernel ms" << std::setw(9) << "MB/s\n";
+    bool ok = true;
+    for (unsigned threads : {1u, static_cast<unsigned>(THREADS)}) {
+        ok = run(CSV_PATH, threads, CSV_SKIPPED, want) && ok;
+        ok = run(BINARY_PATH, threads, 0, want) && ok;
+    }
+    ok = run(UNCLOSED_PATH, THREADS, 0, want) && ok;
+
+    std::remove(CSV_PATH);
+    std::remove(BINARY_PATH);
+    std::remove(UNCLOSED_PATH);
+    std::cout << (ok ? "PASS\n" : "FAIL\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,347 @@
+/**
+ * Finds the edge rate at which the encoder path starts dropping or delaying edges.
+ *
+ * Synthetic edges are stepped through RATES_HZ, STEP_MS at each rate, from one of two stand in edge sources:
+ *
+ *   chardev   ScriptedLineSource writes kernel formatted events through pipes into GpioChardev's epoll thread,
+ *             runs on any Linux machine, see scripted_lines.hpp.
+ *   loopback  hardware PWM on LOOPBACK_OUT drives the pigpio ISR on LOOPBACK_IN at the PWM frequency. On the Pi
+ *             the two pins must be jumpered and --loopback given, with -DPIGPIO_SIM=ON the wire is simulated,
+ *             see pigpio_sim_loopback().
+ *
+ * Each source feeds two chains, so the cost of MotorController::encoder_cb_ can be told apart from the backend:
+ *
+ *   encoder     MotorEncoder::handle_interrupt() and a callback that only counts,
+ *   controller  the same, with the callback running a live MotorController's encoder_cb_ first.
+ *
+ * Printed per rate: edges the source sent, edges dropped before the callback (the source's count minus the
+ * callback's, plus line_seqno gaps for chardev), latency from the edge's timestamp to the end of the callback,
+ * and process CPU as a percentage of one core, which includes the edge source. A rate is sustained when no more
+ * than MAX_DROP_PPM edges are dropped and p99 latency stays under MAX_P99_US, the ceiling of a configuration is
+ * the highest rate sustained along with every rate below it.
+ *
+ * The simulated loopback delivers edges in bursts of SIM_STEP_US, which shows up in its latency.
+ *
+ * usage: tst_edge_stress [--loopback]
+ */
+
+#include "board.hpp"
+#include "encoder.hpp"
+#include "fixed_point.hpp"
+#include "gpio_chardev.hpp"
+#include "gpio_runtime.hpp"
+#include "motor_controller.hpp"
+#include "scripted_lines.hpp"
+#include "tst_common.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <iomanip>
+#include <string>
+#include <sys/resource.h>
+#include <thread>
+#include <vector>
+
+#ifdef PIGPIO_SIM
+#include "pigpio_sim.hpp"
+#endif
+
+#define STEP_MS 500
+#define DRAIN_MS 50
+#define TIMEOUT_MS 0
+#define MIN_INTERVAL 0
+#define MAX_DROP_PPM 100
+#define MAX_P99_US 1000
+
+// the loopback PWM, PWM0 on the Pi. LOOPBACK_IN is a free header pin.
+#define LOOPBACK_OUT 12
+#define LOOPBACK_IN 16
+#define LOOPBACK_DUTY 500000
+
+// the controller's own encoder sits on this pin and sees no edges, the chain under test calls its callback.
+#define IDLE_ENC 25
+
+// unused by MotorController, see its on_configure().
+#define PID_FREQUENCY 10
+#define KP 0
+#define KI 0
+#define KD 0
+#define PID_MIN 0
+#define PID_MAX 100
+
+static constexpr std::array<uint32_t, 8> RATES_HZ {1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000};
+
+// enough for every edge of the fastest step, edges past this are counted but not kept.
+#define MAX_SAMPLES 131072
+
+enum class Source : uint8_t {
+    CHARDEV = 0,
+    LOOPBACK = 1,
+};
+
+/**
+ * Exposes the encoder callback so the chain under test can run it.
+ */
+class StressController : public MotorController {
+  public:
+    void edge(int gpio_pin, uint32_t delta_us, uint32_t tick, TickStatus tick_status)
+    {
+        encoder_cb_(gpio_pin, delta_us, tick, tick_status);
+    }
+};
+
+struct StepResult {
+    uint32_t hz = 0;
+    uint64_t sent = 0;
+    uint64_t dropped = 0;
+    uint32_t p50_us = 0;
+    uint32_t p99_us = 0;
+    uint32_t max_us = 0;
+    double cpu_pct = 0.0;
+    bool sustained = false;
+};
+
+// preallocated, the callback runs on the backend's thread and must not allocate or block.
+static std::array<uint32_t, MAX_SAMPLES> latency_us;
+static std::atomic<size_t> sample_ct {0};
+static std::atomic<uint64_t> received {0};
+static StressController *controller = nullptr;
+
+static void record(uint32_t tick)
+{
+    received.fetch_add(1, std::memory_order_relaxed);
+    size_t idx = sample_ct.fetch_add(1, std::memory_order_relaxed);
+    if (idx < latency_us.size()) {
+        // chardev timestamps come from another clock than gpioTick() and can land a few us ahead of it.
+        int32_t us = static_cast<int32_t>(fixed::tick_elapsed(gpioTick(), tick));
+        latency_us[idx] = us > 0 ? static_cast<uint32_t>(us) : 0;
+    }
+}
+
+static void count_cb(int, uint32_t, uint32_t tick, TickStatus tick_status)
+{
+    if (tick_status == TickStatus::HEALTHY) {
+        record(tick);
+    }
+}
+
+static void controller_cb(int gpio_pin, uint32_t delta_us, uint32_t tick, TickStatus tick_status)
+{
+    controller->edge(gpio_pin, delta_us, tick, tick_status);
+    if (tick_status == TickStatus::HEALTHY) {
+        record(tick);
+    }
+}
+
+static uint64_t process_cpu_us()
+{
+    struct rusage usage {};
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<uint64_t>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000ULL
+        + static_cast<uint64_t>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+
+/**
+ * Source state the harness reads around each step.
+ */
+class EdgeSource {
+  public:
+    EdgeSource(Source source, ScriptedLineSource &script, unsigned pin) : source_(source), script_(script), pin_(pin) {}
+
+    void start(uint32_t hz)
+    {
+        if (source_ == Source::CHARDEV) {
+            script_.set_rate(pin_, hz);
+        }
+        else {
+            gpioHardwarePWM(LOOPBACK_OUT, hz, LOOPBACK_DUTY);
+        }
+    }
+
+    void stop()
+    {
+        if (source_ == Source::CHARDEV) {
+            script_.set_rate(pin_, 0);
+        }
+        else {
+            gpioHardwarePWM(LOOPBACK_OUT, 0, 0);
+        }
+    }
+
+    // edges the source produced, or were due at hz over ms where it can not count them.
+    uint64_t sent(uint32_t hz, uint64_t ms) const
+    {
+        if (source_ == Source::CHARDEV) {
+            return script_.sent(pin_) + GpioChardev::instance().stats().seq_gaps;
+        }
+#ifdef PIGPIO_SIM
+        (void)hz;
+        (void)ms;
+        return pigpio_sim_pulses(pin_);
+#else
+        return static_cast<uint64_t>(hz) * ms / 1000;
+#endif
+    }
+
+  private:
+    Source source_;
+    ScriptedLineSource &script_;
+    unsigned pin_;
+};
+
+static StepResult run_step(EdgeSource &source, uint32_t hz)
+{
+    StepResult r;
+    r.hz = hz;
+    sample_ct.store(0);
+    received.store(0);
+    const uint64_t sent_start = source.sent(0, 0);
+    const uint64_t cpu_start = process_cpu_us();
+    auto start = std::chrono::steady_clock::now();
+
+    source.start(hz);
+    std::this_thread::sleep_for(std::chrono::milliseconds(STEP_MS));
+    source.stop();
+    const uint64_t run_ms = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+    // edges already sent but still queued are not dropped.
+    std::this_thread::sleep_for(std::chrono::milliseconds(DRAIN_MS));
+
+    const uint64_t wall_us = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+    r.cpu_pct = 100.0 * static_cast<double>(process_cpu_us() - cpu_start) / static_cast<double>(wall_us);
+    r.sent = source.sent(hz, run_ms) - sent_start;
+    uint64_t got = received.load();
+    r.dropped = r.sent > got ? r.sent - got : 0;
+
+    size_t s = std::min(sample_ct.load(), latency_us.size());
+    if (s > 0) {
+        std::sort(latency_us.begin(), latency_us.begin() + s);
+        r.p50_us = latency_us[s / 2];
+        r.p99_us = latency_us[static_cast<size_t>(0.99 * (s - 1))];
+        r.max_us = latency_us[s - 1];
+    }
+    r.sustained = r.sent > 0 && r.dropped * 1000000 <= r.sent * MAX_DROP_PPM && r.p99_us <= MAX_P99_US;
+    return r;
+}
+
+/**
+ * Step every rate through one source and chain, returns the ceiling in Hz, 0 if even the first rate failed.
+ */
+static uint32_t run_config(Source src, bool with_controller, ScriptedLineSource &script)
+{
+    const unsigned pin = src == Source::CHARDEV ? board::LeftWheel::enc : LOOPBACK_IN;
+    MotorEncoder encoder;
+    if (encoder.on_configure(pin, with_controller ? &controller_cb : &count_cb, TIMEOUT_MS, MIN_INTERVAL) == CallbackReturn::FAILURE
+        || encoder.set_backend(src == Source::CHARDEV ? EdgeBackend::CHARDEV : EdgeBackend::PIGPIO) == CallbackReturn::FAILURE
+        || encoder.on_activate() == CallbackReturn::FAILURE) {
+        std::cout << "ERROR: unable to bring up the encoder on GPIO " << pin << "\n";
+        return 0;
+    }
+    if (src == Source::CHARDEV) {
+        script.on_activate();
+    }
+
+    EdgeSource source(src, script, pin);
+    std::cout << (src == Source::CHARDEV ? "chardev" : "loopback") << " / "
+              << (with_controller ? "controller" : "encoder") << "\n"
+              << "      hz        sent   dropped   p50 us   p99 us   max us   cpu %\n";
+    uint32_t ceiling = 0;
+    bool failed = false;
+    for (uint32_t hz : RATES_HZ) {
+        StepResult r = run_step(source, hz);
+        std::cout << std::setw(8) << r.hz << std::setw(12) << r.sent << std::setw(10) << r.dropped
+                  << std::setw(9) << r.p50_us << std::setw(9) << r.p99_us << std::setw(9) << r.max_us
+                  << std::fixed << std::setprecision(1) << std::setw(8) << r.cpu_pct
+                  << (r.sustained ? "" : "  <- not sustained") << "\n";
+        if (!r.sustained) {
+            failed = true;
+        }
+        else if (!failed) {
+            ceiling = hz;
+        }
+    }
+
+    encoder.on_deactivate();
+    if (src == Source::CHARDEV) {
+        script.on_deactivate();
+    }
+    return ceiling;
+}
+
+int main(int argc, char *argv[])
+{
+    bool loopback = false;
+#ifdef PIGPIO_SIM
+    loopback = true;
+#endif
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--loopback") == 0) {
+            loopback = true;
+        }
+        else {
+            std::cout << "usage: tst_edge_stress [--loopback]\n";
+            return 1;
+        }
+    }
+
+    GpioRuntime &gpio = GpioRuntime::instance();
+#ifdef PIGPIO_SIM
+    pigpio_sim_loopback(LOOPBACK_OUT, LOOPBACK_IN);
+#endif
+    int pi = gpio.acquire();
+    if (pi < 0) {
+        std::cout << "ERROR: Failed to initialize hardware\n";
+        return 1;
+    }
+
+    ScriptedLineSource script;
+    StressController cntl;
+    if (GpioChardev::instance().on_configure(script) == CallbackReturn::FAILURE
+        || cntl.on_configure(pi, board::RightWheel::pwm, board::RightWheel::dir, IDLE_ENC, TIMEOUT_MS, MIN_INTERVAL,
+               PID_FREQUENCY, KP, KI, KD, PID_MIN, PID_MAX) == CallbackReturn::FAILURE
+        || cntl.on_activate() == CallbackReturn::FAILURE) {
+        std::cout << "ERROR: unable to bring up the controller\n";
+        gpio.release(pi);
+        return 1;
+    }
+    controller = &cntl;
+    if (loopback && gpioSetMode(LOOPBACK_OUT, PI_ALT0) != OK) {
+        std::cout << "ERROR: unable to route GPIO " << LOOPBACK_OUT << " to PWM\n";
+        loopback = false;
+    }
+
+    struct Config {
+        Source source;
+        bool with_controller;
+        uint32_t ceiling;
+    };
+    std::vector<Config> configs {{Source::CHARDEV, false, 0}, {Source::CHARDEV, true, 0}};
+    if (loopback) {
+        configs.push_back({Source::LOOPBACK, false, 0});
+        configs.push_back({Source::LOOPBACK, true, 0});
+    }
+    for (Config &c : configs) {
+        c.ceiling = run_config(c.source, c.with_controller, script);
+    }
+
+    cntl.on_deactivate();
+    gpio.release(pi);
+
+    bool ok = true;
+    std::cout << "sustained ceiling, at most " << MAX_DROP_PPM << " dropped per million and p99 under " << MAX_P99_US
+              << "us\n";
+    for (const Config &c : configs) {
+        std::cout << "  " << std::setw(8) << (c.source == Source::CHARDEV ? "chardev" : "loopback") << " / "
+                  << std::setw(10) << (c.with_controller ? "controller" : "encoder") << "  "
+                  << (c.ceiling > 0 ? std::to_string(c.ceiling) + "Hz" : "below " + std::to_string(RATES_HZ[0]) + "Hz")
+                  << "\n";
+        // the robot's wheels top out around 3.3kHz, the first rate must always hold.
+        if (c.ceiling == 0) {
+            ok = false;
+        }
+    }
+    std::cout << (ok ? "PASS\n" : "FAIL\n");
+    return ok ? 0 : 1;
+}
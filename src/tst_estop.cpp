@@ -0,0 +1,253 @@
+/**
+ * Fault to PWM off latency of EmergencyStop, against stopping both wheels with on_deactivate(), see
+ * emergency_stop.hpp.
+ *
+ * Both wheels are spun up TRIALS times. Each time a thread standing in for the encoder callback reports a
+ * TickStatus::UNEXPECTED edge on the left wheel, which must cut PWM on both wheels, latch and record the cause.
+ * While latched a new duty must be refused, quietly and without the sequencer entering DriveState::FAULT. The
+ * wheels are then deactivated, the latch reset, and the wheels must drive again. For comparison the same number of
+ * stops are made the old way, the main thread calling on_deactivate() on each controller.
+ *
+ * Then RACE_TRIALS times a thread writes the right wheel's duty in a loop while the main thread trips, at offsets
+ * spread over RACE_SPREAD_US. A write that passed the latch check just before trip() cut the pin must not leave
+ * the wheel driven.
+ *
+ * The wheels turn forward, the robot must be free to move. Runs on the robot or with -DPIGPIO_SIM=ON.
+ *
+ * usage: tst_estop
+ */
+
+#include "board.hpp"
+#include "driver_log.hpp"
+#include "emergency_stop.hpp"
+#include "gpio_runtime.hpp"
+#include "motor_controller.hpp"
+#include "tst_common.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#ifdef PIGPIO_SIM
+#include "pigpio_sim.hpp"
+#endif
+
+#define TIMEOUT 0
+#define MIN_INTERVAL 150
+#define TRIALS 20
+#define DUTY 80
+#define FREQ 1000
+#define SPIN_UP_MS 100
+#define RACE_TRIALS 50
+#define RACE_SPREAD_US 500
+
+// unused by MotorController, see its on_configure().
+#define PID_FREQUENCY 10
+#define KP 0
+#define KI 0
+#define KD 0
+#define PID_MIN 0
+#define PID_MAX 100
+
+/**
+ * Exposes the encoder callback, so a fault can be reported without one on the wire.
+ */
+class FaultyController : public MotorController {
+  public:
+    void unexpected_edge(uint32_t tick)
+    {
+        encoder_cb_(board::LeftWheel::enc, 0, tick, TickStatus::UNEXPECTED);
+    }
+};
+
+struct Latency {
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+    unsigned ct = 0;
+
+    void add(uint64_t ns)
+    {
+        total_ns += ns;
+        max_ns = std::max(max_ns, ns);
+        ct++;
+    }
+
+    double mean_us() const { return ct > 0 ? total_ns / 1000.0 / ct : 0.0; }
+};
+
+static uint64_t elapsed_ns(std::chrono::steady_clock::time_point start)
+{
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+static bool activate(std::array<FaultyController, 2> &cntl)
+{
+    return cntl[0].on_activate() == CallbackReturn::SUCCESS && cntl[1].on_activate() == CallbackReturn::SUCCESS;
+}
+
+static void spin_up(std::array<FaultyController, 2> &cntl)
+{
+    cntl[0].publish(DIRECTION::FORWARD, DUTY, FREQ);
+    cntl[1].publish(DIRECTION::FORWARD, DUTY, FREQ);
+    std::this_thread::sleep_for(std::chrono::milliseconds(SPIN_UP_MS));
+}
+
+static bool pwm_off()
+{
+    return gpioGetPWMdutycycle(board::LeftWheel::pwm) == 0 && gpioGetPWMdutycycle(board::RightWheel::pwm) == 0;
+}
+
+/**
+ * Trip while another thread is writing the duty of cntl, returns false if the wheel was left driven.
+ */
+static bool trip_during_write(FaultyController &cntl, EmergencyStop &estop, int trial)
+{
+    if (cntl.on_activate() == CallbackReturn::FAILURE) {
+        std::cout << "FAIL: unable to activate the wheel\n";
+        return false;
+    }
+    uint32_t errors = DriverLog::instance().error_count(board::RightWheel::pwm);
+    std::atomic<bool> writing {true};
+    std::thread writer([&]() {
+        while (writing.load(std::memory_order_relaxed)) {
+            cntl.publish(DIRECTION::FORWARD, DUTY, FREQ);
+        }
+    });
+    std::this_thread::sleep_for(std::chrono::microseconds(trial * RACE_SPREAD_US / RACE_TRIALS));
+    estop.trip(FaultCause::REQUESTED, -1, gpioTick());
+    writing.store(false, std::memory_order_relaxed);
+    writer.join();
+
+    bool ok = true;
+    if (!pwm_off()) {
+        std::cout << "FAIL: a write in flight restarted the wheel after the trip\n";
+        ok = false;
+    }
+    if (DriverLog::instance().error_count(board::RightWheel::pwm) != errors) {
+        std::cout << "FAIL: a write refused by the trip was reported as a failed write\n";
+        ok = false;
+    }
+    cntl.on_deactivate();
+    estop.reset();
+    return ok;
+}
+
+int main()
+{
+    GpioRuntime &gpio = GpioRuntime::instance();
+#ifdef PIGPIO_SIM
+    pigpio_sim_attach(board::LeftWheel::pwm, board::LeftWheel::dir, board::LeftWheel::enc, SimMotorModel {});
+    pigpio_sim_attach(board::RightWheel::pwm, board::RightWheel::dir, board::RightWheel::enc, SimMotorModel {});
+#endif
+    int pi = gpio.acquire();
+    if (pi < 0) {
+        std::cout << "ERROR: Failed to initialize hardware\n";
+        return 1;
+    }
+
+    std::array<FaultyController, 2> cntl;
+    if (cntl[0].on_configure(pi, board::LeftWheel {}, TIMEOUT, MIN_INTERVAL, PID_FREQUENCY, KP, KI, KD, PID_MIN, PID_MAX) == CallbackReturn::FAILURE
+        || cntl[1].on_configure(pi, board::RightWheel {}, TIMEOUT, MIN_INTERVAL, PID_FREQUENCY, KP, KI, KD, PID_MIN, PID_MAX) == CallbackReturn::FAILURE) {
+        std::cout << "ERROR: unable to configure the wheels\n";
+        gpio.release(pi);
+        return 1;
+    }
+
+    EmergencyStop &estop = EmergencyStop::instance();
+    Latency deactivate;
+    Latency trip;
+    Latency fault_to_off;
+    bool ok = true;
+
+    for (int i = 0; i < TRIALS && ok; i++) {
+        if (!activate(cntl)) {
+            std::cout << "FAIL: unable to activate the wheels\n";
+            ok = false;
+            break;
+        }
+        spin_up(cntl);
+        auto start = std::chrono::steady_clock::now();
+        cntl[0].on_deactivate();
+        cntl[1].on_deactivate();
+        deactivate.add(elapsed_ns(start));
+    }
+
+    for (int i = 0; i < TRIALS && ok; i++) {
+        if (!activate(cntl)) {
+            std::cout << "FAIL: unable to activate the wheels after reset\n";
+            ok = false;
+            break;
+        }
+        spin_up(cntl);
+        if (pwm_off()) {
+            std::cout << "FAIL: wheels are not driven\n";
+            ok = false;
+        }
+
+        // from another thread, as the encoder callback would.
+        std::thread callback([&]() { cntl[0].unexpected_edge(gpioTick()); });
+        callback.join();
+
+        FaultRecord fault = estop.fault();
+        if (!estop.tripped() || fault.cause != FaultCause::ENCODER_UNEXPECTED
+            || fault.pin != static_cast<int>(board::LeftWheel::enc)) {
+            std::cout << "FAIL: fault was not latched\n";
+            ok = false;
+        }
+        if (!pwm_off()) {
+            std::cout << "FAIL: PWM still on after the trip\n";
+            ok = false;
+        }
+        if (estop.trip(FaultCause::REQUESTED, -1, gpioTick()) || estop.fault().cause != fault.cause) {
+            std::cout << "FAIL: a second trip replaced the first\n";
+            ok = false;
+        }
+        // the control thread carrying on with the last command must not restart a wheel, nor count the refusal as
+        // a failed write.
+        uint32_t errors = DriverLog::instance().error_count(board::RightWheel::pwm);
+        cntl[1].publish(DIRECTION::FORWARD, DUTY, FREQ);
+        cntl[1].drive(DIRECTION::FORWARD, DUTY / 2);
+        DriveState state = cntl[1].update_drive(gpioTick());
+        if (!pwm_off()) {
+            std::cout << "FAIL: duty accepted while latched\n";
+            ok = false;
+        }
+        if (state == DriveState::FAULT || DriverLog::instance().error_count(board::RightWheel::pwm) != errors) {
+            std::cout << "FAIL: duty refused while latched was reported as a failed write\n";
+            ok = false;
+        }
+        trip.add(fault.latency_ns);
+        fault_to_off.add(static_cast<uint64_t>(fault.fault_to_off_us) * 1000);
+        if (i == 0) {
+            std::cout << "tripped, cause " << static_cast<int>(fault.cause) << " on pin " << fault.pin << ", "
+                      << fault.writes << " writes, " << fault.write_errors << " errors\n";
+        }
+
+        cntl[0].on_deactivate();
+        cntl[1].on_deactivate();
+        estop.reset();
+    }
+
+    for (int i = 0; i < RACE_TRIALS && ok; i++) {
+        ok = trip_during_write(cntl[1], estop, i);
+    }
+    if (ok) {
+        std::cout << RACE_TRIALS << " trips during duty writes, wheel off after each\n";
+    }
+
+    std::cout << TRIALS << " stops of 2 wheels\n"
+              << "on_deactivate()  mean " << deactivate.mean_us() << "us max " << deactivate.max_ns / 1000.0 << "us\n"
+              << "trip()           mean " << trip.mean_us() << "us max " << trip.max_ns / 1000.0 << "us\n"
+              << "fault to off     mean " << fault_to_off.mean_us() << "us max " << fault_to_off.max_ns / 1000.0
+              << "us\n";
+    if (ok && trip.mean_us() >= deactivate.mean_us()) {
+        std::cout << "FAIL: trip() is no faster than on_deactivate()\n";
+        ok = false;
+    }
+
+    gpio.release(pi);
+    std::cout << (ok ? "PASS\n" : "FAIL\n");
+    return ok ? 0 : 1;
+}
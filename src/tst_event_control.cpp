@@ -0,0 +1,167 @@
+/**
+ * Compares timer driven and event triggered control, see ControlTrigger in motor_executor.hpp.
+ *
+ * Both wheels run the same setpoint step, first with the executor running each motor every CONTROL_DIVIDER
+ * periods and then with each new velocity sample waking the executor. For each mode it prints the reaction
+ * time, from the edge that closed a velocity window to the drive update using it, how often the executor woke,
+ * and the mean and worst velocity error once the step has settled.
+ *
+ * Event triggered control must react sooner on average, and in both modes every wheel must hold the step within
+ * MAX_ERROR_PPS once settled.
+ *
+ * Runs on the robot's two wheels, or anywhere with -DPIGPIO_SIM=ON, see pigpio_sim.hpp.
+ *
+ * usage: tst_event_control
+ */
+
+#include "board.hpp"
+#include "gpio_runtime.hpp"
+#include "motor_executor.hpp"
+#include "tst_common.hpp"
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <memory>
+#include <thread>
+
+#ifdef PIGPIO_SIM
+#include "pigpio_sim.hpp"
+#endif
+
+#define PERIOD_US 1000
+#define CONTROL_DIVIDER 10 // 100Hz per motor in timer mode, and the fallback in event mode
+#define MIN_RUN_INTERVAL_US 2000
+#define STALL_TIMEOUT_US 250000
+#define TIMEOUT 0
+#define MIN_INTERVAL 150
+#define STEP_MS 1500
+#define SETTLE_MS 500
+#define SAMPLE_MS 10
+#define SETPOINT_PPS 1200.0
+#define STEP_PPS 1800.0
+#define PULSES_PER_ROTATION 8 // MotorController::velocity() is rotations/s
+#define MAX_ERROR_PPS 90.0     // 5% of STEP_PPS
+
+// velocity PID, output is duty %
+#define KP 0.01
+#define KI 0.2
+#define KD 0
+#define PID_MIN 0
+#define PID_MAX 100
+
+struct ModeResult {
+    StageTimingSnapshot reaction;
+    uint64_t cycles = 0;
+    uint64_t event_wakeups = 0;
+    double mean_error = 0.0;
+    double worst_error = 0.0;
+};
+
+static constexpr std::array<std::array<int, 3>, 2> PINS {{
+    {board::LeftWheel::pwm, board::LeftWheel::dir, board::LeftWheel::enc},
+    {board::RightWheel::pwm, board::RightWheel::dir, board::RightWheel::enc},
+}};
+
+/**
+ * Run the setpoint step with trigger, returns false if the motors could not be brought up.
+ */
+static bool run_mode(int pi, ControlTrigger trigger, ModeResult &result)
+{
+    auto executor = std::make_unique<MotorExecutor>();
+    if (executor->on_configure(PERIOD_US, CONTROL_DIVIDER, STALL_TIMEOUT_US) == CallbackReturn::FAILURE
+        || executor->set_trigger(trigger, MIN_RUN_INTERVAL_US) == CallbackReturn::FAILURE) {
+        return false;
+    }
+    for (const auto &pins : PINS) {
+#ifdef PIGPIO_SIM
+        pigpio_sim_attach(pins[0], pins[1], pins[2], SimMotorModel {});
+#endif
+        if (executor->add_motor(pi, pins[0], pins[1], pins[2], TIMEOUT, MIN_INTERVAL, KP, KI, KD, PID_MIN, PID_MAX) < 0) {
+            return false;
+        }
+    }
+    if (executor->on_activate() == CallbackReturn::FAILURE) {
+        return false;
+    }
+
+    for (size_t i = 0; i < PINS.size(); i++) {
+        executor->set_setpoint(i, SETPOINT_PPS);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(STEP_MS));
+    for (size_t i = 0; i < PINS.size(); i++) {
+        executor->set_setpoint(i, STEP_PPS);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(SETTLE_MS));
+
+    // velocity() is the encoder's smoothed sample, unlike the estimator it is safe to read from this thread.
+    double total_error = 0.0;
+    size_t error_ct = 0;
+    for (int t = SETTLE_MS; t < STEP_MS; t += SAMPLE_MS) {
+        for (size_t i = 0; i < PINS.size(); i++) {
+            double error = std::abs(executor->controller(i).velocity() * PULSES_PER_ROTATION - STEP_PPS);
+            total_error += error;
+            result.worst_error = std::max(result.worst_error, error);
+            error_ct++;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(SAMPLE_MS));
+    }
+    executor->on_deactivate();
+
+    result.mean_error = error_ct == 0 ? 0.0 : total_error / error_ct;
+    result.reaction = executor->timing(ExecutorStage::REACTION);
+    result.cycles = executor->timing(ExecutorStage::CYCLE).samples;
+    result.event_wakeups = executor->event_wakeups();
+    return true;
+}
+
+static void print_mode(const char *name, const ModeResult &r)
+{
+    std::cout << std::fixed << std::setprecision(1)
+              << "  " << std::setw(6) << name
+              << "  reaction mean " << std::setw(7) << r.reaction.mean_ns / 1000.0
+              << "us max " << std::setw(7) << r.reaction.max_ns / 1000.0 << "us"
+              << "  samples " << std::setw(5) << r.reaction.samples
+              << "  runs " << std::setw(5) << r.cycles
+              << "  event wakeups " << std::setw(5) << r.event_wakeups
+              << "  error mean " << std::setw(6) << r.mean_error << " max " << std::setw(6) << r.worst_error
+              << " pps\n";
+}
+
+int main()
+{
+    std::array<ModeResult, 2> results {};
+    const std::array<ControlTrigger, 2> modes {ControlTrigger::TIMER, ControlTrigger::EVENT};
+    for (size_t m = 0; m < modes.size(); m++) {
+        GpioRuntime &gpio = GpioRuntime::instance();
+        int pi = gpio.acquire();
+        if (pi < 0) {
+            std::cout << "ERROR: Failed to initialize hardware\n";
+            return 1;
+        }
+        bool ok = run_mode(pi, modes[m], results[m]);
+        gpio.release(pi);
+        if (!ok) {
+            std::cout << "ERROR: unable to bring up the motors\n";
+            return 1;
+        }
+    }
+
+    std::cout << PINS.size() << " motors, " << SETPOINT_PPS << " to " << STEP_PPS << " pps, period " << PERIOD_US
+              << "us, timer runs every " << CONTROL_DIVIDER << " periods, events at most every "
+              << MIN_RUN_INTERVAL_US << "us\n";
+    print_mode("timer", results[0]);
+    print_mode("event", results[1]);
+
+    bool ok = true;
+    if (results[1].reaction.samples == 0 || results[1].reaction.mean_ns >= results[0].reaction.mean_ns) {
+        std::cout << "FAIL: event triggered control did not react sooner\n";
+        ok = false;
+    }
+    if (results[0].worst_error > MAX_ERROR_PPS || results[1].worst_error > MAX_ERROR_PPS) {
+        std::cout << "FAIL: a wheel was more than " << MAX_ERROR_PPS << " pps from the step once settled\n";
+        ok = false;
+    }
+    std::cout << (ok ? "PASS\n" : "FAIL\n");
+    return ok ? 0 : 1;
+}
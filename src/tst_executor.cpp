@@ -0,0 +1,215 @@
+/**
+ * Measures how the executor cycle scales from 2 to 8 motors.
+ *
+ * The Pi can only wire 2 motors (hardware PWM on 18 and 19), so on hardware the run stops there. Build with
+ * -DPIGPIO_SIM=ON to run every step against simulated wheels, see pigpio_sim.hpp. The simulated board has the
+ * Pi's header, so wheels beyond the two hardware PWM channels are driven from software PWM, see wave_pwm.hpp, and
+ * 8 motors is as many as its 28 GPIO can wire.
+ *
+ * For each motor count every wheel is given a setpoint and the executor runs for RUN_MS, then the mean, percentiles
+ * and max of each stage are printed along with how far each wheel ended from its setpoint. WAKEUP is how late the
+ * executor thread woke against its deadline.
+ *
+ * usage: tst_executor [--rt] [--trace FILE]
+ *
+ * While it runs the executor publishes to the telemetry segment, watch it with tst_telemetry.
+ *
+ * --rt locks memory and pins the control and callback threads, see rt_mode.hpp. The executor thread's page faults
+ * should then stay at 0, voluntary switches are expected, one per period.
+ *
+ * --trace writes the 2 motor run to FILE as Chrome trace JSON, open it with ui.perfetto.dev. Needs a build with
+ * -DTRACE=ON, see trace.hpp.
+ */
+
+#include "board.hpp"
+#include "gpio_runtime.hpp"
+#include "motor_executor.hpp"
+#include "rt_mode.hpp"
+#include "telemetry.hpp"
+#include "trace.hpp"
+#include "tst_common.hpp"
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <memory>
+#include <string>
+#include <thread>
+
+#ifdef PIGPIO_SIM
+#include "pigpio_sim.hpp"
+#endif
+
+#define PERIOD_US 1000
+#define CONTROL_DIVIDER 10 // 100Hz per motor
+#define STALL_TIMEOUT_US 250000
+#define TIMEOUT 0
+#define MIN_INTERVAL 150
+#define RUN_MS 3000
+#define SETPOINT_PPS 1500.0
+#define WAVE_FREQ 1000
+#define WAVE_UPDATE_HZ 100
+
+// velocity PID, output is duty %
+#define KP 0.01
+#define KI 0.2
+#define KD 0
+#define PID_MIN 0
+#define PID_MAX 100
+
+struct MotorPins {
+    int pwm;
+    int dir;
+    int en;
+};
+
+// the first two are the robot's wiring, the rest only exist in the simulated backend.
+static constexpr std::array<MotorPins, 8> PINS {{
+    {board::LeftWheel::pwm, board::LeftWheel::dir, board::LeftWheel::enc},
+    {board::RightWheel::pwm, board::RightWheel::dir, board::RightWheel::enc},
+    {2, 14, 20}, {3, 15, 21}, {4, 16, 22}, {5, 17, 25}, {6, 10, 26}, {7, 11, 27},
+}};
+
+static const char *STAGE_NAMES[] = {"stall", "estimate", "pid", "actuate", "cycle", "wakeup", "reaction", "position"};
+
+/**
+ * Run motor_ct motors for RUN_MS, returns false if the motors could not be brought up.
+ */
+static bool run_motors(int pi, size_t motor_ct, const std::string &trace_path)
+{
+    // declared first so they outlive the executor's motors.
+    WavePwm wave;
+    TelemetryPublisher telemetry;
+    auto executor = std::make_unique<MotorExecutor>();
+    if (executor->on_configure(PERIOD_US, CONTROL_DIVIDER, STALL_TIMEOUT_US) == CallbackReturn::FAILURE) {
+        return false;
+    }
+    // telemetry is optional, the run goes ahead if the segment cannot be created.
+    if (telemetry.on_configure(TELEMETRY_SHM_NAME, static_cast<uint16_t>(motor_ct)) == CallbackReturn::SUCCESS &&
+        telemetry.on_activate() == CallbackReturn::SUCCESS) {
+        executor->set_telemetry(telemetry);
+    }
+#ifdef PIGPIO_SIM
+    const bool software_pwm = motor_ct > 2;
+    if (software_pwm) {
+        if (wave.on_configure(WAVE_FREQ, WAVE_UPDATE_HZ) == CallbackReturn::FAILURE) {
+            return false;
+        }
+        executor->set_software_pwm(wave);
+    }
+#else
+    const bool software_pwm = false;
+#endif
+    for (size_t i = 0; i < motor_ct; i++) {
+        const MotorPins &pins = PINS[i];
+#ifdef PIGPIO_SIM
+        pigpio_sim_attach(pins.pwm, pins.dir, pins.en, SimMotorModel {});
+#endif
+        if (executor->add_motor(pi, pins.pwm, pins.dir, pins.en, TIMEOUT, MIN_INTERVAL, KP, KI, KD, PID_MIN, PID_MAX) < 0) {
+            std::cout << "motor " << i << " could not be configured, stopping at " << i << " motors\n";
+            return false;
+        }
+    }
+    if (software_pwm && wave.on_activate() == CallbackReturn::FAILURE) {
+        std::cout << "ERROR: unable to start the waveform\n";
+        return false;
+    }
+    if (!trace_path.empty() && Tracer::on_activate() == CallbackReturn::FAILURE) {
+        return false;
+    }
+    if (executor->on_activate() == CallbackReturn::FAILURE) {
+        return false;
+    }
+
+    for (size_t i = 0; i < motor_ct; i++) {
+        executor->set_setpoint(i, SETPOINT_PPS);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(RUN_MS));
+
+    // stop the thread before reading, so every stage has the same sample count.
+    executor->on_deactivate();
+    wave.on_deactivate();
+    if (!trace_path.empty()) {
+        Tracer::on_deactivate();
+        if (Tracer::write_json(trace_path)) {
+            std::cout << "trace written to " << trace_path << ", " << Tracer::overwritten() << " events overwritten\n";
+        }
+    }
+
+    std::cout << "\n" << motor_ct << " motors, " << executor->timing(ExecutorStage::CYCLE).samples << " cycles, "
+              << executor->overruns() << " overruns\n";
+    std::cout << std::fixed << std::setprecision(2);
+    for (size_t s = 0; s < static_cast<size_t>(ExecutorStage::COUNT); s++) {
+        StageTimingSnapshot t = executor->timing(static_cast<ExecutorStage>(s));
+        std::cout << "  " << std::setw(9) << STAGE_NAMES[s] << " mean " << std::setw(8) << t.mean_ns / 1000.0
+                  << "us  p50 " << std::setw(8) << t.percentile(0.5) / 1000.0 << "us  p99 " << std::setw(8)
+                  << t.percentile(0.99) / 1000.0 << "us  p99.9 " << std::setw(8) << t.percentile(0.999) / 1000.0
+                  << "us  max " << std::setw(8) << t.max_ns / 1000.0 << "us\n";
+    }
+    std::cout << "  cycle per motor " << executor->timing(ExecutorStage::CYCLE).mean_ns / motor_ct / 1000.0 << "us\n";
+
+    double worst = 0.0;
+    for (size_t i = 0; i < motor_ct; i++) {
+        worst = std::max(worst, std::abs(executor->controller(i).estimator().velocity() - SETPOINT_PPS));
+    }
+    std::cout << "  worst velocity error " << worst << " pps of " << SETPOINT_PPS << "\n";
+
+    ThreadFaultStats faults = executor->control_faults();
+    std::cout << "  control thread minor faults " << faults.minor_faults << " major faults " << faults.major_faults
+              << " voluntary switches " << faults.voluntary_switches
+              << " involuntary switches " << faults.involuntary_switches << "\n";
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    bool rt_mode = false;
+    std::string trace_path;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--rt") == 0) {
+            rt_mode = true;
+        }
+        else if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_path = argv[++i];
+        }
+        else {
+            std::cout << "usage: tst_executor [--rt] [--trace FILE]\n";
+            return 1;
+        }
+    }
+#ifndef RR_TRACE
+    if (!trace_path.empty()) {
+        std::cout << "WARNING: built without trace points, configure with -DTRACE=ON to use --trace\n";
+        trace_path.clear();
+    }
+#endif
+    if (!trace_path.empty() && Tracer::on_configure() == CallbackReturn::FAILURE) {
+        return 1;
+    }
+
+    if (rt_mode) {
+        RtMode &rt = RtMode::instance();
+        if (rt.on_configure(RtConfig {}) == CallbackReturn::FAILURE || rt.on_activate() == CallbackReturn::FAILURE) {
+            return 1;
+        }
+    }
+    RtMode::instance().report();
+
+    std::cout << "executor period " << PERIOD_US << "us, motors run every " << CONTROL_DIVIDER << " periods\n";
+    for (size_t motor_ct : {2, 4, 8}) {
+        GpioRuntime &gpio = GpioRuntime::instance();
+        int pi = gpio.acquire();
+        if (pi < 0) {
+            std::cout << "ERROR: Failed to initialize hardware\n";
+            return 1;
+        }
+        // only the first run is traced, it is the one that can be wired to a Pi.
+        bool ok = run_motors(pi, motor_ct, motor_ct == 2 ? trace_path : std::string());
+        gpio.release(pi);
+        if (!ok) {
+            break;
+        }
+    }
+    return 0;
+}
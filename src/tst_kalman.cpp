@@ -0,0 +1,138 @@
+/**
+ * Benchmarks VelocityKalman against a synthetic encoder, does not need hardware so it can be run
+ * on the Pi while the robot is idle to get the per update cost.
+ *
+ * The wheel accelerates to CRUISE_PPS, holds, then decelerates. Edges are generated where the
+ * wheel position crosses a whole pulse, with gaussian jitter on the edge time. The filter runs at
+ * CONTROL_HZ and is compared against the velocity from the last period alone.
+ */
+
+#include "kalman.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+#define CONTROL_HZ 1000
+#define CRUISE_PPS 3000.0
+#define RAMP_S 1.0
+#define HOLD_S 2.0
+#define JITTER_US 20.0
+
+// duty model used for both the simulation and update_duty()
+#define DUTY_GAIN 100.0  // pps per % above deadband
+#define DUTY_DEADBAND 60.0
+
+#define BENCH_ITERATIONS 1000000
+
+static double true_velocity(double t)
+{
+    if (t < RAMP_S) {
+        return CRUISE_PPS * t / RAMP_S;
+    }
+    if (t < RAMP_S + HOLD_S) {
+        return CRUISE_PPS;
+    }
+    return std::max(0.0, CRUISE_PPS * (2 * RAMP_S + HOLD_S - t) / RAMP_S);
+}
+
+static double elapsed_ns(std::chrono::steady_clock::time_point start, int iterations)
+{
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    return static_cast<double>(ns) / iterations;
+}
+
+int main()
+{
+    VelocityKalman kf;
+    if (kf.on_configure(1.0e7, JITTER_US, DUTY_GAIN, DUTY_DEADBAND, 500.0) != CallbackReturn::SUCCESS) {
+        std::cout << "failed to configure filter\n";
+        return 1;
+    }
+
+    std::mt19937 rng(7);
+    std::normal_distribution<double> jitter(0.0, JITTER_US);
+
+    const double dt = 1.0 / CONTROL_HZ;
+    const double duration = 2 * RAMP_S + HOLD_S;
+
+    double position = 0.0;
+    int64_t counts = 0;
+    double last_edge_us = 0.0;
+    uint32_t last_period = 0;
+
+    double kf_sq_err = 0.0;
+    double raw_sq_err = 0.0;
+    int samples = 0;
+
+    for (double t = 0.0; t < duration; t += dt) {
+        double v = true_velocity(t);
+        double prev_position = position;
+        position += v * dt;
+
+        // edges that happened during this tick, interpolated to where the whole pulse was crossed.
+        bool edge = false;
+        while (counts + 1 <= position) {
+            counts++;
+            double fraction = (counts - prev_position) / (position - prev_position);
+            double edge_us = (t + fraction * dt) * 1.0e6 + jitter(rng);
+            if (last_edge_us > 0.0 && edge_us > last_edge_us) {
+                last_period = static_cast<uint32_t>(std::lround(edge_us - last_edge_us));
+            }
+            last_edge_us = edge_us;
+            edge = true;
+        }
+
+        kf.predict(dt);
+        if (edge && last_period > 0) {
+            kf.update_period(last_period);
+            kf.update_counts(counts);
+        }
+        kf.update_duty(v > 0.0 ? DUTY_DEADBAND + v / DUTY_GAIN : 0.0);
+
+        // skip the first edges while both estimates settle
+        if (t > 0.1 && last_period > 0) {
+            double raw = 1.0e6 / last_period;
+            kf_sq_err += (kf.velocity() - v) * (kf.velocity() - v);
+            raw_sq_err += (raw - v) * (raw - v);
+            samples++;
+        }
+    }
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "Velocity RMS error (pps), Kalman: " << std::sqrt(kf_sq_err / samples)
+              << " last period: " << std::sqrt(raw_sq_err / samples) << "\n";
+    std::cout << "Final velocity: " << kf.velocity() << " +/- " << std::sqrt(kf.covariance()(1, 1))
+              << " pps, acceleration: " << kf.acceleration() << " pps^2\n";
+
+    // cost per call, measured on a warm filter
+    volatile double sink = 0.0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        kf.predict(dt);
+    }
+    double predict_ns = elapsed_ns(start, BENCH_ITERATIONS);
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        kf.update_period(333 + (i & 7));
+    }
+    double update_ns = elapsed_ns(start, BENCH_ITERATIONS);
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+        kf.predict(dt);
+        kf.update_period(333 + (i & 7));
+        kf.update_counts(i);
+        kf.update_duty(90.0);
+    }
+    double tick_ns = elapsed_ns(start, BENCH_ITERATIONS);
+    sink = kf.velocity();
+    (void)sink;
+
+    std::cout << "predict: " << predict_ns << "ns, update: " << update_ns
+              << "ns, full control tick: " << tick_ns << "ns\n";
+    return 0;
+}
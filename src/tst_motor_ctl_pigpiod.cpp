@@ -19,19 +19,42 @@
  */
 
 #include "motor.hpp"
+#include "gpio_runtime.hpp"
+#include "board.hpp"
 
-#define PWM_A 18
-#define PWM_B 19
-#define DIR_A 23
-#define DIR_B 24
 
+// control period used to step the direction sequencer.
+#define CONTROL_PERIOD_MS 10
 
-void test_motor(Motor &motor) {
-    motor.set_direction(FORWARD);
 
+/**
+ * Steps every motor's sequencer once per control period until all of them have settled,
+ * motors are pipelined so a reversal on one does not hold up the other.
+ */
+bool run_sequencers(std::initializer_list<Motor *> motors) {
+    bool settled = false;
+    while (!settled) {
+        settled = true;
+        uint32_t tick = gpioTick();
+        for (Motor *motor : motors) {
+            DriveState state = motor->update(tick);
+            if (state == DriveState::FAULT) {
+                return false;
+            }
+            settled = settled && state == DriveState::IDLE;
+        }
+        if (!settled) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(CONTROL_PERIOD_MS));
+        }
+    }
+    return true;
+}
+
+
+void test_motor(Motor &motor) {
     // should set motor to 65%
-    std::this_thread::sleep_for(std::chrono::microseconds(10)); 
-    if (motor.set_pwm(65) == OK) {  
+    motor.drive(FORWARD, 65);
+    if (run_sequencers({&motor})) {  
         // sleep for 3 seconds to test motor
         std::this_thread::sleep_for(std::chrono::milliseconds(3000));
     }
@@ -41,33 +64,33 @@ void test_motor(Motor &motor) {
 
 int main() {
 
-    int pi = gpioInitialise();
+    GpioRuntime &gpio = GpioRuntime::instance();
+    int pi = gpio.acquire();
     if (pi < 0) {
-        std::cout << "Failed to connect to pigpiod\n";
         return 1;
     }
 
     Motor motor_a, motor_b;
-    if (motor_a.on_configure(PWM_A, DIR_A, pi) == CallbackReturn::FAILURE) {
-        gpioTerminate();
+    if (motor_a.on_configure(board::LeftWheel::motor, pi) == CallbackReturn::FAILURE) {
+        gpio.release(pi);
         std::cout << "FAILED TO CONFIGURE!!! exiting program\n";
         return 1;
     }
 
-    if (motor_b.on_configure(PWM_B, DIR_B, pi) == CallbackReturn::FAILURE) {
-        gpioTerminate();
+    if (motor_b.on_configure(board::RightWheel::motor, pi) == CallbackReturn::FAILURE) {
+        gpio.release(pi);
         std::cout << "FAILED TO CONFIGURE!!! exiting program\n";
         return 1;
     }
 
     if (motor_a.on_activate() == CallbackReturn::FAILURE) {
-        gpioTerminate(); 
+        gpio.release(pi); 
         std::cout << "FAILED TO ACTIVATE!!! exiting program\n";
         return 1;
     }
 
     if (motor_b.on_activate() == CallbackReturn::FAILURE) {
-        gpioTerminate(); 
+        gpio.release(pi); 
         std::cout << "FAILED TO ACTIVATE!!! exiting program\n";
         return 1;
     }
@@ -81,24 +104,32 @@ int main() {
     // Test Motor A and B
     motor_a.on_activate();
     motor_b.on_activate();
-    motor_a.set_direction(FORWARD);
-    motor_b.set_direction(FORWARD);
-    std::this_thread::sleep_for(std::chrono::microseconds(10)); 
-    if (motor_a.set_pwm(65) == OK && motor_b.set_pwm(65) == OK) {  
+    motor_a.drive(FORWARD, 65);
+    motor_b.drive(FORWARD, 65);
+    if (run_sequencers({&motor_a, &motor_b})) {  
         // sleep for 3 seconds to test motor
         std::this_thread::sleep_for(std::chrono::milliseconds(3000));
     }
 
     // Increase speed motor A and B
-    if (motor_a.set_pwm(85) == OK && motor_b.set_pwm(85) == OK) {  
+    motor_a.drive(FORWARD, 85);
+    motor_b.drive(FORWARD, 85);
+    if (run_sequencers({&motor_a, &motor_b})) {  
         // sleep for 3 seconds to test motor
         std::this_thread::sleep_for(std::chrono::milliseconds(3000));
     }
 
+    // Motor A forward, Motor B reverse, B is ramped down, coasted and flipped without blocking A
+    std::cout << "Reversing motor B\n";
+    motor_b.drive(BACKWARD, 85);
+    if (run_sequencers({&motor_a, &motor_b})) {  
+        std::this_thread::sleep_for(std::chrono::milliseconds(3000));
+    }
+
 
     motor_a.on_deactivate();
     motor_b.on_deactivate();
 
-    gpioTerminate(); 
+    gpio.release(pi); 
     return 0;
 }
\ No newline at end of file
@@ -1,43 +1,48 @@
 /**
  * Test controllers as well motor controllers, note that improvements can be made to 
  * motor controllers which is documented in tst_motor_ctl_pigiod.cpp when moving to production.
+ *
+ * Edges are printed as CSV, and with --capture also written to a binary capture for edge_analyzer, see
+ * edge_capture.hpp.
+ *
+ * usage: tst_motor_enc [--capture FILE]
  */
 
+#include <array>
 #include <atomic>
 #include <cstddef>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
-#include <list>
-#include <mutex>
 #include <pigpio.h>
+#include <string>
 #include <thread>
 
+#include "board.hpp"
+#include "edge_capture.hpp"
 #include "encoder.hpp"
+#include "gpio_runtime.hpp"
 #include "motor.hpp"
 // #include "motor_encoder.hpp"
 
-// motor controller pins
-#define PWM_A 18
-#define PWM_B 19
-#define DIR_A 23
-#define DIR_B 24
-
-// direction needs to be confirmed.
-// encoder pins
-#define EN_P1_A 9 // phase A on motor A
-//  #define EN_P2_A 9 // phase B on motor B, will be ignored for the moment.
-
-// #define EN_P1_B 8
-// #define EN_P2_B 9
+// pins are in board.hpp, phase B of each encoder is ignored for the moment.
 
 // pulses per revolution (this is based upon FIT0450)
 //  #define PPR 16
 
-std::list<int> l_gpio_pin = {};
-std::list<uint32_t> l_delta_us = {};
-std::list<uint32_t> l_tick = {};
-std::list<TickStatus> l_tick_status = {};
-std::mutex cb_mutex;
+// enough for 3 seconds at full speed, edges past this are counted but not kept.
+#define MAX_EDGES 16384
+
+struct EdgeRecord {
+    int gpio_pin;
+    uint32_t delta_us;
+    uint32_t tick;
+    TickStatus tick_status;
+};
+
+// preallocated, the callback runs on the pigpio thread and must not allocate or block.
+std::array<EdgeRecord, MAX_EDGES> edges;
+std::atomic<size_t> edge_ct {0};
 
 static void cb(
     int gpio_pin,
@@ -45,55 +50,45 @@ static void cb(
     uint32_t tick,
     TickStatus tick_status)
 {
-    std::lock_guard<std::mutex> lock(cb_mutex);
-    l_gpio_pin.push_back(gpio_pin);
-    l_delta_us.push_back(delta_us);
-    l_tick.push_back(tick);
-    l_tick_status.push_back(tick_status);
+    size_t idx = edge_ct.fetch_add(1, std::memory_order_relaxed);
+    if (idx < edges.size()) {
+        edges[idx] = EdgeRecord {gpio_pin, delta_us, tick, tick_status};
+    }
 }
 
 
-int main()
+int main(int argc, char *argv[])
 {
-    // pre-initialization step
-    {
-        int rev = gpioHardwareRevision();
-        if (rev == 0) {
-            std::cout << "pigpiod has an unknown revision\n";
-            return 1;
+    std::string capture_path;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+            capture_path = argv[++i];
         }
         else {
-            unsigned model = (rev >> 4) & 0xFF;
-
-            std::cout << "Hardware revision: 0x" << std::hex << rev << std::dec << std::endl;
-            std::cout << "Model number: " << model << std::endl;
-            std::cout << "Expected model for Pi4B: 17" << std::endl;
+            std::cout << "usage: tst_motor_enc [--capture FILE]\n";
+            return 1;
         }
-    }    
+    }
 
-    int pi = gpioInitialise();
+    GpioRuntime &gpio = GpioRuntime::instance();
+    int pi = gpio.acquire();
     if (pi < 0) {
-        std::cout << "Failed to connect to pigpiod\n";
         return 1;
     }
     Motor motor_a;
     MotorEncoder en_a;
 
-    // reset lists so they are all 0 elements at this point.
-    l_gpio_pin.clear();
-    l_delta_us.clear();
-    l_tick.clear();
-    l_tick_status.clear();
+    edge_ct.store(0);
 
-    if (motor_a.on_configure(PWM_A, DIR_A, pi) == CallbackReturn::FAILURE || en_a.on_configure(EN_P1_A, &cb, 0, 20) == CallbackReturn::FAILURE) {
-        gpioTerminate();
+    if (motor_a.on_configure(board::LeftWheel::motor, pi) == CallbackReturn::FAILURE || en_a.on_configure(Enc<board::LeftWheel::enc> {}, &cb, 0, 20) == CallbackReturn::FAILURE) {
+        gpio.release(pi);
         std::cout << "FAILED TO CONFIGURE!!! exiting program\n";
         return 1;
     }
 
 
     if (motor_a.on_activate() == CallbackReturn::FAILURE || en_a.on_activate() == CallbackReturn::FAILURE) {
-        gpioTerminate();
+        gpio.release(pi);
         std::cout << "FAILED TO ACTIVATE!!! exiting program\n";
         return 1;
     }
@@ -129,16 +124,14 @@ int main()
     // leaves program in an unstable state.
     motor_a.on_deactivate();
     en_a.on_deactivate();
-    gpioTerminate();
+    gpio.release(pi);
 
-    std::lock_guard<std::mutex> lock(cb_mutex);
-    // list sizes should match, but to be paranoid, find the smallest.
-    size_t s = std::min({l_gpio_pin.size(), l_delta_us.size(),
-        l_tick.size(), l_tick_status.size()});
+    // the callback thread has been stopped, so the count is final.
+    size_t s = std::min(edge_ct.load(), edges.size());
 
     if (s == 0) {
         std::cout << "\nWARNING: No encoder pulses detected!\n";
-        std::cout << "Check encoder wiring on GPIO " << EN_P1_A << "\n";
+        std::cout << "Check encoder wiring on GPIO " << board::LeftWheel::enc << "\n";
         return 1;
     }
 
@@ -148,15 +141,31 @@ int main()
               << "STATUS" << "\n";
 
     for (size_t i = 0; i < s; i++) {
-        std::cout << l_gpio_pin.front() << ","
-                  << l_delta_us.front() << ","
-                  <<  l_tick.front() << ","
-                  <<  (int)l_tick_status.front() << "\n";
-
-        l_gpio_pin.pop_front();
-        l_delta_us.pop_front();
-        l_tick.pop_front();
-        l_tick_status.pop_front();
+        std::cout << edges[i].gpio_pin << ","
+                  << edges[i].delta_us << ","
+                  <<  edges[i].tick << ","
+                  <<  (int)edges[i].tick_status << "\n";
+    }
+    if (edge_ct.load() > s) {
+        std::cout << "WARNING: " << edge_ct.load() - s << " edges were not recorded\n";
+    }
+
+    if (!capture_path.empty()) {
+        EdgeCaptureWriter capture;
+        if (capture.on_activate(capture_path) == CallbackReturn::FAILURE) {
+            return 1;
+        }
+        for (size_t i = 0; i < s; i++) {
+            EdgeCaptureRecord record {edges[i].tick, edges[i].delta_us, static_cast<uint8_t>(edges[i].gpio_pin),
+                static_cast<uint8_t>(edges[i].tick_status), 0};
+            if (capture.write(record) == CallbackReturn::FAILURE) {
+                std::cout << "ERROR: unable to write capture " << capture_path << "\n";
+                return 1;
+            }
+        }
+        if (capture.on_deactivate() == CallbackReturn::FAILURE) {
+            return 1;
+        }
     }
 
     return 0;
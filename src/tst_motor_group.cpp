@@ -0,0 +1,171 @@
+/**
+ * Compares the skew between the two wheels when they are written one after the other with set_pwm(), and when
+ * the same change is committed by a MotorGroup, see motor_group.hpp.
+ *
+ * Each run alternates both wheels between DUTY_LOW and DUTY_HIGH COMMITS times, every PAUSE_US, and prints the
+ * mean and max time from the first wheel's write returning to the second's. The group run also flips both wheels
+ * forward in a single commit and checks that the duty read back from pigpio matches on both. Finally EmergencyStop
+ * is tripped, a commit must then be refused without restarting either wheel or logging a failed write, while a
+ * commit stopping both is accepted.
+ *
+ * Runs on the Pi, or anywhere with -DPIGPIO_SIM=ON.
+ */
+
+#include "board.hpp"
+#include "driver_log.hpp"
+#include "emergency_stop.hpp"
+#include "gpio_runtime.hpp"
+#include "motor.hpp"
+#include "motor_group.hpp"
+#include "tst_common.hpp"
+#include <algorithm>
+#include <chrono>
+#include <time.h>
+
+#define COMMITS 2000
+#define PAUSE_US 500
+#define DUTY_LOW 40
+#define DUTY_HIGH 60
+
+static uint64_t mono_ns()
+{
+    struct timespec ts {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+static void print_skew(const char *name, uint64_t total_ns, uint64_t max_ns, uint64_t ct)
+{
+    std::cout << name << " skew ns mean: " << (ct > 0 ? total_ns / ct : 0) << " max: " << max_ns
+              << " over " << ct << " writes\n";
+}
+
+static bool run_sequential(Motor &left, Motor &right)
+{
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+    for (int i = 0; i < COMMITS; i++) {
+        int duty = (i & 1) ? DUTY_HIGH : DUTY_LOW;
+        if (left.set_pwm(duty) != OK) {
+            return false;
+        }
+        uint64_t first = mono_ns();
+        if (right.set_pwm(duty) != OK) {
+            return false;
+        }
+        uint64_t skew = mono_ns() - first;
+        total_ns += skew;
+        max_ns = std::max(max_ns, skew);
+        std::this_thread::sleep_for(std::chrono::microseconds(PAUSE_US));
+    }
+    print_skew("set_pwm, set_pwm", total_ns, max_ns, COMMITS);
+    return true;
+}
+
+static bool run_group(Motor &left, Motor &right)
+{
+    MotorGroup group;
+    int l = group.add(left);
+    int r = group.add(right);
+    if (l < 0 || r < 0) {
+        return false;
+    }
+
+    group.stage_direction(l, FORWARD);
+    group.stage_direction(r, FORWARD);
+    if (group.commit() != OK || left.direction() != FORWARD || right.direction() != FORWARD) {
+        std::cout << "FAIL: direction commit\n";
+        return false;
+    }
+
+    for (int i = 0; i < COMMITS; i++) {
+        int duty = (i & 1) ? DUTY_HIGH : DUTY_LOW;
+        group.stage_duty(l, duty);
+        group.stage_duty(r, duty);
+        if (group.commit() != OK) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(PAUSE_US));
+    }
+    const GroupSkew &skew = group.skew();
+    print_skew("MotorGroup::commit", skew.total_ns, skew.max_ns, skew.commits);
+
+    int left_duty = gpioGetPWMdutycycle(board::LeftWheel::pwm);
+    int right_duty = gpioGetPWMdutycycle(board::RightWheel::pwm);
+    if (left_duty != right_duty || left.duty() != right.duty()) {
+        std::cout << "FAIL: wheels read back " << left_duty << " and " << right_duty << "\n";
+        return false;
+    }
+    // an unchanged stage writes nothing, so it is not counted as a commit.
+    uint64_t commits = skew.commits;
+    if (group.commit() != OK || group.skew().commits != commits) {
+        std::cout << "FAIL: unchanged commit wrote the motors\n";
+        return false;
+    }
+    return true;
+}
+
+static bool run_tripped(Motor &left, Motor &right)
+{
+    MotorGroup group;
+    int l = group.add(left);
+    int r = group.add(right);
+    if (l < 0 || r < 0) {
+        return false;
+    }
+
+    EmergencyStop::instance().trip(FaultCause::REQUESTED, -1, gpioTick());
+    DriverLog &log = DriverLog::instance();
+    uint32_t errors = log.error_count(board::LeftWheel::pwm) + log.error_count(board::RightWheel::pwm);
+    int duty = left.duty() == DUTY_HIGH ? DUTY_LOW : DUTY_HIGH;
+    group.stage_duty(l, duty);
+    group.stage_duty(r, duty);
+    if (group.commit() != PI_NOT_PERMITTED || gpioGetPWMdutycycle(board::LeftWheel::pwm) != 0
+        || gpioGetPWMdutycycle(board::RightWheel::pwm) != 0) {
+        std::cout << "FAIL: commit restarted the wheels while latched\n";
+        return false;
+    }
+    if (log.error_count(board::LeftWheel::pwm) + log.error_count(board::RightWheel::pwm) != errors) {
+        std::cout << "FAIL: duty refused while latched was reported as a failed write\n";
+        return false;
+    }
+    group.stage_duty(l, 0);
+    group.stage_duty(r, 0);
+    if (group.commit() != OK || left.duty() != 0 || right.duty() != 0) {
+        std::cout << "FAIL: commit could not stop the wheels while latched\n";
+        return false;
+    }
+    return true;
+}
+
+int main()
+{
+    GpioRuntime &gpio = GpioRuntime::instance();
+    int pi = gpio.acquire();
+    if (pi < 0) {
+        std::cout << "ERROR: Failed to initialize hardware\n";
+        return 1;
+    }
+
+    bool ok = false;
+    {
+        Motor left;
+        Motor right;
+        if (left.on_configure(board::LeftWheel::motor, pi) == CallbackReturn::FAILURE
+            || right.on_configure(board::RightWheel::motor, pi) == CallbackReturn::FAILURE
+            || left.on_activate() == CallbackReturn::FAILURE
+            || right.on_activate() == CallbackReturn::FAILURE) {
+            std::cout << "FAILED TO ACTIVATE!!! exiting program\n";
+        }
+        else {
+            ok = run_sequential(left, right) && run_group(left, right) && run_tripped(left, right);
+        }
+        left.on_deactivate();
+        right.on_deactivate();
+        EmergencyStop::instance().reset();
+    }
+    gpio.release(pi);
+
+    std::cout << (ok ? "PASS\n" : "FAIL\n");
+    return ok ? 0 : 1;
+}
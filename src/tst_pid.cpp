@@ -1,18 +1,26 @@
+#include "board.hpp"
+#include "deadband.hpp"
 #include "encoder.hpp"
 #include "motor.hpp"
+#include "motor_controller.hpp"
 #include "pid.hpp"
+#include "gpio_runtime.hpp"
+#include "telemetry.hpp"
+#include "timer_wheel.hpp"
 #include "tst_common.hpp"
+#include <algorithm>
 #include <mutex>
 #include <thread>
 
 #define MAX_PPD 4038286 // aproiximate Nm per pulse (approx 5 kph)
 
-#define PWM_A 18
-#define DIR_A 23
-#define EN_P1_A 9
 #define TIMEOUT 0
 #define MIN_INTERVAL 150
 
+// no healthy pulse for 250ms is treated as a stall, checked at 1ms resolution.
+#define STALL_TIMEOUT_US 250000
+#define STALL_RESOLUTION_US 1000
+
 // 100Hz (100 ms)
 #define PID_FREQUENCY 10
 
@@ -23,274 +31,106 @@
 #define PID_MIN 0  // aproiximate Nm per pulse (approx 5 kph)
 #define PID_MAX 85 // maximum of around 85% of power
 
-#define MIN_DUTY 65
+// breakaway duty is searched at startup and cached, see deadband.hpp. Searched again once a day as it drifts.
+#define PWM_FREQ 2000
+#define DEADBAND_CACHE "deadband.bin"
+#define DEADBAND_MAX_AGE_S 86400
+#define RUN_ABOVE_DEADBAND 10
+
+// Kalman estimator, duty gain is left at 0 until it has been measured for this motor.
+#define ESTIMATOR_JERK 1.0e7
+#define ESTIMATOR_JITTER_US 20.0
 
 /**
- * This class manages GPIO, For production versions it will be used for all communiation with
- * the GPIOs to ensure that things are done in a standard manner. It will be strictly an
- * action based solution, expecting a return for each command that it can perform. But 
- * for now this will be very stupid.
+ * Stand in for the control loop, drives the stall detector and estimator every PID_FREQUENCY ms for duration_ms,
+ * and publishes the result for tst_telemetry.
  */
-class GpIoManager
+static void control_for(MotorController &cntl, TimerWheel &wheel, TelemetryPublisher &telemetry, int duration_ms)
 {
-  public:
-    CallbackReturn on_configure()
-    {
-        return CallbackReturn::SUCCESS;
-    }
-
-    CallbackReturn on_activate()
-    {
-        {
-            int rev = gpioHardwareRevision();
-            if (rev == 0) {
-                std::cout << "pigpiod has an unknown revision\n";
-                return CallbackReturn::FAILURE;
-            }
-            else {
-                // This will be printed to the log, but we may want a way of detecting the hardware.
-                unsigned model = (rev >> 4) & 0xFF;
-
-                std::cout << "Hardware revision: 0x" << std::hex << rev << std::dec << std::endl;
-                std::cout << "Model number: " << model << std::endl;
-                std::cout << "Expected model for Pi4B: 17" << std::endl;
-            }
-        }
-
-        int pi = gpioInitialise();
-        if (pi < 0) {
-            std::cout << "Failed to connect to pigpiod\n";
-            return CallbackReturn::FAILURE;
-        }
-        return CallbackReturn::SUCCESS;
-    }
-
-    CallbackReturn on_deactivate()
-    {
-        gpioTerminate();
-        return CallbackReturn::SUCCESS;
-    }
-};
-
-class MotorController
-{
-  public:
-    // TODO: Ignore PID variables kp, ki, kd, p_min, and p_max for now these will be re-introduced.
-    CallbackReturn on_configure(
-        const int pwm_pin,
-        const int dir_pin,
-        const int en_pin,
-        int timeout,
-        uint32_t min_interval_us,
-        uint32_t pid_frequency_rate,
-        double kp,
-        double ki,
-        double kd,
-        double p_min,
-        double p_max)
-    {
-        callback_ = [this](int gpio_pin, uint32_t delta_us, uint32_t tick, TickStatus tick_status) {
-            this->encoder_cb_(gpio_pin, delta_us, tick, tick_status);
-        };
-
-        // configure motor, pid and encoder.
-        if (motor_.on_configure(pwm_pin, dir_pin, 0) == CallbackReturn::FAILURE ||
-            encoder_.on_configure(en_pin, callback_, timeout, min_interval_us) == CallbackReturn::FAILURE) {
-            callback_ = nullptr;
-            return CallbackReturn::FAILURE;
-        }
-        pwm_pin_ = pwm_pin;
-        return CallbackReturn::SUCCESS;
-    }
-
-    CallbackReturn on_activate()
-    {
-        if (motor_.on_activate() != CallbackReturn::SUCCESS) {
-            return CallbackReturn::FAILURE;
-        }
-
-        // dont rollback, this will call two deactivates for motor,
-        // which may not be what is needed.
-        if (encoder_.on_activate() != CallbackReturn::SUCCESS) {
-            return CallbackReturn::FAILURE;
-        }
-        running_.store(true, std::memory_order_release);
-
-        return CallbackReturn::SUCCESS;
-    }
-
-    CallbackReturn on_deactivate()
-    {
-        running_.store(false, std::memory_order_release);
-        velocity_.store(0.0, std::memory_order_release);
-        auto enc_result = encoder_.on_deactivate(); // stop interrupts first
-        auto motor_result = motor_.on_deactivate(); // then stop PWM
-        callback_ = nullptr;
-        std::this_thread::sleep_for(std::chrono::microseconds(100));
-
-        delta_ct_.store(0, std::memory_order_release);
-        delta_us_ct_.store(0, std::memory_order_release);
-        delta_us_accum_.store(0, std::memory_order_release);
-        publish(DIRECTION::FORWARD, 0, 0);
-
-        return (enc_result == CallbackReturn::SUCCESS && motor_result == CallbackReturn::SUCCESS)
-            ? CallbackReturn::SUCCESS
-            : CallbackReturn::FAILURE;
-    }
-
-    void publish(DIRECTION direction, double duty_cycle, int freq)
-    {
-        motor_.set_direction(direction);
-        motor_.set_pwm(freq, duty_cycle);
-    }
-
-    // velocity, duty_cycle, direction
-    void subscribe()
-    {
-        std::cout << velocity_.load(std::memory_order_acquire) << "," << gpioGetPWMdutycycle(pwm_pin_) << "\n";
-    }
-
-    void print_diagnostics()
-    {
-        int total = total_pulses_.load();
-        int healthy = healthy_pulses_.load();
-        int triggers = boundary_triggers_.load();
-
-        std::cout << "Total pulses: " << total << "\n";
-        std::cout << "Healthy pulses: " << healthy << " ("
-                  << (100.0 * healthy / total) << "%)\n";
-        std::cout << "Rejected pulses: " << (total - healthy) << " ("
-                  << (100.0 * (total - healthy) / total) << "%)\n";
-        std::cout << "Boundary triggers: " << triggers << "\n";
-        std::cout << "Expected rotations: " << (total / PPR_) << "\n";
-    }
-
-  protected:
-    void encoder_cb_(
-        const int gpio_pin,
-        const uint32_t delta_us,
-        const uint32_t tick,
-        const TickStatus tick_status)
-    {
-        (void)gpio_pin;
-        (void)tick;
-
-        if (!running_.load(std::memory_order_acquire)) {
-            return;
-        }
-
-        total_pulses_.fetch_add(1, std::memory_order_relaxed);
-
-        // Accumulate timing (ONCE!)
-        if (tick_status == TickStatus::HEALTHY &&
-            delta_us > MIN_DELTA_US &&
-            delta_us < MAX_DELTA_US) {
-            healthy_pulses_.fetch_add(1, std::memory_order_relaxed);
-            delta_us_ct_.fetch_add(1, std::memory_order_acq_rel);
-            delta_us_accum_.fetch_add(static_cast<uint64_t>(delta_us), std::memory_order_acq_rel);
-        }
-
-        // Atomic increment with boundary check
-        int old_count = delta_ct_.fetch_add(1, std::memory_order_acq_rel);
-
-        // Check if THIS interrupt brought us to exactly PPR
-        if (old_count == PPR_ - 1) {
-            boundary_triggers_.fetch_add(1, std::memory_order_relaxed);
-
-            int expected = PPR_;
-            if (delta_ct_.compare_exchange_strong(expected, 0,
-                    std::memory_order_acq_rel,
-                    std::memory_order_acquire)) {
-                uint64_t accum = delta_us_accum_.load(std::memory_order_acquire);
-                int ct = delta_us_ct_.load(std::memory_order_acquire);
-
-                delta_us_ct_.store(0, std::memory_order_release);
-                delta_us_accum_.store(0, std::memory_order_release);
-
-                if (accum > 0 && ct > 0) {
-                    double avg_us = static_cast<double>(accum) / static_cast<double>(ct);
-                    double new_vel = 1'000'000.0 / (avg_us * PPR_);
-                    double current_vel = velocity_.load(std::memory_order_acquire);
-
-                    // Smooth with EMA (alpha = 0.3)
-                    double smoothed_vel = 0.7 * current_vel + 0.3 * new_vel;
-                    velocity_.store(smoothed_vel, std::memory_order_release);
-                }
-            }
-        }
+    for (auto elapsed = 0; elapsed < duration_ms; elapsed += PID_FREQUENCY) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(PID_FREQUENCY));
+        uint32_t start = gpioTick();
+        wheel.advance(start);
+        cntl.estimate(PID_FREQUENCY / 1000.0);
+        cntl.subscribe(telemetry, 0);
+        telemetry.publish_cycle(start, gpioTick() - start);
     }
-
-
-  private:
-    // output variables
-    std::atomic<double> velocity_ {0}; // velocity per rotation.
-
-    // diagnoses variables
-    std::atomic<int> total_pulses_ {0};
-    std::atomic<int> healthy_pulses_ {0};
-    std::atomic<int> boundary_triggers_ {0};
-
-    // state variables
-    std::atomic<int> delta_ct_ {0};            // count for each delta that has arrive (regardless of its in range or not)
-    std::atomic<int> delta_us_ct_ {0};         // count of healthy delta ticks.
-    std::atomic<uint64_t> delta_us_accum_ {0}; // accumulate deltas
-    int pwm_pin_ = -1;
-
-    // Drivers
-    MotorEncoder encoder_;
-    Motor motor_;
-
-    // callbacks
-    EncoderTickCallback callback_ {nullptr};
-
-    // state control
-    std::atomic<bool> running_ {false};
-
-    // limit variables
-    const double MIN_DELTA_US {300};
-    const double MAX_DELTA_US {3000};
-    const int PPR_ {8};
-};
-
+}
 
 int main()
 {
-    // start motor controller
+    // start motor controller, every controller shares the single pigpio initialisation.
+    GpioRuntime &gpio = GpioRuntime::instance();
+    int pi = gpio.acquire();
+    if (pi < 0) {
+        std::cout << "ERROR: Failed to initialize hardware\n";
+        return 1;
+    }
     MotorController cntl;
-    GpIoManager gpio;
+    TimerWheel stall_wheel;
+    TelemetryPublisher telemetry;
 
     std::cout << "configuring robot\n";
-    if (cntl.on_configure(PWM_A, DIR_A, EN_P1_A, TIMEOUT, MIN_INTERVAL, PID_FREQUENCY, KP, KI, KD, PID_MIN, PID_MAX) == CallbackReturn::FAILURE) {
+    if (stall_wheel.on_configure(STALL_RESOLUTION_US) == CallbackReturn::FAILURE ||
+        cntl.on_configure(pi, board::LeftWheel {}, TIMEOUT, MIN_INTERVAL, PID_FREQUENCY, KP, KI, KD, PID_MIN, PID_MAX) == CallbackReturn::FAILURE ||
+        cntl.attach_stall_detector(stall_wheel, STALL_TIMEOUT_US) == CallbackReturn::FAILURE ||
+        telemetry.on_configure(TELEMETRY_SHM_NAME, 1) == CallbackReturn::FAILURE) {
         std::cout << "failed on configuration\n";
+        gpio.release(pi);
         return 1;
     }
 
     // std::cout << "activating robot\n";
-    if (gpio.on_activate() == CallbackReturn::FAILURE) {
-        std::cout << "ERROR: Failed to initialize hardware\n";
-        return 1;
-    }
     if (cntl.on_activate() == CallbackReturn::FAILURE) {
         std::cout << "failed on activation\n";
-        gpio.on_deactivate();
         cntl.on_deactivate();
+        gpio.release(pi);
         return 1;
     }
+    stall_wheel.on_activate();
+
+    DeadbandCache cache;
+    DeadbandSearch search;
+    cache.load(DEADBAND_CACHE);
+    search.on_configure(DeadbandConfig {});
+    DeadbandResult deadband = search.find(cntl, PWM_FREQ, cache, DEADBAND_MAX_AGE_S);
+    if (deadband.duty < 0) {
+        std::cout << "failed to turn the wheel, check the motor and encoder\n";
+        stall_wheel.on_deactivate();
+        cntl.on_deactivate();
+        gpio.release(pi);
+        return 1;
+    }
+    if (deadband.cached) {
+        std::cout << "deadband " << deadband.duty << "% from " << DEADBAND_CACHE << "\n";
+    }
+    else {
+        std::cout << "deadband " << deadband.duty << "% found in " << deadband.search_us / 1000 << "ms, "
+                  << deadband.probes << " probes\n";
+        cache.save(DEADBAND_CACHE);
+    }
+    cntl.configure_estimator(ESTIMATOR_JERK, ESTIMATOR_JITTER_US, 0.0, deadband.duty, 0.0);
+
+    // telemetry is optional, the test still runs if the segment cannot be created.
+    telemetry.on_activate();
 
-    std::cout << "spinning motor 65\% freq 2Khz\n";
-    // run for 5 seconds @65%
+    const int min_duty = std::min(deadband.duty, PID_MAX);
+    const int run_duty = std::min(deadband.duty + RUN_ABOVE_DEADBAND, PID_MAX);
+    std::cout << "spinning motor " << min_duty << "% freq 2Khz\n";
+    // run for 8 seconds at the deadband
     for (auto i = 0; i < 8; i++) {
-        cntl.publish(DIRECTION::FORWARD, 65, 2000);
-        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-        cntl.subscribe();
+        cntl.publish(DIRECTION::FORWARD, min_duty, PWM_FREQ);
+        control_for(cntl, stall_wheel, telemetry, 1000);
     }
 
     for (auto i = 0; i < 8; i++) {
-        cntl.publish(DIRECTION::FORWARD, 75, 2000);
-        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-        cntl.subscribe();
+        cntl.publish(DIRECTION::FORWARD, run_duty, PWM_FREQ);
+        control_for(cntl, stall_wheel, telemetry, 1000);
     }
     cntl.publish(DIRECTION::FORWARD, 0, 0);
+    if (cntl.is_stalled()) {
+        std::cout << "WARNING: encoder stalled, no pulse for " << cntl.time_since_last_pulse() << "us\n";
+    }
     cntl.print_diagnostics();
 
 
@@ -342,7 +182,9 @@ int main()
     // }
     // cntl.publish(DIRECTION::FORWARD, 0, 0);
 
+    telemetry.on_deactivate();
+    stall_wheel.on_deactivate();
     cntl.on_deactivate();
-    gpio.on_deactivate();
+    gpio.release(pi);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,165 @@
+/**
+ * Positions both wheels with the executor's cascaded position and velocity loops, see motor_executor.hpp.
+ *
+ * The velocity loop runs every PERIOD_US, 1kHz, and the position loop every POSITION_DIVIDER of its runs, 100Hz.
+ * Both wheels are sent through TARGETS in turn. Each move must settle, every wheel within TOLERANCE counts and
+ * not moving, within MOVE_TIMEOUT_MS, and after HOLD_MS more each must still be within ACCURACY counts. Printed
+ * per move: settle time and final error per wheel. Then the mean and max of each executor stage, the cost of
+ * a tick with the cascade running.
+ *
+ * The wheels turn both ways, the robot must be free to move. Runs on the robot or with -DPIGPIO_SIM=ON.
+ *
+ * usage: tst_position
+ */
+
+#include "board.hpp"
+#include "gpio_runtime.hpp"
+#include "motor_executor.hpp"
+#include "tst_common.hpp"
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <memory>
+#include <thread>
+
+#ifdef PIGPIO_SIM
+#include "pigpio_sim.hpp"
+#endif
+
+#define PERIOD_US 1000
+#define CONTROL_DIVIDER 1    // velocity loop at 1kHz
+#define POSITION_DIVIDER 10  // position loop at 100Hz
+#define STALL_TIMEOUT_US 250000
+#define TIMEOUT 0
+#define MIN_INTERVAL 150
+#define MOVE_TIMEOUT_MS 4000
+#define HOLD_MS 300
+#define TOLERANCE 2
+#define ACCURACY 4
+#define POLL_MS 5
+
+// velocity PID, output is duty %
+#define KP 0.01
+#define KI 0.2
+#define KD 0
+#define PID_MIN 0
+#define PID_MAX 100
+
+// position PID, output is pulses/s
+#define POSITION_KP 4.0
+#define POSITION_KI 0.0
+#define POSITION_KD 0.0
+#define MAX_PPS 1200.0
+
+// a held wheel produces no edges, the duty model keeps the estimate at rest, see VelocityKalman::update_duty().
+#define ESTIMATOR_JERK 1.0e7
+#define ESTIMATOR_JITTER_US 20.0
+#define ESTIMATOR_DUTY_GAIN 75.0     // pulses/s per % duty, SimMotorModel's 3000 pulses/s over 40%
+#define ESTIMATOR_DEADBAND 60.0
+#define ESTIMATOR_DUTY_SIGMA 300.0
+
+static constexpr std::array<int64_t, 4> TARGETS {600, 800, 300, 0};
+
+static const char *STAGE_NAMES[] = {"stall", "estimate", "pid", "actuate", "cycle", "wakeup", "reaction", "position"};
+
+static bool settled(const MotorExecutor &executor, int64_t target, const std::array<int64_t, 2> &last)
+{
+    for (size_t i = 0; i < last.size(); i++) {
+        int64_t position = executor.position(i);
+        if (std::llabs(position - target) > TOLERANCE || position != last[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main()
+{
+    GpioRuntime &gpio = GpioRuntime::instance();
+#ifdef PIGPIO_SIM
+    pigpio_sim_attach(board::LeftWheel::pwm, board::LeftWheel::dir, board::LeftWheel::enc, SimMotorModel {});
+    pigpio_sim_attach(board::RightWheel::pwm, board::RightWheel::dir, board::RightWheel::enc, SimMotorModel {});
+#endif
+    int pi = gpio.acquire();
+    if (pi < 0) {
+        std::cout << "ERROR: Failed to initialize hardware\n";
+        return 1;
+    }
+
+    auto executor = std::make_unique<MotorExecutor>();
+    if (executor->on_configure(PERIOD_US, CONTROL_DIVIDER, STALL_TIMEOUT_US) == CallbackReturn::FAILURE
+        || executor->add_motor(pi, board::LeftWheel::pwm, board::LeftWheel::dir, board::LeftWheel::enc, TIMEOUT,
+               MIN_INTERVAL, KP, KI, KD, PID_MIN, PID_MAX) < 0
+        || executor->add_motor(pi, board::RightWheel::pwm, board::RightWheel::dir, board::RightWheel::enc, TIMEOUT,
+               MIN_INTERVAL, KP, KI, KD, PID_MIN, PID_MAX) < 0) {
+        std::cout << "ERROR: unable to configure the wheels\n";
+        gpio.release(pi);
+        return 1;
+    }
+    for (size_t i = 0; i < executor->motor_ct(); i++) {
+        if (executor->configure_position(i, POSITION_KP, POSITION_KI, POSITION_KD, MAX_PPS, POSITION_DIVIDER,
+                TOLERANCE) == CallbackReturn::FAILURE
+            || executor->controller(i).configure_estimator(ESTIMATOR_JERK, ESTIMATOR_JITTER_US, ESTIMATOR_DUTY_GAIN,
+                   ESTIMATOR_DEADBAND, ESTIMATOR_DUTY_SIGMA) == CallbackReturn::FAILURE) {
+            gpio.release(pi);
+            return 1;
+        }
+    }
+    if (executor->on_activate() == CallbackReturn::FAILURE) {
+        std::cout << "ERROR: unable to activate the executor\n";
+        gpio.release(pi);
+        return 1;
+    }
+
+    bool ok = true;
+    std::cout << "velocity loop " << 1000000 / (PERIOD_US * CONTROL_DIVIDER) << "Hz, position loop "
+              << 1000000 / (PERIOD_US * CONTROL_DIVIDER * POSITION_DIVIDER) << "Hz\n"
+              << "target   settle ms   left error   right error\n";
+    for (int64_t target : TARGETS) {
+        auto start = std::chrono::steady_clock::now();
+        executor->set_position_target(0, target);
+        executor->set_position_target(1, target);
+
+        std::array<int64_t, 2> last {executor->position(0), executor->position(1)};
+        bool done = false;
+        int64_t settle_ms = 0;
+        while (!done && settle_ms < MOVE_TIMEOUT_MS) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(POLL_MS));
+            done = settled(*executor, target, last);
+            last = {executor->position(0), executor->position(1)};
+            settle_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(HOLD_MS));
+
+        std::array<int64_t, 2> error {executor->position(0) - target, executor->position(1) - target};
+        std::cout << std::setw(6) << target << std::setw(12) << (done ? std::to_string(settle_ms) : "-")
+                  << std::setw(13) << error[0] << std::setw(14) << error[1] << "\n";
+        if (!done) {
+            std::cout << "FAIL: did not settle within " << MOVE_TIMEOUT_MS << "ms\n";
+            ok = false;
+        }
+        if (std::llabs(error[0]) > ACCURACY || std::llabs(error[1]) > ACCURACY) {
+            std::cout << "FAIL: more than " << ACCURACY << " counts from the target\n";
+            ok = false;
+        }
+    }
+
+    for (size_t s = 0; s < static_cast<size_t>(ExecutorStage::COUNT); s++) {
+        StageTimingSnapshot t = executor->timing(static_cast<ExecutorStage>(s));
+        std::cout << "  " << std::setw(9) << STAGE_NAMES[s] << " mean " << std::setw(8) << t.mean_ns / 1000.0
+                  << "us  p50 " << std::setw(8) << t.percentile(0.5) / 1000.0 << "us  p99 " << std::setw(8)
+                  << t.percentile(0.99) / 1000.0 << "us  p99.9 " << std::setw(8) << t.percentile(0.999) / 1000.0
+                  << "us  max " << std::setw(8) << t.max_ns / 1000.0 << "us\n";
+    }
+    std::cout << "  overruns " << executor->overruns() << "\n";
+    if (executor->timing(ExecutorStage::CYCLE).mean_ns > PERIOD_US * 1000.0) {
+        std::cout << "FAIL: a tick costs more than its period\n";
+        ok = false;
+    }
+
+    executor->on_deactivate();
+    gpio.release(pi);
+    std::cout << (ok ? "PASS\n" : "FAIL\n");
+    return ok ? 0 : 1;
+}
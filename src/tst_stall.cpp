@@ -0,0 +1,170 @@
+/**
+ * Stall detection must not fire on a turning wheel, and must fire on a stopped one, see timer_wheel.hpp.
+ *
+ * First the wheel on its own: edges are touched with ticks up to one slot ahead of the wheel, as the encoder
+ * callback records them between two advance() calls, for well past the timeout, and no timeout may fire. Then
+ * the edges stop and one must fire within the timeout plus a slot.
+ *
+ * Then both wheels are held at SETPOINT_PPS by the executor for SPIN_MS with a STALL_TIMEOUT_US stall detector,
+ * and neither may count a stall event. With the setpoint at 0 both must stall within STOP_MS.
+ *
+ * The wheels turn forward, the robot must be free to move. Runs on the robot or with -DPIGPIO_SIM=ON.
+ *
+ * usage: tst_stall
+ */
+
+#include "board.hpp"
+#include "gpio_runtime.hpp"
+#include "motor_executor.hpp"
+#include "timer_wheel.hpp"
+#include "tst_common.hpp"
+#include <array>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+#ifdef PIGPIO_SIM
+#include "pigpio_sim.hpp"
+#endif
+
+#define RESOLUTION_US 1000
+#define EDGE_US 550            // edge period of a wheel at ~1800 pps
+#define WHEEL_TIMEOUT_US 5000
+#define WHEEL_RUN_US 200000
+
+#define PERIOD_US 1000
+#define CONTROL_DIVIDER 10
+#define STALL_TIMEOUT_US 250000
+#define ISR_TIMEOUT 0
+#define MIN_INTERVAL 150
+#define SETPOINT_PPS 1800.0
+#define SPIN_MS 3000
+#define STOP_MS 1500
+
+// velocity PID, output is duty %
+#define KP 0.01
+#define KI 0.2
+#define KD 0
+#define PID_MIN 0
+#define PID_MAX 100
+
+static int timeouts = 0;
+
+static void timeout_cb(int, uint32_t, uint32_t, TickStatus tick_status)
+{
+    if (tick_status == TickStatus::TIMEOUT) {
+        timeouts++;
+    }
+}
+
+/**
+ * Drive a TimerWheel by hand, the clock starts at the tick on_activate() read.
+ */
+static bool wheel_only()
+{
+    TimerWheel wheel;
+    if (wheel.on_configure(RESOLUTION_US) == CallbackReturn::FAILURE) {
+        return false;
+    }
+    int id = wheel.add(0, WHEEL_TIMEOUT_US, &timeout_cb);
+    if (id < 0 || wheel.on_activate() == CallbackReturn::FAILURE) {
+        return false;
+    }
+    const uint32_t start = gpioTick();
+    bool ok = true;
+
+    // the wheel is advanced once per slot, so between two advances its clock is up to a slot behind the edges.
+    uint32_t now = start;
+    for (uint32_t t = 0; t < WHEEL_RUN_US; t += EDGE_US) {
+        wheel.touch(id, start + t + RESOLUTION_US - 1);
+        if (t - (now - start) >= RESOLUTION_US) {
+            now = start + t;
+            wheel.advance(now);
+        }
+        if (wheel.time_since_last_edge(id) > WHEEL_TIMEOUT_US) {
+            ok = false;
+        }
+    }
+    if (timeouts != 0 || !ok) {
+        std::cout << "FAIL: " << timeouts << " timeouts with edges arriving every " << EDGE_US << "us\n";
+        return false;
+    }
+
+    const uint32_t last = now;
+    for (uint32_t t = 0; t <= WHEEL_TIMEOUT_US + 2 * RESOLUTION_US; t += RESOLUTION_US) {
+        wheel.advance(last + t);
+    }
+    if (timeouts == 0 || !wheel.is_stalled(id)) {
+        std::cout << "FAIL: no timeout once the edges stopped\n";
+        return false;
+    }
+    wheel.on_deactivate();
+    std::cout << "wheel: no timeouts while turning, " << timeouts << " once stopped\n";
+    return true;
+}
+
+static bool spinning(int pi)
+{
+    auto executor = std::make_unique<MotorExecutor>();
+    if (executor->on_configure(PERIOD_US, CONTROL_DIVIDER, STALL_TIMEOUT_US) == CallbackReturn::FAILURE
+        || executor->add_motor(pi, board::LeftWheel::pwm, board::LeftWheel::dir, board::LeftWheel::enc, ISR_TIMEOUT,
+               MIN_INTERVAL, KP, KI, KD, PID_MIN, PID_MAX) < 0
+        || executor->add_motor(pi, board::RightWheel::pwm, board::RightWheel::dir, board::RightWheel::enc, ISR_TIMEOUT,
+               MIN_INTERVAL, KP, KI, KD, PID_MIN, PID_MAX) < 0
+        || executor->on_activate() == CallbackReturn::FAILURE) {
+        std::cout << "ERROR: unable to bring up the wheels\n";
+        return false;
+    }
+
+    for (size_t i = 0; i < executor->motor_ct(); i++) {
+        executor->set_setpoint(i, SETPOINT_PPS);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(SPIN_MS));
+    std::array<int, 2> spin_stalls {};
+    for (size_t i = 0; i < executor->motor_ct(); i++) {
+        spin_stalls[i] = executor->controller(i).counters().stall_events;
+    }
+
+    for (size_t i = 0; i < executor->motor_ct(); i++) {
+        executor->set_setpoint(i, 0.0);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(STOP_MS));
+    std::array<int, 2> stop_stalls {};
+    for (size_t i = 0; i < executor->motor_ct(); i++) {
+        stop_stalls[i] = executor->controller(i).counters().stall_events - spin_stalls[i];
+    }
+    executor->on_deactivate();
+
+    std::cout << "spinning at " << SETPOINT_PPS << " pps for " << SPIN_MS << "ms, stall events " << spin_stalls[0]
+              << " / " << spin_stalls[1] << ", stopped for " << STOP_MS << "ms " << stop_stalls[0] << " / "
+              << stop_stalls[1] << "\n";
+    bool ok = true;
+    if (spin_stalls[0] != 0 || spin_stalls[1] != 0) {
+        std::cout << "FAIL: a turning wheel was reported stalled\n";
+        ok = false;
+    }
+    if (stop_stalls[0] == 0 || stop_stalls[1] == 0) {
+        std::cout << "FAIL: a stopped wheel was not reported stalled\n";
+        ok = false;
+    }
+    return ok;
+}
+
+int main()
+{
+    GpioRuntime &gpio = GpioRuntime::instance();
+#ifdef PIGPIO_SIM
+    pigpio_sim_attach(board::LeftWheel::pwm, board::LeftWheel::dir, board::LeftWheel::enc, SimMotorModel {});
+    pigpio_sim_attach(board::RightWheel::pwm, board::RightWheel::dir, board::RightWheel::enc, SimMotorModel {});
+#endif
+    int pi = gpio.acquire();
+    if (pi < 0) {
+        std::cout << "ERROR: Failed to initialize hardware\n";
+        return 1;
+    }
+
+    bool ok = wheel_only() && spinning(pi);
+    gpio.release(pi);
+    std::cout << (ok ? "PASS\n" : "FAIL\n");
+    return ok ? 0 : 1;
+}
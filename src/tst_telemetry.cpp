@@ -0,0 +1,70 @@
+/**
+ * Prints the telemetry published by tst_pid or tst_executor as CSV, run it in a second terminal while either is
+ * running. The executor columns stay 0 for tst_pid, which drives its controller by hand.
+ *
+ * usage: tst_telemetry [rate_hz] [samples]
+ *
+ * Only maps the segment read only, it does not need pigpio or root and cannot disturb the control loop.
+ */
+
+#include "telemetry.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+#define DEFAULT_RATE_HZ 10
+#define DEFAULT_SAMPLES 200
+
+// ExecutorStage::CYCLE and ExecutorStage::WAKEUP, this tool does not link the executor.
+#define EXECUTOR_CYCLE 4
+#define EXECUTOR_WAKEUP 5
+
+int main(int argc, char *argv[])
+{
+    int rate_hz = argc > 1 ? std::atoi(argv[1]) : DEFAULT_RATE_HZ;
+    int samples = argc > 2 ? std::atoi(argv[2]) : DEFAULT_SAMPLES;
+    if (rate_hz <= 0 || samples <= 0) {
+        std::cout << "usage: tst_telemetry [rate_hz] [samples]\n";
+        return 1;
+    }
+
+    TelemetryReader reader;
+    if (reader.on_activate(TELEMETRY_SHM_NAME) == CallbackReturn::FAILURE) {
+        std::cout << "is tst_pid or tst_executor running?\n";
+        return 1;
+    }
+
+    std::cout << "motor,tick,duty,direction,state,stalled,velocity,est_velocity,est_sigma,"
+                 "total,healthy,interval_mean_us,interval_p50_us,interval_p99_us,cycle_us,cycle_max_us,"
+                 "cycle_p99_us,cycle_p999_us,wakeup_p99_us,overruns\n";
+    std::cout << std::fixed << std::setprecision(3);
+
+    LoopTelemetry loop {};
+    MotorTelemetry motor {};
+    for (auto i = 0; i < samples; i++) {
+        if (!reader.read_loop(loop)) {
+            std::cout << "WARNING: loop telemetry busy\n";
+        }
+        const StageTelemetry &cycle = loop.stages[EXECUTOR_CYCLE];
+        const StageTelemetry &wakeup = loop.stages[EXECUTOR_WAKEUP];
+        for (uint16_t idx = 0; idx < reader.motor_ct(); idx++) {
+            if (!reader.read(idx, motor)) {
+                continue;
+            }
+            std::cout << idx << "," << motor.tick << "," << motor.duty << "," << motor.direction << ","
+                      << motor.drive_state << "," << motor.stalled << "," << motor.velocity << ","
+                      << motor.est_velocity << "," << std::sqrt(std::max(0.0, motor.est_velocity_var)) << ","
+                      << motor.total_pulses << "," << motor.healthy_pulses << "," << motor.interval_mean_us << ","
+                      << motor.interval_p50_us << "," << motor.interval_p99_us << ","
+                      << loop.cycle_us << "," << loop.cycle_max_us << "," << cycle.p99_ns / 1000.0 << ","
+                      << cycle.p999_ns / 1000.0 << "," << wakeup.p99_ns / 1000.0 << "," << loop.overruns << "\n";
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(1000000 / rate_hz));
+    }
+    reader.on_deactivate();
+    return 0;
+}
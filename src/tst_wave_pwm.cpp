@@ -0,0 +1,254 @@
+/**
+ * Software PWM from pigpio waveforms, see wave_pwm.hpp.
+ *
+ * First prints what WavePwm can achieve as the channel count grows: duty steps and bits per frequency, and the
+ * pulses and DMA control blocks the waveform needs. Then drives the motors from one WavePwm:
+ *
+ * - each motor is set to its own duty, and once settled the duty seen on each pin must match (simulated backend
+ *   only, where each wheel's velocity must also match the duty),
+ * - the control thread then writes every motor's duty at CONTROL_HZ for RUN_MS, the waveform must be rebuilt at
+ *   most UPDATE_HZ times a second however many writes are made,
+ * - EmergencyStop is tripped TRIP_TRIALS times, at offsets spread over the refresh period so some trips land on a
+ *   rebuild in flight. The waveform must be stopped after every trip.
+ *
+ * A motor destroyed without on_cleanup() must also give its channel back, so the pin can be added again.
+ *
+ * On the Pi the two wired wheels are driven from software PWM on their usual pins, build with -DPIGPIO_SIM=ON
+ * for the rest.
+ */
+
+#include "board.hpp"
+#include "emergency_stop.hpp"
+#include "gpio_runtime.hpp"
+#include "motor.hpp"
+#include "tst_common.hpp"
+#include "wave_pwm.hpp"
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <sys/resource.h>
+
+#ifdef PIGPIO_SIM
+#include "pigpio_sim.hpp"
+#endif
+
+#define WAVE_FREQ 1000
+#define UPDATE_HZ 100
+#define CONTROL_HZ 1000
+#define SETTLE_MS 500
+#define RUN_MS 2000
+#define VELOCITY_TOLERANCE 0.03
+#define TRIP_TRIALS 50
+
+struct MotorPins {
+    unsigned pwm;
+    unsigned dir;
+    unsigned en;
+};
+
+// the first two are the robot's wiring, the rest only exist in the simulated backend.
+static constexpr std::array<MotorPins, 8> PINS {{
+    {board::LeftWheel::pwm, board::LeftWheel::dir, board::LeftWheel::enc},
+    {board::RightWheel::pwm, board::RightWheel::dir, board::RightWheel::enc},
+    {2, 14, 20}, {3, 15, 21}, {4, 16, 22}, {5, 17, 25}, {6, 10, 26}, {7, 11, 27},
+}};
+
+static constexpr std::array<unsigned, 6> FREQS {500, 1000, 2000, 5000, 10000, 20000};
+static constexpr std::array<size_t, 5> CHANNEL_CTS {1, 2, 4, 8, 16};
+
+static void print_capability()
+{
+    std::cout << "channels,freq_hz,steps,bits,pulses,cbs,fits\n";
+    for (size_t channels : CHANNEL_CTS) {
+        for (unsigned freq : FREQS) {
+            WaveCapability cap = WavePwm::capability(channels, freq);
+            std::cout << channels << "," << freq << "," << cap.steps << "," << cap.bits << "," << cap.pulses << ","
+                      << cap.cbs << "," << (cap.fits ? "yes" : "no") << "\n";
+        }
+    }
+}
+
+static uint64_t process_cpu_us()
+{
+    struct rusage usage {};
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<uint64_t>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000ULL
+        + static_cast<uint64_t>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+
+static int duty_for(size_t motor)
+{
+    return static_cast<int>(70 + 3 * motor);
+}
+
+static bool check_settled(const std::array<Motor, PINS.size()> &motors, size_t motor_ct)
+{
+    bool ok = true;
+    for (size_t i = 0; i < motor_ct; i++) {
+        std::cout << "  GPIO " << PINS[i].pwm << " duty " << motors[i].duty();
+#ifdef PIGPIO_SIM
+        SimMotorModel model;
+        int seen = gpioGetPWMdutycycle(PINS[i].pwm);
+        double expected = model.max_pps * (duty_for(i) - model.deadband) / (100.0 - model.deadband);
+        double velocity = pigpio_sim_velocity(PINS[i].en);
+        std::cout << std::fixed << std::setprecision(1) << " seen " << seen * 100.0 / WavePwm::PWM_RANGE
+                  << " velocity " << velocity << " expected " << expected;
+        if (seen != duty_for(i) * static_cast<int>(WavePwm::PWM_RANGE / 100)
+            || std::abs(velocity - expected) > expected * VELOCITY_TOLERANCE) {
+            std::cout << " FAIL";
+            ok = false;
+        }
+#endif
+        std::cout << "\n";
+    }
+    return ok;
+}
+
+/**
+ * Trip with duties pending, the waveform must stay stopped whether or not a rebuild was in flight. Restarts the
+ * motors and waveform after each trip.
+ */
+static bool check_trips(std::array<Motor, PINS.size()> &motors, size_t motor_ct, WavePwm &wave)
+{
+    EmergencyStop &estop = EmergencyStop::instance();
+    const unsigned update_us = 1000000 / UPDATE_HZ;
+    unsigned transmitting = 0;
+    for (int t = 0; t < TRIP_TRIALS; t++) {
+        for (size_t i = 0; i < motor_ct; i++) {
+            motors[i].set_pwm(duty_for(i) + t % 5);
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(update_us * t / TRIP_TRIALS));
+        estop.trip(FaultCause::REQUESTED, -1, gpioTick());
+        std::this_thread::sleep_for(std::chrono::microseconds(2 * update_us));
+        transmitting += gpioWaveTxBusy() != 0 ? 1 : 0;
+
+        for (size_t i = 0; i < motor_ct; i++) {
+            motors[i].on_deactivate();
+        }
+        wave.on_deactivate();
+        estop.reset();
+        for (size_t i = 0; i < motor_ct; i++) {
+            if (motors[i].on_activate() == CallbackReturn::FAILURE) {
+                std::cout << "FAIL: unable to activate motor " << i << " after a trip\n";
+                return false;
+            }
+        }
+        if (wave.on_activate() == CallbackReturn::FAILURE) {
+            std::cout << "FAIL: unable to restart the waveform after a trip\n";
+            return false;
+        }
+    }
+    std::cout << "  " << TRIP_TRIALS << " trips, waveform still sent after " << transmitting << "\n";
+    if (transmitting != 0) {
+        std::cout << "FAIL: a rebuild restarted the waveform after a trip\n";
+        return false;
+    }
+    return true;
+}
+
+static bool check_destroyed(int pi)
+{
+    WavePwm wave;
+    if (wave.on_configure(WAVE_FREQ, UPDATE_HZ) == CallbackReturn::FAILURE) {
+        return false;
+    }
+    {
+        Motor motor;
+        if (motor.on_configure(make_motor_pinout(PINS[0].pwm, PINS[0].dir), pi, wave) == CallbackReturn::FAILURE) {
+            return false;
+        }
+    }
+    if (wave.add_channel(PINS[0].pwm) < 0) {
+        std::cout << "FAIL: a destroyed motor kept its waveform channel\n";
+        return false;
+    }
+    return true;
+}
+
+static bool run_motors(int pi, size_t motor_ct)
+{
+    WavePwm wave;
+    if (wave.on_configure(WAVE_FREQ, UPDATE_HZ) == CallbackReturn::FAILURE) {
+        return false;
+    }
+    std::array<Motor, PINS.size()> motors;
+    for (size_t i = 0; i < motor_ct; i++) {
+#ifdef PIGPIO_SIM
+        pigpio_sim_attach(PINS[i].pwm, PINS[i].dir, PINS[i].en, SimMotorModel {});
+#endif
+        if (motors[i].on_configure(make_motor_pinout(PINS[i].pwm, PINS[i].dir), pi, wave) == CallbackReturn::FAILURE
+            || motors[i].on_activate() == CallbackReturn::FAILURE) {
+            std::cout << "FAILED TO ACTIVATE!!! exiting program\n";
+            return false;
+        }
+    }
+    if (wave.on_activate() == CallbackReturn::FAILURE) {
+        std::cout << "ERROR: unable to start the waveform\n";
+        return false;
+    }
+
+    std::cout << motor_ct << " motors on " << WAVE_FREQ << "Hz software PWM\n";
+    for (size_t i = 0; i < motor_ct; i++) {
+        motors[i].set_direction(FORWARD);
+        motors[i].set_pwm(duty_for(i));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(SETTLE_MS));
+    bool ok = check_settled(motors, motor_ct);
+
+    // every motor written every control period, far faster than the waveform is rebuilt.
+    WaveStats before = wave.stats();
+    uint64_t cpu_start = process_cpu_us();
+    const int periods = RUN_MS * CONTROL_HZ / 1000;
+    auto next = std::chrono::steady_clock::now();
+    for (int p = 0; p < periods; p++) {
+        for (size_t i = 0; i < motor_ct; i++) {
+            motors[i].set_pwm(duty_for(i) + (p / 10 + static_cast<int>(i)) % 5);
+        }
+        next += std::chrono::microseconds(1000000 / CONTROL_HZ);
+        std::this_thread::sleep_until(next);
+    }
+    uint64_t cpu_us = process_cpu_us() - cpu_start;
+    WaveStats after = wave.stats();
+    uint64_t builds = after.builds - before.builds;
+    uint64_t max_builds = static_cast<uint64_t>(RUN_MS) * UPDATE_HZ / 1000 + 1;
+    std::cout << "  " << periods * motor_ct << " duty writes, " << builds << " waveforms, pulses "
+              << after.last_pulses << ", build us mean "
+              << (builds > 0 ? (after.total_build_ns - before.total_build_ns) / builds / 1000 : 0)
+              << " max " << after.max_build_ns / 1000 << ", process cpu " << cpu_us << "us, errors "
+              << after.errors << "\n";
+    if (builds > max_builds || after.errors != 0) {
+        std::cout << "FAIL: more than " << max_builds << " waveforms, or waveform errors\n";
+        ok = false;
+    }
+    ok = check_trips(motors, motor_ct, wave) && ok;
+
+    for (size_t i = 0; i < motor_ct; i++) {
+        motors[i].on_deactivate();
+    }
+    wave.on_deactivate();
+    return ok;
+}
+
+int main()
+{
+    print_capability();
+
+    GpioRuntime &gpio = GpioRuntime::instance();
+    int pi = gpio.acquire();
+    if (pi < 0) {
+        std::cout << "ERROR: Failed to initialize hardware\n";
+        return 1;
+    }
+#ifdef PIGPIO_SIM
+    size_t motor_ct = PINS.size();
+#else
+    size_t motor_ct = 2;
+#endif
+    bool ok = run_motors(pi, motor_ct);
+    ok = check_destroyed(pi) && ok;
+    gpio.release(pi);
+
+    std::cout << (ok ? "PASS\n" : "FAIL\n");
+    return ok ? 0 : 1;
+}
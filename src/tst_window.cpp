@@ -0,0 +1,131 @@
+/**
+ * Stress test of WindowAccumulator, the double buffered PPR window MotorController's encoder callback fills, see
+ * window_accumulator.hpp.
+ *
+ * One writer thread plays the encoder callback for WINDOWS windows as fast as it can while READERS threads copy
+ * the retired window continuously. Every window is built so its contents can be checked on their own: window k
+ * has PPR edges of DELTA_US + k % DELTA_SPREAD us, the first k % 3 of them unhealthy. A copy whose count, healthy
+ * count, sum or end tick disagree with its index is torn, and any torn copy fails the test.
+ *
+ * Does not touch hardware.
+ *
+ * usage: tst_window
+ */
+
+#include "window_accumulator.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#define PPR 8
+#define WINDOWS 2000000
+#define READERS 3
+#define DELTA_US 1000
+#define DELTA_SPREAD 1000
+
+struct ReaderStats {
+    uint64_t reads = 0;
+    uint64_t failed = 0;     // retired() gave up or no window closed yet
+    uint64_t torn = 0;
+    uint64_t backwards = 0;  // index lower than a previous copy
+};
+
+static uint32_t window_delta(uint32_t k) { return DELTA_US + k % DELTA_SPREAD; }
+
+static int window_unhealthy(uint32_t k) { return static_cast<int>(k % 3); }
+
+// tick of the edge that closes window k, every window ends on a whole PPR * DELTA_US.
+static uint32_t window_end(uint32_t k) { return (k + 1) * PPR * DELTA_US; }
+
+static bool consistent(const PulseWindow &w)
+{
+    const int healthy = PPR - window_unhealthy(w.index);
+    return w.pulses == PPR && w.healthy == healthy
+        && w.accum_us == static_cast<uint32_t>(healthy) * window_delta(w.index)
+        && w.end_tick == window_end(w.index);
+}
+
+int main()
+{
+    static WindowAccumulator<PPR> window;
+    std::atomic<bool> done {false};
+    std::vector<ReaderStats> stats(READERS);
+    std::vector<std::thread> readers;
+    for (size_t r = 0; r < READERS; r++) {
+        readers.emplace_back([&, r]() {
+            ReaderStats &s = stats[r];
+            uint32_t last_index = 0;
+            PulseWindow w;
+            while (!done.load(std::memory_order_relaxed)) {
+                s.reads++;
+                if (!window.retired(w)) {
+                    s.failed++;
+                    continue;
+                }
+                if (!consistent(w)) {
+                    s.torn++;
+                }
+                if (w.index < last_index) {
+                    s.backwards++;
+                }
+                last_index = w.index;
+            }
+        });
+    }
+
+    bool ok = true;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t k = 0; k < WINDOWS; k++) {
+        const uint32_t delta = window_delta(k);
+        for (int e = 0; e < PPR; e++) {
+            const uint32_t tick = window_end(k) - static_cast<uint32_t>(PPR - 1 - e) * DELTA_US;
+            if (window.add(e >= window_unhealthy(k), delta, tick) != (e == PPR - 1)) {
+                ok = false;
+            }
+        }
+    }
+    double elapsed_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    done.store(true);
+    for (std::thread &t : readers) {
+        t.join();
+    }
+
+    if (!ok) {
+        std::cout << "FAIL: a window closed on the wrong edge\n";
+    }
+    if (window.closed() != WINDOWS) {
+        std::cout << "FAIL: " << window.closed() << " windows closed, expected " << WINDOWS << "\n";
+        ok = false;
+    }
+    PulseWindow last;
+    if (!window.retired(last) || last.index != WINDOWS - 1 || !consistent(last)) {
+        std::cout << "FAIL: last window is not " << WINDOWS - 1 << "\n";
+        ok = false;
+    }
+
+    std::cout << WINDOWS << " windows of " << PPR << " edges, " << elapsed_ns / (static_cast<double>(WINDOWS) * PPR)
+              << " ns per edge\n"
+              << "reader       reads      failed  torn  backwards\n";
+    for (size_t r = 0; r < READERS; r++) {
+        const ReaderStats &s = stats[r];
+        std::cout << std::setw(6) << r << std::setw(12) << s.reads << std::setw(12) << s.failed << std::setw(6) << s.torn
+                  << std::setw(11) << s.backwards << "\n";
+        if (s.torn > 0 || s.backwards > 0) {
+            ok = false;
+        }
+    }
+
+    // a reset accumulator has nothing to read until the next window closes.
+    window.reset();
+    if (window.retired(last) || window.closed() != 0) {
+        std::cout << "FAIL: window readable after reset\n";
+        ok = false;
+    }
+
+    std::cout << (ok ? "PASS\n" : "FAIL\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,337 @@
+#include "wave_pwm.hpp"
+#include "emergency_stop.hpp"
+#include <algorithm>
+#include <chrono>
+#include <pthread.h>
+#include <time.h>
+
+namespace {
+    // a waveform pulse only covers bank 0.
+    constexpr unsigned MAX_WAVE_GPIO = 31;
+
+    struct Edge {
+        unsigned at_us;
+        uint32_t on;
+        uint32_t off;
+    };
+
+    uint64_t mono_ns()
+    {
+        struct timespec ts {};
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+    }
+}
+
+WaveCapability WavePwm::capability(size_t channels, unsigned freq_hz)
+{
+    WaveCapability cap;
+    if (freq_hz == 0) {
+        return cap;
+    }
+    cap.period_us = 1000000 / freq_hz;
+    cap.steps = cap.period_us;
+    while ((2u << cap.bits) <= cap.steps) {
+        cap.bits++;
+    }
+    cap.pulses = static_cast<unsigned>(2 * channels + 1);
+    cap.cbs = cap.pulses * CBS_PER_PULSE;
+    // every channel needs two distinct microseconds in the period to switch on and off.
+    cap.fits = cap.period_us >= 2 && cap.pulses <= PI_WAVE_MAX_PULSES && 2 * channels < cap.period_us;
+    return cap;
+}
+
+WavePwm::~WavePwm()
+{
+    if (running_.load()) {
+        on_deactivate();
+    }
+}
+
+CallbackReturn WavePwm::on_configure(unsigned freq_hz, unsigned update_hz)
+{
+    if (running_.load()) {
+        std::cout << "ERROR: wave PWM must be deactivated before it is configured\n";
+        return CallbackReturn::FAILURE;
+    }
+    if (freq_hz == 0 || freq_hz > 500000 || update_hz == 0) {
+        std::cout << "ERROR: wave PWM frequency must be between 1Hz and 500kHz\n";
+        return CallbackReturn::FAILURE;
+    }
+    freq_hz_ = freq_hz;
+    period_us_ = 1000000 / freq_hz;
+    update_us_ = 1000000 / update_hz;
+    return CallbackReturn::SUCCESS;
+}
+
+int WavePwm::add_channel(unsigned gpio)
+{
+    if (running_.load()) {
+        std::cout << "ERROR: wave PWM channels can only be added while deactivated\n";
+        return -1;
+    }
+    if (gpio > MAX_WAVE_GPIO) {
+        std::cout << "ERROR: wave PWM pin " << gpio << " is outside bank 0\n";
+        return -1;
+    }
+    int free_idx = -1;
+    for (size_t i = 0; i < MAX_CHANNELS; i++) {
+        if (channels_[i].used && channels_[i].gpio == gpio) {
+            std::cout << "ERROR: wave PWM pin " << gpio << " is already a channel\n";
+            return -1;
+        }
+        if (!channels_[i].used && free_idx < 0) {
+            free_idx = static_cast<int>(i);
+        }
+    }
+    if (free_idx < 0) {
+        std::cout << "ERROR: more than " << MAX_CHANNELS << " wave PWM channels\n";
+        return -1;
+    }
+    Channel &ch = channels_[free_idx];
+    ch.used = true;
+    ch.gpio = gpio;
+    ch.duty.store(0);
+    pin_mask_ |= 1u << gpio;
+    return free_idx;
+}
+
+void WavePwm::remove_channel(unsigned gpio)
+{
+    if (running_.load()) {
+        return;
+    }
+    for (Channel &ch : channels_) {
+        if (ch.used && ch.gpio == gpio) {
+            ch.used = false;
+            ch.duty.store(0);
+            pin_mask_ &= ~(1u << gpio);
+        }
+    }
+}
+
+CallbackReturn WavePwm::on_activate()
+{
+    if (running_.load()) {
+        return CallbackReturn::SUCCESS;
+    }
+    if (period_us_ == 0) {
+        std::cout << "ERROR: wave PWM is not configured\n";
+        return CallbackReturn::FAILURE;
+    }
+    for (const Channel &ch : channels_) {
+        if (ch.used && gpioSetMode(ch.gpio, PI_OUTPUT) != OK) {
+            std::cout << "ERROR: pin " << ch.gpio << " had errors\n";
+            return CallbackReturn::FAILURE;
+        }
+    }
+    gpioWrite_Bits_0_31_Clear(pin_mask_);
+
+    builds_.store(0);
+    errors_.store(0);
+    last_build_ns_.store(0);
+    max_build_ns_.store(0);
+    total_build_ns_.store(0);
+
+    // the first waveform is sent here, so a failure is reported rather than left to the refresh thread.
+    dirty_.store(false);
+    if (rebuild() != OK) {
+        return CallbackReturn::FAILURE;
+    }
+    running_.store(true);
+    thread_ = std::thread(&WavePwm::run, this);
+    return CallbackReturn::SUCCESS;
+}
+
+CallbackReturn WavePwm::on_deactivate()
+{
+    running_.store(false);
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    CallbackReturn result = CallbackReturn::SUCCESS;
+    if (gpioWaveTxStop() != OK) {
+        result = CallbackReturn::FAILURE;
+    }
+    if (wave_id_ >= 0) {
+        gpioWaveDelete(static_cast<unsigned>(wave_id_));
+        wave_id_ = -1;
+    }
+    // TxStop leaves pins wherever the waveform was, the motors must not be left running.
+    if (gpioWrite_Bits_0_31_Clear(pin_mask_) != OK) {
+        result = CallbackReturn::FAILURE;
+    }
+    for (Channel &ch : channels_) {
+        ch.duty.store(0);
+    }
+    return result;
+}
+
+int WavePwm::set_duty(size_t channel, unsigned duty)
+{
+    if (channel >= MAX_CHANNELS || !channels_[channel].used) {
+        return PI_BAD_USER_GPIO;
+    }
+    if (duty > PWM_RANGE) {
+        return PI_BAD_HPWM_DUTY;
+    }
+    if (channels_[channel].duty.exchange(duty, std::memory_order_relaxed) != duty) {
+        dirty_.store(true, std::memory_order_release);
+    }
+    return OK;
+}
+
+unsigned WavePwm::on_us(unsigned duty) const
+{
+    return static_cast<unsigned>((static_cast<uint64_t>(duty) * period_us_ + PWM_RANGE / 2) / PWM_RANGE);
+}
+
+unsigned WavePwm::applied_duty(size_t channel) const
+{
+    if (channel >= MAX_CHANNELS || period_us_ == 0) {
+        return 0;
+    }
+    return static_cast<unsigned>(
+        static_cast<uint64_t>(on_us(channels_[channel].duty.load(std::memory_order_relaxed))) * PWM_RANGE
+        / period_us_);
+}
+
+WaveStats WavePwm::stats() const
+{
+    WaveStats s;
+    s.builds = builds_.load(std::memory_order_relaxed);
+    s.errors = errors_.load(std::memory_order_relaxed);
+    s.last_build_ns = last_build_ns_.load(std::memory_order_relaxed);
+    s.max_build_ns = max_build_ns_.load(std::memory_order_relaxed);
+    s.total_build_ns = total_build_ns_.load(std::memory_order_relaxed);
+    s.last_pulses = last_pulses_.load(std::memory_order_relaxed);
+    return s;
+}
+
+void WavePwm::run()
+{
+    pthread_setname_np(pthread_self(), "rr_wave");
+    auto next = std::chrono::steady_clock::now();
+    while (running_.load(std::memory_order_relaxed)) {
+        next += std::chrono::microseconds(update_us_);
+        std::this_thread::sleep_until(next);
+        // a tripped EmergencyStop has stopped the waveform, it stays stopped until the wheels are deactivated.
+        if (!EmergencyStop::instance().tripped() && dirty_.exchange(false, std::memory_order_acquire)) {
+            rebuild();
+        }
+    }
+}
+
+int WavePwm::rebuild()
+{
+    uint64_t start = mono_ns();
+
+    // one on and one off edge per channel, phase shifted by channel so the switching is spread over the period.
+    std::array<Edge, 2 * MAX_CHANNELS + 1> edges {};
+    size_t edge_ct = 1;
+    edges[0] = Edge {0, 0, 0};
+    size_t used_ct = 0;
+    for (const Channel &ch : channels_) {
+        used_ct += ch.used ? 1 : 0;
+    }
+    size_t slot = 0;
+    for (const Channel &ch : channels_) {
+        if (!ch.used) {
+            continue;
+        }
+        uint32_t bit = 1u << ch.gpio;
+        unsigned on = on_us(ch.duty.load(std::memory_order_relaxed));
+        unsigned phase = static_cast<unsigned>(period_us_ * slot++ / used_ct);
+        if (on == 0 || on >= period_us_) {
+            // constant level, set once at the start of the period.
+            (on == 0 ? edges[0].off : edges[0].on) |= bit;
+            continue;
+        }
+        // high from phase for on us, wrapping past the end of the period back to its start.
+        unsigned off_at = phase + on;
+        bool high_at_start = phase == 0 || off_at > period_us_;
+        (high_at_start ? edges[0].on : edges[0].off) |= bit;
+        if (phase != 0) {
+            edges[edge_ct++] = Edge {phase, bit, 0};
+        }
+        // switching off exactly at the end of the period is done by the start of the next one.
+        off_at %= period_us_;
+        if (off_at != 0) {
+            edges[edge_ct++] = Edge {off_at, 0, bit};
+        }
+    }
+    std::sort(edges.begin() + 1, edges.begin() + edge_ct, [](const Edge &a, const Edge &b) {
+        return a.at_us < b.at_us;
+    });
+
+    // edges at the same microsecond are merged into one pulse, each pulse lasts until the next edge.
+    std::array<gpioPulse_t, 2 * MAX_CHANNELS + 1> pulses {};
+    size_t pulse_ct = 0;
+    unsigned last_at = 0;
+    for (size_t i = 0; i < edge_ct; i++) {
+        const Edge &e = edges[i];
+        if (pulse_ct > 0 && e.at_us == last_at) {
+            pulses[pulse_ct - 1].gpioOn |= e.on;
+            pulses[pulse_ct - 1].gpioOff |= e.off;
+            continue;
+        }
+        if (pulse_ct > 0) {
+            pulses[pulse_ct - 1].usDelay = e.at_us - last_at;
+        }
+        pulses[pulse_ct++] = gpioPulse_t {e.on, e.off, 0};
+        last_at = e.at_us;
+    }
+    pulses[pulse_ct - 1].usDelay = period_us_ - last_at;
+
+    int r = gpioWaveAddNew();
+    if (r == OK) {
+        r = gpioWaveAddGeneric(static_cast<unsigned>(pulse_ct), pulses.data());
+    }
+    int id = r >= 0 ? gpioWaveCreate() : r;
+    if (id < 0) {
+        errors_.fetch_add(1, std::memory_order_relaxed);
+        return id;
+    }
+    // the stop may have landed while this waveform was built.
+    if (EmergencyStop::instance().tripped()) {
+        gpioWaveDelete(static_cast<unsigned>(id));
+        return PI_NOT_PERMITTED;
+    }
+    // starts at the end of the current period, so every channel changes together and no period is cut short.
+    r = gpioWaveTxSend(static_cast<unsigned>(id), PI_WAVE_MODE_REPEAT_SYNC);
+    if (r < 0) {
+        gpioWaveDelete(static_cast<unsigned>(id));
+        errors_.fetch_add(1, std::memory_order_relaxed);
+        return r;
+    }
+    // a trip between the check above and the send had its gpioWaveTxStop() undone by it. trip() latches before
+    // stopping, so either this sees the latch and stops again, or the trip's stop comes after the send.
+    if (EmergencyStop::instance().tripped()) {
+        gpioWaveTxStop();
+        gpioWrite_Bits_0_31_Clear(pin_mask_);
+        if (wave_id_ >= 0) {
+            gpioWaveDelete(static_cast<unsigned>(wave_id_));
+        }
+        wave_id_ = id;
+        return PI_NOT_PERMITTED;
+    }
+    if (wave_id_ >= 0) {
+        // the previous waveform is still sent until its period ends, it can only be deleted after that.
+        uint64_t deadline = mono_ns() + 2ULL * period_us_ * 1000ULL + 1000000ULL;
+        while (gpioWaveTxAt() != id && mono_ns() < deadline) {
+            std::this_thread::sleep_for(std::chrono::microseconds(std::max(1u, period_us_ / 4)));
+        }
+        gpioWaveDelete(static_cast<unsigned>(wave_id_));
+    }
+    wave_id_ = id;
+
+    uint64_t build_ns = mono_ns() - start;
+    builds_.fetch_add(1, std::memory_order_relaxed);
+    last_build_ns_.store(build_ns, std::memory_order_relaxed);
+    total_build_ns_.fetch_add(build_ns, std::memory_order_relaxed);
+    if (build_ns > max_build_ns_.load(std::memory_order_relaxed)) {
+        max_build_ns_.store(build_ns, std::memory_order_relaxed);
+    }
+    last_pulses_.store(static_cast<unsigned>(pulse_ct), std::memory_order_relaxed);
+    return OK;
+}
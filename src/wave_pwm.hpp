@@ -0,0 +1,131 @@
+/**
+ * Software PWM on any GPIO, timed by pigpio's DMA waveforms.
+ *
+ * The Pi4B has two hardware PWM channels, so Motor could only ever drive two wheels independently. WavePwm builds
+ * one pigpio waveform covering a single PWM period for every channel, and pigpio's DMA engine repeats it without
+ * the CPU touching the pins:
+ *
+ * - a period of 1e6 / freq_hz microseconds has that many duty steps, waveform pulses are timed to 1us,
+ * - each channel switches on and off once per period, so the waveform has at most 2 * channels + 1 pulses.
+ *   Channels are phase shifted across the period so the wheels don't all switch on at the same instant,
+ * - set_duty() only stores the new duty, a refresh thread rebuilds the waveform at most update_hz times a second
+ *   and swaps it in with PI_WAVE_MODE_REPEAT_SYNC, at the end of the current period. CPU cost is bounded by
+ *   update_hz however many channels or duty writes there are, and every channel changes on the same period,
+ * - duty uses the gpioHardwarePWM() range, 0 to PWM_RANGE.
+ *
+ * pigpio can only transmit one waveform at a time, so there is one WavePwm per process. Waveform pins must be in
+ * bank 0 (GPIO 0 to 31). pigpio must keep its default PCM clock (gpioCfgClock()), so hardware PWM stays usable
+ * alongside.
+ *
+ * capability() gives the steps, pulses and DMA control blocks a given channel count and frequency needs, and
+ * whether pigpio can hold the waveform, without touching hardware.
+ */
+
+#pragma once
+
+#include "tst_common.hpp"
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+struct WaveCapability {
+    unsigned period_us = 0;
+    unsigned steps = 0;     // distinct duty values, one per microsecond of the period
+    unsigned bits = 0;      // floor(log2(steps))
+    unsigned pulses = 0;    // waveform pulses in the worst case, every channel at a distinct partial duty
+    unsigned cbs = 0;       // DMA control blocks those pulses need
+    bool fits = false;      // pigpio can build the waveform, and every channel can switch within the period
+};
+
+struct WaveStats {
+    uint64_t builds = 0;     // waveforms created and sent
+    uint64_t errors = 0;     // pigpio errors while building or sending
+    uint64_t last_build_ns = 0;
+    uint64_t max_build_ns = 0;
+    uint64_t total_build_ns = 0;
+    unsigned last_pulses = 0;
+};
+
+class WavePwm {
+  public:
+    static constexpr size_t MAX_CHANNELS = 16;
+    static constexpr unsigned PWM_RANGE = 1000000;
+
+    // roughly what pigpio spends per pulse, a control block for the levels and one for the delay.
+    static constexpr unsigned CBS_PER_PULSE = 2;
+
+    static WaveCapability capability(size_t channels, unsigned freq_hz);
+
+    ~WavePwm();
+
+    /**
+     * @param freq_hz PWM frequency shared by every channel.
+     * @param update_hz highest rate the waveform is rebuilt at, duties written faster are merged.
+     */
+    CallbackReturn on_configure(unsigned freq_hz, unsigned update_hz);
+
+    /**
+     * Add gpio as a channel, only while deactivated.
+     *
+     * @return channel index for set_duty(), or -1.
+     */
+    int add_channel(unsigned gpio);
+
+    void remove_channel(unsigned gpio);
+
+    // drive every channel low and start transmitting.
+    CallbackReturn on_activate();
+
+    // stop transmitting and drive every channel low.
+    CallbackReturn on_deactivate();
+
+    /**
+     * Store duty for channel, applied by the next rebuild. Never blocks, safe from the control thread.
+     *
+     * @return OK, or PI_BAD_HPWM_DUTY / PI_BAD_USER_GPIO for a bad duty or channel.
+     */
+    int set_duty(size_t channel, unsigned duty);
+
+    unsigned frequency() const { return freq_hz_; }
+
+    // duty as it will be applied, quantised to the period's steps.
+    unsigned applied_duty(size_t channel) const;
+
+    WaveStats stats() const;
+
+  private:
+    struct Channel {
+        bool used = false;
+        unsigned gpio = 0;
+        std::atomic<unsigned> duty {0};
+    };
+
+    void run();
+
+    // build the waveform from the current duties and swap it in, returns a pigpio error or OK.
+    int rebuild();
+
+    unsigned on_us(unsigned duty) const;
+
+    unsigned freq_hz_ = 0;
+    unsigned period_us_ = 0;
+    unsigned update_us_ = 0;
+
+    std::array<Channel, MAX_CHANNELS> channels_ {};
+    uint32_t pin_mask_ = 0;
+
+    std::atomic<bool> dirty_ {false};
+    std::atomic<bool> running_ {false};
+    std::thread thread_;
+    int wave_id_ = -1;
+
+    // written by the refresh thread only.
+    std::atomic<uint64_t> builds_ {0};
+    std::atomic<uint64_t> errors_ {0};
+    std::atomic<uint64_t> last_build_ns_ {0};
+    std::atomic<uint64_t> max_build_ns_ {0};
+    std::atomic<uint64_t> total_build_ns_ {0};
+    std::atomic<unsigned> last_pulses_ {0};
+};
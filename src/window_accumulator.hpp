@@ -0,0 +1,126 @@
+/**
+ * Double buffered PPR window of encoder periods, written by the encoder callback and read from any thread.
+ *
+ * MotorController sums PPR edges into a window and turns the closed window into a velocity. The sums used to be
+ * three separate atomics reset at the boundary, so anything reading them off the callback thread could see a
+ * count from one window and a sum from the next. WindowAccumulator keeps two buffers:
+ *
+ * - the callback only writes the active buffer, closed() & 1,
+ * - at the PPR-th edge it retires the active buffer by bumping closed(), and starts the other one, which held
+ *   the window retired before, from zero,
+ * - readers copy the retired buffer and check closed() did not move while they did, a retired buffer is only
+ *   reused once the next window closes, a whole window later.
+ *
+ * There is no compare_exchange and nothing for the callback to retry, and a reader never sees a torn window.
+ * Each buffer has its own cache line so readers of the retired window are not invalidated by edges landing in
+ * the active one.
+ *
+ * add() and reset() must only be called from one thread at a time, every edge backend calls one pin's callback
+ * from a single thread. reset() must only be called while no edge can arrive.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+struct PulseWindow {
+    uint32_t index = 0;     // windows closed before this one
+    int pulses = 0;         // edges in the window, healthy or not
+    int healthy = 0;        // healthy periods summed into accum_us
+    uint32_t accum_us = 0;
+    uint32_t end_tick = 0;  // tick of the edge that closed it
+};
+
+template <int PPR>
+class WindowAccumulator {
+  public:
+    static_assert(PPR > 0, "PPR must be positive");
+
+    // bounded, a reader only retries when a whole window closes while it copies.
+    static constexpr int MAX_READ_ATTEMPTS = 1000;
+
+    /**
+     * Add an edge to the active window, delta_us is summed when healthy.
+     *
+     * @return true if the edge closed the window, retired() then returns it.
+     */
+    bool add(bool healthy, uint32_t delta_us, uint32_t tick)
+    {
+        const uint32_t closed = closed_.load(std::memory_order_relaxed);
+        Buffer &active = buffers_[closed & 1];
+        if (healthy) {
+            active.healthy.store(active.healthy.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            active.accum_us.store(active.accum_us.load(std::memory_order_relaxed) + delta_us, std::memory_order_relaxed);
+        }
+        const int pulses = active.pulses.load(std::memory_order_relaxed) + 1;
+        active.pulses.store(pulses, std::memory_order_relaxed);
+        if (pulses < PPR) {
+            return false;
+        }
+
+        active.end_tick.store(tick, std::memory_order_relaxed);
+        // the window is complete before it is published.
+        closed_.store(closed + 1, std::memory_order_release);
+        // and the other buffer is only cleared after, so a reader that sees a cleared field also sees closed_ move.
+        std::atomic_thread_fence(std::memory_order_release);
+        clear(buffers_[(closed + 1) & 1]);
+        return true;
+    }
+
+    /**
+     * Copy the most recently closed window.
+     *
+     * @return false if no window has closed yet, or windows closed too quickly to copy one.
+     */
+    bool retired(PulseWindow &out) const
+    {
+        for (int i = 0; i < MAX_READ_ATTEMPTS; i++) {
+            const uint32_t closed = closed_.load(std::memory_order_acquire);
+            if (closed == 0) {
+                return false;
+            }
+            const Buffer &b = buffers_[(closed - 1) & 1];
+            out.index = closed - 1;
+            out.pulses = b.pulses.load(std::memory_order_relaxed);
+            out.healthy = b.healthy.load(std::memory_order_relaxed);
+            out.accum_us = b.accum_us.load(std::memory_order_relaxed);
+            out.end_tick = b.end_tick.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (closed_.load(std::memory_order_relaxed) == closed) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // windows closed since the last reset().
+    uint32_t closed() const { return closed_.load(std::memory_order_acquire); }
+
+    void reset()
+    {
+        clear(buffers_[0]);
+        clear(buffers_[1]);
+        closed_.store(0, std::memory_order_release);
+    }
+
+  private:
+    struct alignas(64) Buffer {
+        std::atomic<int> pulses {0};
+        std::atomic<int> healthy {0};
+        std::atomic<uint32_t> accum_us {0};
+        std::atomic<uint32_t> end_tick {0};
+    };
+
+    static void clear(Buffer &b)
+    {
+        b.pulses.store(0, std::memory_order_relaxed);
+        b.healthy.store(0, std::memory_order_relaxed);
+        b.accum_us.store(0, std::memory_order_relaxed);
+        b.end_tick.store(0, std::memory_order_relaxed);
+    }
+
+    std::array<Buffer, 2> buffers_ {};
+    alignas(64) std::atomic<uint32_t> closed_ {0};
+};